@@ -0,0 +1,60 @@
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "AggregatorServer.h"
+#include "PerformanceMarker.h"
+
+using namespace std;
+
+// 接收多个进程通过PerformanceMarker::forwardToAggregator()发送的采样点，合并之后按
+// prefix生成一份报告，报告的格式、日志文件等与普通进程相同。
+//
+// 用法：PerformanceAggregator <socket path> <prefix> <intervalSeconds> [windowSeconds...]
+int main(int argc, char* argv[])
+{
+    if (argc < 4) {
+        cerr << "usage: " << argv[0] << " <socket path> <prefix> <intervalSeconds> [windowSeconds...]" << endl;
+        return 1;
+    }
+    int intervalSeconds = atoi(argv[3]);
+    if (intervalSeconds <= 0) {
+        cerr << "invalid interval " << argv[3] << endl;
+        return 1;
+    }
+    vector<uint32_t> windows;
+    for (int i = 4; i < argc; ++i) {
+        windows.push_back(uint32_t(atoi(argv[i])));
+    }
+
+    // 在启动任何线程之前屏蔽信号，之后由主线程同步等待
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    if (!windows.empty()) {
+        PerformanceMarker::setReportWindows(windows);
+    }
+    PerformanceMarker::initialize(argv[2], uint32_t(intervalSeconds));
+    auto& marker = PerformanceMarker::getInstance();
+
+    AggregatorServer server;
+    bool listening = server.listen(argv[1], [&marker](string_view name, const AggregatorFrame::Snapshot& delta) {
+        if (!marker.addAggregated(string(name), delta)) {
+            LOG_WARN << "bucket layout of " << name << " does not match, dropped";
+        }
+    });
+    if (!listening) {
+        cerr << "cannot listen on " << argv[1] << endl;
+        return 1;
+    }
+
+    int signal = 0;
+    sigwait(&signals, &signal);
+    server.stop();
+    return 0;
+}
@@ -0,0 +1,54 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+#include "SharedSnapshot.h"
+#include "SnapshotReader.h"
+
+using namespace std;
+
+// 读取PerformanceMarker::publishToSharedMemory()发布的报告，以JSON格式输出到stdout。
+// 指定了间隔时，每隔intervalSeconds检查一次，有新报告时输出。
+int main(int argc, char* argv[])
+{
+    if (argc < 2 || argc > 3) {
+        cerr << "usage: " << argv[0] << " <shm name> [intervalSeconds]" << endl;
+        return 1;
+    }
+    int intervalSeconds = argc == 3 ? atoi(argv[2]) : 0;
+
+    SharedSnapshotSubscriber subscriber;
+    if (!subscriber.open(argv[1])) {
+        cerr << "cannot open shared memory " << argv[1] << endl;
+        return 1;
+    }
+
+    ReportBuffer snapshot;
+    ReportBuffer json;
+    uint64_t lastGeneration = 0;
+    while (true) {
+        uint64_t generation = 0;
+        if (subscriber.read(snapshot, &generation) && generation != lastGeneration) {
+            SnapshotReader reader;
+            if (!reader.open(snapshot.data(), snapshot.size())) {
+                cerr << "invalid snapshot in " << argv[1] << endl;
+                return 1;
+            }
+            json.clear();
+            reader.toJson(json);
+            json.append('\n');
+            fwrite(json.data(), 1, json.size(), stdout);
+            fflush(stdout);
+            lastGeneration = generation;
+        } else if (intervalSeconds <= 0) {
+            cerr << "no snapshot published in " << argv[1] << endl;
+            return 1;
+        }
+        if (intervalSeconds <= 0) {
+            return 0;
+        }
+        this_thread::sleep_for(chrono::seconds(intervalSeconds));
+    }
+}
@@ -0,0 +1,72 @@
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "SnapshotReader.h"
+
+using namespace std;
+
+// 把PerformanceMarker写出的二进制snapshot（或者.snap报告日志）转换为JSON，输出到stdout
+int main(int argc, char* argv[])
+{
+    if (argc != 2) {
+        cerr << "usage: " << argv[0] << " <snapshot file>" << endl;
+        return 1;
+    }
+
+    const char* data = nullptr;
+    size_t size = 0;
+#ifndef _WIN32
+    int fd = open(argv[1], O_RDONLY);
+    struct stat st {};
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    size = size_t(st.st_size);
+    void* mapped = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        perror(argv[1]);
+        return 1;
+    }
+    data = static_cast<const char*>(mapped);
+#else
+    ifstream file(argv[1], ios::binary | ios::ate);
+    if (!file) {
+        cerr << "cannot open " << argv[1] << endl;
+        return 1;
+    }
+    size = size_t(file.tellg());
+    // new double[]保证8字节对齐
+    unique_ptr<double[]> storage(new double[size / sizeof(double) + 1]);
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(storage.get()), size);
+    data = reinterpret_cast<const char*>(storage.get());
+#endif
+
+    // 报告日志中的多个snapshot首尾相接，逐个转换
+    ReportBuffer json;
+    size_t offset = 0;
+    while (offset < size) {
+        SnapshotReader reader;
+        if (!reader.open(data + offset, size - offset)) {
+            cerr << argv[1] << " is not a valid snapshot at offset " << offset << endl;
+            return 1;
+        }
+        json.clear();
+        reader.toJson(json);
+        json.append('\n');
+        fwrite(json.data(), 1, json.size(), stdout);
+        offset += reader.header().totalSize;
+    }
+    return 0;
+}
@@ -0,0 +1,63 @@
+/**
+ * Copyright (c) 2018 Duobei Brothers Information Technology Co.,Ltd. All rights reserved.
+ *
+ * Author: haosheng (sheng.hao@duobei.com)
+ *
+ * Date: 2021/10/13
+ *
+ */
+
+#ifndef PERFORMANCE_AGGREGATORCLIENT_H
+#define PERFORMANCE_AGGREGATORCLIENT_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+/*
+ * 把AggregatorFrame发送到聚合进程监听的Unix domain socket。
+ *
+ * push()只把帧追加到待发送的缓冲区，由自己的线程负责连接和发送，定时器线程不会被
+ * 慢的或者不存在的聚合进程阻塞。连接失败或断开时，这次的数据被丢弃，下一次push()时重连。
+ * 待发送的数据超过kMaxPending时丢弃还没有发送的旧数据。
+ */
+class AggregatorClient {
+public:
+    static constexpr size_t kMaxPending = 16 * 1024 * 1024;
+
+    AggregatorClient() = default;
+    ~AggregatorClient() { close(); }
+
+    AggregatorClient(const AggregatorClient&) = delete;
+    AggregatorClient& operator=(const AggregatorClient&) = delete;
+
+    /* 启动发送线程，聚合进程不需要已经在运行 */
+    bool open(const std::string& path);
+
+    bool isOpen() const { return mThread.joinable(); }
+
+    /* 追加一帧到待发送的缓冲区，不会阻塞 */
+    void push(std::string_view frame);
+
+    /* 停止发送线程并断开连接，还没有发送的数据被丢弃 */
+    void close();
+
+private:
+    void run();
+    bool connectSocket();
+    void disconnect();
+
+    std::string mPath;
+    int mFd = -1;
+    std::thread mThread;
+
+    std::mutex mLock;
+    std::condition_variable mCond;
+    bool mStopping = false;
+    std::string mPending;
+};
+
+#endif //PERFORMANCE_AGGREGATORCLIENT_H
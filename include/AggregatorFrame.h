@@ -0,0 +1,76 @@
+/**
+ * Copyright (c) 2018 Duobei Brothers Information Technology Co.,Ltd. All rights reserved.
+ *
+ * Author: haosheng (sheng.hao@duobei.com)
+ *
+ * Date: 2021/10/13
+ *
+ */
+
+#ifndef PERFORMANCE_AGGREGATORFRAME_H
+#define PERFORMANCE_AGGREGATORFRAME_H
+
+#include <cstdint>
+#include <functional>
+#include <string_view>
+
+#include "HistogramSnapshot.h"
+#include "ReportBuffer.h"
+
+/*
+ * 客户端进程发送给聚合进程（PerformanceAggregator）的数据帧。
+ *
+ * 一帧包含一个进程在一个报告周期内新增的采样点：每个metric一个只有一个窗口的
+ * HistogramSnapshot，窗口中是这个周期里每个bucket新增的count和sum。
+ *
+ *   magic "PMAG"    4字节
+ *   payloadSize     uint32，之后的字节数
+ *   每个metric：名称长度（varint）、名称、HistogramSnapshot::serialize()的内容
+ *
+ * 聚合进程把它们加入自己的直方图，所有进程的数据进入同一个时间序列，百分位数由合并之后的
+ * bucket估计。帧在流式socket上首尾相接，payloadSize用于切分。
+ */
+class AggregatorFrame {
+public:
+    using Snapshot = HistogramSnapshot<double>;
+    using Callback = std::function<void(std::string_view name, const Snapshot& snapshot)>;
+
+    enum class ParseResult {
+        Ok,
+        // 数据还不是一个完整的帧，需要继续接收
+        Incomplete,
+        Invalid
+    };
+
+    static constexpr char kMagic[4] = { 'P', 'M', 'A', 'G' };
+    static constexpr size_t kHeaderSize = 8;
+    // 单个帧的最大长度，超过时认为数据不合法
+    static constexpr uint32_t kMaxPayloadSize = 64 * 1024 * 1024;
+
+    /* 在out的末尾开始一帧 */
+    void begin(ReportBuffer& out);
+
+    /* 增加一个metric */
+    void add(std::string_view name, const Snapshot& snapshot);
+
+    /* 回填payloadSize */
+    void finish();
+
+    /* 当前帧中metric的个数 */
+    size_t size() const { return mCount; }
+
+    /*
+     * 解析data开头的一帧，对其中每个metric调用fn。
+     *
+     * @param frameSize 返回Ok时写入这一帧的字节数
+     * @return 返回Invalid时，不合法的数据之前的metric可能已经被回调，调用方应该断开连接
+     */
+    static ParseResult parse(const char* data, size_t size, size_t* frameSize, const Callback& fn);
+
+private:
+    ReportBuffer* mOut = nullptr;
+    size_t mStart = 0;
+    size_t mCount = 0;
+};
+
+#endif //PERFORMANCE_AGGREGATORFRAME_H
@@ -0,0 +1,65 @@
+/**
+ * Copyright (c) 2018 Duobei Brothers Information Technology Co.,Ltd. All rights reserved.
+ *
+ * Author: haosheng (sheng.hao@duobei.com)
+ *
+ * Date: 2021/10/13
+ *
+ */
+
+#ifndef PERFORMANCE_AGGREGATORSERVER_H
+#define PERFORMANCE_AGGREGATORSERVER_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AggregatorFrame.h"
+
+/*
+ * 聚合进程一端：在Unix domain socket上接收多个AggregatorClient发送的帧。
+ *
+ * 一个服务线程用poll()同时处理所有连接，每收到一个完整的帧，就对其中每个metric
+ * 调用回调函数。回调在服务线程中执行。帧不合法的连接会被断开。
+ */
+class AggregatorServer {
+public:
+    using Callback = AggregatorFrame::Callback;
+
+    AggregatorServer() = default;
+    ~AggregatorServer() { stop(); }
+
+    AggregatorServer(const AggregatorServer&) = delete;
+    AggregatorServer& operator=(const AggregatorServer&) = delete;
+
+    /* 监听path并启动服务线程，path已存在时会被删除 */
+    bool listen(const std::string& path, Callback fn);
+
+    bool isRunning() const { return mRunning.load(std::memory_order_acquire); }
+
+    /* 停止服务线程，关闭所有连接 */
+    void stop();
+
+private:
+    struct Connection {
+        int fd;
+        // 已经收到但还不是完整帧的数据
+        std::string buffer;
+    };
+
+    void run();
+    /* 读取连接上的数据并处理完整的帧，连接关闭或数据不合法时返回false */
+    bool receive(Connection& connection);
+
+    int mListenFd = -1;
+    // stop()通过这个pipe唤醒服务线程
+    int mWakeFd[2] = { -1, -1 };
+    std::string mPath;
+    Callback mCallback;
+    std::atomic<bool> mRunning { false };
+    std::thread mThread;
+    std::vector<Connection> mConnections;
+};
+
+#endif //PERFORMANCE_AGGREGATORSERVER_H
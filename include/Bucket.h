@@ -10,12 +10,47 @@
 #ifndef PERFORMANCE_BUCKET_H
 #define PERFORMANCE_BUCKET_H
 
+#include <cmath>
 #include <cstdint>
+#include <limits>
+#include <type_traits>
+
+/* Bucket的统计策略：只记录count和sum，默认策略，普通计数器不需要额外的开销 */
+struct BucketNoStats {
+};
+
+/* Bucket的统计策略：另外记录最小值、最大值和平方和，用于报告max和标准差 */
+struct BucketMoments {
+};
+
+/* 每种策略额外保存的字段，BucketNoStats没有任何字段，作为空基类不占空间 */
+template <typename T, typename Stats>
+struct BucketStats {
+};
 
 template <typename T>
-class Bucket {
+struct BucketStats<T, BucketMoments> {
+    T mMin = std::numeric_limits<T>::max();
+    T mMax = std::numeric_limits<T>::lowest();
+    // 平方和总是使用double，整数类型的平方很容易溢出
+    double mSumSquares = 0;
+};
+
+/*
+ * 一个时间片内数据的汇总。
+ *
+ * Stats为BucketMoments时还记录最小值、最大值和平方和：
+ * - addValue()和operator+=是精确的；
+ * - addValueAggregated()只知道总和，把这批数据都当作平均值处理，min/max和方差是近似的，
+ *   需要精确值时使用addMoments()补上这批数据的统计；
+ * - operator-=只能减去平方和，min/max无法相减，所以BucketedTimeSeries的窗口min/max
+ *   总是由窗口内每个时间片归约得到，而不是来自减法维护的汇总。
+ */
+template <typename T, typename Stats = BucketNoStats>
+class Bucket : public BucketStats<T, Stats> {
 public:
     using ValueType = T;
+    static constexpr bool kHasMoments = std::is_same<Stats, BucketMoments>::value;
 
     Bucket()
         : mSum(ValueType())
@@ -25,30 +60,72 @@ public:
 
     void addValue(const ValueType& value, const uint64_t& count)
     {
+        if constexpr (kHasMoments) {
+            if (count != 0) {
+                addMoments(value, value, double(value) * double(value) * double(count));
+            }
+        }
         mSum += value * count;
         mCount += count;
     }
 
     void addValueAggregated(const ValueType& total, const uint64_t& count)
+    {
+        if constexpr (kHasMoments) {
+            if (count != 0) {
+                auto avg = ValueType(total / count);
+                addMoments(avg, avg, double(total) * double(total) / double(count));
+            }
+        }
+        mSum += total;
+        mCount += count;
+    }
+
+    /* 只合并count和sum，用于不需要统计的中间结果 */
+    void addCountAndSum(const ValueType& total, const uint64_t& count)
     {
         mSum += total;
         mCount += count;
     }
 
+    /* 加入一批数据的最小值、最大值和平方和，只有BucketMoments可用 */
+    void addMoments(const ValueType& min, const ValueType& max, double sumSquares)
+    {
+        static_assert(kHasMoments, "addMoments() requires BucketMoments");
+        if (min < this->mMin) {
+            this->mMin = min;
+        }
+        if (max > this->mMax) {
+            this->mMax = max;
+        }
+        this->mSumSquares += sumSquares;
+    }
+
     void clearBucket()
     {
         mCount = 0;
         mSum = ValueType(0);
+        if constexpr (kHasMoments) {
+            *static_cast<BucketStats<T, Stats>*>(this) = BucketStats<T, Stats>();
+        }
     }
 
     Bucket& operator+=(const Bucket& bucket)
     {
-        addValue(bucket.mSum, bucket.mCount);
+        if constexpr (kHasMoments) {
+            if (bucket.mCount != 0) {
+                addMoments(bucket.mMin, bucket.mMax, bucket.mSumSquares);
+            }
+        }
+        addCountAndSum(bucket.mSum, bucket.mCount);
         return *this;
     }
 
     Bucket& operator-=(const Bucket& bucket)
     {
+        if constexpr (kHasMoments) {
+            this->mSumSquares -= bucket.mSumSquares;
+        }
         mSum -= bucket.mSum;
         mCount -= bucket.mCount;
         return *this;
@@ -63,6 +140,24 @@ public:
         return sumf / countf;
     }
 
+    /* 没有数据时返回ValueType() */
+    ValueType min() const { return mCount == 0 ? ValueType() : this->mMin; }
+
+    ValueType max() const { return mCount == 0 ? ValueType() : this->mMax; }
+
+    /* 总体方差 E[x^2] - E[x]^2，舍入误差导致的负数按0处理 */
+    double variance() const
+    {
+        if (mCount == 0) {
+            return 0.0;
+        }
+        double mean = avg();
+        double result = this->mSumSquares / double(mCount) - mean * mean;
+        return result > 0 ? result : 0.0;
+    }
+
+    double stddev() const { return std::sqrt(variance()); }
+
     uint64_t mCount;
     ValueType mSum;
 };
@@ -5,8 +5,8 @@
 #ifndef PERFORMANCE_BUCKETTIMESERIES_INL_H
 #define PERFORMANCE_BUCKETTIMESERIES_INL_H
 
-template <typename VT>
-BucketedTimeSeries<VT>::BucketedTimeSeries(
+template <typename VT, typename Stats>
+BucketedTimeSeries<VT, Stats>::BucketedTimeSeries(
     size_t numBuckets, Duration duration)
     : mFirstTime(Duration(1))
     , mLatestTime(Duration(0))
@@ -21,8 +21,8 @@ BucketedTimeSeries<VT>::BucketedTimeSeries(
     mMutex = std::make_shared<std::mutex>();
 }
 
-template <typename VT >
-bool BucketedTimeSeries<VT >::addValueAggregated(TimePoint now, const ValueType& total, uint64_t nsamples)
+template <typename VT, typename Stats>
+bool BucketedTimeSeries<VT, Stats>::addBucket(TimePoint now, const BucketType& bucket)
 {
     int bucketIndex;
     if (isEmpty()) {
@@ -35,7 +35,7 @@ bool BucketedTimeSeries<VT >::addValueAggregated(TimePoint now, const ValueType&
         bucketIndex = getBucketIndex(now);
     } else if (now > mLatestTime) {
         // now是一个稍新的时间
-        bucketIndex = updateBuckets(now);
+        bucketIndex = updateBuckets(now, NoExpire());
     } else {
         // now是一个稍早一些的过去的时间, 需要check 这个时间是否还在
         // 我们的跟踪的时间范围内
@@ -44,27 +44,44 @@ bool BucketedTimeSeries<VT >::addValueAggregated(TimePoint now, const ValueType&
         bucketIndex = getBucketIndex(now);
     }
     std::lock_guard<std::mutex> guard(*mMutex);
-    mTotal.addValueAggregated(total, nsamples);
-    mBuckets[bucketIndex].addValueAggregated(total, nsamples);
+    mTotal += bucket;
+    mBuckets[bucketIndex] += bucket;
+    if (!mIndex.empty()) {
+        indexAdd(bucketIndex, bucket.mSum, bucket.mCount);
+    }
     return true;
 }
 
-template <typename VT >
-bool BucketedTimeSeries<VT>::isEmpty() const
+template <typename VT, typename Stats>
+typename BucketedTimeSeries<VT, Stats>::BucketType BucketedTimeSeries<VT, Stats>::windowTotal() const
+{
+    // 过期的时间片在update()时已经清空，剩下的都在窗口内
+    BucketType total;
+    for (const BucketType& bucket : mBuckets) {
+        if (bucket.mCount != 0) {
+            total += bucket;
+        }
+    }
+    return total;
+}
+
+template <typename VT, typename Stats>
+bool BucketedTimeSeries<VT, Stats>::isEmpty() const
 {
     // 在构造函数中已经把mFirstTime设置为较大值，如果有数据
     // 插入，那么mFirstTime不会是较大值
     return mFirstTime > mLatestTime;
 }
 
-template <typename VT >
-size_t BucketedTimeSeries<VT>::update(TimePoint now)
+template <typename VT, typename Stats>
+template <typename OnExpire>
+size_t BucketedTimeSeries<VT, Stats>::update(TimePoint now, OnExpire onExpire)
 {
     if (isEmpty()) {
         mFirstTime = now;
     }
     if(now > mLatestTime) {
-        return updateBuckets(now);
+        return updateBuckets(now, onExpire);
     }
     // 如果传入的时间没有当前有记录的时间新，那么不用管它
     else {
@@ -72,13 +89,16 @@ size_t BucketedTimeSeries<VT>::update(TimePoint now)
     }
 }
 
-template <typename VT >
-void BucketedTimeSeries<VT>::clear()
+template <typename VT, typename Stats>
+void BucketedTimeSeries<VT, Stats>::clear()
 {
     for (BucketType& bucket : mBuckets) {
-        bucket.clear();
+        bucket.clearBucket();
     }
-    mTotal.clear();
+    for (CountBucket& node : mIndex) {
+        node.clearBucket();
+    }
+    mTotal.clearBucket();
     mFirstTime = TimePoint(Duration(1));
     mLatestTime = TimePoint();
 }
@@ -96,16 +116,17 @@ void BucketedTimeSeries<VT>::clear()
  * 为此，当一个真实的时间戳传递进来时，我们需要先把timestamp乘以buckets_.size()来获得一个
  * 模拟的内部bucket时间戳，然后把这个时间除以duration_就获得了timestamp对应的bucket index
  */
-template <typename VT >
-size_t BucketedTimeSeries<VT >::getBucketIndex(TimePoint now) const
+template <typename VT, typename Stats>
+size_t BucketedTimeSeries<VT, Stats>::getBucketIndex(TimePoint now) const
 {
     // 获取当前时间周期中经历的一段duration
     auto timeInCurrentCycle = now.time_since_epoch() % mDuration;
     return timeInCurrentCycle.count() * mBuckets.size() / mDuration.count();
 }
 
-template <typename VT >
-size_t BucketedTimeSeries<VT >::updateBuckets(TimePoint now)
+template <typename VT, typename Stats>
+template <typename OnExpire>
+size_t BucketedTimeSeries<VT, Stats>::updateBuckets(TimePoint now, OnExpire onExpire)
 {
     std::lock_guard<std::mutex> guard(*mMutex);
 
@@ -115,6 +136,26 @@ size_t BucketedTimeSeries<VT >::updateBuckets(TimePoint now)
     // 先计算出自从上次插入的数据落入的bucket的信息
     getBucketInfo(mLatestTime, &currentBucketIdx, &currentBucketStart, &nextBucketStart);
 
+    if constexpr (!std::is_same<OnExpire, NoExpire>::value) {
+        if (now >= nextBucketStart) {
+            // 新的时间窗口之前的bucket都会被清除，从最早的bucket开始传出
+            size_t newBucketIdx;
+            TimePoint newBucketStart;
+            TimePoint newNextBucketStart;
+            getBucketInfo(now, &newBucketIdx, &newBucketStart, &newNextBucketStart);
+            TimePoint windowStart = newNextBucketStart - mDuration;
+            forEachBucket([&](const BucketType& bucket, TimePoint bucketStart, TimePoint) -> bool {
+                if (bucketStart >= windowStart) {
+                    return false;
+                }
+                if (bucket.mCount != 0) {
+                    onExpire(bucket, bucketStart);
+                }
+                return true;
+            });
+        }
+    }
+
     mLatestTime = now;
     // 现在的timestamp有三种情况，（1）时间过去没多久，now依然落在上次update的bucket上
     // （2）时间过去了多于duration_，buckets中的所有数据都过时了，对所有的bucket进行clear()
@@ -126,6 +167,9 @@ size_t BucketedTimeSeries<VT >::updateBuckets(TimePoint now)
         for (BucketType& bucket : mBuckets) {
             bucket.clearBucket();
         }
+        for (CountBucket& node : mIndex) {
+            node.clearBucket();
+        }
         mTotal.clearBucket();
         return getBucketIndex(now);
     } else {
@@ -137,6 +181,9 @@ size_t BucketedTimeSeries<VT >::updateBuckets(TimePoint now)
                 idx = 0;
             }
             mTotal -= mBuckets[idx];
+            if (!mIndex.empty()) {
+                indexAdd(idx, -mBuckets[idx].mSum, uint64_t(0) - mBuckets[idx].mCount);
+            }
             mBuckets[idx].clearBucket();
         }
         return newBucket;
@@ -158,8 +205,8 @@ size_t BucketedTimeSeries<VT >::updateBuckets(TimePoint now)
  *
  * 在这里，每五个bucket对应的时间宽度为3、3、3、3、2，每五个一循环。
  */
-template <typename VT >
-void BucketedTimeSeries<VT >::getBucketInfo(
+template <typename VT, typename Stats>
+void BucketedTimeSeries<VT, Stats>::getBucketInfo(
     TimePoint timePoint, size_t* bucketIdx, TimePoint* bucketStart, TimePoint* nextBucketStart) const
 {
     using TimeInt = typename Duration::rep;
@@ -177,8 +224,8 @@ void BucketedTimeSeries<VT >::getBucketInfo(
                        + TimePoint(numFullDurations * mDuration);
 }
 
-template <typename VT >
-std::chrono::steady_clock::time_point BucketedTimeSeries<VT>::getEarliestTime() const
+template <typename VT, typename Stats>
+std::chrono::steady_clock::time_point BucketedTimeSeries<VT, Stats>::getEarliestTime() const
 {
     if (isEmpty() ){
         return TimePoint{};
@@ -198,36 +245,49 @@ std::chrono::steady_clock::time_point BucketedTimeSeries<VT>::getEarliestTime()
 
 /*---------------------------------------------------------------------*/
 
-template <typename VT >
-uint64_t BucketedTimeSeries<VT >::count(
+template <typename VT, typename Stats>
+uint64_t BucketedTimeSeries<VT, Stats>::count(
     TimePoint start, TimePoint end) const
 {
-    uint64_t sample_count = 0;
-    forEachBucket(
-        start,
-        end,
-        [&](const BucketType& bucket,
-            TimePoint bucketStart,
-            TimePoint nextBucketStart) -> bool {
-            sample_count += this->rangeAdjust(
-                bucketStart, nextBucketStart, start, end, bucket.mCount);
-            return true;
-        });
+    return rangeTotal(start, end).mCount;
+}
 
-    return sample_count;
+template <typename VT, typename Stats>
+VT BucketedTimeSeries<VT, Stats>::sum(TimePoint start, TimePoint end) const
+{
+    return rangeTotal(start, end).mSum;
 }
 
-template <typename VT >
-VT BucketedTimeSeries<VT >::sum(TimePoint start, TimePoint end) const
+template <typename VT, typename Stats>
+double BucketedTimeSeries<VT, Stats>::avg(TimePoint start, TimePoint end) const
 {
-    ValueType total = ValueType();
+    CountBucket total = rangeTotal(start, end);
+    if (total.mCount == 0)
+        return 0.0;
+    return double(total.mSum * 1.0 / total.mCount);
+}
+
+template <typename VT, typename Stats>
+typename BucketedTimeSeries<VT, Stats>::CountBucket BucketedTimeSeries<VT, Stats>::rangeTotal(
+    TimePoint start, TimePoint end) const
+{
+    // 空区间，否则rangeAdjust()会按负的长度插值
+    if (start >= end) {
+        return CountBucket();
+    }
+    if (!mIndex.empty()) {
+        return rangeTotalIndexed(start, end);
+    }
+    CountBucket total;
     forEachBucket(
         start,
         end,
         [&](const BucketType& bucket,
             TimePoint bucketStart,
             TimePoint nextBucketStart) -> bool {
-            total += this->rangeAdjust(
+            total.mCount += this->rangeAdjust(
+                bucketStart, nextBucketStart, start, end, bucket.mCount);
+            total.mSum += this->rangeAdjust(
                 bucketStart, nextBucketStart, start, end, bucket.mSum);
             return true;
         });
@@ -235,31 +295,97 @@ VT BucketedTimeSeries<VT >::sum(TimePoint start, TimePoint end) const
     return total;
 }
 
-template <typename VT >
-double BucketedTimeSeries<VT >::avg(TimePoint start, TimePoint end) const
+/*
+ * 带索引的区间查询：
+ *
+ * buckets覆盖的时间窗口是[最新bucket的结束时间 - duration, 最新bucket的结束时间)，
+ * 窗口内每个下标恰好出现一次。先把[start,end)截取到窗口内，找到首尾两个bucket，
+ * 它们可能只有一部分在区间内，与forEachBucket()一样用rangeAdjust()调整；两者之间的
+ * bucket完整地包含在区间内，按环形下标拆成至多两段，用Fenwick树的前缀和求出。
+ */
+template <typename VT, typename Stats>
+typename BucketedTimeSeries<VT, Stats>::CountBucket BucketedTimeSeries<VT, Stats>::rangeTotalIndexed(
+    TimePoint start, TimePoint end) const
 {
-    uint64_t sample_count = 0;
-    ValueType total = ValueType();
-    forEachBucket(
-        start,
-        end,
-        [&](const BucketType& bucket,
-            TimePoint bucketStart,
-            TimePoint nextBucketStart) -> bool {
-            sample_count += this->template rangeAdjust(
-                bucketStart, nextBucketStart, start, end, bucket.mCount);
-            total += this->rangeAdjust(
-                bucketStart, nextBucketStart, start, end, bucket.mSum);
-            return true;
-        });
-    if (sample_count == 0)
-        return 0.0;
-    return double(total * 1.0 / sample_count);
+    CountBucket total;
+    size_t latestIdx;
+    TimePoint latestStart;
+    TimePoint windowEnd;
+    getBucketInfo(mLatestTime, &latestIdx, &latestStart, &windowEnd);
+    TimePoint first = std::max(start, windowEnd - mDuration);
+    TimePoint last = std::min(end, windowEnd);
+    if (first >= last) {
+        return total;
+    }
+
+    size_t firstIdx, lastIdx;
+    TimePoint firstStart, firstNext, lastStart, lastNext;
+    getBucketInfo(first, &firstIdx, &firstStart, &firstNext);
+    getBucketInfo(last - Duration(1), &lastIdx, &lastStart, &lastNext);
+
+    auto addEdge = [&](size_t idx, TimePoint bucketStart, TimePoint nextBucketStart) {
+        total.mCount += rangeAdjust(
+            bucketStart, nextBucketStart, start, end, mBuckets[idx].mCount);
+        total.mSum += rangeAdjust(
+            bucketStart, nextBucketStart, start, end, mBuckets[idx].mSum);
+    };
+    addEdge(firstIdx, firstStart, firstNext);
+    if (firstIdx == lastIdx) {
+        return total;
+    }
+    addEdge(lastIdx, lastStart, lastNext);
+
+    // 中间的bucket是环形下标(firstIdx, lastIdx)
+    size_t from = firstIdx + 1 == mBuckets.size() ? 0 : firstIdx + 1;
+    if (from == lastIdx) {
+        return total;
+    }
+    CountBucket inner;
+    if (from < lastIdx) {
+        inner = indexPrefix(lastIdx);
+        inner -= indexPrefix(from);
+    } else {
+        inner = indexPrefix(mBuckets.size());
+        inner -= indexPrefix(from);
+        CountBucket head = indexPrefix(lastIdx);
+        inner.addValueAggregated(head.mSum, head.mCount);
+    }
+    total.addValueAggregated(inner.mSum, inner.mCount);
+    return total;
+}
+
+template <typename VT, typename Stats>
+void BucketedTimeSeries<VT, Stats>::enableRangeIndex()
+{
+    std::lock_guard<std::mutex> guard(*mMutex);
+    mIndex.assign(mBuckets.size(), CountBucket());
+    for (size_t i = 0; i < mBuckets.size(); ++i) {
+        indexAdd(i, mBuckets[i].mSum, mBuckets[i].mCount);
+    }
+}
+
+template <typename VT, typename Stats>
+void BucketedTimeSeries<VT, Stats>::indexAdd(
+    size_t idx, const ValueType& total, uint64_t count)
+{
+    for (size_t i = idx + 1; i <= mIndex.size(); i += i & (~i + 1)) {
+        mIndex[i - 1].addValueAggregated(total, count);
+    }
+}
+
+template <typename VT, typename Stats>
+typename BucketedTimeSeries<VT, Stats>::CountBucket BucketedTimeSeries<VT, Stats>::indexPrefix(size_t end) const
+{
+    CountBucket result;
+    for (size_t i = end; i > 0; i -= i & (~i + 1)) {
+        result.addValueAggregated(mIndex[i - 1].mSum, mIndex[i - 1].mCount);
+    }
+    return result;
 }
 
-template <typename VT >
+template <typename VT, typename Stats>
 template <typename Interval>
-Interval BucketedTimeSeries<VT>::elapsed() const
+Interval BucketedTimeSeries<VT, Stats>::elapsed() const
 {
     if (isEmpty())
         return Interval(0);
@@ -267,9 +393,9 @@ Interval BucketedTimeSeries<VT>::elapsed() const
         (mLatestTime - getEarliestTime()) + Interval(1);
 }
 
-template <typename VT>
+template <typename VT, typename Stats>
 template <typename Interval>
-Interval BucketedTimeSeries<VT>::elapsed(TimePoint start, TimePoint end) const
+Interval BucketedTimeSeries<VT, Stats>::elapsed(TimePoint start, TimePoint end) const
 {
     if (isEmpty())
         return Interval(0);
@@ -279,9 +405,9 @@ Interval BucketedTimeSeries<VT>::elapsed(TimePoint start, TimePoint end) const
     return std::chrono::duration_cast<Interval>(end - start);
 }
 
-template <typename VT >
+template <typename VT, typename Stats>
 template <typename Function>
-void BucketedTimeSeries<VT >::forEachBucket(Function fn) const
+void BucketedTimeSeries<VT, Stats>::forEachBucket(Function fn) const
 {
     typedef typename Duration::rep TimeInt;
 
@@ -296,7 +422,7 @@ void BucketedTimeSeries<VT >::forEachBucket(Function fn) const
     // 开始遍历buckets，从最新的bucket的下一个bucket开始。
     // 由于这个bucket属于上一个time cycle，所以fullDuration的时间
     // 要减去一个duration
-    size_t latestBucketIdx = size_t(scaledTime / mBuckets.count());
+    size_t latestBucketIdx = size_t(scaledTime / mDuration.count());
     size_t idx = latestBucketIdx;
     TimePoint fullDuration = TimePoint(numFullDurations * mDuration) - mDuration;
     TimePoint bucketStart;
@@ -329,9 +455,9 @@ void BucketedTimeSeries<VT >::forEachBucket(Function fn) const
     }
 }
 
-template <typename VT >
+template <typename VT, typename Stats>
 template <typename Function>
-void BucketedTimeSeries<VT >::forEachBucket(
+void BucketedTimeSeries<VT, Stats>::forEachBucket(
     TimePoint start, TimePoint end, Function fn) const
 {
     forEachBucket(
@@ -355,9 +481,9 @@ void BucketedTimeSeries<VT >::forEachBucket(
         });
 }
 
-template <typename VT >
+template <typename VT, typename Stats>
 template <typename ReturnType>
-ReturnType BucketedTimeSeries<VT >::rangeAdjust(
+ReturnType BucketedTimeSeries<VT, Stats>::rangeAdjust(
     TimePoint bucketStart,
     TimePoint nextBucketStart,
     TimePoint start,
@@ -14,33 +14,91 @@
 #include <vector>
 #include <mutex>
 #include <memory>
+#include <type_traits>
 
 #include "Bucket.h"
 
-template <typename VT>
+/*
+ * Stats是每个时间片的统计策略，见Bucket。默认的BucketNoStats只记录count和sum；
+ * BucketMoments另外记录min、max和平方和，窗口内的统计由windowTotal()归约每个时间片得到。
+ */
+template <typename VT, typename Stats = BucketNoStats>
 class BucketedTimeSeries {
 public:
     using ValueType = VT;
     using Clock = std::chrono::steady_clock;
     using Duration = Clock::duration;
     using TimePoint = Clock::time_point;
-    using BucketType = Bucket<ValueType>;
+    using BucketType = Bucket<ValueType, Stats>;
+    // 区间查询和索引只需要count和sum
+    using CountBucket = Bucket<ValueType>;
 
     BucketedTimeSeries(size_t numBuckets, Duration duration);
 
-    size_t update(TimePoint now);
+    size_t update(TimePoint now) { return update(now, NoExpire()); }
+
+    /*
+     * 同update(now)，但每个因过时而被清除的非空bucket在清除之前会以
+     * onExpire(bucket, bucketStart)的形式传出，bucketStart是这个bucket的起始时间。
+     * 按时间从早到晚传出，MultiLevelTimeSeries用它把过时的数据滚入更粗的level。
+     */
+    template <typename OnExpire>
+    size_t update(TimePoint now, OnExpire onExpire);
 
     /* 将timeseries重置为空，就像没有添加过数据一样 */
     void clear();
 
+    /*
+     * 为[start,end)区间查询建立索引。
+     *
+     * 默认情况下count/sum/avg(start, end)逐个遍历bucket，复杂度是O(numBuckets)。
+     * 建立索引后，在各个bucket（按环形数组的下标）之上维护一棵Fenwick树，插入数据和
+     * 丢弃过时bucket时增量更新，区间查询只需要对首尾两个bucket做rangeAdjust，中间的
+     * bucket用两次前缀和求出，复杂度是O(log numBuckets)。结果与不建立索引时相同。
+     *
+     * 适用于bucket很多、区间查询频繁的场景，代价是每次插入多O(log numBuckets)次加法。
+     * 索引随对象一起被复制。
+     */
+    void enableRangeIndex();
+
+    bool hasRangeIndex() const { return !mIndex.empty(); }
+
     bool addValue(TimePoint now, const ValueType& value) { return addValue(now, value, 1); }
 
     bool addValue(TimePoint now, const ValueType& value, uint64_t count)
     {
-        return addValueAggregated(now,value * count, count);
+        BucketType bucket;
+        bucket.addValue(value, count);
+        return addBucket(now, bucket);
+    }
+
+    bool addValueAggregated(TimePoint now, const ValueType& total, uint64_t nsamples)
+    {
+        BucketType bucket;
+        bucket.addValueAggregated(total, nsamples);
+        return addBucket(now, bucket);
+    }
+
+    /* 把一批已经汇总好的数据（包括Stats记录的统计）加入时间now所在的时间片 */
+    bool addBucket(TimePoint now, const BucketType& bucket);
+
+    /*
+     * 在now写入的一批数据实际从更早的firstTime开始累积时，把第一个数据的时间提前到firstTime，
+     * 这样elapsed()从第一个采样点算起，而不是从写入的时刻。没有数据时什么都不做。
+     */
+    void backdate(TimePoint firstTime)
+    {
+        if (!isEmpty() && firstTime < mFirstTime) {
+            mFirstTime = firstTime;
+        }
     }
 
-    bool addValueAggregated(TimePoint now, const ValueType& total, uint64_t nsamples);
+    /*
+     * 窗口内所有时间片的归约，复杂度是O(numBuckets)。
+     *
+     * count和sum与count()、sum()相同；BucketMoments的min、max不能由减法维护，只能从这里得到。
+     */
+    BucketType windowTotal() const;
 
     uint64_t count() const { return mTotal.mCount; }
 
@@ -129,17 +187,40 @@ public:
     TimePoint getFirstTime() const { return mFirstTime; }
     TimePoint getLatestTime() const { return mLatestTime; }
     Duration getDuration() const { return mDuration; }
+    size_t numBuckets() const { return mBuckets.size(); }
     const BucketType& getBucketByIdx(size_t index) const { return mBuckets[index]; }
 
+    /* 占用的堆内存字节数，不包括对象本身 */
+    size_t memoryUsage() const
+    {
+        return mBuckets.capacity() * sizeof(BucketType) + mIndex.capacity() * sizeof(CountBucket);
+    }
+
 private:
+    struct NoExpire {
+        void operator()(const BucketType&, TimePoint) const {}
+    };
+
     /* 清除bucktes数组中过时的数据 */
-    size_t updateBuckets(TimePoint now);
+    template <typename OnExpire>
+    size_t updateBuckets(TimePoint now, OnExpire onExpire);
+
+    /* [start,end)内的数据，mCount和mSum都已经过rangeAdjust */
+    CountBucket rangeTotal(TimePoint start, TimePoint end) const;
+    CountBucket rangeTotalIndexed(TimePoint start, TimePoint end) const;
+
+    /* 把第idx个bucket的变化加到索引上，减去时count传入补码 */
+    void indexAdd(size_t idx, const ValueType& total, uint64_t count);
+    /* 下标在[0,end)内的bucket之和 */
+    CountBucket indexPrefix(size_t end) const;
 
     TimePoint mFirstTime;
     TimePoint mLatestTime;
     Duration mDuration;
     BucketType mTotal; //一个记录所有数据的bucket
     std::vector<BucketType> mBuckets;
+    // Fenwick树，mIndex[i]是下标在(i - lowbit(i + 1), i]内的bucket之和；为空表示没有建立索引
+    std::vector<CountBucket> mIndex;
     std::shared_ptr<std::mutex> mMutex;
 };
 
@@ -0,0 +1,216 @@
+/**
+ * Copyright (c) 2018 Duobei Brothers Information Technology Co.,Ltd. All rights reserved.
+ *
+ * Author: haosheng (sheng.hao@duobei.com)
+ *
+ * Date: 2021/9/14
+ *
+ */
+
+#ifndef PERFORMANCE_COUNTSCAN_H
+#define PERFORMANCE_COUNTSCAN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PERFORMANCE_COUNTSCAN_SSE2
+#endif
+
+/*
+ * 32字节对齐的、可复用的count数组。
+ *
+ * 计算百分位数时需要先把每个bucket的count收集到一块连续内存中。为了避免每次查询都
+ * 分配一个新的vector，每个线程持有一个CountBuffer，容量只增不减。
+ */
+class CountBuffer {
+public:
+    static constexpr size_t kAlignment = 32;
+    // 一次SIMD扫描处理的元素个数，数组长度会被补齐到它的整数倍
+    static constexpr size_t kLaneCount = 4;
+
+    CountBuffer() = default;
+    ~CountBuffer() { release(); }
+
+    CountBuffer(const CountBuffer&) = delete;
+    CountBuffer& operator=(const CountBuffer&) = delete;
+
+    /*
+     * 返回一个至少能容纳n个元素的数组。
+     *
+     * 长度补齐到kLaneCount的整数倍，补齐部分被置为0，因此扫描时可以整块读取。
+     */
+    uint64_t* reserve(size_t n)
+    {
+        size_t padded = (n + kLaneCount - 1) / kLaneCount * kLaneCount;
+        if (padded > mCapacity) {
+            release();
+            mData = static_cast<uint64_t*>(
+                ::operator new(padded * sizeof(uint64_t), std::align_val_t(kAlignment)));
+            mCapacity = padded;
+        }
+        if (padded > n) {
+            std::memset(mData + n, 0, (padded - n) * sizeof(uint64_t));
+        }
+        return mData;
+    }
+
+    uint64_t* data() { return mData; }
+
+    size_t capacity() const { return mCapacity; }
+
+    /* 返回当前线程的缓冲区 */
+    static CountBuffer& local()
+    {
+        static thread_local CountBuffer buffer;
+        return buffer;
+    }
+
+private:
+    void release()
+    {
+        if (mData) {
+            ::operator delete(mData, std::align_val_t(kAlignment));
+            mData = nullptr;
+            mCapacity = 0;
+        }
+    }
+
+    uint64_t* mData = nullptr;
+    size_t mCapacity = 0;
+};
+
+/*
+ * 在count数组上做累加和查找。
+ *
+ * 定义了__AVX2__时每次处理4个count，在寄存器内做前缀和并与阈值比较；只有SSE2时每次处理
+ * 2个；其他平台退化为标量循环。三种实现的结果完全一致。
+ *
+ * 注意：counts必须来自CountBuffer::reserve()，即32字节对齐且补齐了长度。
+ */
+class CountScan {
+public:
+    /* 返回bits中最低的非0位的位置，bits不能为0。用于遍历活跃bucket的位图 */
+    static unsigned lowestBit(uint64_t bits)
+    {
+#ifdef _MSC_VER
+        unsigned long bit;
+        _BitScanForward64(&bit, bits);
+        return unsigned(bit);
+#else
+        return unsigned(__builtin_ctzll(bits));
+#endif
+    }
+
+    /* 返回counts[0, n)的总和 */
+    static uint64_t sum(const uint64_t* counts, size_t n)
+    {
+        uint64_t total = 0;
+        size_t idx = 0;
+#if defined(__AVX2__)
+        __m256i acc = _mm256_setzero_si256();
+        for (; idx + 4 <= n; idx += 4) {
+            acc = _mm256_add_epi64(acc, _mm256_load_si256(reinterpret_cast<const __m256i*>(counts + idx)));
+        }
+        alignas(32) uint64_t lanes[4];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc);
+        total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#elif defined(PERFORMANCE_COUNTSCAN_SSE2)
+        __m128i acc = _mm_setzero_si128();
+        for (; idx + 2 <= n; idx += 2) {
+            acc = _mm_add_epi64(acc, _mm_load_si128(reinterpret_cast<const __m128i*>(counts + idx)));
+        }
+        alignas(16) uint64_t lanes[2];
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes), acc);
+        total = lanes[0] + lanes[1];
+#endif
+        for (; idx < n; ++idx) {
+            total += counts[idx];
+        }
+        return total;
+    }
+
+    /*
+     * 返回第一个满足 counts[0] + ... + counts[idx] >= threshold 的下标idx。
+     *
+     * @param countBefore 输出counts[0, idx)的累加和
+     *
+     * 如果所有count的总和都小于threshold，返回n。threshold至少为1，因此找到的bucket的count
+     * 一定不为0。
+     */
+    static size_t lowerBound(const uint64_t* counts, size_t n, uint64_t threshold, uint64_t* countBefore)
+    {
+        uint64_t cum = 0;
+        size_t idx = 0;
+#if defined(__AVX2__)
+        const __m256i zero = _mm256_setzero_si256();
+        // 有符号比较：cum > threshold - 1 等价于 cum >= threshold，count的总和远小于2^63
+        const __m256i limit = _mm256_set1_epi64x(static_cast<int64_t>(threshold - 1));
+        __m256i carry = zero;
+        for (; idx < n; idx += 4) {
+            __m256i v = _mm256_load_si256(reinterpret_cast<const __m256i*>(counts + idx));
+            // 寄存器内的前缀和：[a, b, c, d] -> [a, a+b, a+b+c, a+b+c+d]
+            v = _mm256_add_epi64(v, _mm256_blend_epi32(_mm256_permute4x64_epi64(v, 0x90), zero, 0x03));
+            v = _mm256_add_epi64(v, _mm256_blend_epi32(_mm256_permute4x64_epi64(v, 0x40), zero, 0x0F));
+            v = _mm256_add_epi64(v, carry);
+            int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(v, limit)));
+            if (mask != 0) {
+                alignas(32) uint64_t lanes[4];
+                _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), v);
+                size_t lane = 0;
+                while ((mask & (1 << lane)) == 0) {
+                    ++lane;
+                }
+                // 补齐部分的count都是0，不会让累加和越过阈值
+                if (idx + lane < n) {
+                    *countBefore = lanes[lane] - counts[idx + lane];
+                    return idx + lane;
+                }
+            }
+            // 把这一组的总和广播到所有lane，作为下一组的起点
+            carry = _mm256_permute4x64_epi64(v, 0xFF);
+        }
+        alignas(32) uint64_t lanes[4];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), carry);
+        cum = lanes[0];
+        idx = n;
+#elif defined(PERFORMANCE_COUNTSCAN_SSE2)
+        for (; idx + 2 <= n; idx += 2) {
+            __m128i v = _mm_load_si128(reinterpret_cast<const __m128i*>(counts + idx));
+            // [a, b] -> [a, a+b]
+            v = _mm_add_epi64(v, _mm_slli_si128(v, 8));
+            alignas(16) uint64_t lanes[2];
+            _mm_store_si128(reinterpret_cast<__m128i*>(lanes), v);
+            if (cum + lanes[1] >= threshold) {
+                if (cum + lanes[0] >= threshold) {
+                    *countBefore = cum;
+                    return idx;
+                }
+                *countBefore = cum + lanes[0];
+                return idx + 1;
+            }
+            cum += lanes[1];
+        }
+#endif
+        for (; idx < n; ++idx) {
+            if (cum + counts[idx] >= threshold) {
+                *countBefore = cum;
+                return idx;
+            }
+            cum += counts[idx];
+        }
+        *countBefore = cum;
+        return n;
+    }
+};
+
+#endif //PERFORMANCE_COUNTSCAN_H
@@ -0,0 +1,179 @@
+//
+// Created by haosheng on 2021/10/16.
+//
+
+#ifndef PERFORMANCE_DDSKETCH_INL_H
+#define PERFORMANCE_DDSKETCH_INL_H
+
+#include <algorithm>
+#include <cmath>
+
+template <typename T>
+DDSketch<T>::DDSketch(double relativeAccuracy, size_t maxBins)
+    : mRelativeAccuracy(relativeAccuracy)
+    , mMaxBins(std::max<size_t>(maxBins, 1))
+    , mGamma((1 + relativeAccuracy) / (1 - relativeAccuracy))
+    , mMultiplier(1 / std::log(mGamma))
+{
+}
+
+template <typename T>
+void DDSketch<T>::add(const ValueType& value, uint64_t count)
+{
+    if (count == 0) {
+        return;
+    }
+    auto v = double(value);
+    if (v > kMinIndexable) {
+        mPositive.add(getKey(v), count, mMaxBins, true);
+    } else if (v < -kMinIndexable) {
+        mNegative.add(getKey(-v), count, mMaxBins, false);
+    } else {
+        mZeroCount += count;
+    }
+    if (mCount == 0) {
+        mMin = value;
+        mMax = value;
+    } else {
+        mMin = std::min(mMin, value);
+        mMax = std::max(mMax, value);
+    }
+    mCount += count;
+    mSum += value * count;
+}
+
+template <typename T>
+void DDSketch<T>::clear()
+{
+    mPositive.clear();
+    mNegative.clear();
+    mZeroCount = 0;
+    mCount = 0;
+    mSum = ValueType();
+    mMin = ValueType();
+    mMax = ValueType();
+}
+
+template <typename T>
+T DDSketch<T>::getPercentileEstimate(double pct) const
+{
+    if (mCount == 0) {
+        return ValueType();
+    }
+    double rank = std::clamp(pct / 100.0, 0.0, 1.0) * double(mCount - 1);
+    double estimate = double(mMax);
+    // 从最小的值开始累加：绝对值最大的负数、0、最小的正数
+    uint64_t seen = 0;
+    bool found = false;
+    for (size_t i = mNegative.counts.size(); i-- > 0 && !found;) {
+        seen += mNegative.counts[i];
+        if (double(seen) > rank) {
+            estimate = -getValue(mNegative.offset + int32_t(i));
+            found = true;
+        }
+    }
+    if (!found) {
+        seen += mZeroCount;
+        if (double(seen) > rank) {
+            estimate = 0;
+            found = true;
+        }
+    }
+    for (size_t i = 0; i < mPositive.counts.size() && !found; ++i) {
+        seen += mPositive.counts[i];
+        if (double(seen) > rank) {
+            estimate = getValue(mPositive.offset + int32_t(i));
+            found = true;
+        }
+    }
+    return ValueType(std::clamp(estimate, double(mMin), double(mMax)));
+}
+
+template <typename T>
+DDSketch<T>& DDSketch<T>::operator+=(const DDSketch& other)
+{
+    if (!isMergeable(other) || other.mCount == 0) {
+        return *this;
+    }
+    mPositive.merge(other.mPositive, mMaxBins, true);
+    mNegative.merge(other.mNegative, mMaxBins, false);
+    mZeroCount += other.mZeroCount;
+    if (mCount == 0) {
+        mMin = other.mMin;
+        mMax = other.mMax;
+    } else {
+        mMin = std::min(mMin, other.mMin);
+        mMax = std::max(mMax, other.mMax);
+    }
+    mCount += other.mCount;
+    mSum += other.mSum;
+    return *this;
+}
+
+template <typename T>
+int32_t DDSketch<T>::getKey(double magnitude) const
+{
+    return int32_t(std::ceil(std::log(magnitude) * mMultiplier));
+}
+
+template <typename T>
+double DDSketch<T>::getValue(int32_t key) const
+{
+    return 2 * std::pow(mGamma, key) / (mGamma + 1);
+}
+
+template <typename T>
+void DDSketch<T>::Store::add(int32_t key, uint64_t count, size_t maxBins, bool collapseLowest)
+{
+    if (counts.empty() || key < offset || key >= offset + int32_t(counts.size())) {
+        int32_t minKey = key;
+        int32_t maxKey = key;
+        extend(&minKey, &maxKey, maxBins, collapseLowest);
+        key = std::clamp(key, minKey, maxKey);
+    }
+    counts[size_t(key - offset)] += count;
+}
+
+template <typename T>
+void DDSketch<T>::Store::merge(const Store& other, size_t maxBins, bool collapseLowest)
+{
+    if (other.counts.empty()) {
+        return;
+    }
+    int32_t minKey = other.offset;
+    int32_t maxKey = other.offset + int32_t(other.counts.size()) - 1;
+    extend(&minKey, &maxKey, maxBins, collapseLowest);
+    for (size_t i = 0; i < other.counts.size(); ++i) {
+        int32_t key = std::clamp(other.offset + int32_t(i), minKey, maxKey);
+        counts[size_t(key - offset)] += other.counts[i];
+    }
+}
+
+template <typename T>
+void DDSketch<T>::Store::extend(int32_t* minKey, int32_t* maxKey, size_t maxBins, bool collapseLowest)
+{
+    if (!counts.empty()) {
+        *minKey = std::min(*minKey, offset);
+        *maxKey = std::max(*maxKey, offset + int32_t(counts.size()) - 1);
+    }
+    if (int64_t(*maxKey) - *minKey + 1 > int64_t(maxBins)) {
+        if (collapseLowest) {
+            *minKey = *maxKey - int32_t(maxBins) + 1;
+        } else {
+            *maxKey = *minKey + int32_t(maxBins) - 1;
+        }
+    }
+    if (!counts.empty() && *minKey == offset && *maxKey == offset + int32_t(counts.size()) - 1) {
+        return;
+    }
+    // 范围之外的bin合并到保留范围的边界上
+    std::vector<uint64_t> resized(size_t(*maxKey - *minKey + 1), 0);
+    for (size_t i = 0; i < counts.size(); ++i) {
+        int32_t key = std::clamp(offset + int32_t(i), *minKey, *maxKey);
+        resized[size_t(key - *minKey)] += counts[i];
+    }
+    counts.swap(resized);
+    offset = *minKey;
+}
+
+#endif //PERFORMANCE_DDSKETCH_INL_H
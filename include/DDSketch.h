@@ -0,0 +1,119 @@
+/**
+ * Copyright (c) 2018 Duobei Brothers Information Technology Co.,Ltd. All rights reserved.
+ *
+ * Author: haosheng (sheng.hao@duobei.com)
+ *
+ * Date: 2021/10/16
+ *
+ */
+
+#ifndef PERFORMANCE_DDSKETCH_H
+#define PERFORMANCE_DDSKETCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * DDSketch：有相对误差保证的分位数估计。
+ *
+ * 值v被放入第ceil(log_gamma(|v|))个bin，gamma = (1 + alpha) / (1 - alpha)，每个bin覆盖
+ * (gamma^(k-1), gamma^k]，用bin的中点估计其中的值，所以任何分位数的估计值与真实值之间的
+ * 相对误差不超过alpha（relativeAccuracy）。与HistogramBuckets的等宽bucket相比，不需要预先
+ * 知道数据范围，长尾的延迟也能得到准确的高百分位数。
+ *
+ * 正数和负数各有一个连续的bin数组，绝对值小于kMinIndexable的值计入0。每个数组最多maxBins个
+ * bin，超过时合并数值最小的一端（正数中最小的bin、负数中绝对值最大的bin），高百分位数的
+ * 误差保证不受影响，内存有上界。
+ *
+ * 相同relativeAccuracy的sketch可以用operator+=合并，结果与把所有数据加入同一个sketch相同。
+ */
+template <typename T>
+class DDSketch {
+public:
+    using ValueType = T;
+
+    // 绝对值小于它的值计入0，避免log产生巨大的下标
+    static constexpr double kMinIndexable = 1e-9;
+
+    /*
+     * @param relativeAccuracy 分位数的相对误差上界，范围(0, 1)
+     * @param maxBins          正数、负数各自最多使用的bin个数
+     */
+    explicit DDSketch(double relativeAccuracy = 0.01, size_t maxBins = 2048);
+
+    /* 加入count个值为value的数据 */
+    void add(const ValueType& value, uint64_t count = 1);
+
+    void clear();
+
+    bool isEmpty() const { return mCount == 0; }
+
+    uint64_t count() const { return mCount; }
+
+    ValueType sum() const { return mSum; }
+
+    double avg() const { return mCount == 0 ? 0.0 : double(mSum) / double(mCount); }
+
+    /* 最小值和最大值是准确的，没有数据时返回ValueType() */
+    ValueType min() const { return mCount == 0 ? ValueType() : mMin; }
+
+    ValueType max() const { return mCount == 0 ? ValueType() : mMax; }
+
+    double relativeAccuracy() const { return mRelativeAccuracy; }
+
+    size_t maxBins() const { return mMaxBins; }
+
+    /* 正数和负数实际使用的bin个数 */
+    size_t numBins() const { return mPositive.counts.size() + mNegative.counts.size(); }
+
+    /*
+     * 返回给定百分位数处的估计值，pct的范围是0-100。
+     *
+     * 估计值被限制在[min(), max()]之内，没有数据时返回ValueType()。
+     */
+    ValueType getPercentileEstimate(double pct) const;
+
+    /* relativeAccuracy相同才能合并 */
+    bool isMergeable(const DDSketch& other) const { return mGamma == other.mGamma; }
+
+    /* 把other的数据合并进来，不能合并时保持不变 */
+    DDSketch& operator+=(const DDSketch& other);
+
+private:
+    /*
+     * 下标连续的bin，counts[i]是下标为offset + i的bin。
+     * 范围超过maxBins时合并一端：collapseLowest为true时合并下标最小的bin，否则合并最大的。
+     */
+    struct Store {
+        int32_t offset = 0;
+        std::vector<uint64_t> counts;
+
+        void add(int32_t key, uint64_t count, size_t maxBins, bool collapseLowest);
+        void merge(const Store& other, size_t maxBins, bool collapseLowest);
+        void clear() { counts.clear(); }
+        /* 扩展到能容纳[minKey, maxKey]，超过maxBins时按collapseLowest调整范围，返回实际的范围 */
+        void extend(int32_t* minKey, int32_t* maxKey, size_t maxBins, bool collapseLowest);
+    };
+
+    int32_t getKey(double magnitude) const;
+    /* 第key个bin的代表值，到bin两端的相对误差相同 */
+    double getValue(int32_t key) const;
+
+    double mRelativeAccuracy;
+    size_t mMaxBins;
+    double mGamma;
+    double mMultiplier;
+    Store mPositive;
+    // 按绝对值计算下标，合并下标最大的一端，即数值最小的负数
+    Store mNegative;
+    uint64_t mZeroCount = 0;
+    uint64_t mCount = 0;
+    ValueType mSum = ValueType();
+    ValueType mMin = ValueType();
+    ValueType mMax = ValueType();
+};
+
+#include "DDSketch-inl.h"
+
+#endif //PERFORMANCE_DDSKETCH_H
@@ -0,0 +1,116 @@
+/**
+ * Copyright (c) 2018 Duobei Brothers Information Technology Co.,Ltd. All rights reserved.
+ *
+ * Author: haosheng (sheng.hao@duobei.com)
+ *
+ * Date: 2021/10/18
+ *
+ */
+
+#ifndef PERFORMANCE_DECAYINGRATE_H
+#define PERFORMANCE_DECAYINGRATE_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+
+/*
+ * 指数衰减的qps、rate和平均值估计，与Unix load average的算法相同。
+ *
+ * 采样点先累加到两个原子变量中，每隔一个tick（默认5秒）由某一个写入方或读取方把这个tick
+ * 内的count和sum折算进每个窗口的指数加权移动平均（EWMA）：
+ *
+ *   rate = rate + (1 - exp(-tick / window)) * (本tick的瞬时值 - rate)
+ *
+ * 窗口默认为1、5、15分钟。写入是两次原子加法，读取是一次原子读，都是O(1)，不需要锁，
+ * 可以在每个请求上调用，例如用于过载保护。代价是结果只更新到最近一个完整的tick，并且是
+ * 近似值：窗口之前的数据按指数衰减而不是直接丢弃。需要准确窗口统计时使用TimeseriesHistogram。
+ *
+ * 与其他时间序列一样，查询之前应先调用update(now)，否则长时间没有写入时读到的是衰减之前的值。
+ *
+ * 除了EWMA本身，还有两处有界的误差：
+ * - tick边界上的采样点可能被算进相邻的tick。折算线程推进mLastTick之后才取走未折算的数据，
+ *   在这之间已经属于新tick的写入方会被算进上一个tick；count和sum分别取走，一个采样点的
+ *   count和sum也可能分属两个tick。受影响的只是边界上几条指令之间的写入，总数不会丢失。
+ * - 第一个tick从第一个采样点开始，只有部分时间。它的数据与下一个tick合并，按第一个采样点
+ *   以来实际经过的时间折算为第一次的瞬时值，所以第一次折算在第一个采样点的一到两个tick之后。
+ */
+class DecayingRate {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Duration = Clock::duration;
+    using TimePoint = Clock::time_point;
+
+    static constexpr size_t kMaxWindows = 4;
+
+    /*
+     * @param windows 每个EWMA的时间常数，最多kMaxWindows个，超出的被忽略
+     * @param tick    折算的间隔，越短结果越及时，折算的次数也越多
+     */
+    explicit DecayingRate(
+        std::initializer_list<Duration> windows = { std::chrono::minutes(1), std::chrono::minutes(5),
+            std::chrono::minutes(15) },
+        Duration tick = std::chrono::seconds(5));
+
+    DecayingRate(const DecayingRate&) = delete;
+    DecayingRate& operator=(const DecayingRate&) = delete;
+
+    void addValue(TimePoint now, double value) { addValue(now, value, 1); }
+    /* 添加count个时间now处的值value，可以在多个线程中同时调用 */
+    void addValue(TimePoint now, double value, uint64_t count);
+
+    /* 折算now之前已经结束的tick，还没有采样点时什么都不做 */
+    void update(TimePoint now) { tickIfNecessary(now); }
+
+    size_t numWindows() const { return mNumWindows; }
+
+    Duration getWindow(size_t window) const { return mWindows[window].duration; }
+
+    /* count per second */
+    double qps(size_t window) const { return mWindows[window].countRate.load(std::memory_order_relaxed); }
+
+    /* sum per second */
+    double rate(size_t window) const { return mWindows[window].sumRate.load(std::memory_order_relaxed); }
+
+    /* 按count加权、指数衰减的平均值，没有数据时返回0 */
+    double avg(size_t window) const
+    {
+        double count = qps(window);
+        return count > 0 ? rate(window) / count : 0.0;
+    }
+
+private:
+    struct Window {
+        Duration duration { 0 };
+        // 每个tick的衰减系数 exp(-tick / duration)
+        double decay = 0;
+        std::atomic<double> countRate { 0 };
+        std::atomic<double> sumRate { 0 };
+    };
+
+    // mLastTick的初始值，表示还没有采样点
+    static constexpr int64_t kNotStarted = INT64_MIN;
+
+    /* 第一个采样点开始计时 */
+    void start(TimePoint now);
+    void tickIfNecessary(TimePoint now);
+
+    std::array<Window, kMaxWindows> mWindows;
+    size_t mNumWindows = 0;
+    Duration mTick;
+    double mTickSeconds;
+    // 最近一次折算时的tick序号，即时间 / mTick
+    std::atomic<int64_t> mLastTick { kNotStarted };
+    // 第一次折算时直接使用瞬时值，避免从0开始的长时间预热
+    std::atomic<bool> mInitialized { false };
+    // 第一个采样点的时间，第一次折算时用于计算实际经过的时间
+    std::atomic<Duration::rep> mFirstSample { 0 };
+    // 当前tick内还没有折算的数据
+    std::atomic<uint64_t> mUncountedCount { 0 };
+    std::atomic<double> mUncountedSum { 0 };
+};
+
+#endif //PERFORMANCE_DECAYINGRATE_H
@@ -0,0 +1,99 @@
+/**
+ * Copyright (c) 2018 Duobei Brothers Information Technology Co.,Ltd. All rights reserved.
+ *
+ * Author: haosheng (sheng.hao@duobei.com)
+ *
+ * Date: 2021/10/19
+ *
+ */
+
+#ifndef PERFORMANCE_EXEMPLARRESERVOIR_H
+#define PERFORMANCE_EXEMPLARRESERVOIR_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+/* 一个样例：采样点的值、采样时间和调用方附带的上下文（请求id、trace id等） */
+struct Exemplar {
+    // 上下文的最大长度，超出的部分被截断
+    static constexpr size_t kMaxPayload = 48;
+
+    double value;
+    // 自1970-01-01以来的毫秒数
+    uint64_t timestamp;
+    uint32_t payloadLength;
+    char payload[kMaxPayload];
+
+    std::string_view payloadView() const { return std::string_view(payload, payloadLength); }
+};
+
+/*
+ * ExemplarReservoir 保存一个metric中值最大的N个采样点及其上下文，用于定位百分位数升高时
+ * 是哪些请求造成的。
+ *
+ * 每个写入线程有自己的分片：一个最多N个元素的小顶堆，以及它的门槛（堆满时为堆顶的值，
+ * 否则为-inf）。写入时先与本线程的门槛比较，大部分采样点在这里就被丢弃，热路径只有一次
+ * thread_local查找和一次比较；超过门槛时才锁住本线程的分片，只会与collect()竞争。
+ *
+ * collect()在生成报告时取走所有分片中的样例，与上一次的结果合并，丢弃时间窗口之外的，
+ * 只保留最大的N个。窗口内被挤出的较小样例不会在较大的过期之后恢复，所以结果是窗口内
+ * 最大的N个的近似。
+ */
+class ExemplarReservoir {
+public:
+    explicit ExemplarReservoir(size_t capacity);
+    ~ExemplarReservoir();
+
+    ExemplarReservoir(const ExemplarReservoir&) = delete;
+    ExemplarReservoir& operator=(const ExemplarReservoir&) = delete;
+
+    size_t capacity() const { return mCapacity; }
+
+    /* 加入一个采样点，payload超过Exemplar::kMaxPayload时被截断，可以在多个线程中同时调用 */
+    void add(double value, std::string_view payload)
+    {
+        Shard& shard = localShard();
+        if (value > shard.threshold.load(std::memory_order_relaxed)) {
+            insert(shard, value, payload);
+        }
+    }
+
+    /*
+     * 取走所有线程分片中的样例并与之前的结果合并，丢弃时间早于minTimestamp（毫秒）的样例。
+     *
+     * 返回值按value从大到小排列，在下一次collect()之前有效。同一时刻只能有一个线程调用。
+     */
+    const std::vector<Exemplar>& collect(uint64_t minTimestamp);
+
+    /* 占用的堆内存字节数，不包括对象本身 */
+    size_t memoryUsage() const;
+
+private:
+    struct Shard {
+        std::atomic<double> threshold { -std::numeric_limits<double>::infinity() };
+        std::mutex lock;
+        // 按value的小顶堆
+        std::vector<Exemplar> heap;
+    };
+
+    /* 当前线程的分片，第一次调用时创建 */
+    Shard& localShard();
+    void insert(Shard& shard, double value, std::string_view payload);
+
+    size_t mCapacity;
+    // 区分不同的reservoir，线程缓存按它查找分片，不会重复使用；销毁之后线程缓存中
+    // 对应的项在缓存变大时被清理
+    uint64_t mId;
+    mutable std::mutex mShardsLock;
+    // 分片由reservoir持有，线程退出之后仍然可以被collect()读取
+    std::vector<std::unique_ptr<Shard>> mShards;
+    std::vector<Exemplar> mCollected;
+};
+
+#endif //PERFORMANCE_EXEMPLARRESERVOIR_H
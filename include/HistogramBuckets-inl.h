@@ -5,8 +5,11 @@
 #ifndef PERFORMANCE_HISTOGRAMBUCKETS_INL_H
 #define PERFORMANCE_HISTOGRAMBUCKETS_INL_H
 
-template <typename T>
-HistogramBuckets<T>::HistogramBuckets(
+#include <algorithm>
+#include <cmath>
+
+template <typename T, typename BucketT>
+HistogramBuckets<T, BucketT>::HistogramBuckets(
     ValueType bucketSize,
     ValueType min,
     ValueType max,
@@ -24,8 +27,8 @@ HistogramBuckets<T>::HistogramBuckets(
     mBuckets.assign(size_t(numBuckets), defaultBucket);
 }
 
-template <typename T>
-size_t HistogramBuckets<T>::getBucketIdx(ValueType value) const
+template <typename T, typename BucketT>
+size_t HistogramBuckets<T, BucketT>::getBucketIdx(ValueType value) const
 {
     if (value < mMin) {
         return 0;
@@ -37,9 +40,9 @@ size_t HistogramBuckets<T>::getBucketIdx(ValueType value) const
     }
 }
 
-template <typename T>
+template <typename T, typename BucketT>
 template <typename CountFn>
-uint64_t HistogramBuckets<T>::computeTotalCount(
+uint64_t HistogramBuckets<T, BucketT>::computeTotalCount(
     CountFn countFromBucket) const
 {
     uint64_t count = 0;
@@ -49,9 +52,9 @@ uint64_t HistogramBuckets<T>::computeTotalCount(
     return count;
 }
 
-template <typename T>
+template <typename T, typename BucketT>
 template <typename CountFn>
-size_t HistogramBuckets<T>::getPercentileBucketIdx(
+size_t HistogramBuckets<T, BucketT>::getPercentileBucketIdx(
     double pct,
     CountFn countFromBucket,
     double* lowPct,
@@ -60,16 +63,24 @@ size_t HistogramBuckets<T>::getPercentileBucketIdx(
 
     auto numBuckets = mBuckets.size();
 
-    // 计算出每个bucket中数据的count
-    std::vector<uint64_t> counts(numBuckets);
-    uint64_t totalCount = 0;
+    // 把每个bucket中数据的count收集到当前线程复用的对齐数组中
+    uint64_t* counts = CountBuffer::local().reserve(numBuckets);
     for (size_t n = 0; n < numBuckets; ++n) {
-        uint64_t bucketCount =
-            countFromBucket(const_cast<const BucketType&>(mBuckets[n]));
-        counts[n] = bucketCount;
-        totalCount += bucketCount;
+        counts[n] = countFromBucket(const_cast<const BucketType&>(mBuckets[n]));
     }
+    uint64_t totalCount = CountScan::sum(counts, numBuckets);
+
+    return getPercentileBucketIdxFromCounts(pct, counts, totalCount, lowPct, highPct);
+}
 
+template <typename T, typename BucketT>
+size_t HistogramBuckets<T, BucketT>::getPercentileBucketIdxFromCounts(
+    double pct,
+    const uint64_t* counts,
+    uint64_t totalCount,
+    double* lowPct,
+    double* highPct) const
+{
     // 如果所有bucket都没有数据，返回最小的bucket下标即可。
     if (totalCount == 0) {
         // lowPct和highPct设为0，代表bucket中没有数据。
@@ -82,45 +93,60 @@ size_t HistogramBuckets<T>::getPercentileBucketIdx(
         return 1;
     }
 
-    // 循环遍历每个bucket, 同时跟踪每个bucket所占的count的范围，例如[0,10%],[10%,17%]
-    // 这样，如果遍历到一个范围包含了我们给定的pct，返回这个bucket下标即可。
-    double prevPct = 0.0;
-    double curPct = 0.0;
-    uint64_t curCount = 0;
-    size_t idx;
-    for (idx = 0; idx < numBuckets; ++idx) {
-        if (counts[idx] == 0) {
-            continue;
+    // 每个bucket所占的count的范围是[countBefore, countBefore + count]，例如[0,10%],[10%,17%]。
+    // 我们要找第一个右边界比pct大的bucket，也就是第一个累加count达到threshold的bucket，
+    // threshold是满足 pct <= threshold / totalCount 的最小整数。
+    uint64_t threshold = 1;
+    if (pct > 0.0) {
+        double estimate = std::ceil(pct * static_cast<double>(totalCount));
+        threshold = estimate > static_cast<double>(totalCount) ? totalCount : uint64_t(std::max(estimate, 1.0));
+        // 修正浮点误差，保证与逐个bucket比较百分比的结果一致
+        while (threshold > 1 && pct <= static_cast<double>(threshold - 1) / totalCount) {
+            --threshold;
         }
-
-        prevPct = curPct;
-        curCount += counts[idx];
-        curPct = static_cast<double>(curCount) / totalCount;
-        if (pct <= curPct) {
-            // 找到第一个右边界比pct大的bucket
-            break;
+        while (threshold < totalCount && pct > static_cast<double>(threshold) / totalCount) {
+            ++threshold;
         }
     }
 
+    uint64_t countBefore = 0;
+    size_t idx = CountScan::lowerBound(counts, mBuckets.size(), threshold, &countBefore);
+
     if (lowPct) {
-        *lowPct = prevPct;
+        *lowPct = static_cast<double>(countBefore) / totalCount;
     }
     if (highPct) {
-        *highPct = curPct;
+        *highPct = static_cast<double>(countBefore + counts[idx]) / totalCount;
     }
     return idx;
 }
 
-template <typename T>
+template <typename T, typename BucketT>
 template <typename CountFn, typename AvgFn>
-T HistogramBuckets<T>::getPercentileEstimate(
+T HistogramBuckets<T, BucketT>::getPercentileEstimate(
     double pct, CountFn countFromBucket, AvgFn avgFromBucket) const
+{
+    auto numBuckets = mBuckets.size();
+
+    uint64_t* counts = CountBuffer::local().reserve(numBuckets);
+    for (size_t n = 0; n < numBuckets; ++n) {
+        counts[n] = countFromBucket(const_cast<const BucketType&>(mBuckets[n]));
+    }
+    uint64_t totalCount = CountScan::sum(counts, numBuckets);
+
+    return getPercentileEstimateFromCounts(pct, counts, totalCount, avgFromBucket);
+}
+
+template <typename T, typename BucketT>
+template <typename AvgFn>
+T HistogramBuckets<T, BucketT>::getPercentileEstimateFromCounts(
+    double pct, const uint64_t* counts, uint64_t totalCount, AvgFn avgFromBucket) const
 {
     // 先找到给定pct落入的bucket
     double lowPct;
     double highPct;
     size_t bucketIdx =
-        getPercentileBucketIdx(pct, countFromBucket, &lowPct, &highPct);
+        getPercentileBucketIdxFromCounts(pct, counts, totalCount, &lowPct, &highPct);
     if (lowPct == 0.0 && highPct == 0.0) {
         return ValueType();
     }
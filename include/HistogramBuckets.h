@@ -10,19 +10,25 @@
 #ifndef PERFORMANCE_HISTOGRAMBUCKETS_H
 #define PERFORMANCE_HISTOGRAMBUCKETS_H
 
+#include <limits>
+
+#include "CountScan.h"
 #include "MultiLevelTimeSeries.h"
 
 /*
  * TimeSeriesHistogram的帮助类
+ *
+ * 每个bucket默认是一个MultiLevelTimeSeries<T>；HistogramSnapshot使用Bucket<T>，
+ * 只保存某个时间窗口内的count和sum。
  */
-template <typename T>
+template <typename T, typename BucketT = MultiLevelTimeSeries<T>>
 class HistogramBuckets {
 public:
     using ValueType = T;
-    using BucketType = MultiLevelTimeSeries<ValueType>;
+    using BucketType = BucketT;
 
     /*
-     * 创建一组直方图buckets的集合。BucketType的类型为MultiLevelTimeSeries<T>
+     * 创建一组直方图buckets的集合，每个bucket都是defaultBucket的拷贝
      *
      * 为每个间隔创建一个bucket，一个bucket存储bucketSize范围大小的数据。
      * 此外，将创建一个bucket来跟踪 < min 的所有值，以及一个bucket跟踪 > max 的所有值。
@@ -51,6 +57,9 @@ public:
      */
     size_t getNumBuckets() const { return mBuckets.size(); }
 
+    /* bucket数组占用的堆内存字节数，不包括bucket自己在堆上分配的内存 */
+    size_t memoryUsage() const { return mBuckets.capacity() * sizeof(BucketType); }
+
     /* 返回给定的value值落入的bucket下标 */
     size_t getBucketIdx(ValueType value) const;
 
@@ -136,6 +145,21 @@ public:
         double* lowPct = nullptr,
         double* highPct = nullptr) const;
 
+    /*
+     * 与getPercentileBucketIdx()相同，但直接使用已经收集好的每个bucket的count。
+     *
+     * 需要对同一组数据计算多个百分位数时，只收集一次count即可。
+     *
+     * @param counts     每个bucket中数据的count，必须来自CountBuffer::reserve()
+     * @param totalCount counts的总和
+     */
+    size_t getPercentileBucketIdxFromCounts(
+        double pct,
+        const uint64_t* counts,
+        uint64_t totalCount,
+        double* lowPct = nullptr,
+        double* highPct = nullptr) const;
+
     /*
      * 计算给定percent的数据的value是多少。
      *
@@ -155,6 +179,13 @@ public:
     ValueType getPercentileEstimate(
         double pct, CountFn countFromBucket, AvgFn avgFromBucket) const;
 
+    /*
+     * 与getPercentileEstimate()相同，但直接使用已经收集好的每个bucket的count。
+     */
+    template <typename AvgFn>
+    ValueType getPercentileEstimateFromCounts(
+        double pct, const uint64_t* counts, uint64_t totalCount, AvgFn avgFromBucket) const;
+
     /*
      * buckets的迭代器
      *
@@ -0,0 +1,233 @@
+//
+// Created by haosheng on 2021/10/12.
+//
+
+#ifndef PERFORMANCE_HISTOGRAMSNAPSHOT_INL_H
+#define PERFORMANCE_HISTOGRAMSNAPSHOT_INL_H
+
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+
+template <typename T>
+void HistogramSnapshot<T>::reset(ValueType bucketSize, ValueType min, ValueType max)
+{
+    mBucketSize = bucketSize;
+    mMin = min;
+    mMax = max;
+    mNumBuckets = Buckets(bucketSize, min, max, BucketType()).getNumBuckets();
+    mWindows.clear();
+}
+
+template <typename T>
+void HistogramSnapshot<T>::clear()
+{
+    for (Window& window : mWindows) {
+        window.total.clearBucket();
+        for (BucketType& bucket : window.buckets) {
+            bucket.clearBucket();
+        }
+    }
+}
+
+template <typename T>
+size_t HistogramSnapshot<T>::addWindow(Duration window, Duration elapsed)
+{
+    mWindows.push_back(Window { window, elapsed, BucketType(),
+        Buckets(mBucketSize, mMin, mMax, BucketType()) });
+    return mWindows.size() - 1;
+}
+
+template <typename T>
+void HistogramSnapshot<T>::addBucket(size_t window, size_t bucketIdx, const ValueType& sum, uint64_t count)
+{
+    Window& w = mWindows[window];
+    w.buckets.getByIndex(bucketIdx).addValueAggregated(sum, count);
+    w.total.addValueAggregated(sum, count);
+}
+
+template <typename T>
+T HistogramSnapshot<T>::getPercentileEstimate(double pct, size_t window) const
+{
+    return mWindows[window].buckets.getPercentileEstimate(
+        pct / 100.0,
+        [](const BucketType& bucket) { return bucket.mCount; },
+        [](const BucketType& bucket) { return ValueType(bucket.avg()); });
+}
+
+template <typename T>
+bool HistogramSnapshot<T>::isMergeable(const HistogramSnapshot& other) const
+{
+    if (mNumBuckets == 0 || other.mNumBuckets == 0) {
+        return true;
+    }
+    if (mBucketSize != other.mBucketSize || mMin != other.mMin || mMax != other.mMax
+        || mWindows.size() != other.mWindows.size()) {
+        return false;
+    }
+    for (size_t w = 0; w < mWindows.size(); ++w) {
+        if (mWindows[w].window != other.mWindows[w].window) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename T>
+HistogramSnapshot<T>& HistogramSnapshot<T>::operator+=(const HistogramSnapshot& other)
+{
+    if (other.mNumBuckets == 0 || !isMergeable(other)) {
+        return *this;
+    }
+    if (mNumBuckets == 0) {
+        *this = other;
+        return *this;
+    }
+    for (size_t w = 0; w < mWindows.size(); ++w) {
+        Window& window = mWindows[w];
+        const Window& from = other.mWindows[w];
+        // 各个进程的窗口是同一段时间，所以elapsed不相加
+        window.elapsed = std::max(window.elapsed, from.elapsed);
+        window.total += from.total;
+        for (size_t b = 0; b < mNumBuckets; ++b) {
+            window.buckets.getByIndex(b) += from.buckets.getByIndex(b);
+        }
+    }
+    return *this;
+}
+
+template <typename T>
+void HistogramSnapshot<T>::serialize(ReportBuffer& out) const
+{
+    out.append(std::string_view(kMagic, sizeof(kMagic)));
+    appendVarint(out, kVersion);
+    appendVarint(out, mWindows.size());
+    appendDouble(out, double(mBucketSize));
+    appendDouble(out, double(mMin));
+    appendDouble(out, double(mMax));
+    for (const Window& window : mWindows) {
+        appendVarint(out, uint64_t(std::max<Duration::rep>(window.window.count(), 0)));
+        appendVarint(out, uint64_t(std::max<Duration::rep>(window.elapsed.count(), 0)));
+        uint64_t nonEmpty = 0;
+        for (const BucketType& bucket : window.buckets) {
+            nonEmpty += bucket.mCount != 0 ? 1 : 0;
+        }
+        appendVarint(out, nonEmpty);
+        size_t last = 0;
+        for (size_t b = 0; b < mNumBuckets; ++b) {
+            const BucketType& bucket = window.buckets.getByIndex(b);
+            if (bucket.mCount == 0) {
+                continue;
+            }
+            appendVarint(out, b - last);
+            appendVarint(out, bucket.mCount);
+            appendDouble(out, double(bucket.mSum));
+            last = b;
+        }
+    }
+}
+
+template <typename T>
+bool HistogramSnapshot<T>::parse(const char* data, size_t size, size_t* consumed)
+{
+    const char* pos = data;
+    const char* end = data + size;
+    if (size < sizeof(kMagic) || std::memcmp(data, kMagic, sizeof(kMagic)) != 0) {
+        return false;
+    }
+    pos += sizeof(kMagic);
+
+    uint64_t version, numWindows;
+    double bucketSize, min, max;
+    if (!readVarint(pos, end, &version) || version != kVersion || !readVarint(pos, end, &numWindows)
+        || !readDouble(pos, end, &bucketSize) || !readDouble(pos, end, &min) || !readDouble(pos, end, &max)) {
+        return false;
+    }
+    if (numWindows == 0 && bucketSize == 0 && min == 0 && max == 0) {
+        // 默认构造的空快照
+        *this = HistogramSnapshot();
+        if (consumed) {
+            *consumed = size_t(pos - data);
+        }
+        return true;
+    }
+    // 取反的写法同时排除了NaN
+    if (!(bucketSize > 0) || !(max - min >= bucketSize) || (max - min) / bucketSize > kMaxBuckets) {
+        return false;
+    }
+    // 每个窗口至少占3个字节
+    if (numWindows > size_t(end - pos) / 3) {
+        return false;
+    }
+    reset(ValueType(bucketSize), ValueType(min), ValueType(max));
+
+    for (uint64_t w = 0; w < numWindows; ++w) {
+        uint64_t window, elapsed, nonEmpty;
+        if (!readVarint(pos, end, &window) || !readVarint(pos, end, &elapsed)
+            || !readVarint(pos, end, &nonEmpty) || nonEmpty > mNumBuckets) {
+            return false;
+        }
+        size_t idx = addWindow(Duration(Duration::rep(window)), Duration(Duration::rep(elapsed)));
+        uint64_t bucketIdx = 0;
+        for (uint64_t n = 0; n < nonEmpty; ++n) {
+            uint64_t delta, count;
+            double sum;
+            if (!readVarint(pos, end, &delta) || !readVarint(pos, end, &count) || !readDouble(pos, end, &sum)) {
+                return false;
+            }
+            bucketIdx += delta;
+            if (bucketIdx >= mNumBuckets || (n != 0 && delta == 0)) {
+                return false;
+            }
+            addBucket(idx, size_t(bucketIdx), ValueType(sum), count);
+        }
+    }
+    if (consumed) {
+        *consumed = size_t(pos - data);
+    }
+    return true;
+}
+
+template <typename T>
+void HistogramSnapshot<T>::appendVarint(ReportBuffer& out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out.append(char((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.append(char(value));
+}
+
+template <typename T>
+void HistogramSnapshot<T>::appendDouble(ReportBuffer& out, double value)
+{
+    out.append(std::string_view(reinterpret_cast<const char*>(&value), sizeof(value)));
+}
+
+template <typename T>
+bool HistogramSnapshot<T>::readVarint(const char*& pos, const char* end, uint64_t* value)
+{
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && pos < end; shift += 7) {
+        auto byte = uint8_t(*pos++);
+        result |= uint64_t(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename T>
+bool HistogramSnapshot<T>::readDouble(const char*& pos, const char* end, double* value)
+{
+    if (size_t(end - pos) < sizeof(double)) {
+        return false;
+    }
+    std::memcpy(value, pos, sizeof(double));
+    pos += sizeof(double);
+    return true;
+}
+
+#endif //PERFORMANCE_HISTOGRAMSNAPSHOT_INL_H
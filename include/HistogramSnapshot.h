@@ -0,0 +1,180 @@
+/**
+ * Copyright (c) 2018 Duobei Brothers Information Technology Co.,Ltd. All rights reserved.
+ *
+ * Author: haosheng (sheng.hao@duobei.com)
+ *
+ * Date: 2021/10/12
+ *
+ */
+
+#ifndef PERFORMANCE_HISTOGRAMSNAPSHOT_H
+#define PERFORMANCE_HISTOGRAMSNAPSHOT_H
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "Bucket.h"
+#include "HistogramBuckets.h"
+#include "ReportBuffer.h"
+
+/*
+ * TimeseriesHistogram在某一时刻的可合并快照。
+ *
+ * 对直方图的每个时间level保存一个窗口，窗口中是每个bucket的count和sum。多个进程（或分片）
+ * 的快照只要bucket划分和窗口相同，就可以用operator+=逐bucket相加，合并结果与把所有数据
+ * 写入同一个直方图完全一致，之后的百分位数由合并后的bucket重新估计，而不是对各自的
+ * 百分位数求平均。
+ *
+ * serialize()/parse()使用紧凑的二进制格式，只写入有数据的bucket：
+ *
+ *   magic "PMHIST\0\0"        8字节
+ *   version, numWindows       varint
+ *   bucketSize, min, max      double
+ *   每个窗口：
+ *     window, elapsed         varint，单位是纳秒
+ *     numNonEmpty             varint
+ *     每个非空bucket：与上一个非空bucket的下标之差（varint）、count（varint）、sum（double）
+ *
+ * double使用写入方机器的字节序（小端），与SnapshotFormat.h相同。
+ */
+template <typename T>
+class HistogramSnapshot {
+public:
+    using ValueType = T;
+    using BucketType = Bucket<ValueType>;
+    using Buckets = HistogramBuckets<ValueType, BucketType>;
+    using Duration = std::chrono::steady_clock::duration;
+
+    static constexpr char kMagic[8] = { 'P', 'M', 'H', 'I', 'S', 'T', '\0', '\0' };
+    static constexpr uint32_t kVersion = 1;
+    // parse()接受的最大bucket数目，防止错误的数据导致巨大的内存分配
+    static constexpr size_t kMaxBuckets = 1 << 20;
+
+    /* 空快照，可以作为合并的起点，也可以用parse()填充 */
+    HistogramSnapshot() = default;
+
+    /* 使用与TimeseriesHistogram相同的bucket划分 */
+    HistogramSnapshot(ValueType bucketSize, ValueType min, ValueType max) { reset(bucketSize, min, max); }
+
+    /* 清空所有窗口，使用新的bucket划分 */
+    void reset(ValueType bucketSize, ValueType min, ValueType max);
+
+    /* 清空所有窗口中的数据，保留bucket划分和窗口 */
+    void clear();
+
+    /*
+     * 增加一个没有数据的窗口，返回它的下标。
+     *
+     * @param window  窗口的长度，即对应level的duration
+     * @param elapsed 窗口内实际经历的时间，用于计算rate
+     */
+    size_t addWindow(Duration window, Duration elapsed);
+
+    /* 向第window个窗口的第bucketIdx个bucket加入count个总和为sum的数据 */
+    void addBucket(size_t window, size_t bucketIdx, const ValueType& sum, uint64_t count);
+
+    ValueType getBucketSize() const { return mBucketSize; }
+
+    ValueType getMin() const { return mMin; }
+
+    ValueType getMax() const { return mMax; }
+
+    size_t getNumBuckets() const { return mNumBuckets; }
+
+    size_t numWindows() const { return mWindows.size(); }
+
+    /* 占用的堆内存字节数，不包括对象本身 */
+    size_t memoryUsage() const
+    {
+        size_t bytes = mWindows.capacity() * sizeof(Window);
+        for (const Window& window : mWindows) {
+            bytes += window.buckets.memoryUsage();
+        }
+        return bytes;
+    }
+
+    Duration getWindow(size_t window) const { return mWindows[window].window; }
+
+    Duration getElapsed(size_t window) const { return mWindows[window].elapsed; }
+
+    const Buckets& getBuckets(size_t window) const { return mWindows[window].buckets; }
+
+    uint64_t count(size_t window) const { return mWindows[window].total.mCount; }
+
+    ValueType sum(size_t window) const { return mWindows[window].total.mSum; }
+
+    double avg(size_t window) const { return mWindows[window].total.avg(); }
+
+    /* sum / elapsed，单位是value per second */
+    template <typename ReturnType = double, typename Interval = std::chrono::seconds>
+    ReturnType rate(size_t window) const
+    {
+        auto elapsed = std::chrono::duration_cast<Interval>(mWindows[window].elapsed);
+        if (elapsed == Interval(0)) {
+            return ReturnType();
+        }
+        return ReturnType(sum(window) * 1.0 / elapsed.count());
+    }
+
+    /* count / elapsed，单位是count per second */
+    template <typename ReturnType = double, typename Interval = std::chrono::seconds>
+    ReturnType countRate(size_t window) const
+    {
+        auto elapsed = std::chrono::duration_cast<Interval>(mWindows[window].elapsed);
+        if (elapsed == Interval(0)) {
+            return ReturnType();
+        }
+        return ReturnType(count(window) * 1.0 / elapsed.count());
+    }
+
+    /* 与TimeseriesHistogram::getPercentileEstimate()相同，pct的范围是0-100 */
+    ValueType getPercentileEstimate(double pct, size_t window) const;
+
+    /*
+     * 能否与other合并：bucket划分相同，窗口的个数和长度一一对应。
+     * 空快照（默认构造）可以与任何快照合并。
+     */
+    bool isMergeable(const HistogramSnapshot& other) const;
+
+    /*
+     * 把other合并到当前快照：每个bucket的count和sum相加，elapsed取两者中较大的。
+     *
+     * 不能合并时当前快照保持不变，调用方应该先用isMergeable()检查。
+     */
+    HistogramSnapshot& operator+=(const HistogramSnapshot& other);
+
+    /* 把快照追加到out的末尾 */
+    void serialize(ReportBuffer& out) const;
+
+    /*
+     * 从data解析一个快照，替换当前的内容。
+     *
+     * @param consumed 不为nullptr时写入快照占用的字节数，data中可以连续存放多个快照
+     * @return 数据不完整或不合法时返回false，当前快照的内容未定义
+     */
+    bool parse(const char* data, size_t size, size_t* consumed = nullptr);
+
+private:
+    struct Window {
+        Duration window;
+        Duration elapsed;
+        BucketType total;
+        Buckets buckets;
+    };
+
+    static void appendVarint(ReportBuffer& out, uint64_t value);
+    static void appendDouble(ReportBuffer& out, double value);
+    static bool readVarint(const char*& pos, const char* end, uint64_t* value);
+    static bool readDouble(const char*& pos, const char* end, double* value);
+
+    ValueType mBucketSize = ValueType();
+    ValueType mMin = ValueType();
+    ValueType mMax = ValueType();
+    size_t mNumBuckets = 0;
+    std::vector<Window> mWindows;
+};
+
+#include "HistogramSnapshot-inl.h"
+
+#endif //PERFORMANCE_HISTOGRAMSNAPSHOT_H
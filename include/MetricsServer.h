@@ -0,0 +1,74 @@
+/**
+ * Copyright (c) 2018 Duobei Brothers Information Technology Co.,Ltd. All rights reserved.
+ *
+ * Author: haosheng (sheng.hao@duobei.com)
+ *
+ * Date: 2021/9/24
+ *
+ */
+
+#ifndef PERFORMANCE_METRICSSERVER_H
+#define PERFORMANCE_METRICSSERVER_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+/*
+ * 一个极简的HTTP/1.1服务器，在自己的线程中响应GET /metrics。
+ *
+ * 响应内容由publish()提供，服务线程只拷贝一个shared_ptr，然后在锁外发送，
+ * 所以抓取再慢也不会阻塞生成报告的线程，更不会阻塞addValue()。
+ * 每个连接只处理一个请求（Connection: close），连接按顺序处理。
+ */
+class MetricsServer {
+public:
+    MetricsServer() = default;
+    ~MetricsServer() { stop(); }
+
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+    /* 监听127.0.0.1:port并启动服务线程，port为0时由系统分配 */
+    bool listenTcp(uint16_t port);
+    /* 监听Unix domain socket并启动服务线程，path已存在时会被删除 */
+    bool listenUnix(const std::string& path);
+
+    /* 实际监听的TCP端口，未监听TCP时返回0 */
+    uint16_t port() const { return mPort; }
+
+    bool isRunning() const { return mRunning.load(std::memory_order_acquire); }
+
+    /* 替换之后请求返回的内容 */
+    void publish(std::string_view body, std::string_view contentType);
+
+    /* 停止服务线程并关闭socket */
+    void stop();
+
+private:
+    struct Content {
+        std::string body;
+        std::string contentType;
+    };
+
+    bool start(int fd);
+    void run();
+    void handle(int fd);
+
+    int mListenFd = -1;
+    // stop()通过这个pipe唤醒服务线程
+    int mWakeFd[2] = { -1, -1 };
+    uint16_t mPort = 0;
+    std::string mUnixPath;
+    std::atomic<bool> mRunning { false };
+    std::thread mThread;
+
+    std::mutex mContentLock;
+    std::shared_ptr<const Content> mContent;
+};
+
+#endif //PERFORMANCE_METRICSSERVER_H
@@ -0,0 +1,79 @@
+/**
+ * Copyright (c) 2018 Duobei Brothers Information Technology Co.,Ltd. All rights reserved.
+ *
+ * Author: haosheng (sheng.hao@duobei.com)
+ *
+ * Date: 2021/10/11
+ *
+ */
+
+#ifndef PERFORMANCE_METRICSSNAPSHOT_H
+#define PERFORMANCE_METRICSSNAPSHOT_H
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "ReportBuffer.h"
+#include "SnapshotFormat.h"
+#include "SnapshotReader.h"
+
+/*
+ * 一次定时报告的不可变副本，用于在进程内按名称查询统计结果。
+ *
+ * PerformanceMarker每个周期生成报告之后创建一个MetricsSnapshot，以shared_ptr<const>发布；
+ * 使用方拿到指针之后可以在任意线程中无锁地读取，查询的开销只是一次二分查找。
+ *
+ * 记录按metric名称（prefix_name）排序，同一个metric的多个时间窗口按窗口从短到长连续存放。
+ * 完整报告中没有出现的metric在所有窗口内都没有数据。PerformanceMarker发布的总是完整报告；
+ * 从日志等处读取的增量报告中没有出现的metric没有新采样点，统计以之前的报告为准
+ * （见PerformanceMarker::setDeltaReports()）。
+ */
+class MetricsSnapshot {
+public:
+    /* 拷贝data中的二进制snapshot，data不是有效的snapshot时返回nullptr */
+    static std::shared_ptr<const MetricsSnapshot> create(const char* data, size_t size);
+
+    MetricsSnapshot(const MetricsSnapshot&) = delete;
+    MetricsSnapshot& operator=(const MetricsSnapshot&) = delete;
+
+    /* 生成报告的时间，自1970-01-01以来的秒数 */
+    uint64_t timestamp() const { return mReader.header().timestamp; }
+
+    size_t recordCount() const { return mReader.recordCount(); }
+
+    const SnapshotRecord& record(size_t idx) const { return mReader.record(idx); }
+
+    std::string_view name(const SnapshotRecord& record) const { return mReader.name(record); }
+
+    /*
+     * 查找名为name（prefix_name）的metric在windowSeconds窗口上的记录。
+     *
+     * @param windowSeconds 为0时返回最短的窗口
+     * @return 没有这个metric或者窗口时返回nullptr
+     */
+    const SnapshotRecord* find(std::string_view name, uint32_t windowSeconds = 0) const;
+
+    /*
+     * 返回记录中百分位数pct（0-100）的估计值。
+     *
+     * 只能查询报告中保存的百分位数（见TimeseriesHistogram::kReportPercentiles），
+     * 没有保存时返回false。
+     */
+    bool percentile(const SnapshotRecord& record, double pct, double* value) const;
+
+    /* 与PerformanceMarker::getLastReport()相同格式的JSON */
+    void toJson(ReportBuffer& out) const { mReader.toJson(out); }
+
+    const SnapshotReader& reader() const { return mReader; }
+
+private:
+    MetricsSnapshot() = default;
+
+    // 按8字节对齐保存snapshot，mReader直接读取它
+    std::vector<uint64_t> mData;
+    SnapshotReader mReader;
+};
+
+#endif //PERFORMANCE_METRICSSNAPSHOT_H
@@ -5,10 +5,10 @@
 #ifndef PERFORMANCE_MULTILEVELTIMESERIES_INL_H
 #define PERFORMANCE_MULTILEVELTIMESERIES_INL_H
 
-template <typename VT>
-MultiLevelTimeSeries<VT>::MultiLevelTimeSeries(
+template <typename VT, typename Stats>
+MultiLevelTimeSeries<VT, Stats>::MultiLevelTimeSeries(
     size_t nBuckets, size_t nLevels, const Duration levelDurations[])
-    : mCachedTime(), mCachedSum(0), mCachedCount(0)
+    : mCachedTime()
 {
     mMutex = std::make_shared<std::mutex>();
     mLevels.reserve(nLevels);
@@ -17,10 +17,10 @@ MultiLevelTimeSeries<VT>::MultiLevelTimeSeries(
     }
 }
 
-template <typename VT >
-MultiLevelTimeSeries<VT>::MultiLevelTimeSeries(
+template <typename VT, typename Stats>
+MultiLevelTimeSeries<VT, Stats>::MultiLevelTimeSeries(
     size_t nBuckets, std::initializer_list<Duration> durations)
-    : mCachedTime(), mCachedSum(0), mCachedCount(0)
+    : mCachedTime()
 {
     mMutex = std::make_shared<std::mutex>();
     mLevels.reserve(durations.size());
@@ -31,23 +31,45 @@ MultiLevelTimeSeries<VT>::MultiLevelTimeSeries(
     }
 }
 
-template <typename VT >
-void MultiLevelTimeSeries<VT>::addValue(
+template <typename VT, typename Stats>
+MultiLevelTimeSeries<VT, Stats>::MultiLevelTimeSeries(
+    const std::vector<LevelConfig>& levels, bool rollup)
+    : mRollup(rollup), mCachedTime()
+{
+    mMutex = std::make_shared<std::mutex>();
+    mLevels.reserve(levels.size());
+    for (const auto& level : levels) {
+        mLevels.emplace_back(level.numBuckets, level.duration);
+    }
+}
+
+template <typename VT, typename Stats>
+void MultiLevelTimeSeries<VT, Stats>::addValue(
     TimePoint now, const ValueType& val)
 {
     addValue(now, val, 1);
 }
 
-template <typename VT >
-void MultiLevelTimeSeries<VT>::addValue(
+template <typename VT, typename Stats>
+void MultiLevelTimeSeries<VT, Stats>::addValue(
     TimePoint now, const ValueType& val, uint64_t times)
 {
-    addValueAggregated(now, val * times, times);
+    BucketType bucket;
+    bucket.addValue(val, times);
+    addBucket(now, bucket);
 }
 
-template <typename VT >
-void MultiLevelTimeSeries<VT>::addValueAggregated(
+template <typename VT, typename Stats>
+void MultiLevelTimeSeries<VT, Stats>::addValueAggregated(
     TimePoint now, const ValueType& total, uint64_t nsamples)
+{
+    BucketType bucket;
+    bucket.addValueAggregated(total, nsamples);
+    addBucket(now, bucket);
+}
+
+template <typename VT, typename Stats>
+void MultiLevelTimeSeries<VT, Stats>::addBucket(TimePoint now, const BucketType& bucket)
 {
     // 如果已经过了一段时间，需要将缓存中的数据更新到每个level中
     if (mCachedTime != now) {
@@ -56,34 +78,73 @@ void MultiLevelTimeSeries<VT>::addValueAggregated(
     }
     // 将传入的数据写入缓存
     std::lock_guard<std::mutex> guard(*mMutex);
-    mCachedSum += total;
-    mCachedCount += nsamples;
+    mCached += bucket;
 }
 
-template <typename VT>
-void MultiLevelTimeSeries<VT>::update(TimePoint now)
+template <typename VT, typename Stats>
+void MultiLevelTimeSeries<VT, Stats>::update(TimePoint now)
 {
     flush();
     for (size_t i = 0; i < mLevels.size(); ++i) {
-        mLevels[i].update(now);
+        if (mRollup) {
+            advanceLevel(i, now);
+        } else {
+            mLevels[i].update(now);
+        }
     }
 }
 
-template <typename VT >
-void MultiLevelTimeSeries<VT>::flush()
+template <typename VT, typename Stats>
+void MultiLevelTimeSeries<VT, Stats>::advanceLevel(size_t level, TimePoint now)
+{
+    // 还没有数据滚入的level不能update()，否则mFirstTime会被设为now，更早的数据无法再滚入
+    if (level > 0 && mLevels[level].isEmpty()) {
+        return;
+    }
+    if (level + 1 == mLevels.size()) {
+        mLevels[level].update(now);
+        return;
+    }
+    mLevels[level].update(now, [this, level](const BucketType& bucket, TimePoint bucketStart) {
+        rollInto(level + 1, bucketStart, bucket);
+    });
+}
+
+template <typename VT, typename Stats>
+void MultiLevelTimeSeries<VT, Stats>::rollInto(
+    size_t level, TimePoint bucketStart, const BucketType& bucket)
+{
+    // 先推进到bucketStart，这样写入不会再触发没有滚动的过期
+    advanceLevel(level, bucketStart);
+    mLevels[level].addBucket(bucketStart, bucket);
+}
+
+template <typename VT, typename Stats>
+void MultiLevelTimeSeries<VT, Stats>::flush()
 {
     std::lock_guard<std::mutex> guard(*mMutex);
-    if (mCachedCount > 0) {
-        for (size_t i = 0; i < mLevels.size(); ++i) {
-            mLevels[i].addValueAggregated(mCachedTime, mCachedSum, mCachedCount);
+    if (mCached.mCount > 0) {
+        if (mRollup) {
+            // 写入能容纳mCachedTime的最细的level，之前先推进各个level
+            for (size_t i = 0; i < mLevels.size(); ++i) {
+                advanceLevel(i, mCachedTime);
+            }
+            for (size_t i = 0; i < mLevels.size(); ++i) {
+                if (mLevels[i].addBucket(mCachedTime, mCached)) {
+                    break;
+                }
+            }
+        } else {
+            for (size_t i = 0; i < mLevels.size(); ++i) {
+                mLevels[i].addBucket(mCachedTime, mCached);
+            }
         }
-        mCachedCount = 0;
-        mCachedSum = 0;
+        mCached.clearBucket();
     }
 }
 
-template <typename VT>
-void MultiLevelTimeSeries<VT>::clear()
+template <typename VT, typename Stats>
+void MultiLevelTimeSeries<VT, Stats>::clear()
 {
     std::lock_guard<std::mutex> guard(*mMutex);
 
@@ -92,8 +153,18 @@ void MultiLevelTimeSeries<VT>::clear()
     }
 
     mCachedTime = TimePoint();
-    mCachedSum = 0;
-    mCachedCount = 0;
+    mCached.clearBucket();
+}
+
+template <typename VT, typename Stats>
+typename MultiLevelTimeSeries<VT, Stats>::BucketType
+MultiLevelTimeSeries<VT, Stats>::windowTotal(size_t level) const
+{
+    BucketType total;
+    for (size_t i = firstLevel(level); i <= level; ++i) {
+        total += mLevels[i].windowTotal();
+    }
+    return total;
 }
 
 #endif //PERFORMANCE_MULTILEVELTIMESERIES_INL_H
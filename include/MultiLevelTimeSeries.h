@@ -23,15 +23,28 @@
  * 这个类可以很容易地用于同时跟踪数个预定时间段内的数据。例如，可以使用它来同时跟踪过去5分钟、
  * 15分钟、30分钟的数据的count、sum、avg。
  *
+ * 默认每个数据都会写入所有level。开启rollup后只有level 0接收数据，level 0中的bucket过时时，
+ * 它的总和被滚入level 1，依此类推；每个level只保存比上一级更早的那部分数据，查询level i时
+ * 合并level 0..i。这样每次写入只更新一个level，更粗的level可以使用更少的bucket。
+ * 代价是滚入的数据按原bucket的起始时间落入粗level的bucket，时间精度是细level的bucket宽度。
+ *
+ * Stats是每个bucket的统计策略，见Bucket。BucketMoments的min、max和标准差由windowTotal()得到，
+ * 滚入下一个level时这些统计随bucket一起滚入。
  */
-template <typename VT>
+template <typename VT, typename Stats = BucketNoStats>
 class MultiLevelTimeSeries {
 public:
     using ValueType = VT;
     using Clock = std::chrono::steady_clock;
     using Duration = Clock::duration;
     using TimePoint = Clock::time_point;
-    using Level = BucketedTimeSeries<ValueType>;
+    using Level = BucketedTimeSeries<ValueType, Stats>;
+    using BucketType = typename Level::BucketType;
+
+    struct LevelConfig {
+        size_t numBuckets;
+        Duration duration;
+    };
 
     /*
      * 这将创建一个MultiLevelTimeSeries对象，用于跟踪数个不同duration（level）的
@@ -44,6 +57,26 @@ public:
     MultiLevelTimeSeries(
         size_t nBuckets, std::initializer_list<Duration> durations);
 
+    /*
+     * 每个level可以有不同的bucket个数，如{{60, minutes(1)}, {60, minutes(10)}, {24, hours(1)}}。
+     * rollup为true时开启level间的滚动汇总，见类注释。
+     */
+    explicit MultiLevelTimeSeries(
+        const std::vector<LevelConfig>& levels, bool rollup = false);
+
+    /* 复制other的level配置和rollup设置，不复制数据，用于创建另一种统计策略的同构对象 */
+    template <typename OtherStats>
+    explicit MultiLevelTimeSeries(const MultiLevelTimeSeries<VT, OtherStats>& other)
+        : mRollup(other.isRollup())
+        , mCachedTime()
+    {
+        mMutex = std::make_shared<std::mutex>();
+        mLevels.reserve(other.numLevels());
+        for (size_t i = 0; i < other.numLevels(); ++i) {
+            mLevels.emplace_back(other.getLevel(i).numBuckets(), other.getLevel(i).getDuration());
+        }
+    }
+
     /*
      * 将时间now处的值val添加到所有level。
      *
@@ -64,6 +97,20 @@ public:
     void addValueAggregated(
         TimePoint now, const ValueType& total, uint64_t nsamples);
 
+    /*
+     * 在所有level中，添加时间now处一批已经汇总好的数据，包括Stats记录的统计。
+     */
+    void addBucket(TimePoint now, const BucketType& bucket);
+
+    /* 见BucketedTimeSeries::backdate()，先把缓存中的数据写入各个level */
+    void backdate(TimePoint firstTime)
+    {
+        flush();
+        for (auto& level : mLevels) {
+            level.backdate(firstTime);
+        }
+    }
+
     /*
      * 将缓存中的数据写入buckets,同时丢弃过时的数据
      */
@@ -76,7 +123,14 @@ public:
      * 在获取count信息之前，应该先调用update()或者flush()，用来清除过时的数据，或者
      * 将缓存中的数据写入到每个level中。
      */
-    uint64_t count(size_t level) const { return getLevel(level).count(); }
+    uint64_t count(size_t level) const
+    {
+        uint64_t total = 0;
+        for (size_t i = firstLevel(level); i <= level; ++i) {
+            total += mLevels[i].count();
+        }
+        return total;
+    }
 
     /*
      * 返回给定level上跟踪的所有数据的sum。
@@ -85,7 +139,21 @@ public:
      * 在获取sum信息之前，应该先调用update()或者flush()，用来清除过时的数据，或者
      * 将缓存中的数据写入到每个level中。
      */
-    ValueType sum(size_t level) const { return getLevel(level).sum(); }
+    ValueType sum(size_t level) const
+    {
+        ValueType total = ValueType();
+        for (size_t i = firstLevel(level); i <= level; ++i) {
+            total += mLevels[i].sum();
+        }
+        return total;
+    }
+
+    /*
+     * 返回给定level上所有bucket的归约，BucketMoments的min、max和标准差从这里得到。
+     *
+     * 注意：与count()一样，应该先调用update()或者flush()。
+     */
+    BucketType windowTotal(size_t level) const;
 
     /*
      * 返回给定level上跟踪的所有数据的avg (即sum / count)。
@@ -94,7 +162,28 @@ public:
      * 在获取avg信息之前，应该先调用update()或者flush()，用来清除过时的数据，或者
      * 将缓存中的数据写入到每个level中。
      */
-    double avg(size_t level) const { return getLevel(level).avg(); }
+    double avg(size_t level) const
+    {
+        if (!mRollup) {
+            return getLevel(level).avg();
+        }
+        uint64_t total = count(level);
+        return total == 0 ? 0.0 : double(sum(level) * 1.0 / total);
+    }
+
+    /*
+     * 返回给定level上数据经历的时间，见BucketedTimeSeries::elapsed()。
+     * 开启rollup时是level 0..i中最长的一个。
+     */
+    template <typename Interval = std::chrono::seconds>
+    Interval elapsed(size_t level) const
+    {
+        Interval result(0);
+        for (size_t i = firstLevel(level); i <= level; ++i) {
+            result = std::max(result, mLevels[i].template elapsed<Interval>());
+        }
+        return result;
+    }
 
     /*
      * 返回给定level上跟踪的所有数据的rate (即sum / elapsed time)。
@@ -106,7 +195,7 @@ public:
     template <typename ReturnType = double, typename Interval = std::chrono::seconds>
     ReturnType rate(size_t level) const
     {
-        return getLevel(level).template rate<ReturnType, Interval>();
+        return ReturnType(sum(level) * 1.0 / elapsed<Interval>(level).count());
     }
 
     /*
@@ -119,67 +208,117 @@ public:
     template <typename ReturnType = double, typename Interval = std::chrono::seconds>
     ReturnType countRate(size_t level) const
     {
-        return getLevel(level).template countRate<ReturnType, Interval>();
+        return ReturnType(count(level) * 1.0 / elapsed<Interval>(level).count());
     }
 
     uint64_t count(Duration duration) const
     {
-        return getLevelByDuration(duration).count();
+        return count(getLevelIndex(duration));
     }
 
     ValueType sum(Duration duration) const
     {
-        return getLevelByDuration(duration).sum();
+        return sum(getLevelIndex(duration));
     }
 
     double avg(Duration duration) const
     {
-        return getLevelByDuration(duration).avg();
+        return avg(getLevelIndex(duration));
     }
 
     template <typename ReturnType = double, typename Interval = std::chrono::seconds>
     ReturnType rate(Duration duration) const
     {
-        return getLevelByDuration(duration).template rate<ReturnType, Interval>();
+        return rate<ReturnType, Interval>(getLevelIndex(duration));
     }
 
     template <typename ReturnType = double, typename Interval = std::chrono::seconds>
     ReturnType countRate(Duration duration) const
     {
-        return getLevelByDuration(duration)
-            .template countRate<ReturnType, Interval>();
+        return countRate<ReturnType, Interval>(getLevelIndex(duration));
     }
 
+    /*
+     * [start,end)区间上的查询使用能覆盖start的最细的level；开启rollup时
+     * 各level保存的数据互不重叠，结果是所有level之和。
+     */
     uint64_t count(TimePoint start, TimePoint end) const
     {
-        return getLevel(start).count(start, end);
+        if (!mRollup) {
+            return getLevel(start).count(start, end);
+        }
+        uint64_t total = 0;
+        for (const Level& level : mLevels) {
+            total += level.count(start, end);
+        }
+        return total;
     }
 
     ValueType sum(TimePoint start, TimePoint end) const
     {
-        return getLevel(start).sum(start, end);
+        if (!mRollup) {
+            return getLevel(start).sum(start, end);
+        }
+        ValueType total = ValueType();
+        for (const Level& level : mLevels) {
+            total += level.sum(start, end);
+        }
+        return total;
     }
 
     double avg(TimePoint start, TimePoint end) const
     {
-        return getLevel(start).avg(start, end);
+        if (!mRollup) {
+            return getLevel(start).avg(start, end);
+        }
+        uint64_t total = count(start, end);
+        return total == 0 ? 0.0 : double(sum(start, end) * 1.0 / total);
+    }
+
+    template <typename Interval = std::chrono::seconds>
+    Interval elapsed(TimePoint start, TimePoint end) const
+    {
+        if (!mRollup) {
+            return getLevel(start).template elapsed<Interval>(start, end);
+        }
+        Interval result(0);
+        for (const Level& level : mLevels) {
+            result = std::max(result, level.template elapsed<Interval>(start, end));
+        }
+        return result;
     }
 
     template <typename ReturnType = double, typename Interval = std::chrono::seconds>
     ReturnType rate(TimePoint start, TimePoint end) const
     {
-        return getLevel(start).template rate<ReturnType, Interval>(start, end);
+        if (!mRollup) {
+            return getLevel(start).template rate<ReturnType, Interval>(start, end);
+        }
+        return ReturnType(sum(start, end) * 1.0 / elapsed<Interval>(start, end).count());
     }
 
     size_t numBuckets() const { return mLevels[0].numBuckets();}
 
     size_t numLevels() const { return mLevels.size(); }
 
+    /* 注意：开启rollup时每个level只保存它自己那一部分数据 */
     const Level& getLevel(size_t level) const { return mLevels[level]; }
 
+    bool isRollup() const { return mRollup; }
+
+    /* 占用的堆内存字节数，不包括对象本身 */
+    size_t memoryUsage() const
+    {
+        size_t bytes = mLevels.capacity() * sizeof(Level);
+        for (const Level& level : mLevels) {
+            bytes += level.memoryUsage();
+        }
+        return bytes;
+    }
+
     const Level& getLevel(TimePoint start) const
     {
-        for (Level & level : mLevels) {
+        for (const Level& level : mLevels) {
             if (level.getLatestTime() - level.getDuration() <= start) {
                 return level;
             }
@@ -189,28 +328,54 @@ public:
 
     const Level& getLevelByDuration(Duration duration) const
     {
-        for (const auto& level : mLevels) {
-            if (level.getDuration() == duration) {
-                return level;
+        return mLevels[getLevelIndex(duration)];
+    }
+
+    /* 返回duration对应的level，没有时返回最后一个level */
+    size_t getLevelIndex(Duration duration) const
+    {
+        for (size_t i = 0; i < mLevels.size(); ++i) {
+            if (mLevels[i].getDuration() == duration) {
+                return i;
             }
         }
+        return mLevels.size() - 1;
     }
 
     void clear();
 
+    /*
+     * 为每个level建立区间查询索引，参见BucketedTimeSeries::enableRangeIndex()。
+     *
+     * TimeseriesHistogram会复制传入的MultiLevelTimeSeries，在构造前调用即可对所有bucket生效。
+     */
+    void enableRangeIndex()
+    {
+        for (auto& level : mLevels) {
+            level.enableRangeIndex();
+        }
+    }
+
     /*
      * 将缓存中的数据写入buckets
      */
     void flush();
 
 private:
+    size_t firstLevel(size_t level) const { return mRollup ? 0 : level; }
+
+    /* 把level推进到now，过时的bucket滚入下一个level */
+    void advanceLevel(size_t level, TimePoint now);
+    /* 把更细的level中过时的bucket写入level */
+    void rollInto(size_t level, TimePoint bucketStart, const BucketType& bucket);
+
     std::vector<Level> mLevels;
     std::shared_ptr<std::mutex> mMutex;
+    bool mRollup = false;
 
     // 缓存中存储同样时间的数据，当新时间的数据到来或者调用flush()时，缓存会被清空
     TimePoint mCachedTime;
-    ValueType mCachedSum;
-    uint64_t mCachedCount;
+    BucketType mCached;
 };
 
 #include "MultiLevelTimeSeries-inl.h"
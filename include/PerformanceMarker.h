@@ -10,22 +10,62 @@
 #ifndef PERFORMANCE_PERFORMANCEMARKER_H
 #define PERFORMANCE_PERFORMANCEMARKER_H
 
+#include <atomic>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <map>
 #include <mutex>
+#include <shared_mutex>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
+#include "AggregatorFrame.h"
+#include "DecayingRate.h"
+#include "ExemplarReservoir.h"
 #include "Defer.h"
+#include "HistogramSnapshot.h"
+#include "MetricsSnapshot.h"
+#include "PrometheusWriter.h"
+#include "ReportBuffer.h"
+#include "SnapshotWriter.h"
+#include "SpaceSaving.h"
 #include "TimeseriesHistogram.h"
+#include "WorkerPool.h"
+#include "WriterReaderPhaser.h"
 #include "cpptime.h"
+#include "log/AsyncLogging.h"
 #include "log/Logger.h"
 #include "log/LogFile.h"
 
+// 以下类型的实现在src/posix中，只在UNIX上编译
+#ifndef _WIN32
+#include <sys/types.h>
+
+#include "AggregatorClient.h"
+#include "MetricsServer.h"
+#include "SharedMetricTable.h"
+#include "SharedSnapshot.h"
+#include "StatsdServer.h"
+#endif
+
 class PerformanceMarker {
 public:
+    using Snapshot = MetricsSnapshot;
+
+    /* 定时报告写入日志文件的格式，见setJournal() */
+    enum class ReportFormat {
+        // 每个周期追加一行JSON（SnapshotReader::toJsonLine()）到 .jsonl 文件
+        Json,
+        // 每个周期追加一个snapshot到 .snap 文件，格式见SnapshotFormat.h，snapshot首尾相接
+        Binary,
+        // 不写文件，例如只通过共享内存发布报告
+        None
+    };
+
     static PerformanceMarker& getInstance();
 
     /*
@@ -35,26 +75,467 @@ public:
      */
     static void initialize(const std::string& prefix, uint32_t intervalSeconds);
 
+    /*
+     * 设置报告中的时间窗口，单位为秒，如{10, 60, 600, 3600}，需要在第一次addValue()之前调用。
+     *
+     * 每个报告都包含所有窗口的统计，JSON中每个窗口以"<秒数>s"为key；Prometheus只输出
+     * 最短的窗口。默认只有一个等于报告周期的窗口。窗口不能短于报告周期：暂存的采样点每个
+     * 周期才写入直方图一次，更短的窗口会把整个周期的数据都算在窗口内。
+     *
+     * 多个窗口使用MultiLevelTimeSeries的rollup：采样点只写入最短的窗口，过时的bucket
+     * 滚入更长的窗口，所以增加窗口几乎不增加addValue()的开销。
+     *
+     * @return 已经创建了metric，或者有窗口短于报告周期时返回false，窗口保持不变；
+     *         在initialize()之前设置的短于报告周期的窗口由initialize()去掉
+     */
+    static bool setReportWindows(const std::vector<uint32_t>& windowSeconds);
+
+    /*
+     * 设置生成定时报告的后台线程数，需要在initialize()之前调用。
+     *
+     * 为0时（默认）在定时器线程中生成报告。大于0时metric按名称顺序分为若干段，由固定大小的
+     * 线程池和定时器线程并行生成，每段写入自己的缓冲区，最后按顺序拼接，报告内容与单线程相同。
+     * 适用于metric很多（上万个）、单线程生成报告会阻塞定时器的场景。
+     */
+    static void setReportThreads(uint32_t threads) { mReportThreads = threads; }
+
+    /* 设置定时报告的格式，默认为JSON。二进制报告可以用SnapshotToJson转换为JSON */
+    static void setReportFormat(ReportFormat format) { mFormat = format; }
+
+    /*
+     * 设置定时报告写入的日志文件，需要在initialize()之前调用。
+     *
+     * 所有周期的报告都追加到同一个日志文件中，由AsyncLogging在后台线程写入磁盘，
+     * 定时器线程只拷贝一次报告内容。实际文件名为 fileName.%Y%m%d-%H%M%S.pid.jsonl（或.snap）。
+     *
+     * @param fileName     文件名前缀，默认为 prefix_report
+     * @param rollSize     单个文件超过多少字节时换一个新文件，默认64MB
+     * @param rollInterval 每隔多少秒换一个新文件，为0时只按大小换文件，默认一天
+     * @param maxFiles     最多保留多少个文件，更旧的文件会被删除，为0时不删除，默认7个
+     */
+    static void setJournal(const std::string& fileName, uint32_t rollSize, uint32_t rollInterval, uint32_t maxFiles);
+
+    /*
+     * 开启增量报告：定时报告只包含上次报告之后有新采样点的metric，SnapshotHeader::flags中
+     * 带有kSnapshotFlagDelta，JSON中带有"delta":true。没有新采样点的metric即使窗口内的
+     * 数据正在过时也不出现，每keyframeInterval个报告中有一个完整报告，方便读取方重新同步。
+     * keyframeInterval为0时关闭增量报告（默认）。增量只影响日志、共享内存等输出，
+     * getSnapshot()和getLastReport()仍然是包含所有metric的完整报告。
+     *
+     * 无论是否开启，没有新采样点并且上次报告时已经没有数据的metric都不会被update()和
+     * 计算百分位数；Prometheus中它们始终以空直方图出现。
+     */
+    static void setDeltaReports(uint32_t keyframeInterval) { mKeyframeInterval = keyframeInterval; }
+
+    // 有界模式下未被跟踪的名称写入的metric
+    static constexpr const char* kOtherMetric = "__other__";
+
+    /*
+     * 开启有界模式：最多为maxMetrics个名称保存独立的直方图，需要在第一次addValue()之前调用。
+     * 为0时（默认）不限制，每个新名称都创建一个metric。
+     *
+     * 适用于名称中带有用户输入（"api_" + endpoint）的场景。有空位时新名称直接创建metric；
+     * 满了之后其余名称的采样点写入名为kOtherMetric的metric，同时由SpaceSaving估计每个名称
+     * 的次数。每次生成报告时按这个估计（每个周期减半）把次数最多的maxMetrics个名称提升为
+     * 独立的metric，替换掉不再属于其中的metric，被替换的metric的历史数据被丢弃。
+     *
+     * 内存只与maxMetrics有关。已跟踪的名称的addValue()与不限制时相同，未跟踪的名称多一次
+     * 加锁的计数。
+     */
+    static void setMaxMetrics(size_t maxMetrics) { mMaxMetrics = maxMetrics; }
+
+    /*
+     * 设置metric的空闲时间：连续ttlSeconds秒没有新采样点的metric在生成报告时被移除，
+     * 释放它的直方图，之后再写入时重新创建。为0时（默认）metric不会被移除。
+     *
+     * ttlSeconds小于最长的报告窗口时，窗口内还没有过时的数据会随metric一起被丢弃。
+     * 增量报告中被移除的metric只是不再出现，读取方在下一个完整报告中才会发现。
+     * 指数衰减的metric和共享模式下的metric不会被移除。
+     */
+    static void setMetricTtl(uint32_t ttlSeconds) { mMetricTtl = std::chrono::seconds(ttlSeconds); }
+
+#ifndef _WIN32
+    /*
+     * 每个周期把二进制报告发布到名为name的POSIX共享内存中，可以用SharedSnapshotDump读取。
+     *
+     * @param capacity 报告的最大字节数，超过时这个周期的报告不会被发布
+     * @return 创建共享内存失败时返回false
+     */
+    static bool publishToSharedMemory(const std::string& name, size_t capacity = 16 * 1024 * 1024);
+
+    /*
+     * 启动内嵌的HTTP服务器，以Prometheus文本格式在GET /metrics上提供最近一个周期的统计。
+     *
+     * 报告在定时器线程中生成，服务线程只发送已生成的内容，抓取不会阻塞addValue()。
+     *
+     * @param port 监听127.0.0.1上的端口，为0时由系统分配，可以用metricsPort()获取
+     */
+    static bool serveMetrics(uint16_t port);
+    /* 同上，但监听Unix domain socket */
+    static bool serveMetrics(const std::string& unixSocketPath);
+    /* 内嵌HTTP服务器实际监听的TCP端口 */
+    static uint16_t metricsPort() { return getInstance().mMetricsServer.port(); }
+
+    /*
+     * 每个周期把新增的采样点发送给监听unixSocketPath的聚合进程（PerformanceAggregator）。
+     *
+     * 发送的是每个bucket新增的count和sum（AggregatorFrame），聚合进程把所有进程的数据
+     * 合并到自己的直方图中，得到准确的整体百分位数。发送在后台线程中进行，聚合进程
+     * 不可用时这个周期的数据被丢弃，不影响本进程的报告。
+     */
+    static bool forwardToAggregator(const std::string& unixSocketPath);
+
+    /*
+     * 开启多进程共享模式，用于pre-fork服务器，需要在initialize()之后、fork()之前调用。
+     *
+     * 之后所有进程的addValue()都写入父进程创建的匿名共享内存（SharedMetricTable），只使用
+     * 原子操作，没有进程间通信；只有父进程的定时器线程读取这些数据并生成报告，子进程中
+     * 没有定时器线程。子进程中调用getLastReport()等也不会读取共享表，共享表中的数据
+     * 只出现在父进程的报告中。
+     *
+     * @param capacity 最多容纳的metric个数，名称超过SharedMetricTable::kMaxNameLength或者
+     *                 表已满时采样点被丢弃
+     */
+    static bool enableSharedMetrics(size_t capacity = 1024);
+
+    /*
+     * 启动StatsD协议的接收线程，在127.0.0.1:port上接收UDP数据报，供脚本、sidecar等
+     * 非C++的客户端写入同样的直方图，格式见StatsdParser。
+     *
+     * 每一行是名为name的metric的一个采样点（@rate表示1/rate个），与addValue()写入
+     * 同一个metric。一批数据报中的采样点一次写入暂存区，每个metric只查找一次。
+     *
+     * @param port 为0时由系统分配，可以用statsdPort()获取
+     */
+    static bool listenStatsd(uint16_t port);
+    /* 同上，但接收Unix datagram socket */
+    static bool listenStatsd(const std::string& unixSocketPath);
+    /* StatsD接收线程实际监听的UDP端口 */
+    static uint16_t statsdPort() { return getInstance().mStatsd.port(); }
+#endif
+
     // 向内部增加一个采样点value
     void addValue(const std::string& name, double value);
     void addFloatValue(const std::string& name, float value) { addValue(name, double(value)); }
     void addIntValue(const std::string& name, int value) { addValue(name, double(value)); }
     void addInt64Value(const std::string& name, int64_t value) { addValue(name, double(value)); }
 
-    // 获取最新的报告
+    /*
+     * 为名为name的metric保存最近一个报告窗口（最短的时间窗口）内值最大的count个采样点，
+     * 每个采样点带有addValue()传入的payload，见ExemplarReservoir。重复调用不改变count。
+     *
+     * 报告中这些样例按值从大到小输出在metric的"exemplars"数组中，Prometheus格式不包含样例。
+     */
+    void enableExemplars(const std::string& name, size_t count);
+
+    /*
+     * 同addValue(name, value)，开启了样例的metric同时记录payload（请求id、trace id等），
+     * 超过Exemplar::kMaxPayload的部分被截断。没有进入前count大的采样点只多一次比较。
+     */
+    void addValue(const std::string& name, double value, std::string_view payload);
+
+    /*
+     * 返回名为name的指数衰减metric，不存在时创建一个，见DecayingRate。
+     *
+     * 读写都是O(1)并且不需要锁，适合在每个请求上估计当前的qps和延迟。返回的引用一直有效，
+     * 热路径上应该保存它，避免每次按名称查找：
+     *   static DecayingRate& requests = PerformanceMarker::getInstance().getDecayingRate("requests");
+     *   requests.addValue(std::chrono::steady_clock::now(), latency);
+     *   if (requests.qps(0) > limit) { ... }
+     *
+     * 报告中每个EWMA窗口是一条记录：qps、rate、avg是衰减后的估计，count和sum是它们乘以
+     * 窗口长度，百分位数、max和stddev为0。名称不应与addValue()的metric相同。
+     */
+    DecayingRate& getDecayingRate(const std::string& name);
+    /* 按名称查找并写入一个采样点，时间为当前时间 */
+    void addDecayingValue(const std::string& name, double value)
+    {
+        getDecayingRate(name).addValue(std::chrono::steady_clock::now(), value);
+    }
+
+    /*
+     * 把其他进程在一个周期内新增的采样点加入名为name的metric，由聚合进程调用。
+     *
+     * delta只使用第一个窗口，bucket划分与本进程的直方图不同时返回false。
+     */
+    bool addAggregated(const std::string& name, const HistogramSnapshot<double>& delta);
+
+    /*
+     * 获取最近一次定时报告的不可变副本，还没有生成过报告时返回nullptr。
+     *
+     * 只拷贝一次shared_ptr，可以高频调用，例如：
+     *   auto snapshot = PerformanceMarker::getInstance().getSnapshot();
+     *   const SnapshotRecord* record = snapshot ? snapshot->find("prefix_latency") : nullptr;
+     */
+    std::shared_ptr<const Snapshot> getSnapshot();
+
+    /*
+     * 获取最近一次定时报告的JSON格式。
+     *
+     * 还没有生成过定时报告时，立即用当前的数据生成一个。
+     */
     std::string getLastReport();
 
+    /*
+     * 估计所有metric占用的内存字节数，包括直方图、暂存区、样例以及有界模式下的SpaceSaving。
+     *
+     * perMetric不为空时写入每个metric（包括指数衰减的metric）的名称和字节数，按名称排序。
+     * 需要遍历所有metric，与生成报告互斥，不应在热路径上调用。
+     */
+    size_t memoryUsage(std::vector<std::pair<std::string, size_t>>* perMetric = nullptr);
+
 private:
+    /*
+     * 一个phase的暂存区。addValue()只把采样点按直方图的bucket累加到这里，所有字段都是
+     * 原子变量，多个线程可以同时写入同一个metric；定时器线程切换phase之后再把它写入直方图。
+     */
+    struct Staging {
+        explicit Staging(size_t numBuckets);
+
+        void add(size_t bucketIdx, double sum, uint64_t count);
+        /* count个值为value的样本，同时准确地更新min、max和平方和 */
+        void addSample(size_t bucketIdx, double value, uint64_t count);
+        /* 一批数据的min、max和平方和 */
+        void addMoments(double min, double max, double sumSquares);
+        /*
+         * 把暂存的数据在now时刻写入histogram并清空，返回写入的采样点个数。汇总的elapsed从
+         * 这一批的第一个采样点算起。forward不为空时同时累加到forward的第一个窗口中。
+         */
+        uint64_t drain(TimeseriesHistogram<double>& histogram, std::chrono::steady_clock::time_point now,
+            HistogramSnapshot<double>* forward);
+        /* 占用的堆内存字节数 */
+        size_t memoryUsage() const;
+
+        std::vector<std::atomic<uint64_t>> counts;
+        std::vector<std::atomic<double>> sums;
+        // 有数据的bucket的位图
+        std::vector<std::atomic<uint64_t>> active;
+        // 所有bucket的min、max和平方和，drain()时一次写入直方图的汇总
+        std::atomic<double> min;
+        std::atomic<double> max;
+        std::atomic<double> sumSquares { 0 };
+        std::atomic<bool> dirty { false };
+        // dirty从false变为true时的steady_clock时间，即这一批数据的第一个采样点
+        std::atomic<std::chrono::steady_clock::rep> firstWrite { 0 };
+    };
+
+    struct Metric {
+        explicit Metric(const TimeseriesHistogram<double>& histogram);
+
+        /* 包括对象本身在内占用的字节数 */
+        size_t memoryUsage() const;
+
+        // 只在持有mReportLock时访问，写入方只访问staging
+        TimeseriesHistogram<double> histogram;
+        // 由mPhaser决定写入哪一个
+        Staging staging[2];
+        // 上次定时报告之后是否有数据写入了histogram
+        bool changed = true;
+        // 上次报告时窗口内是否已经没有数据
+        bool empty = false;
+        // 最近一次从暂存区读到采样点的时间，创建时为创建时间，用于setMetricTtl()
+        std::chrono::steady_clock::time_point lastActive;
+        // 上次发送给聚合进程之后新增的数据，只在forwardToAggregator()之后使用
+        HistogramSnapshot<double> forward;
+        // enableExemplars()之后不为空，创建之后不再改变
+        std::atomic<ExemplarReservoir*> exemplars { nullptr };
+        std::unique_ptr<ExemplarReservoir> exemplarStorage;
+    };
+
+    /* 报告中的一个metric，按名称排序，decaying不为空时是指数衰减的metric */
+    struct MetricEntry {
+        const std::string* name;
+        Metric* metric;
+        DecayingRate* decaying;
+    };
+
+    /* 一段metric的报告，由一个线程生成 */
+    struct ReportPartition {
+        // 负责mMetricList中[begin, end)范围内的metric
+        size_t begin = 0;
+        size_t end = 0;
+        ReportBuffer snapshot;
+        SnapshotWriter writer;
+        // 增量报告时另外生成的完整snapshot，用于getSnapshot()和getLastReport()
+        ReportBuffer full;
+        SnapshotWriter fullWriter;
+        PrometheusWriter prometheus;
+        ReportBuffer exposition;
+    };
+
     PerformanceMarker() = default;
 
+    /* 按mWindows创建一个新metric使用的直方图 */
+    static TimeseriesHistogram<double> makeHistogram();
+    /*
+     * 查找名为name的metric，不存在时插入一个，有界模式下可能返回kOtherMetric。
+     *
+     * 有界模式下metric可能在生成报告时被移出，所以写入方需要在WriterSection之内调用，
+     * 返回的引用只在离开WriterSection之前有效。
+     */
+    Metric& getMetric(const std::string& name);
+    /* 有界模式下getMetric()没有找到name时调用 */
+    Metric& admitMetric(const std::string& name);
+    /*
+     * 在mBuckets中插入名为name的metric，已经存在时返回已有的。新插入的metric按
+     * mExemplarCounts开启样例。调用时需要独占mMetricsLock。
+     */
+    Metric& insertMetric(const std::string& name);
+    /*
+     * 把metric从mBuckets中移到mRetired，写入方可能还在使用它，下一次切换phase之后才释放。
+     * 调用时需要持有mReportLock并独占mMetricsLock。
+     */
+    void retireMetric(std::map<std::string, Metric>::iterator it);
+    /*
+     * 释放上一次移出的metric：切换之后不再有写入方使用它们，移出之后写入的数据并入同名的
+     * metric（有界模式下名称未被跟踪时并入kOtherMetric）。调用时的要求同retireMetric()。
+     */
+    void releaseRetired(size_t phase, std::chrono::steady_clock::time_point now);
+    /* 移出超过mMetricTtl没有采样点的metric，调用时的要求同retireMetric() */
+    void evictIdleMetrics(size_t phase, std::chrono::steady_clock::time_point now);
+    /* 有界模式下的kOtherMetric，不存在时插入一个，调用时需要独占mMetricsLock */
+    Metric& otherMetric();
+    /* 开启forwardToAggregator()之后返回metric的forward，第一次使用时初始化 */
+    HistogramSnapshot<double>* forwardOf(Metric& metric);
+    /*
+     * 有界模式下在切换phase之后调整被跟踪的名称：把SpaceSaving中次数最多的名称提升为独立的
+     * metric，移出不再属于其中的metric。调用时的要求同retireMetric()。
+     */
+    void rebalanceMetrics(size_t phase, std::chrono::steady_clock::time_point now);
+#ifndef _WIN32
+    /* 当前进程是调用enableSharedMetrics()的进程，只有它读取共享表 */
+    bool ownsSharedTable() const;
+    /* 为共享表中新出现的metric创建本进程的Metric，调用时需要持有mReportLock */
+    void syncSharedMetrics();
+    /* StatsD接收线程的回调，把一批采样点写入暂存区 */
+    void addStatsdBatch(const StatsdSample* samples, size_t count);
+#endif
+    /*
+     * 切换mPhaser，把所有metric在旧phase中暂存的数据写入直方图。
+     *
+     * 切换发生在同一时刻，之后的报告只包含切换之前的采样点，不会与写入方交错。
+     * 写入方可能在WriterSection之内等待mMetricsLock，所以调用时需要持有mReportLock，
+     * 但不能持有mMetricsLock。
+     */
+    void drainStaging(std::chrono::steady_clock::time_point now);
+    /*
+     * 更新metric，把它所有时间窗口的统计写入writer和full，返回最长窗口内的数据个数。
+     * 两者都可以为空；prometheus不为空时同时写入最短窗口的Prometheus文本格式。
+     */
+    uint64_t writeWindows(SnapshotWriter* writer, SnapshotWriter* full, Metric& metric, const std::string& name,
+        std::chrono::steady_clock::time_point now, PrometheusWriter* prometheus);
+    /* 同上，写入指数衰减metric的每个EWMA窗口 */
+    void writeDecaying(SnapshotWriter& writer, DecayingRate& rate, const std::string& name,
+        std::chrono::steady_clock::time_point now, PrometheusWriter* prometheus);
+    /* 生成一段metric的snapshot（以及Prometheus文本），可以在任意线程中调用 */
+    void writePartition(ReportPartition& partition, std::chrono::steady_clock::time_point now,
+        uint64_t timestamp, bool keyframe, bool exposition);
+
+    /* 一次遍历所有metric，把完整的JSON报告写入out */
+    void writeReport(ReportBuffer& out);
+    /*
+     * 一次遍历所有metric，把二进制报告写入out。
+     *
+     * exposition不为空时，同一次遍历中还会把Prometheus文本格式写入exposition。
+     *
+     * @return 包含所有metric的snapshot：完整报告时就是out，增量报告时是同时生成的mFullSnapshot
+     */
+    const ReportBuffer& writeSnapshot(ReportBuffer& out, ReportBuffer* exposition = nullptr);
+    /* 把所有metric上次发送之后新增的数据写成一帧，没有新数据时返回false */
+    bool writeForward(ReportBuffer& out);
+    /* 定时器回调：生成报告并写入文件、共享内存 */
+    void report();
+
     static PerformanceMarker* mInstance;
     static std::mutex mLock;
 
     static std::string mPrefix;
     static std::chrono::seconds mDuration;
+    // 报告中的时间窗口，升序，每个窗口对应直方图的一个level
+    static std::vector<uint32_t> mWindows;
+    static ReportFormat mFormat;
+    static std::string mJournalName;
+    static uint32_t mJournalRollSize;
+    static uint32_t mJournalRollInterval;
+    static uint32_t mJournalMaxFiles;
+    static uint32_t mKeyframeInterval;
+    static uint32_t mReportThreads;
+    static size_t mMaxMetrics;
+    static std::chrono::seconds mMetricTtl;
     CppTime::Timer mTimer;
-    std::map<std::string, TimeseriesHistogram<double>> mBuckets;
-    std::string mReport;
+    // 保护mBuckets的结构，addValue()只在新增metric时需要独占
+    std::shared_mutex mMetricsLock;
+    std::map<std::string, Metric> mBuckets;
+    // enableExemplars()设置的每个名称的样例个数，metric被移出之后重新创建时仍然开启，由mMetricsLock保护
+    std::unordered_map<std::string, size_t> mExemplarCounts;
+    // getDecayingRate()注册的metric，与mBuckets一样由mMetricsLock保护
+    std::map<std::string, DecayingRate> mDecayingRates;
+    // 有界模式下已跟踪的名称个数，不包括kOtherMetric，只在独占mMetricsLock时修改
+    std::atomic<size_t> mNumTracked { 0 };
+    // 有界模式下的kOtherMetric，创建之后不再移出
+    std::atomic<Metric*> mOtherMetric { nullptr };
+    // 保护mHeavyHitters，未跟踪的名称的写入方和生成报告时使用
+    std::mutex mHeavyLock;
+    // 有界模式下所有名称的次数估计，容量为mMaxMetrics的kCandidateFactor倍，第一次使用时创建
+    std::unique_ptr<SpaceSaving> mHeavyHitters;
+    std::vector<SpaceSaving::Counter> mHeavyTop;
+    // 从mBuckets中移出的metric，写入方可能还在使用，下一次切换phase之后才释放
+    std::vector<std::map<std::string, Metric>::node_type> mRetired;
+    // 每次移出metric时加一，保存了Metric指针的缓存据此清空
+    std::atomic<uint64_t> mRetireGeneration { 0 };
+    // 按名称排序的所有metric，每次生成报告时在drainStaging()中更新。元素指向map的节点，
+    // 插入不会使它失效，移出和释放只在持有mReportLock时发生，所以遍历只需要mReportLock
+    std::vector<MetricEntry> mMetricList;
+    // 写入方与生成报告之间的phase切换
+    WriterReaderPhaser mPhaser;
+    // 同一时刻只有一个线程生成报告（定时报告或getLastReport()）
+    std::mutex mReportLock;
+    // 最近一次定时报告，由mSnapshotLock保护指针本身
+    std::mutex mSnapshotLock;
+    std::shared_ptr<const Snapshot> mLastSnapshot;
+    // 已经生成的定时报告个数，用于决定哪些报告是完整报告
+    uint64_t mReportCount = 0;
+    // 定时报告使用的缓冲区，每次报告之后复用
+    ReportBuffer mReport;
+    // 定时报告的日志文件，在第一次写报告或者格式改变时创建
+    std::unique_ptr<AsyncLogging> mJournal;
+    ReportFormat mJournalFormat = ReportFormat::None;
+    ReportBuffer mSnapshot;
+    SnapshotWriter mSnapshotWriter;
+    // 增量报告时缓存的完整snapshot，没有新采样点的metric也能用find()找到
+    ReportBuffer mFullSnapshot;
+    SnapshotWriter mFullWriter;
+    // 没有数据的metric的统计结果，所有字段都是0
+    TimeseriesHistogram<double>::Summary mEmptySummary;
+    ReportBuffer mExposition;
+    // 把各个分段的Prometheus输出合并到mExposition，跳过名称冲突的family
+    PrometheusWriter mExpositionWriter;
+    // forwardToAggregator()之后为true，drainStaging()开始把新增的数据累加到Metric::forward
+    std::atomic<bool> mForwarding { false };
+    AggregatorFrame mFrameWriter;
+    ReportBuffer mForward;
+    // 并行生成报告时每个线程一段，容量在多次报告之间复用
+    std::vector<std::unique_ptr<ReportPartition>> mPartitions;
+    // setReportThreads()大于0时，在第一次生成报告时创建
+    std::unique_ptr<WorkerPool> mWorkers;
+#ifndef _WIN32
+    // 保护mPublisher，它可能在定时器线程运行时被打开
+    std::mutex mPublisherLock;
+    SharedSnapshotPublisher mPublisher;
+    MetricsServer mMetricsServer;
+    AggregatorClient mAggregator;
+    // enableSharedMetrics()之后不为空，之后不再改变，所有进程的addValue()都写入这里
+    std::unique_ptr<SharedMetricTable> mSharedTable;
+    // 创建共享表的进程，fork出的子进程继承了单例，但不能切换共享表的phase
+    pid_t mSharedOwner = 0;
+    // 共享表中每个slot对应的本进程Metric，只在持有mReportLock时访问
+    std::vector<Metric*> mSharedMetrics;
+    StatsdServer mStatsd;
+    // 以下只在StatsD接收线程中访问：名称到Metric的缓存，以及缓存对应的mRetireGeneration
+    std::unordered_map<std::string, Metric*> mStatsdMetrics;
+    uint64_t mStatsdGeneration = 0;
+    std::string mStatsdName;
+#endif
 };
 
 // 给name增加一个采样点
@@ -75,4 +556,15 @@ private:
     };
 #define SOL2_PERFORMANCE_MEASURE(name) SOL2_PERFORMANCE_MEASURE_HELP(name, L_DEFER_COMBINE(_perf_measure_start_, __LINE__));
 
+// 同SOL2_PERFORMANCE_MEASURE，并把payload作为样例的上下文，见PerformanceMarker::enableExemplars()
+#define SOL2_PERFORMANCE_MEASURE_EXEMPLAR_HELP(name, payload, startTime)                                    \
+    auto startTime = std::chrono::steady_clock::now();                                                      \
+    sol2::Defer timeVar##_Defer_ = [&]() -> void {                                                          \
+        auto endTime = std::chrono::steady_clock::now();                                                    \
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count(); \
+        PerformanceMarker::getInstance().addValue(name, double(duration), payload);                         \
+    };
+#define SOL2_PERFORMANCE_MEASURE_EXEMPLAR(name, payload) \
+    SOL2_PERFORMANCE_MEASURE_EXEMPLAR_HELP(name, payload, L_DEFER_COMBINE(_perf_measure_start_, __LINE__));
+
 #endif //PERFORMANCE_PERFORMANCEMARKER_H
@@ -0,0 +1,107 @@
+/**
+ * Copyright (c) 2018 Duobei Brothers Information Technology Co.,Ltd. All rights reserved.
+ *
+ * Author: haosheng (sheng.hao@duobei.com)
+ *
+ * Date: 2021/9/24
+ *
+ */
+
+#ifndef PERFORMANCE_PROMETHEUSWRITER_H
+#define PERFORMANCE_PROMETHEUSWRITER_H
+
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include "DecayingRate.h"
+#include "ReportBuffer.h"
+#include "TimeseriesHistogram.h"
+
+/*
+ * 把TimeseriesHistogram写成Prometheus文本格式（text/plain; version=0.0.4）。
+ *
+ * 每个metric输出为一个histogram：
+ *
+ *   # TYPE prefix_name histogram
+ *   prefix_name_bucket{le="1000"} 3
+ *   prefix_name_bucket{le="+Inf"} 5
+ *   prefix_name_sum 120
+ *   prefix_name_count 5
+ *
+ * le直接使用HistogramBuckets的bucket上边界，只输出有数据的bucket（累计值不变的bucket
+ * 可以省略）。注意所有值都是给定level时间窗口内的统计，不是单调递增的counter，
+ * 查询时应直接使用，不需要rate()。
+ *
+ * 不合法的字符被替换为'_'之后，不同的名称（a.b和a_b）可能对应同一个family，重复的
+ * family会让Prometheus拒绝整个响应。add*()不检查名称冲突，由append()合并时只保留
+ * 每个名称第一次出现的family。
+ */
+class PrometheusWriter {
+public:
+    using Summary = TimeseriesHistogram<double>::Summary;
+
+    static constexpr const char* kContentType = "text/plain; version=0.0.4; charset=utf-8";
+
+    /* 开始写入out，out会被清空 */
+    void begin(ReportBuffer& out);
+
+    /* 写入名为prefix_name的metric在level上的直方图 */
+    void addHistogram(std::string_view prefix, std::string_view name,
+        const TimeseriesHistogram<double>& histogram, size_t level);
+
+    /*
+     * 同上，但使用刚刚由histogram.summarize()得到的summary，不再遍历bucket。
+     *
+     * 生成报告时已经遍历过一次所有bucket，这样生成Prometheus格式几乎没有额外开销。
+     * summary.numBuckets为0时按没有数据输出。
+     */
+    void addHistogram(std::string_view prefix, std::string_view name,
+        const TimeseriesHistogram<double>& histogram, const Summary& summary);
+
+    /*
+     * 把指数衰减的metric写成三组gauge，每个EWMA窗口以window标签区分（单位为秒）：
+     *
+     *   # TYPE prefix_name_qps gauge
+     *   prefix_name_qps{window="60"} 12.5
+     *
+     * 另外两组是prefix_name_rate和prefix_name_avg。
+     */
+    void addDecayingRate(std::string_view prefix, std::string_view name, const DecayingRate& rate);
+
+    /*
+     * 把part写出的内容按顺序追加到当前输出，跳过名称已经在当前输出中出现过的family。
+     * part的输出在下一次begin()之前不能修改。
+     */
+    void append(const PrometheusWriter& part);
+
+private:
+    /* 输出中的一个family，从"# TYPE "开始，到下一个family或者输出末尾为止 */
+    struct Family {
+        size_t begin;
+        size_t nameLength;
+    };
+
+    /* 在写入"# TYPE "之前记录family的位置 */
+    void beginFamily(size_t nameLength) { mFamilies.push_back({ mOut->size(), nameLength }); }
+    /* 把prefix_name中不合法的字符替换为'_'，结果保存在mName中 */
+    void setName(std::string_view prefix, std::string_view name);
+    /* 格式化后的le标签只与bucket的划分有关，划分不变时复用 */
+    void updateBounds(const TimeseriesHistogram<double>& histogram);
+
+    ReportBuffer* mOut = nullptr;
+    std::string mName;
+    Summary mSummary;
+
+    double mBucketSize = 0;
+    double mMin = 0;
+    double mMax = 0;
+    // mBounds[i]是第i个bucket的 {le="上边界"}
+    std::vector<std::string> mBounds;
+    std::vector<Family> mFamilies;
+    // append()已经追加的family名称，指向各个part的输出
+    std::unordered_set<std::string_view> mAppended;
+};
+
+#endif //PERFORMANCE_PROMETHEUSWRITER_H
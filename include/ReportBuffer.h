@@ -0,0 +1,83 @@
+/**
+ * Copyright (c) 2018 Duobei Brothers Information Technology Co.,Ltd. All rights reserved.
+ *
+ * Author: haosheng (sheng.hao@duobei.com)
+ *
+ * Date: 2021/9/16
+ *
+ */
+
+#ifndef PERFORMANCE_REPORTBUFFER_H
+#define PERFORMANCE_REPORTBUFFER_H
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+
+/*
+ * 生成报告用的可增长字节缓冲区。
+ *
+ * 与std::stringstream和std::string拼接不同，clear()只重置写入位置而不释放内存，
+ * 因此同一个ReportBuffer反复用于生成报告时，容量稳定之后不再有内存分配。
+ * 数字使用std::to_chars格式化，不经过locale，也不产生临时字符串。
+ */
+class ReportBuffer {
+public:
+    explicit ReportBuffer(size_t initialCapacity = 4096);
+
+    ReportBuffer(const ReportBuffer&) = delete;
+    ReportBuffer& operator=(const ReportBuffer&) = delete;
+
+    /* 清空内容，保留已分配的内存 */
+    void clear() { mSize = 0; }
+
+    void append(char c)
+    {
+        ensure(1);
+        mData[mSize++] = c;
+    }
+
+    void append(std::string_view str)
+    {
+        ensure(str.size());
+        std::memcpy(mData.get() + mSize, str.data(), str.size());
+        mSize += str.size();
+    }
+
+    void appendInt(int64_t value);
+    void appendUInt(uint64_t value);
+
+    /*
+     * 以定点格式写入value，保留precision位小数，与std::fixed + std::setprecision一致。
+     *
+     * precision为负数时使用能精确还原value的最短格式，例如99、99.9。
+     */
+    void appendDouble(double value, int precision = 2);
+
+    const char* data() const { return mData.get(); }
+    char* data() { return mData.get(); }
+    size_t size() const { return mSize; }
+    size_t capacity() const { return mCapacity; }
+    bool empty() const { return mSize == 0; }
+
+    std::string_view view() const { return std::string_view(mData.get(), mSize); }
+    std::string str() const { return std::string(mData.get(), mSize); }
+
+private:
+    void ensure(size_t len)
+    {
+        if (mSize + len > mCapacity) {
+            grow(mSize + len);
+        }
+    }
+
+    void grow(size_t required);
+
+    std::unique_ptr<char[]> mData;
+    size_t mSize;
+    size_t mCapacity;
+};
+
+#endif //PERFORMANCE_REPORTBUFFER_H
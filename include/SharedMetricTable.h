@@ -0,0 +1,202 @@
+/**
+ * Copyright (c) 2018 Duobei Brothers Information Technology Co.,Ltd. All rights reserved.
+ *
+ * Author: haosheng (sheng.hao@duobei.com)
+ *
+ * Date: 2021/10/14
+ *
+ */
+
+#ifndef PERFORMANCE_SHAREDMETRICTABLE_H
+#define PERFORMANCE_SHAREDMETRICTABLE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "CountScan.h"
+#include "WriterReaderPhaser.h"
+
+/*
+ * 多个进程共用的metric暂存表，位于fork()之前创建的匿名共享内存（MAP_SHARED | MAP_ANONYMOUS）中。
+ *
+ * 用于pre-fork服务器：父进程创建表之后fork出子进程，所有进程的采样点都用原子操作累加到
+ * 同一张表里，只有父进程的定时器线程读取并生成报告，写入时没有任何进程间通信。
+ *
+ * 表是固定容量的开放寻址哈希表，每个slot保存一个metric的名称和两个phase的暂存区
+ * （每个bucket的count和sum，以及有数据的bucket的位图），含义与PerformanceMarker::Staging
+ * 相同。phase的切换使用放在共享内存中的WriterReaderPhaser，它只包含无锁的原子变量，
+ * 跨进程同样有效。slot一旦插入就不会被删除。
+ *
+ * 子进程可能在任何时候被kill，所有等待其他进程的地方都有超时：
+ * - 插入名称的进程死掉时slot停留在插入中的状态。slot记录了插入方的pid，等待超过
+ *   kInsertTimeout之后，插入方已经不存在时由当前进程接管这个slot；插入方仍然存在时
+ *   放弃本次插入，返回kNotFound，采样点计入dropped()。
+ * - 写入方在add()中死掉时它永远不会离开旧的phase。flipPhase()最多等待kFlipTimeout，
+ *   超时之后记录警告并照常读取旧phase，下一次切换到这个phase时不再等待死掉的写入方。
+ *   超时只在写入方死掉或者被长时间挂起时发生，后一种情况下它的采样点可能被推迟到
+ *   下一次报告，或者count和sum被分到两次报告中。
+ */
+class SharedMetricTable {
+public:
+    // 名称的最大长度，更长的名称无法插入
+    static constexpr size_t kMaxNameLength = 119;
+    static constexpr size_t kNotFound = ~size_t(0);
+    // 等待其他进程插入名称的最长时间
+    static constexpr std::chrono::milliseconds kInsertTimeout { 10 };
+    // 等待写入方离开旧phase的最长时间
+    static constexpr std::chrono::milliseconds kFlipTimeout { 100 };
+
+    SharedMetricTable() = default;
+    ~SharedMetricTable() { close(); }
+
+    SharedMetricTable(const SharedMetricTable&) = delete;
+    SharedMetricTable& operator=(const SharedMetricTable&) = delete;
+
+    /*
+     * 创建能容纳capacity个metric的表，每个metric有numBuckets个bucket。
+     *
+     * 必须在fork()之前调用，子进程继承同一块共享内存。
+     */
+    bool create(size_t capacity, size_t numBuckets);
+
+    void close();
+
+    bool isOpen() const { return mHeader != nullptr; }
+
+    size_t capacity() const { return mHeader ? mHeader->capacity : 0; }
+
+    size_t numBuckets() const { return mHeader ? mHeader->numBuckets : 0; }
+
+    /* 因为名称过长或者表已满而被丢弃的采样点个数 */
+    uint64_t dropped() const { return mHeader ? mHeader->dropped.load(std::memory_order_relaxed) : 0; }
+
+    /*
+     * 查找名为name的metric，不存在时插入，返回slot下标；名称过长、表已满，或者其他进程
+     * 插入同一个slot超时时返回kNotFound
+     */
+    size_t findOrInsert(std::string_view name);
+
+    /* 向slot的第bucketIdx个bucket加入count个总和为sum的采样点，可以在任意进程、任意线程调用 */
+    void add(size_t slot, size_t bucketIdx, double sum, uint64_t count)
+    {
+        WriterReaderPhaser::WriterSection section(mHeader->phaser);
+        Phase phase = getPhase(slot, section.phase());
+        phase.counts[bucketIdx].fetch_add(count, std::memory_order_relaxed);
+        double current = phase.sums[bucketIdx].load(std::memory_order_relaxed);
+        while (!phase.sums[bucketIdx].compare_exchange_weak(current, current + sum, std::memory_order_relaxed)) {
+        }
+        uint64_t bit = uint64_t(1) << (bucketIdx % 64);
+        auto& word = phase.active[bucketIdx / 64];
+        if ((word.load(std::memory_order_relaxed) & bit) == 0) {
+            word.fetch_or(bit, std::memory_order_relaxed);
+        }
+        if (phase.dirty->load(std::memory_order_relaxed) == 0) {
+            phase.dirty->store(1, std::memory_order_relaxed);
+        }
+    }
+
+    /* 名称无法插入时记录被丢弃的采样点 */
+    void addDropped(uint64_t count) { mHeader->dropped.fetch_add(count, std::memory_order_relaxed); }
+
+    /*
+     * 切换phase，之后旧phase中的数据只有调用方访问（等待写入方超时的情况除外）。
+     * 同一时刻只能有一个读取方，由调用方保证（PerformanceMarker只在父进程的定时器线程中调用）。
+     */
+    size_t flipPhase();
+
+    /* 第slot个slot已经插入完成时返回true，并返回它的名称 */
+    bool getName(size_t slot, std::string_view* name) const
+    {
+        const SlotHeader* header = getSlot(slot);
+        if (header->state.load(std::memory_order_acquire) != kReady) {
+            return false;
+        }
+        *name = std::string_view(header->name, header->nameLength);
+        return true;
+    }
+
+    /*
+     * 把slot在phase中暂存的数据交给fn(bucketIdx, sum, count)并清空，没有数据时返回false。
+     * 只能对flipPhase()返回的旧phase调用。
+     */
+    template <typename Fn>
+    bool drain(size_t slot, size_t phaseIdx, Fn fn)
+    {
+        Phase phase = getPhase(slot, phaseIdx);
+        if (phase.dirty->exchange(0, std::memory_order_relaxed) == 0) {
+            return false;
+        }
+        for (size_t w = 0; w < mActiveWords; ++w) {
+            uint64_t bits = phase.active[w].exchange(0, std::memory_order_relaxed);
+            while (bits != 0) {
+                size_t idx = w * 64 + CountScan::lowestBit(bits);
+                fn(idx, phase.sums[idx].exchange(0, std::memory_order_relaxed),
+                    phase.counts[idx].exchange(0, std::memory_order_relaxed));
+                bits &= bits - 1;
+            }
+        }
+        return true;
+    }
+
+private:
+    // slot状态的低32位，高32位是kInserting时插入方的pid
+    static constexpr uint64_t kEmpty = 0;
+    // 正在写入名称，其他进程需要等待它变为kReady
+    static constexpr uint64_t kInserting = 1;
+    static constexpr uint64_t kReady = 2;
+
+    struct Header {
+        WriterReaderPhaser phaser;
+        std::atomic<uint64_t> dropped;
+        uint64_t capacity;
+        uint64_t numBuckets;
+    };
+
+    struct SlotHeader {
+        std::atomic<uint64_t> state;
+        uint32_t nameLength;
+        uint64_t hash;
+        char name[kMaxNameLength + 1];
+    };
+
+    /* 一个phase的暂存区在共享内存中的位置 */
+    struct Phase {
+        std::atomic<uint64_t>* dirty;
+        std::atomic<uint64_t>* active;
+        std::atomic<uint64_t>* counts;
+        std::atomic<double>* sums;
+    };
+
+    /* 写入名称，slot必须处于由当前进程插入的状态 */
+    static void fillSlot(SlotHeader* slot, std::string_view name, uint64_t hash);
+
+    SlotHeader* getSlot(size_t slot) const
+    {
+        return reinterpret_cast<SlotHeader*>(mSlots + slot * mSlotSize);
+    }
+
+    Phase getPhase(size_t slot, size_t phase) const
+    {
+        auto* base = reinterpret_cast<std::atomic<uint64_t>*>(mSlots + slot * mSlotSize + sizeof(SlotHeader))
+            + phase * mPhaseWords;
+        size_t numBuckets = mHeader->numBuckets;
+        return Phase { base, base + 1, base + 1 + mActiveWords,
+            reinterpret_cast<std::atomic<double>*>(base + 1 + mActiveWords + numBuckets) };
+    }
+
+    Header* mHeader = nullptr;
+    char* mSlots = nullptr;
+    size_t mMappedSize = 0;
+    size_t mSlotSize = 0;
+    size_t mActiveWords = 0;
+    // 一个phase占用的8字节字数：dirty、位图、counts、sums
+    size_t mPhaseWords = 0;
+};
+
+static_assert(std::atomic<double>::is_always_lock_free, "shared memory requires lock free atomics");
+static_assert(sizeof(std::atomic<double>) == sizeof(std::atomic<uint64_t>), "sums share the counts layout");
+
+#endif //PERFORMANCE_SHAREDMETRICTABLE_H
@@ -0,0 +1,112 @@
+/**
+ * Copyright (c) 2018 Duobei Brothers Information Technology Co.,Ltd. All rights reserved.
+ *
+ * Author: haosheng (sheng.hao@duobei.com)
+ *
+ * Date: 2021/9/22
+ *
+ */
+
+#ifndef PERFORMANCE_SHAREDSNAPSHOT_H
+#define PERFORMANCE_SHAREDSNAPSHOT_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "ReportBuffer.h"
+
+/*
+ * POSIX共享内存（shm_open + mmap）中的snapshot区域。
+ *
+ * PerformanceMarker每个周期把最新的二进制snapshot（见SnapshotFormat.h）发布到这里，
+ * 同一台机器上的其他进程可以随时读取，不需要读写文件。
+ *
+ * 区域中有两个slot，写入方轮流写入，每个slot有自己的seqlock：
+ *   - 写入方：sequence变为奇数 -> 拷贝数据 -> sequence变为偶数 -> generation加1
+ *   - 读取方：读generation找到最新的slot，拷贝前后的sequence相同且为偶数时数据有效
+ * 写入方只有内存拷贝和原子写，没有系统调用，也从不等待读取方；读取方只有在写入方连续
+ * 写了两次的时间内都没拷贝完时才需要重试。
+ */
+struct SharedSnapshotRegion {
+    static constexpr char kMagic[8] = { 'P', 'M', 'S', 'H', 'M', '\0', '\0', '\0' };
+    static constexpr uint32_t kVersion = 1;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    // 每个slot的数据容量
+    uint64_t capacity;
+    // 已发布的snapshot个数，第g个snapshot在slot (g & 1)中，0表示还没有数据
+    std::atomic<uint64_t> generation;
+    std::atomic<uint64_t> sequence[2];
+    std::atomic<uint64_t> size[2];
+
+    const char* slot(size_t idx) const { return reinterpret_cast<const char*>(this) + headerSize + idx * capacity; }
+    char* slot(size_t idx) { return reinterpret_cast<char*>(this) + headerSize + idx * capacity; }
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared memory requires lock free atomics");
+
+/*
+ * 写入方，创建并拥有共享内存区域，析构时删除它。
+ */
+class SharedSnapshotPublisher {
+public:
+    SharedSnapshotPublisher() = default;
+    ~SharedSnapshotPublisher() { close(); }
+
+    SharedSnapshotPublisher(const SharedSnapshotPublisher&) = delete;
+    SharedSnapshotPublisher& operator=(const SharedSnapshotPublisher&) = delete;
+
+    /*
+     * 创建名为name的共享内存区域，每个slot能容纳capacity字节的snapshot。
+     *
+     * name不以'/'开头时会自动补上。同名区域已经存在时会被重新初始化。
+     */
+    bool open(const std::string& name, size_t capacity);
+
+    /* 发布一个snapshot，超过容量时返回false */
+    bool publish(const char* data, size_t size);
+
+    void close();
+
+    bool isOpen() const { return mRegion != nullptr; }
+
+    size_t capacity() const { return mRegion ? mRegion->capacity : 0; }
+
+private:
+    std::string mName;
+    SharedSnapshotRegion* mRegion = nullptr;
+    size_t mMappedSize = 0;
+};
+
+/*
+ * 读取方，以只读方式打开共享内存区域。
+ */
+class SharedSnapshotSubscriber {
+public:
+    SharedSnapshotSubscriber() = default;
+    ~SharedSnapshotSubscriber() { close(); }
+
+    SharedSnapshotSubscriber(const SharedSnapshotSubscriber&) = delete;
+    SharedSnapshotSubscriber& operator=(const SharedSnapshotSubscriber&) = delete;
+
+    bool open(const std::string& name);
+
+    /*
+     * 把最新的snapshot拷贝到out（out会被清空）。
+     *
+     * @param generation 输出读到的snapshot序号，可用于判断是否有新数据
+     * @return 还没有数据，或者连续多次与写入方冲突时返回false
+     */
+    bool read(ReportBuffer& out, uint64_t* generation = nullptr) const;
+
+    void close();
+
+private:
+    const SharedSnapshotRegion* mRegion = nullptr;
+    size_t mMappedSize = 0;
+};
+
+#endif //PERFORMANCE_SHAREDSNAPSHOT_H
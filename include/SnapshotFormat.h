@@ -0,0 +1,110 @@
+/**
+ * Copyright (c) 2018 Duobei Brothers Information Technology Co.,Ltd. All rights reserved.
+ *
+ * Author: haosheng (sheng.hao@duobei.com)
+ *
+ * Date: 2021/9/18
+ *
+ */
+
+#ifndef PERFORMANCE_SNAPSHOTFORMAT_H
+#define PERFORMANCE_SNAPSHOTFORMAT_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * 二进制报告（snapshot）的文件格式。
+ *
+ * 整个文件可以直接mmap之后按结构体访问，不需要解析：
+ *
+ *   +------------------+  0
+ *   | SnapshotHeader   |
+ *   +------------------+  header.recordOffset
+ *   | SnapshotRecord   |  header.recordCount个定长记录，每个metric的每个时间窗口一条
+ *   | ...              |
+ *   +------------------+  header.exemplarOffset
+ *   | SnapshotExemplar |  header.exemplarCount个定长样例，按metric的顺序存放
+ *   | ...              |
+ *   +------------------+  header.stringTableOffset
+ *   | string table     |  所有metric名称，以'\0'结尾，由SnapshotRecord::nameOffset引用
+ *   +------------------+  header.totalSize
+ *
+ * 所有整数都是写入方机器的字节序（小端）。读取时先检查magic和version，headerSize和
+ * recordSize允许以后在header和记录末尾追加字段：读取方接受比结构体长的header和记录，
+ * 也接受追加字段之前的较短版本（不短于kSnapshotMinHeaderSize和kSnapshotMinRecordSize），
+ * 缺少的字段为0。
+ */
+
+constexpr char kSnapshotMagic[8] = { 'P', 'M', 'S', 'N', 'A', 'P', '\0', '\0' };
+constexpr uint32_t kSnapshotVersion = 1;
+// 每条记录最多保存的百分位数个数
+constexpr size_t kSnapshotMaxPercentiles = 4;
+// 样例上下文的最大长度
+constexpr size_t kSnapshotMaxPayload = 48;
+// SnapshotHeader::flags：只包含上次报告之后有变化的metric，没有出现的metric与上次报告相同
+constexpr uint32_t kSnapshotFlagDelta = 1;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t recordSize;
+    uint32_t recordCount;
+    uint32_t percentileCount;
+    // kSnapshotFlagDelta等标志位
+    uint32_t flags;
+    // 生成报告的时间，自1970-01-01以来的秒数
+    uint64_t timestamp;
+    uint64_t recordOffset;
+    uint64_t stringTableOffset;
+    uint64_t stringTableSize;
+    uint64_t totalSize;
+    // 每条记录中percentiles[i]对应的百分位数，范围是0-100
+    double percentiles[kSnapshotMaxPercentiles];
+    // 以下字段是之后追加的，较短的旧header中它们为0，即没有样例
+    uint64_t exemplarOffset;
+    uint32_t exemplarCount;
+    uint32_t exemplarSize;
+};
+
+struct SnapshotRecord {
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    // 这条记录统计的时间窗口长度
+    uint32_t windowSeconds;
+    uint32_t reserved;
+    uint64_t count;
+    double sum;
+    double avg;
+    double rate;
+    double qps;
+    double percentiles[kSnapshotMaxPercentiles];
+    // 窗口内的最大值和总体标准差
+    double max;
+    double stddev;
+};
+
+/* 一个metric最近一个时间窗口内值最大的采样点，见ExemplarReservoir */
+struct SnapshotExemplar {
+    // 与所属metric的SnapshotRecord::nameOffset相同
+    uint32_t nameOffset;
+    uint32_t payloadLength;
+    double value;
+    // 采样时间，自1970-01-01以来的毫秒数
+    uint64_t timestamp;
+    char payload[kSnapshotMaxPayload];
+};
+
+// 第一版的SnapshotHeader到percentiles为止，样例的字段是之后追加的
+constexpr size_t kSnapshotMinHeaderSize = offsetof(SnapshotHeader, exemplarOffset);
+// 第一版的SnapshotRecord到percentiles为止，max和stddev是之后追加的
+constexpr size_t kSnapshotMinRecordSize = offsetof(SnapshotRecord, max);
+
+static_assert(sizeof(SnapshotHeader) == 120, "SnapshotHeader layout changed");
+static_assert(sizeof(SnapshotRecord) == 104, "SnapshotRecord layout changed");
+static_assert(sizeof(SnapshotExemplar) == 72, "SnapshotExemplar layout changed");
+static_assert(kSnapshotMinHeaderSize == 104, "the first SnapshotHeader layout must stay readable");
+static_assert(kSnapshotMinRecordSize == 88, "the first SnapshotRecord layout must stay readable");
+
+#endif //PERFORMANCE_SNAPSHOTFORMAT_H
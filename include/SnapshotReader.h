@@ -0,0 +1,108 @@
+/**
+ * Copyright (c) 2018 Duobei Brothers Information Technology Co.,Ltd. All rights reserved.
+ *
+ * Author: haosheng (sheng.hao@duobei.com)
+ *
+ * Date: 2021/9/18
+ *
+ */
+
+#ifndef PERFORMANCE_SNAPSHOTREADER_H
+#define PERFORMANCE_SNAPSHOTREADER_H
+
+#include <string_view>
+#include <vector>
+
+#include "ReportBuffer.h"
+#include "SnapshotFormat.h"
+
+/*
+ * 读取SnapshotWriter写出的二进制报告。
+ *
+ * SnapshotReader不拷贝数据，只在open()时检查格式，之后直接按结构体访问，因此可以
+ * 用在mmap得到的内存上。data必须8字节对齐，并且在reader使用期间保持有效。
+ *
+ * header总是被拷贝一份；旧版本写出的记录比SnapshotRecord短时，open()把记录也拷贝一份。
+ * 两者缺少的字段都补0。
+ */
+class SnapshotReader {
+public:
+    SnapshotReader() = default;
+
+    /* 检查data是否是一个完整有效的snapshot，失败时返回false */
+    bool open(const char* data, size_t size);
+
+    const SnapshotHeader& header() const { return mHeader; }
+
+    size_t recordCount() const { return header().recordCount; }
+
+    const SnapshotRecord& record(size_t idx) const
+    {
+        if (!mUpgraded.empty()) {
+            return mUpgraded[idx];
+        }
+        const auto& h = header();
+        return *reinterpret_cast<const SnapshotRecord*>(mData + h.recordOffset + idx * h.recordSize);
+    }
+
+    size_t exemplarCount() const { return header().exemplarCount; }
+
+    /* 样例按metric的顺序存放，同一个metric的样例按value从大到小排列 */
+    const SnapshotExemplar& exemplar(size_t idx) const
+    {
+        const auto& h = header();
+        return *reinterpret_cast<const SnapshotExemplar*>(mData + h.exemplarOffset + idx * h.exemplarSize);
+    }
+
+    std::string_view payload(const SnapshotExemplar& exemplar) const
+    {
+        return std::string_view(exemplar.payload, exemplar.payloadLength);
+    }
+
+    /* 字符串表，所有名称以'\0'结尾首尾相接 */
+    std::string_view stringTable() const
+    {
+        return std::string_view(mData + header().stringTableOffset, header().stringTableSize);
+    }
+
+    /* 返回记录对应的metric名称，格式为prefix_name */
+    std::string_view name(const SnapshotRecord& record) const
+    {
+        return std::string_view(mData + header().stringTableOffset + record.nameOffset, record.nameLength);
+    }
+
+    /*
+     * 把snapshot转换为与PerformanceMarker的JSON报告相同的格式，追加到out。
+     *
+     * 一个metric只有一个时间窗口时，统计字段直接写在metric下；有多个时间窗口时，
+     * 每个窗口以"<秒数>s"为key写成一个子对象。有样例的metric另外有一个"exemplars"数组。
+     */
+    void toJson(ReportBuffer& out) const;
+
+    /*
+     * 把snapshot转换为一行紧凑的JSON，以'\n'结尾，追加到out，用于按行追加的报告日志：
+     *
+     *   {"timestamp":1631000000,"metrics":{"prefix_name":{"count":3,"accu":6.00,...}}}
+     *
+     * 每个metric的内容与toJson()相同。delta snapshot会多一个"delta":true字段。
+     */
+    void toJsonLine(ReportBuffer& out) const;
+
+private:
+    /* indent为nullptr时输出紧凑格式 */
+    void appendFields(ReportBuffer& out, const SnapshotRecord& record, const char* indent) const;
+    /*
+     * 写入nameOffset所属metric的"exemplars"数组，*cursor是下一个未输出的样例，
+     * 没有样例时不输出。indent为nullptr时输出紧凑格式。
+     */
+    void appendExemplars(ReportBuffer& out, uint32_t nameOffset, size_t* cursor, const char* indent) const;
+
+    const char* mData = nullptr;
+    size_t mSize = 0;
+    // header比SnapshotHeader短时补0
+    SnapshotHeader mHeader {};
+    // 记录比SnapshotRecord短时补0之后的副本
+    std::vector<SnapshotRecord> mUpgraded;
+};
+
+#endif //PERFORMANCE_SNAPSHOTREADER_H
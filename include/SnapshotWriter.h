@@ -0,0 +1,77 @@
+/**
+ * Copyright (c) 2018 Duobei Brothers Information Technology Co.,Ltd. All rights reserved.
+ *
+ * Author: haosheng (sheng.hao@duobei.com)
+ *
+ * Date: 2021/9/18
+ *
+ */
+
+#ifndef PERFORMANCE_SNAPSHOTWRITER_H
+#define PERFORMANCE_SNAPSHOTWRITER_H
+
+#include <string_view>
+
+#include "ExemplarReservoir.h"
+#include "ReportBuffer.h"
+#include "SnapshotFormat.h"
+#include "SnapshotReader.h"
+#include "TimeseriesHistogram.h"
+
+/*
+ * 把报告写成SnapshotFormat.h中定义的二进制格式。
+ *
+ * 用法：
+ *   writer.begin(out, pcts, nPcts, timestamp);
+ *   writer.beginMetric(prefix, name);
+ *   writer.addWindow(windowSeconds, summary);   // 每个时间窗口一次
+ *   writer.addExemplar(exemplar);               // 可选，当前metric的样例
+ *   ...
+ *   writer.finish();
+ *
+ * 记录直接写入out，名称和样例先写入内部的缓冲区，finish()时追加到记录之后并回填header。
+ * writer和out都可以复用，容量稳定之后不再有内存分配。
+ */
+class SnapshotWriter {
+public:
+    using Summary = TimeseriesHistogram<double>::Summary;
+
+    SnapshotWriter();
+
+    /*
+     * 开始一个新的snapshot，out会被清空。
+     *
+     * @param pcts  每条记录保存的百分位数，最多kSnapshotMaxPercentiles个，多余的被忽略
+     * @param flags 写入SnapshotHeader::flags，例如kSnapshotFlagDelta
+     */
+    void begin(ReportBuffer& out, const double pcts[], size_t nPcts, uint64_t timestamp, uint32_t flags = 0);
+
+    /* 开始一个metric，名称为prefix_name */
+    void beginMetric(std::string_view prefix, std::string_view name);
+
+    /* 为当前metric增加一个时间窗口的统计结果 */
+    void addWindow(uint32_t windowSeconds, const Summary& summary);
+
+    /* 为当前metric增加一个样例 */
+    void addExemplar(const Exemplar& exemplar);
+
+    /*
+     * 把另一个snapshot的所有记录追加到当前snapshot，用于合并并行生成的多个部分。
+     *
+     * part的百分位数需要与begin()时相同；它的字符串表被整体追加，记录和样例只调整nameOffset。
+     */
+    void append(const SnapshotReader& part);
+
+    /* 写入字符串表并回填header */
+    void finish();
+
+private:
+    ReportBuffer* mOut;
+    ReportBuffer mStrings;
+    ReportBuffer mExemplars;
+    SnapshotHeader mHeader;
+    uint32_t mNameOffset;
+    uint32_t mNameLength;
+};
+
+#endif //PERFORMANCE_SNAPSHOTWRITER_H
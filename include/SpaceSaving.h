@@ -0,0 +1,76 @@
+/**
+ * Copyright (c) 2018 Duobei Brothers Information Technology Co.,Ltd. All rights reserved.
+ *
+ * Author: haosheng (sheng.hao@duobei.com)
+ *
+ * Date: 2021/10/20
+ *
+ */
+
+#ifndef PERFORMANCE_SPACESAVING_H
+#define PERFORMANCE_SPACESAVING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Space-Saving算法（Metwally等，2005）：用固定个数的计数器找出数据流中出现次数最多的key。
+ *
+ * 每个计数器记录一个key的count和error。已有的key直接累加；表满时新key替换count最小的
+ * 计数器，继承它的count作为error。对任意key，count - error <= 真实次数 <= count，真实次数
+ * 超过 总次数 / capacity 的key一定在表中。
+ *
+ * 计数器按count组成小顶堆，offer()是O(log capacity)，内存只与capacity有关，与出现过的
+ * key的个数无关。不是线程安全的。
+ */
+class SpaceSaving {
+public:
+    struct Counter {
+        const std::string* key;
+        // 次数的上界
+        uint64_t count;
+        // 被替换时继承的次数，count - error是次数的下界
+        uint64_t error;
+    };
+
+    explicit SpaceSaving(size_t capacity);
+
+    SpaceSaving(const SpaceSaving&) = delete;
+    SpaceSaving& operator=(const SpaceSaving&) = delete;
+
+    size_t capacity() const { return mCapacity; }
+    size_t size() const { return mCounters.size(); }
+
+    /* key出现了count次 */
+    void offer(const std::string& key, uint64_t count = 1);
+
+    /* key次数的上界，不在表中时返回0 */
+    uint64_t estimate(const std::string& key) const;
+
+    /* count最大的k个计数器，按count从大到小写入out，在下一次修改之前有效 */
+    void top(size_t k, std::vector<Counter>* out) const;
+
+    /* 所有count和error减半，让过去的数据逐渐失去影响，不改变计数器的顺序 */
+    void decay();
+
+    void clear();
+
+    /* 占用的堆内存字节数（估计值），不包括对象本身 */
+    size_t memoryUsage() const;
+
+private:
+    void siftUp(size_t pos);
+    void siftDown(size_t pos);
+    void swapCounters(size_t lhs, size_t rhs);
+
+    size_t mCapacity;
+    // 按count的小顶堆
+    std::vector<Counter> mCounters;
+    // key到mCounters中下标的映射，Counter::key指向这里的key
+    std::unordered_map<std::string, size_t> mIndex;
+};
+
+#endif //PERFORMANCE_SPACESAVING_H
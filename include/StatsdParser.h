@@ -0,0 +1,66 @@
+/**
+ * Copyright (c) 2018 Duobei Brothers Information Technology Co.,Ltd. All rights reserved.
+ *
+ * Author: haosheng (sheng.hao@duobei.com)
+ *
+ * Date: 2021/10/15
+ *
+ */
+
+#ifndef PERFORMANCE_STATSDPARSER_H
+#define PERFORMANCE_STATSDPARSER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+/* 一行StatsD数据解析出的采样点，name指向原始数据 */
+struct StatsdSample {
+    std::string_view name;
+    double value;
+    // 采样率为@rate时一行代表1/rate个采样点
+    uint64_t count;
+};
+
+/*
+ * StatsD文本协议的解析，一个数据报中可以有多行，以'\n'分隔：
+ *
+ *   <name>:<value>|<type>[|@<sampleRate>][|#<tags>]
+ *
+ * type为ms、h、d（计时、直方图、分布）和c（计数）时，value作为一个采样点加入直方图，
+ * 与addValue()相同；g（gauge）只接受绝对值，+/-开头的增量无法表示为采样点。
+ * s（set）等其他类型、无法解析的数值视为不合法。tags和其他未知的段被忽略。
+ */
+class StatsdParser {
+public:
+    /*
+     * 解析data中的所有行，对每个合法的采样点调用fn(const StatsdSample&)，返回不合法的行数。
+     * 空行不计入。
+     */
+    template <typename Fn>
+    static size_t parse(const char* data, size_t size, Fn&& fn)
+    {
+        size_t invalid = 0;
+        std::string_view rest(data, size);
+        while (!rest.empty()) {
+            size_t end = rest.find('\n');
+            std::string_view line = rest.substr(0, end);
+            rest = end == std::string_view::npos ? std::string_view() : rest.substr(end + 1);
+            if (line.empty()) {
+                continue;
+            }
+            StatsdSample sample;
+            if (parseLine(line, &sample)) {
+                fn(sample);
+            } else {
+                ++invalid;
+            }
+        }
+        return invalid;
+    }
+
+    /* 解析一行（不含'\n'），不合法时返回false */
+    static bool parseLine(std::string_view line, StatsdSample* sample);
+};
+
+#endif //PERFORMANCE_STATSDPARSER_H
@@ -0,0 +1,85 @@
+/**
+ * Copyright (c) 2018 Duobei Brothers Information Technology Co.,Ltd. All rights reserved.
+ *
+ * Author: haosheng (sheng.hao@duobei.com)
+ *
+ * Date: 2021/10/15
+ *
+ */
+
+#ifndef PERFORMANCE_STATSDSERVER_H
+#define PERFORMANCE_STATSDSERVER_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "StatsdParser.h"
+
+/*
+ * 在本机数据报socket（127.0.0.1上的UDP或者Unix datagram socket）上接收StatsD协议的数据，
+ * 供脚本、sidecar等非C++的客户端使用。
+ *
+ * 服务线程每次用recvmmsg()接收最多kBatchSize个数据报，解析其中所有的行，再把这一批
+ * 采样点一次交给回调函数，系统调用和回调的开销由一批数据分摊。回调在服务线程中执行，
+ * 采样点的name指向接收缓冲区，只在回调期间有效。
+ */
+class StatsdServer {
+public:
+    // 一次recvmmsg()接收的数据报个数
+    static constexpr size_t kBatchSize = 64;
+    // 单个数据报的最大字节数，更长的数据报被截断，只解析完整的行
+    static constexpr size_t kMaxDatagramSize = 8192;
+
+    using Callback = std::function<void(const StatsdSample* samples, size_t count)>;
+
+    StatsdServer() = default;
+    ~StatsdServer() { stop(); }
+
+    StatsdServer(const StatsdServer&) = delete;
+    StatsdServer& operator=(const StatsdServer&) = delete;
+
+    /* 监听127.0.0.1:port上的UDP并启动服务线程，port为0时由系统分配 */
+    bool listenUdp(uint16_t port, Callback fn);
+    /* 监听Unix datagram socket并启动服务线程，path已存在时会被删除 */
+    bool listenUnix(const std::string& path, Callback fn);
+
+    /* 实际监听的UDP端口，未监听UDP时返回0 */
+    uint16_t port() const { return mPort; }
+
+    bool isRunning() const { return mRunning.load(std::memory_order_acquire); }
+
+    /* 已经解析的合法行数 */
+    uint64_t received() const { return mReceived.load(std::memory_order_relaxed); }
+
+    /* 不合法或者被截断的行数 */
+    uint64_t invalid() const { return mInvalid.load(std::memory_order_relaxed); }
+
+    /* 停止服务线程并关闭socket */
+    void stop();
+
+private:
+    bool start(int fd, Callback fn);
+    void run();
+    /* 接收并处理一批数据报，没有数据时返回false */
+    bool receiveBatch();
+
+    int mFd = -1;
+    // stop()通过这个pipe唤醒服务线程
+    int mWakeFd[2] = { -1, -1 };
+    uint16_t mPort = 0;
+    std::string mUnixPath;
+    Callback mCallback;
+    std::atomic<bool> mRunning { false };
+    std::atomic<uint64_t> mReceived { 0 };
+    std::atomic<uint64_t> mInvalid { 0 };
+    std::thread mThread;
+    // 接收缓冲区和一批解析出的采样点，在批次之间复用
+    std::vector<char> mBuffer;
+    std::vector<StatsdSample> mSamples;
+};
+
+#endif //PERFORMANCE_STATSDSERVER_H
@@ -10,7 +10,9 @@
 #ifndef PERFORMANCE_TIMESERIESHISTOGRAM_INL_H
 #define PERFORMANCE_TIMESERIESHISTOGRAM_INL_H
 
-#include <sstream>
+#include <algorithm>
+#include <string>
+#include <type_traits>
 
 template <typename T>
 TimeseriesHistogram<T>::TimeseriesHistogram(
@@ -18,48 +20,99 @@ TimeseriesHistogram<T>::TimeseriesHistogram(
     ValueType min,
     ValueType max,
     const ContainerType& defaultContainer)
-    : mBuckets(bucketSize, min, max, defaultContainer) {}
+    : mBuckets(bucketSize, min, max, defaultContainer)
+    , mTotals(defaultContainer)
+    , mActive((mBuckets.getNumBuckets() + 63) / 64, 0) {}
 
 template <typename T>
 void TimeseriesHistogram<T>::addValue(
     TimePoint now, const ValueType& value) {
-    mBuckets.getByValue(value).addValue(now, value);
+    size_t idx = mBuckets.getBucketIdx(value);
+    mBuckets.getByIndex(idx).addValue(now, value);
+    mTotals.addValue(now, value);
+    markActive(idx);
 }
 
 template <typename T>
 void TimeseriesHistogram<T>::addValue(
     TimePoint now, const ValueType& value, uint64_t times) {
-    mBuckets.getByValue(value).addValue(now, value, times);
+    size_t idx = mBuckets.getBucketIdx(value);
+    mBuckets.getByIndex(idx).addValue(now, value, times);
+    mTotals.addValue(now, value, times);
+    markActive(idx);
 }
 
+template <typename T>
+void TimeseriesHistogram<T>::addBucketAggregated(
+    TimePoint now, size_t bucketIdx, const ValueType& total, uint64_t nsamples) {
+    addBucketAggregated(now, bucketIdx, total, nsamples, true);
+}
+
+template <typename T>
+void TimeseriesHistogram<T>::addBucketAggregated(
+    TimePoint now, size_t bucketIdx, const ValueType& total, uint64_t nsamples, bool updateTotals) {
+    mBuckets.getByIndex(bucketIdx).addValueAggregated(now, total, nsamples);
+    if (updateTotals) {
+        mTotals.addValueAggregated(now, total, nsamples);
+    }
+    markActive(bucketIdx);
+}
+
+template <typename T>
+template <typename Fn>
+void TimeseriesHistogram<T>::forEachActive(Fn fn) const {
+    for (size_t w = 0; w < mActive.size(); ++w) {
+        uint64_t bits = mActive[w];
+        while (bits != 0) {
+            fn(w * 64 + CountScan::lowestBit(bits));
+            bits &= bits - 1;
+        }
+    }
+}
+
+template <typename T>
+template <typename CountFn>
+void TimeseriesHistogram<T>::gatherCounts(uint64_t* counts, CountFn countFromBucket) const {
+    std::fill(counts, counts + mBuckets.getNumBuckets(), 0);
+    forEachActive([&](size_t b) { counts[b] = countFromBucket(mBuckets.getByIndex(b)); });
+}
 
 template <typename T>
 T TimeseriesHistogram<T>::getPercentileEstimate(
     double pct, size_t level) const {
-    return mBuckets.getPercentileEstimate(
-        pct / 100.0, CountFromLevel(level), AvgFromLevel(level));
+    uint64_t* counts = CountBuffer::local().reserve(mBuckets.getNumBuckets());
+    gatherCounts(counts, CountFromLevel(level));
+    uint64_t totalCount = CountScan::sum(counts, mBuckets.getNumBuckets());
+    return mBuckets.getPercentileEstimateFromCounts(
+        pct / 100.0, counts, totalCount, AvgFromLevel(level));
 }
 
 template <typename T>
 T TimeseriesHistogram<T>::getPercentileEstimate(
     double pct, TimePoint start, TimePoint end) const {
-    return mBuckets.getPercentileEstimate(
-        pct / 100.0,
-        CountFromInterval(start, end),
-        AvgFromInterval<T>(start, end));
+    uint64_t* counts = CountBuffer::local().reserve(mBuckets.getNumBuckets());
+    gatherCounts(counts, CountFromInterval(start, end));
+    uint64_t totalCount = CountScan::sum(counts, mBuckets.getNumBuckets());
+    return mBuckets.getPercentileEstimateFromCounts(
+        pct / 100.0, counts, totalCount, AvgFromInterval<T>(start, end));
 }
 
 template <typename T>
 size_t TimeseriesHistogram<T>::getPercentileBucketIdx(
     double pct, size_t level) const {
-    return mBuckets.getPercentileBucketIdx(pct / 100.0, CountFromLevel(level));
+    uint64_t* counts = CountBuffer::local().reserve(mBuckets.getNumBuckets());
+    gatherCounts(counts, CountFromLevel(level));
+    uint64_t totalCount = CountScan::sum(counts, mBuckets.getNumBuckets());
+    return mBuckets.getPercentileBucketIdxFromCounts(pct / 100.0, counts, totalCount);
 }
 
 template <typename T>
 size_t TimeseriesHistogram<T>::getPercentileBucketIdx(
     double pct, TimePoint start, TimePoint end) const {
-    return mBuckets.getPercentileBucketIdx(
-        pct / 100.0, CountFromInterval(start, end));
+    uint64_t* counts = CountBuffer::local().reserve(mBuckets.getNumBuckets());
+    gatherCounts(counts, CountFromInterval(start, end));
+    uint64_t totalCount = CountScan::sum(counts, mBuckets.getNumBuckets());
+    return mBuckets.getPercentileBucketIdxFromCounts(pct / 100.0, counts, totalCount);
 }
 
 template <typename T>
@@ -67,31 +120,119 @@ void TimeseriesHistogram<T>::clear() {
     for (size_t i = 0; i < mBuckets.getNumBuckets(); i++) {
         mBuckets.getByIndex(i).clear();
     }
+    mTotals.clear();
+    std::fill(mActive.begin(), mActive.end(), 0);
 }
 
 template <typename T>
 void TimeseriesHistogram<T>::update(TimePoint now) {
-    for (size_t i = 0; i < mBuckets.getNumBuckets(); i++) {
-        mBuckets.getByIndex(i).update(now);
+    mTotals.update(now);
+    size_t numLevels = mTotals.numLevels();
+    forEachActive([&](size_t b) {
+        auto& bucket = mBuckets.getByIndex(b);
+        bucket.update(now);
+        for (size_t level = 0; level < numLevels; ++level) {
+            if (bucket.count(level) != 0) {
+                return;
+            }
+        }
+        // 所有level上的数据都已经过期，之后的查询不需要再访问这个bucket
+        mActive[b / 64] &= ~(uint64_t(1) << (b % 64));
+    });
+}
+
+template <typename T>
+void TimeseriesHistogram<T>::summarize(
+    size_t level, const double pcts[], size_t nPcts, Summary* summary) const {
+    auto numBuckets = mBuckets.getNumBuckets();
+    uint64_t* counts = CountBuffer::local().reserve(numBuckets);
+
+    // 只收集可能有数据的bucket的count，sum和elapsed直接来自汇总
+    gatherCounts(counts, CountFromLevel(level));
+    ValueType total = mTotals.sum(level);
+    auto elapsed = mTotals.template elapsed<std::chrono::seconds>(level);
+    uint64_t totalCount = CountScan::sum(counts, numBuckets);
+
+    summary->count = totalCount;
+    summary->sum = total;
+    summary->avg = totalCount == 0 ? 0.0 : static_cast<double>(total / totalCount);
+    summary->rate = elapsed.count() == 0 ? 0.0 : total * 1.0 / elapsed.count();
+    summary->qps = elapsed.count() == 0 ? 0.0 : totalCount * 1.0 / elapsed.count();
+    MomentsBucket window = mTotals.windowTotal(level);
+    summary->max = window.max();
+    summary->stddev = window.stddev();
+    summary->bucketCounts = counts;
+    summary->numBuckets = numBuckets;
+
+    summary->percentiles.resize(nPcts);
+    for (size_t i = 0; i < nPcts; ++i) {
+        summary->percentiles[i] = mBuckets.getPercentileEstimateFromCounts(
+            pcts[i] / 100.0, counts, totalCount, AvgFromLevel(level));
+    }
+}
+
+template <typename T>
+void TimeseriesHistogram<T>::snapshot(HistogramSnapshot<T>* out) const {
+    out->reset(getBucketSize(), getMin(), getMax());
+    for (size_t level = 0; level < getNumLevels(); ++level) {
+        // elapsed与summarize()一样按秒计算，合并后的rate与报告中的一致
+        size_t window = out->addWindow(mTotals.getLevel(level).getDuration(),
+            mTotals.template elapsed<std::chrono::seconds>(level));
+        forEachActive([&](size_t b) {
+            const auto& bucket = mBuckets.getByIndex(b);
+            uint64_t count = bucket.count(level);
+            if (count != 0) {
+                out->addBucket(window, b, bucket.sum(level), count);
+            }
+        });
     }
 }
 
 template <typename T>
 std::string TimeseriesHistogram<T>::getString(size_t level) const {
-    std::stringstream result;
-    result.setf(std::ios::fixed);
-    result << std::setprecision(2);
-    result << "\t\t\"count\": " << count(level) << ",\n"
-        << "\t\t\"accu\": " << sum(level) << ",\n"
-        << "\t\t\"avg\": " << avg(level) << ",\n"
-        << "\t\t\"rate\": " << rate(level) << ",\n"
-        << "\t\t\"qps\": " << countRate(level) << ",\n"
-        << "\t\t\"99%\": " << getPercentileEstimate(99,level) << ",\n"
-        << "\t\t\"90%\": " << getPercentileEstimate(90,level) << ",\n"
-        << "\t\t\"80%\": " << getPercentileEstimate(80,level);
+    ReportBuffer result(256);
+    appendString(level, result);
     return result.str();
 }
 
+template <typename T>
+void TimeseriesHistogram<T>::appendString(size_t level, ReportBuffer& out) const {
+    // 每个线程复用同一个Summary，避免percentiles的内存分配
+    static thread_local Summary summary;
+    summarize(level, kReportPercentiles, kNumReportPercentiles, &summary);
+
+    out.append("\t\t\"count\": ");
+    out.appendUInt(summary.count);
+    out.append(",\n\t\t\"accu\": ");
+    appendValue(out, summary.sum);
+    out.append(",\n\t\t\"avg\": ");
+    out.appendDouble(summary.avg);
+    out.append(",\n\t\t\"rate\": ");
+    out.appendDouble(summary.rate);
+    out.append(",\n\t\t\"qps\": ");
+    out.appendDouble(summary.qps);
+    out.append(",\n\t\t\"99%\": ");
+    appendValue(out, summary.percentiles[0]);
+    out.append(",\n\t\t\"90%\": ");
+    appendValue(out, summary.percentiles[1]);
+    out.append(",\n\t\t\"80%\": ");
+    appendValue(out, summary.percentiles[2]);
+    out.append(",\n\t\t\"max\": ");
+    appendValue(out, summary.max);
+    out.append(",\n\t\t\"stddev\": ");
+    out.appendDouble(summary.stddev);
+}
+
+template <typename T>
+void TimeseriesHistogram<T>::appendValue(ReportBuffer& out, const ValueType& value) {
+    // 与std::fixed的输出保持一致：浮点数保留两位小数，整数原样输出
+    if constexpr (std::is_floating_point<ValueType>::value) {
+        out.appendDouble(value);
+    } else {
+        out.appendInt(static_cast<int64_t>(value));
+    }
+}
+
 template <typename T>
 std::string TimeseriesHistogram<T>::getString(
     TimePoint start, TimePoint end) const {
@@ -10,12 +10,14 @@
 #ifndef PERFORMANCE_TIMESERIESHISTOGRAM_H
 #define PERFORMANCE_TIMESERIESHISTOGRAM_H
 
+#include <initializer_list>
 #include <string>
-#include <iomanip>
-#include <sstream>
+#include <vector>
 
 #include "HistogramBuckets.h"
+#include "HistogramSnapshot.h"
 #include "MultiLevelTimeSeries.h"
+#include "ReportBuffer.h"
 
 /*
  * TimeseriesHistogram 跟踪一段时间的数据分布。
@@ -30,18 +32,52 @@
  * 你的bucket范围在0-100000之间，但第99百分位的估计值可能在115000左右，这个估计
  * 可能是非常错误的。
  *
- * 如果bucket数目为n，一般情况下的内存使用量约为3k*（n）。所有的插入操作都分摊到O（1），
- * 所有的查询都是O（n）。
+ * 如果bucket数目为n，一般情况下的内存使用量约为3k*（n）。所有的插入操作都分摊到O（1）。
+ *
+ * 除了每个bucket的MultiLevelTimeSeries，还有一个接收所有数据的MultiLevelTimeSeries，
+ * 它随插入和过期一起更新，所以整个level上的count、sum、avg、rate、countRate都是O（1）。
+ * 另外记录了哪些bucket中可能有数据，update()和百分位数查询只访问这些bucket，
+ * 其余的bucket一定是空的。给定时间范围的查询仍然是O（n）。
+ *
+ * 汇总使用BucketMoments，另外记录每个时间片的最小值、最大值和平方和，报告中的max和
+ * stddev来自汇总在窗口内的归约，与bucket的宽度无关。
  */
 template <typename VT>
 class TimeseriesHistogram {
 public:
     using ValueType = VT;
     using ContainerType = MultiLevelTimeSeries<VT>;
+    using TotalsType = MultiLevelTimeSeries<VT, BucketMoments>;
+    using MomentsBucket = typename TotalsType::BucketType;
     using Clock = std::chrono::steady_clock;
     using Duration = Clock::duration;
     using TimePoint = Clock::time_point;
 
+    /* getString()/appendString()报告中输出的百分位数 */
+    static constexpr double kReportPercentiles[] = { 99, 90, 80 };
+    static constexpr size_t kNumReportPercentiles = 3;
+
+    /*
+     * summarize()的结果，包含一个时间level上报告所需的全部统计量。
+     */
+    struct Summary {
+        uint64_t count = 0;
+        ValueType sum = ValueType();
+        double avg = 0.0;
+        // sum / elapsed，单位是value per second
+        double rate = 0.0;
+        // count / elapsed，单位是count per second
+        double qps = 0.0;
+        // 窗口内的最大值和总体标准差
+        ValueType max = ValueType();
+        double stddev = 0.0;
+        // 与传入的百分位数一一对应
+        std::vector<ValueType> percentiles;
+        // 每个bucket的count，指向当前线程的CountBuffer，该线程下一次summarize()之前有效
+        const uint64_t* bucketCounts = nullptr;
+        size_t numBuckets = 0;
+    };
+
     /*
      * 创建一个TimeSeries直方图并初始化buckets和levels。
      *
@@ -76,15 +112,36 @@ public:
     /* 向某个bucket中，添加给定次数的、时间now处的值value。 */
     void addValue(TimePoint now, const ValueType& value, uint64_t times);
 
-    /* 返回给定时间level中的数据count（所有bucket） */
-    uint64_t count(size_t level) const {
-        uint64_t total = 0;
-        for (size_t b = 0; b < mBuckets.getNumBuckets(); ++b) {
-            total += mBuckets.getByIndex(b).count(level);
-        }
-        return total;
+    /*
+     * 向第bucketIdx个bucket中添加时间now处的一批数据，总和为total，个数为nsamples。
+     * 用于把在别处按bucket预先汇总的数据（如PerformanceMarker的暂存区）写入直方图。
+     */
+    void addBucketAggregated(TimePoint now, size_t bucketIdx, const ValueType& total, uint64_t nsamples);
+
+    /*
+     * 同上，updateTotals为false时只写入bucket，汇总由调用方用addTotalAggregated()写入。
+     * 这样一批数据分散在多个bucket中时，汇总的min、max和平方和可以一次准确地写入，
+     * 而不是按每个bucket的平均值近似。
+     */
+    void addBucketAggregated(
+        TimePoint now, size_t bucketIdx, const ValueType& total, uint64_t nsamples, bool updateTotals);
+
+    /* 向汇总中写入时间now处的一批数据，包括它的min、max和平方和 */
+    void addTotalAggregated(TimePoint now, const MomentsBucket& total) { mTotals.addBucket(now, total); }
+
+    /* 同上，这批数据从firstTime开始累积，qps和rate的elapsed从firstTime算起 */
+    void addTotalAggregated(TimePoint now, const MomentsBucket& total, TimePoint firstTime)
+    {
+        mTotals.addBucket(now, total);
+        mTotals.backdate(firstTime);
     }
 
+    /* 返回value所在的bucket的下标，只读取bucket的划分，可以在任意线程调用 */
+    size_t getBucketIdx(const ValueType& value) const { return mBuckets.getBucketIdx(value); }
+
+    /* 返回给定时间level中的数据count（所有bucket） */
+    uint64_t count(size_t level) const { return mTotals.count(level); }
+
     /* 返回给定时间范围中的数据count（所有bucket）。  */
     uint64_t count(TimePoint start, TimePoint end) const {
         uint64_t total = 0;
@@ -94,14 +151,16 @@ public:
         return total;
     }
 
+    /* 返回给定时间level中的最大值，没有数据时返回ValueType() */
+    ValueType max(size_t level) const { return mTotals.windowTotal(level).max(); }
+
+    ValueType min(size_t level) const { return mTotals.windowTotal(level).min(); }
+
+    /* 返回给定时间level中数据的总体标准差 */
+    double stddev(size_t level) const { return mTotals.windowTotal(level).stddev(); }
+
     /* 返回给定时间等级中的数据sum（所有bucket中）。 */
-    ValueType sum(size_t level) const {
-        ValueType total = ValueType();
-        for (size_t b = 0; b < mBuckets.getNumBuckets(); ++b) {
-            total += mBuckets.getByIndex(b).sum(level);
-        }
-        return total;
-    }
+    ValueType sum(size_t level) const { return mTotals.sum(level); }
 
     /* 返回给定时间范围中的数据sum（所有bucket）。 */
     ValueType sum(TimePoint start, TimePoint end) const {
@@ -115,12 +174,8 @@ public:
     /* 返回给定时间等级中的数据avg（所有bucket）。 */
     template <typename ReturnType = double>
     ReturnType avg(size_t level) const {
-        auto total = ValueType();
-        uint64_t nsamples = 0;
-        for (size_t b = 0; b < mBuckets.getNumBuckets(); ++b) {
-            total += mBuckets.getByIndex(b).sum(level);
-            nsamples += mBuckets.getByIndex(b).count(level);
-        }
+        auto total = mTotals.sum(level);
+        uint64_t nsamples = mTotals.count(level);
         if(nsamples == 0){
             return ReturnType();
         }
@@ -148,13 +203,8 @@ public:
      */
     template <typename ReturnType = double, typename Interval = std::chrono::seconds>
     ReturnType rate(size_t level) const {
-        auto total = ValueType();
-        Interval elapsed(0);
-        for (size_t b = 0; b < mBuckets.getNumBuckets(); ++b) {
-            const auto& levelObj = mBuckets.getByIndex(b).getLevel(level);
-            total += levelObj.sum();
-            elapsed = std::max(elapsed, levelObj.template elapsed<Interval>());
-        }
+        auto total = mTotals.sum(level);
+        Interval elapsed = mTotals.template elapsed<Interval>(level);
         if(elapsed == Interval(0)){
             return ReturnType();
         }
@@ -170,9 +220,9 @@ public:
         auto total = ValueType();
         Interval elapsed(0);
         for (size_t b = 0; b < mBuckets.getNumBuckets(); ++b) {
-            const auto& levelObj = mBuckets.getByIndex(b).getLevel(start);
-            total += levelObj.sum(start,end);
-            elapsed = std::max(elapsed, levelObj.template elapsed<Interval>(start,end));
+            const auto& bucket = mBuckets.getByIndex(b);
+            total += bucket.sum(start,end);
+            elapsed = std::max(elapsed, bucket.template elapsed<Interval>(start,end));
         }
         if(elapsed == Interval(0)){
             return ReturnType();
@@ -186,12 +236,8 @@ public:
      */
     template <typename ReturnType = double, typename Interval = std::chrono::seconds>
     ReturnType countRate(size_t level) const {
-        auto total = count(level);
-        Interval elapsed(0);
-        for (size_t b = 0; b < mBuckets.getNumBuckets(); ++b) {
-            const auto& levelObj = mBuckets.getByIndex(b).getLevel(level);
-            elapsed = std::max(elapsed, levelObj.template elapsed<Interval>());
-        }
+        auto total = mTotals.count(level);
+        Interval elapsed = mTotals.template elapsed<Interval>(level);
         if(elapsed == Interval(0)){
             return ReturnType();
         }
@@ -207,8 +253,8 @@ public:
         auto total = count(start,end);
         Interval elapsed(0);
         for (size_t b = 0; b < mBuckets.getNumBuckets(); ++b) {
-            const auto& levelObj = mBuckets.getByIndex(b).getLevel(start);
-            elapsed = std::max(elapsed, levelObj.template elapsed<Interval>(start,end));
+            const auto& bucket = mBuckets.getByIndex(b);
+            elapsed = std::max(elapsed, bucket.template elapsed<Interval>(start,end));
         }
         if(elapsed == Interval(0)){
             return ReturnType();
@@ -235,12 +281,43 @@ public:
     ValueType getPercentileEstimate(
         double pct, TimePoint start, TimePoint end) const;
 
+    /*
+     * 只遍历一次所有bucket，计算给定level上的count、sum、avg、rate、qps以及任意多个百分位数。
+     *
+     * 结果与分别调用count()、sum()、avg()、rate()、countRate()、getPercentileEstimate()
+     * 一致，但每个bucket的MultiLevelTimeSeries只被访问一次。
+     *
+     * @param pcts    百分位数数组，范围是0-100
+     * @param nPcts   百分位数个数
+     * @param summary 输出结果，percentiles会被resize为nPcts，可复用以避免内存分配
+     */
+    void summarize(size_t level, const double pcts[], size_t nPcts, Summary* summary) const;
+
+    Summary summarize(size_t level, std::initializer_list<double> pcts) const
+    {
+        Summary summary;
+        summarize(level, pcts.begin(), pcts.size(), &summary);
+        return summary;
+    }
+
+    /*
+     * 把每个level上每个bucket的count和sum写入out，每个level对应一个窗口，out原有的内容被替换。
+     *
+     * 多个进程的快照合并之后可以得到准确的整体百分位数，见HistogramSnapshot。
+     */
+    void snapshot(HistogramSnapshot<ValueType>* out) const;
+
     /*
      * 对于给定的时间level，输出每个bucket的统计信息，
      * 类似于: bucketMin:-- count:-- avg:--
      */
     std::string getString(size_t level) const;
 
+    /*
+     * 把getString(level)的内容直接写入out，不产生临时字符串。
+     */
+    void appendString(size_t level, ReportBuffer& out) const;
+
     /*
      * 对于给定的时间范围，输出每个bucket的统计信息，
      */
@@ -258,6 +335,16 @@ public:
     /* 返回buckets的数目 */
     size_t getNumBuckets() const { return mBuckets.getNumBuckets(); }
 
+    /* 占用的堆内存字节数，不包括对象本身 */
+    size_t memoryUsage() const
+    {
+        size_t bytes = mBuckets.memoryUsage() + mTotals.memoryUsage() + mActive.capacity() * sizeof(uint64_t);
+        for (const ContainerType& bucket : mBuckets) {
+            bytes += bucket.memoryUsage();
+        }
+        return bytes;
+    }
+
     /*
      * 返回给定下标对应bucket的下边界值
      */
@@ -265,6 +352,13 @@ public:
         return mBuckets.getBucketMin(bucketIdx);
     }
 
+    /*
+     * 返回给定下标对应bucket的上边界值
+     */
+    ValueType getBucketMax(size_t bucketIdx) const {
+        return mBuckets.getBucketMax(bucketIdx);
+    }
+
     /* 返回给定下标对应bucket */
     const ContainerType& getBucket(size_t bucketIdx) const {
         return mBuckets.getByIndex(bucketIdx);
@@ -339,7 +433,23 @@ private:
         TimePoint end_;
     };
 
+    static void appendValue(ReportBuffer& out, const ValueType& value);
+
+    void markActive(size_t bucketIdx) { mActive[bucketIdx / 64] |= uint64_t(1) << (bucketIdx % 64); }
+
+    /* 按下标从小到大对每个可能有数据的bucket调用fn(bucketIdx) */
+    template <typename Fn>
+    void forEachActive(Fn fn) const;
+
+    /* 把level上每个bucket的count写入counts，只访问可能有数据的bucket */
+    template <typename CountFn>
+    void gatherCounts(uint64_t* counts, CountFn countFromBucket) const;
+
     HistogramBuckets<ValueType> mBuckets;
+    // 所有数据的汇总
+    TotalsType mTotals;
+    // 第i位为1表示第i个bucket中可能有数据，update()时清除已经没有数据的bucket
+    std::vector<uint64_t> mActive;
 };
 
 #include "TimeseriesHistogram-inl.h"
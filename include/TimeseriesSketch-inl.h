@@ -0,0 +1,189 @@
+//
+// Created by haosheng on 2021/10/16.
+//
+
+#ifndef PERFORMANCE_TIMESERIESSKETCH_INL_H
+#define PERFORMANCE_TIMESERIESSKETCH_INL_H
+
+#include <algorithm>
+
+template <typename VT>
+TimeseriesSketch<VT>::TimeseriesSketch(const std::vector<LevelConfig>& levels, const SketchType& defaultSketch)
+    : mDefaultSketch(defaultSketch)
+    , mFirstTime(TimePoint::max())
+    , mLatestTime(TimePoint::min())
+{
+    mDefaultSketch.clear();
+    for (const LevelConfig& config : levels) {
+        size_t numSlots = std::max<size_t>(config.numBuckets, 1);
+        Duration slotDuration = std::max(Duration(config.duration / int64_t(numSlots)), Duration(1));
+        mLevels.push_back(Level { config.duration, slotDuration, std::vector<Slot>(numSlots, Slot { -1, mDefaultSketch }) });
+    }
+}
+
+template <typename VT>
+void TimeseriesSketch<VT>::update(TimePoint now)
+{
+    mLatestTime = std::max(mLatestTime, now);
+    for (Level& level : mLevels) {
+        for (Slot& slot : level.slots) {
+            if (slot.seq >= 0 && !isLive(level, slot)) {
+                slot.sketch.clear();
+                slot.seq = -1;
+            }
+        }
+    }
+}
+
+template <typename VT>
+void TimeseriesSketch<VT>::clear()
+{
+    for (Level& level : mLevels) {
+        for (Slot& slot : level.slots) {
+            slot.sketch.clear();
+            slot.seq = -1;
+        }
+    }
+    mFirstTime = TimePoint::max();
+    mLatestTime = TimePoint::min();
+}
+
+template <typename VT>
+void TimeseriesSketch<VT>::addValue(TimePoint now, const ValueType& value, uint64_t times)
+{
+    mFirstTime = std::min(mFirstTime, now);
+    mLatestTime = std::max(mLatestTime, now);
+    for (Level& level : mLevels) {
+        int64_t seq = getSeq(level, now);
+        Slot& slot = level.slots[size_t(seq % int64_t(level.slots.size()))];
+        if (slot.seq != seq) {
+            // 这个位置已经被更新的时间片占用，now早于窗口
+            if (slot.seq > seq) {
+                continue;
+            }
+            slot.sketch.clear();
+            slot.seq = seq;
+        }
+        if (isLive(level, slot)) {
+            slot.sketch.add(value, times);
+        }
+    }
+}
+
+template <typename VT>
+uint64_t TimeseriesSketch<VT>::count(size_t level) const
+{
+    uint64_t total = 0;
+    for (const Slot& slot : mLevels[level].slots) {
+        if (isLive(mLevels[level], slot)) {
+            total += slot.sketch.count();
+        }
+    }
+    return total;
+}
+
+template <typename VT>
+VT TimeseriesSketch<VT>::sum(size_t level) const
+{
+    ValueType total = ValueType();
+    for (const Slot& slot : mLevels[level].slots) {
+        if (isLive(mLevels[level], slot)) {
+            total += slot.sketch.sum();
+        }
+    }
+    return total;
+}
+
+template <typename VT>
+template <typename Interval>
+Interval TimeseriesSketch<VT>::elapsed(size_t level) const
+{
+    if (isEmpty() || count(level) == 0) {
+        return Interval(0);
+    }
+    const Level& l = mLevels[level];
+    // 窗口内最早的时间片的起始时间
+    TimePoint windowStart((getSeq(l, mLatestTime) - int64_t(l.slots.size()) + 1) * l.slotDuration);
+    TimePoint earliest = std::max(mFirstTime, windowStart);
+    return std::chrono::duration_cast<Interval>(mLatestTime - earliest) + Interval(1);
+}
+
+template <typename VT>
+void TimeseriesSketch<VT>::getLevelSketch(size_t level, SketchType* out) const
+{
+    *out = mDefaultSketch;
+    for (const Slot& slot : mLevels[level].slots) {
+        if (isLive(mLevels[level], slot)) {
+            *out += slot.sketch;
+        }
+    }
+}
+
+template <typename VT>
+VT TimeseriesSketch<VT>::getPercentileEstimate(double pct, size_t level) const
+{
+    SketchType merged;
+    getLevelSketch(level, &merged);
+    return merged.getPercentileEstimate(pct);
+}
+
+template <typename VT>
+void TimeseriesSketch<VT>::summarize(size_t level, const double pcts[], size_t nPcts, Summary* summary) const
+{
+    SketchType merged;
+    getLevelSketch(level, &merged);
+    auto interval = elapsed<std::chrono::seconds>(level);
+
+    summary->count = merged.count();
+    summary->sum = merged.sum();
+    summary->avg = merged.avg();
+    summary->rate = interval.count() == 0 ? 0.0 : merged.sum() * 1.0 / interval.count();
+    summary->qps = interval.count() == 0 ? 0.0 : merged.count() * 1.0 / interval.count();
+    summary->bucketCounts = nullptr;
+    summary->numBuckets = 0;
+    summary->percentiles.resize(nPcts);
+    for (size_t i = 0; i < nPcts; ++i) {
+        summary->percentiles[i] = merged.getPercentileEstimate(pcts[i]);
+    }
+}
+
+template <typename VT>
+bool TimeseriesSketch<VT>::isMergeable(const TimeseriesSketch& other) const
+{
+    if (!mDefaultSketch.isMergeable(other.mDefaultSketch) || mLevels.size() != other.mLevels.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < mLevels.size(); ++i) {
+        if (mLevels[i].duration != other.mLevels[i].duration
+            || mLevels[i].slots.size() != other.mLevels[i].slots.size()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename VT>
+TimeseriesSketch<VT>& TimeseriesSketch<VT>::operator+=(const TimeseriesSketch& other)
+{
+    if (!isMergeable(other) || other.isEmpty()) {
+        return *this;
+    }
+    for (size_t i = 0; i < mLevels.size(); ++i) {
+        std::vector<Slot>& slots = mLevels[i].slots;
+        const std::vector<Slot>& otherSlots = other.mLevels[i].slots;
+        for (size_t s = 0; s < slots.size(); ++s) {
+            if (otherSlots[s].seq > slots[s].seq) {
+                slots[s].seq = otherSlots[s].seq;
+                slots[s].sketch.clear();
+            }
+            if (otherSlots[s].seq == slots[s].seq) {
+                slots[s].sketch += otherSlots[s].sketch;
+            }
+        }
+    }
+    mFirstTime = std::min(mFirstTime, other.mFirstTime);
+    mLatestTime = std::max(mLatestTime, other.mLatestTime);
+    return *this;
+}
+
+#endif //PERFORMANCE_TIMESERIESSKETCH_INL_H
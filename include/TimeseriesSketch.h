@@ -0,0 +1,146 @@
+/**
+ * Copyright (c) 2018 Duobei Brothers Information Technology Co.,Ltd. All rights reserved.
+ *
+ * Author: haosheng (sheng.hao@duobei.com)
+ *
+ * Date: 2021/10/16
+ *
+ */
+
+#ifndef PERFORMANCE_TIMESERIESSKETCH_H
+#define PERFORMANCE_TIMESERIESSKETCH_H
+
+#include <chrono>
+#include <vector>
+
+#include "DDSketch.h"
+#include "MultiLevelTimeSeries.h"
+#include "TimeseriesHistogram.h"
+
+/*
+ * TimeseriesSketch 与TimeseriesHistogram一样跟踪多个时间窗口内的数据分布，但用DDSketch代替
+ * 固定宽度的bucket，百分位数有相对误差保证，不需要预先设定[min, max]。
+ *
+ * 每个level的窗口被等分为若干个时间片，每个时间片是一个DDSketch，数据只写入当前时间片，
+ * 过时的时间片在下一次使用或update()时被清空。查询一个level时合并窗口内的时间片，
+ * 所以查询是O(时间片个数 * bin个数)，写入是O(level个数)。内存上界为
+ * level个数 * 时间片个数 * 2 * maxBins 个计数。
+ *
+ * 查询接口（count、sum、avg、rate、countRate、getPercentileEstimate、summarize）与
+ * TimeseriesHistogram相同。两个level配置和精度都相同的TimeseriesSketch可以用operator+=
+ * 合并，同一时间片的sketch相加。
+ */
+template <typename VT>
+class TimeseriesSketch {
+public:
+    using ValueType = VT;
+    using SketchType = DDSketch<VT>;
+    using Clock = std::chrono::steady_clock;
+    using Duration = Clock::duration;
+    using TimePoint = Clock::time_point;
+    using LevelConfig = typename MultiLevelTimeSeries<VT>::LevelConfig;
+    using Summary = typename TimeseriesHistogram<VT>::Summary;
+
+    /*
+     * @param levels        每个level的时间片个数和窗口长度，例如{{60, seconds(60)}, {60, seconds(3600)}}
+     * @param defaultSketch 每个时间片使用的DDSketch的精度和bin个数上限
+     */
+    explicit TimeseriesSketch(const std::vector<LevelConfig>& levels, const SketchType& defaultSketch = SketchType());
+
+    /* 在查询之前调用，清空已经过时的时间片 */
+    void update(TimePoint now);
+
+    void clear();
+
+    void addValue(TimePoint now, const ValueType& value) { addValue(now, value, 1); }
+    /* 添加times个时间now处的值value，早于所有窗口的数据被忽略 */
+    void addValue(TimePoint now, const ValueType& value, uint64_t times);
+
+    uint64_t count(size_t level) const;
+
+    ValueType sum(size_t level) const;
+
+    template <typename ReturnType = double>
+    ReturnType avg(size_t level) const
+    {
+        uint64_t nsamples = count(level);
+        return nsamples == 0 ? ReturnType() : static_cast<ReturnType>(sum(level) / nsamples);
+    }
+
+    /* 窗口内从最早的数据到最近一次写入或update()的时间，与BucketedTimeSeries::elapsed()相同 */
+    template <typename Interval = std::chrono::seconds>
+    Interval elapsed(size_t level) const;
+
+    /* sum / elapsed，单位是value per second */
+    template <typename ReturnType = double, typename Interval = std::chrono::seconds>
+    ReturnType rate(size_t level) const
+    {
+        Interval interval = elapsed<Interval>(level);
+        return interval == Interval(0) ? ReturnType() : ReturnType(sum(level) * 1.0 / interval.count());
+    }
+
+    /* count / elapsed，单位是count per second */
+    template <typename ReturnType = double, typename Interval = std::chrono::seconds>
+    ReturnType countRate(size_t level) const
+    {
+        Interval interval = elapsed<Interval>(level);
+        return interval == Interval(0) ? ReturnType() : ReturnType(count(level) * 1.0 / interval.count());
+    }
+
+    /* 返回给定level中给定百分位数处的值，pct的范围是0-100，相对误差不超过DDSketch的精度 */
+    ValueType getPercentileEstimate(double pct, size_t level) const;
+
+    /*
+     * 只合并一次时间片，计算给定level上的count、sum、avg、rate、qps以及多个百分位数。
+     * summary中的bucketCounts为空。
+     */
+    void summarize(size_t level, const double pcts[], size_t nPcts, Summary* summary) const;
+
+    /* 把给定level窗口内的所有时间片合并到out，out原有的数据被替换 */
+    void getLevelSketch(size_t level, SketchType* out) const;
+
+    size_t getNumLevels() const { return mLevels.size(); }
+
+    Duration getLevelDuration(size_t level) const { return mLevels[level].duration; }
+
+    /* level的个数、时间片个数、窗口长度和DDSketch的精度都相同时才能合并 */
+    bool isMergeable(const TimeseriesSketch& other) const;
+
+    /*
+     * 把other合并进来：同一个时间片的sketch相加，只有一方有数据的时间片取较新的一方。
+     * 不能合并时保持不变。
+     */
+    TimeseriesSketch& operator+=(const TimeseriesSketch& other);
+
+private:
+    struct Slot {
+        // 时间片的序号，即起始时间 / 时间片长度，-1表示没有数据
+        int64_t seq;
+        SketchType sketch;
+    };
+
+    struct Level {
+        Duration duration;
+        Duration slotDuration;
+        std::vector<Slot> slots;
+    };
+
+    static int64_t getSeq(const Level& level, TimePoint time) { return time.time_since_epoch() / level.slotDuration; }
+
+    /* 时间片是否还在窗口内 */
+    bool isLive(const Level& level, const Slot& slot) const
+    {
+        return slot.seq >= 0 && slot.seq > getSeq(level, mLatestTime) - int64_t(level.slots.size());
+    }
+
+    bool isEmpty() const { return mFirstTime > mLatestTime; }
+
+    SketchType mDefaultSketch;
+    std::vector<Level> mLevels;
+    TimePoint mFirstTime;
+    TimePoint mLatestTime;
+};
+
+#include "TimeseriesSketch-inl.h"
+
+#endif //PERFORMANCE_TIMESERIESSKETCH_H
@@ -0,0 +1,57 @@
+/**
+ * Copyright (c) 2018 Duobei Brothers Information Technology Co.,Ltd. All rights reserved.
+ *
+ * Author: haosheng (sheng.hao@duobei.com)
+ *
+ * Date: 2021/10/9
+ *
+ */
+
+#ifndef PERFORMANCE_WORKERPOOL_H
+#define PERFORMANCE_WORKERPOOL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * 固定大小的线程池，用于把一次报告的生成拆分到多个线程上。
+ *
+ * run(n, fn)在线程池和调用线程上并行执行fn(0) ... fn(n - 1)，全部完成后返回。
+ * 同一时刻只能有一个线程调用run()。
+ */
+class WorkerPool {
+public:
+    /* 创建numThreads个后台线程，加上调用run()的线程，共有numThreads + 1个线程参与计算 */
+    explicit WorkerPool(size_t numThreads);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    /* 参与计算的线程数，包括调用线程 */
+    size_t concurrency() const { return mThreads.size() + 1; }
+
+    void run(size_t numTasks, const std::function<void(size_t)>& fn);
+
+private:
+    void threadFunc();
+    /* 取出下一个任务执行，没有剩余任务时返回false。调用时持有lock */
+    bool runNext(std::unique_lock<std::mutex>& lock);
+
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    std::condition_variable mDone;
+    const std::function<void(size_t)>* mTask = nullptr;
+    size_t mNumTasks = 0;
+    size_t mNext = 0;
+    size_t mRemaining = 0;
+    bool mStop = false;
+    // 最后初始化
+    std::vector<std::thread> mThreads;
+};
+
+#endif //PERFORMANCE_WORKERPOOL_H
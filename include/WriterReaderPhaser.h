@@ -0,0 +1,110 @@
+/**
+ * Copyright (c) 2018 Duobei Brothers Information Technology Co.,Ltd. All rights reserved.
+ *
+ * Author: haosheng (sheng.hao@duobei.com)
+ *
+ * Date: 2021/10/8
+ *
+ */
+
+#ifndef PERFORMANCE_WRITERREADERPHASER_H
+#define PERFORMANCE_WRITERREADERPHASER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <thread>
+
+/*
+ * 写入方/读取方相位切换器（与HdrHistogram的WriterReaderPhaser相同的算法）。
+ *
+ * 数据被双缓冲为两个phase：写入方进入临界区时得到当前的phase，只写入这个phase的缓冲区；
+ * 读取方调用flipPhase()切换到另一个phase，并等待所有仍在旧phase中的写入方离开，之后
+ * 旧phase的缓冲区不会再被写入，可以安全地读取和清空。
+ *
+ * 写入方只有两次原子加法，不会被读取方阻塞；flipPhase()只等待切换前已经进入的写入方。
+ * 同一时刻只能有一个读取方调用flipPhase()，由调用方保证。
+ */
+class WriterReaderPhaser {
+public:
+    /* 写入方临界区，构造时进入，析构时离开 */
+    class WriterSection {
+    public:
+        explicit WriterSection(WriterReaderPhaser& phaser)
+            : mPhaser(phaser)
+            , mEpoch(phaser.mStartEpoch.fetch_add(1))
+        {
+        }
+
+        ~WriterSection()
+        {
+            (mEpoch < 0 ? mPhaser.mOddEndEpoch : mPhaser.mEvenEndEpoch).fetch_add(1);
+        }
+
+        WriterSection(const WriterSection&) = delete;
+        WriterSection& operator=(const WriterSection&) = delete;
+
+        /* 当前写入方应该写入的缓冲区，0或1 */
+        size_t phase() const { return mEpoch < 0 ? 1 : 0; }
+
+    private:
+        WriterReaderPhaser& mPhaser;
+        int64_t mEpoch;
+    };
+
+    /* 当前写入方使用的phase */
+    size_t activePhase() const { return mStartEpoch.load() < 0 ? 1 : 0; }
+
+    /*
+     * 切换phase，返回之后所有写入方都已经离开旧的phase。
+     *
+     * @return 旧的phase，它的缓冲区现在只有读取方访问
+     */
+    size_t flipPhase()
+    {
+        bool timedOut = false;
+        return flipPhase(std::chrono::nanoseconds::max(), &timedOut);
+    }
+
+    /*
+     * 与flipPhase()相同，但最多等待timeout。
+     *
+     * 写入方在另一个进程中、进程在临界区内被kill时，它永远不会离开旧的phase。超时之后
+     * phase仍然已经切换，timedOut为true，调用方可以读取旧phase，但仍在其中的写入方
+     * 可能还会写入。下一次切换到这个phase时它的结束计数被重置，已经死掉的写入方不再被等待。
+     *
+     * @return 旧的phase
+     */
+    size_t flipPhase(std::chrono::nanoseconds timeout, bool* timedOut)
+    {
+        bool nextPhaseIsEven = mStartEpoch.load() < 0;
+        int64_t initialStartValue = nextPhaseIsEven ? 0 : kOddStart;
+        // 新phase的结束计数要在写入方进入之前重置
+        (nextPhaseIsEven ? mEvenEndEpoch : mOddEndEpoch).store(initialStartValue);
+
+        int64_t startValueAtFlip = mStartEpoch.exchange(initialStartValue);
+        // 旧phase中进入了多少写入方，就等待多少写入方离开
+        auto& previousEndEpoch = nextPhaseIsEven ? mOddEndEpoch : mEvenEndEpoch;
+        *timedOut = false;
+        auto start = std::chrono::steady_clock::now();
+        while (previousEndEpoch.load() != startValueAtFlip) {
+            if (std::chrono::steady_clock::now() - start >= timeout) {
+                *timedOut = true;
+                break;
+            }
+            std::this_thread::yield();
+        }
+        return nextPhaseIsEven ? 1 : 0;
+    }
+
+private:
+    static constexpr int64_t kOddStart = std::numeric_limits<int64_t>::min();
+
+    // 非负时处于偶数phase（0），负数时处于奇数phase（1）
+    std::atomic<int64_t> mStartEpoch { 0 };
+    std::atomic<int64_t> mEvenEndEpoch { 0 };
+    std::atomic<int64_t> mOddEndEpoch { kOddStart };
+};
+
+#endif //PERFORMANCE_WRITERREADERPHASER_H
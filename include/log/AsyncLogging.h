@@ -20,35 +20,49 @@
 // append(): when buffer A is full(?), notify the looping thread to log
 // all the full buffers and the buffer being written.
 // threadFunc(): log buffers, swap buffer B buffer A
+// rollSize, rollInterval, maxFiles, suffix are passed to LogFile.
 class AsyncLogging {
 public:
-    AsyncLogging(std::string& fileName, int flushInterval);
+    AsyncLogging(std::string& fileName, int flushInterval, uint32_t rollSize = 1000 * 1000,
+        uint32_t rollInterval = 0, uint32_t maxFiles = 0, const std::string& suffix = ".log");
+    ~AsyncLogging() { stop(); }
 
     void append(const char* logLine, int len);
 
     void threadFunc();
 
+    // writes everything appended so far, then joins the thread
     void stop()
     {
-        mIsRunning = false;
-        mCondition.notify_one();
-        mThread.join();
+        if (mThread.joinable()) {
+            {
+                std::lock_guard<std::mutex> guard(mMutex);
+                mIsRunning = false;
+            }
+            mCondition.notify_one();
+            mThread.join();
+        }
     }
 
 private:
-    const int kFixedSize = 1000;
+    const size_t kFixedSize = 1000;
     const int kFlushInterval;
     std::string mFileName;
+    uint32_t mRollSize;
+    uint32_t mRollInterval;
+    uint32_t mMaxFiles;
+    std::string mSuffix;
     std::atomic<bool> mIsRunning;
-    std::thread mThread;
 
-    using Buffer = std::stringstream;
+    using Buffer = std::string;
     using BufferPtr = std::unique_ptr<Buffer>;
     using BufferVector = std::vector<BufferPtr>;
     std::mutex mMutex;
     std::condition_variable mCondition;
     BufferPtr mCurrentBuffer;
     BufferVector mBuffers;
+    // started last, after everything above is initialized
+    std::thread mThread;
 };
 
 #endif // PERFORMANCEMARKER_ASYNCLOGGING_H
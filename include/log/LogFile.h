@@ -11,9 +11,13 @@
 
 #include "TimeStamp.h"
 
+// 文件名为 fileName.%Y%m%d-%H%M%S.pid.log
+// 写入超过rollSize字节，或者进入新的rollInterval秒周期时换一个新文件；
+// maxFiles不为0时，只保留最新的maxFiles个同名文件。
 class LogFile {
 public:
-    LogFile(std::string& fileName, uint32_t rollSize, uint32_t flushInterval);
+    LogFile(std::string& fileName, uint32_t rollSize = 10 * 1000, uint32_t flushInterval = 10,
+        uint32_t rollInterval = 0, uint32_t maxFiles = 0, const std::string& suffix = ".log");
     ~LogFile() = default;
 
     void append(const char* logLine, int len);
@@ -22,9 +26,14 @@ public:
 
     void flush() { mFile.flush(); }
 
-    static std::string getLogFileName(const std::string& fileName);
+    static std::string getLogFileName(const std::string& fileName, const std::string& suffix = ".log");
 
 private:
+    // 删除最旧的文件，只保留mMaxFiles个
+    void removeOldFiles();
+
+    std::string mBaseName;
+    std::string mSuffix;
     std::string mFileName;
     std::ofstream mFile;
 
@@ -32,6 +41,10 @@ private:
     uint32_t mRollSize;
     uint32_t mFlushInterval;
     uint32_t mLastFlush;
+    uint32_t mRollInterval;
+    uint32_t mMaxFiles;
+    // 当前文件所在的rollInterval周期的起始时间
+    uint64_t mStartOfPeriod;
 };
 
 #endif // PERFORMANCEMARKER_LOGFILE_H
@@ -6,6 +6,7 @@
 #define PERFORMANCEMARKER_LOGGER_H
 
 #include <chrono>
+#include <cstring>
 #include <sstream>
 #include <string>
 
@@ -0,0 +1,97 @@
+//
+// Created by haosheng on 2021/10/13.
+//
+#include "AggregatorFrame.h"
+
+#include <cstring>
+
+using namespace std;
+
+namespace {
+
+void appendVarint(ReportBuffer& out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out.append(char((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.append(char(value));
+}
+
+bool readVarint(const char*& pos, const char* end, uint64_t* value)
+{
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && pos < end; shift += 7) {
+        auto byte = uint8_t(*pos++);
+        result |= uint64_t(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+}
+
+void AggregatorFrame::begin(ReportBuffer& out)
+{
+    mOut = &out;
+    mStart = out.size();
+    mCount = 0;
+    // payloadSize先占位，finish()时回填
+    mOut->append(string_view(kMagic, sizeof(kMagic)));
+    mOut->append(string_view("\0\0\0\0", 4));
+}
+
+void AggregatorFrame::add(string_view name, const Snapshot& snapshot)
+{
+    appendVarint(*mOut, name.size());
+    mOut->append(name);
+    snapshot.serialize(*mOut);
+    ++mCount;
+}
+
+void AggregatorFrame::finish()
+{
+    auto payloadSize = uint32_t(mOut->size() - mStart - kHeaderSize);
+    memcpy(mOut->data() + mStart + sizeof(kMagic), &payloadSize, sizeof(payloadSize));
+    mOut = nullptr;
+}
+
+AggregatorFrame::ParseResult AggregatorFrame::parse(
+    const char* data, size_t size, size_t* frameSize, const Callback& fn)
+{
+    if (size < kHeaderSize) {
+        // 不完整的magic也要尽早发现
+        return memcmp(data, kMagic, min(size, sizeof(kMagic))) == 0 ? ParseResult::Incomplete : ParseResult::Invalid;
+    }
+    uint32_t payloadSize;
+    memcpy(&payloadSize, data + sizeof(kMagic), sizeof(payloadSize));
+    if (memcmp(data, kMagic, sizeof(kMagic)) != 0 || payloadSize > kMaxPayloadSize) {
+        return ParseResult::Invalid;
+    }
+    if (size - kHeaderSize < payloadSize) {
+        return ParseResult::Incomplete;
+    }
+
+    const char* pos = data + kHeaderSize;
+    const char* end = pos + payloadSize;
+    Snapshot snapshot;
+    while (pos < end) {
+        uint64_t nameSize;
+        if (!readVarint(pos, end, &nameSize) || nameSize > size_t(end - pos)) {
+            return ParseResult::Invalid;
+        }
+        string_view name(pos, size_t(nameSize));
+        pos += nameSize;
+        size_t consumed = 0;
+        if (!snapshot.parse(pos, size_t(end - pos), &consumed)) {
+            return ParseResult::Invalid;
+        }
+        pos += consumed;
+        fn(name, snapshot);
+    }
+    *frameSize = kHeaderSize + payloadSize;
+    return ParseResult::Ok;
+}
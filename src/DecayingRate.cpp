@@ -0,0 +1,96 @@
+//
+// Created by haosheng on 2021/10/18.
+//
+#include "DecayingRate.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+DecayingRate::DecayingRate(initializer_list<Duration> windows, Duration tick)
+    : mTick(max(tick, Duration(1)))
+    , mTickSeconds(chrono::duration<double>(mTick).count())
+{
+    for (Duration window : windows) {
+        if (mNumWindows == kMaxWindows) {
+            break;
+        }
+        Window& w = mWindows[mNumWindows++];
+        w.duration = window;
+        w.decay = exp(-mTickSeconds / max(chrono::duration<double>(window).count(), mTickSeconds));
+    }
+}
+
+void DecayingRate::addValue(TimePoint now, double value, uint64_t count)
+{
+    // 先折算之前的tick，这样未折算的数据总是属于同一个tick
+    if (mLastTick.load(memory_order_acquire) == kNotStarted) {
+        start(now);
+    } else {
+        tickIfNecessary(now);
+    }
+    mUncountedCount.fetch_add(count, memory_order_relaxed);
+    double current = mUncountedSum.load(memory_order_relaxed);
+    while (!mUncountedSum.compare_exchange_weak(current, current + value * double(count), memory_order_relaxed)) {
+    }
+}
+
+void DecayingRate::start(TimePoint now)
+{
+    // 同时写入第一个采样点的几个线程的时间相差无几，保留哪一个都可以
+    mFirstSample.store(now.time_since_epoch().count(), memory_order_relaxed);
+    int64_t expected = kNotStarted;
+    if (!mLastTick.compare_exchange_strong(expected, now.time_since_epoch() / mTick, memory_order_acq_rel)) {
+        tickIfNecessary(now);
+    }
+}
+
+void DecayingRate::tickIfNecessary(TimePoint now)
+{
+    int64_t current = now.time_since_epoch() / mTick;
+    int64_t last = mLastTick.load(memory_order_acquire);
+    if (last == kNotStarted || current <= last) {
+        return;
+    }
+    // 只有把mLastTick推进到current的线程进行折算，其余线程直接返回
+    if (!mLastTick.compare_exchange_strong(last, current, memory_order_acq_rel)) {
+        return;
+    }
+
+    // 未折算的数据都属于第last个tick，之后的空tick只衰减，合并为一次乘法
+    auto idleTicks = double(current - last - 1);
+    double seconds = mTickSeconds;
+    bool initialized = mInitialized.load(memory_order_relaxed);
+    if (!initialized) {
+        // 第一个tick不完整时与下一个tick合并，下一个tick还没有结束时数据留到那时再折算
+        Duration elapsed = mTick * (last + 1) - Duration(mFirstSample.load(memory_order_relaxed));
+        if (elapsed < mTick) {
+            if (idleTicks == 0) {
+                return;
+            }
+            elapsed += mTick;
+            idleTicks -= 1;
+        }
+        seconds = chrono::duration<double>(elapsed).count();
+        mInitialized.store(true, memory_order_relaxed);
+    }
+    double countRate = double(mUncountedCount.exchange(0, memory_order_relaxed)) / seconds;
+    double sumRate = mUncountedSum.exchange(0, memory_order_relaxed) / seconds;
+    for (size_t i = 0; i < mNumWindows; ++i) {
+        Window& w = mWindows[i];
+        double count = countRate;
+        double sum = sumRate;
+        if (initialized) {
+            count += w.decay * (w.countRate.load(memory_order_relaxed) - countRate);
+            sum += w.decay * (w.sumRate.load(memory_order_relaxed) - sumRate);
+        }
+        if (idleTicks > 0) {
+            double idleDecay = pow(w.decay, idleTicks);
+            count *= idleDecay;
+            sum *= idleDecay;
+        }
+        w.countRate.store(count, memory_order_relaxed);
+        w.sumRate.store(sum, memory_order_relaxed);
+    }
+}
@@ -0,0 +1,142 @@
+//
+// Created by haosheng on 2021/10/19.
+//
+#include "ExemplarReservoir.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+
+using namespace std;
+
+namespace {
+
+atomic<uint64_t> g_nextReservoirId { 1 };
+// 线程缓存达到这么多个分片时才检查其中是否有已经销毁的reservoir
+constexpr size_t kShardCachePurgeSize = 64;
+
+/* 还没有销毁的reservoir的id，线程缓存按它清理；不析构，进程退出时仍然可以使用 */
+struct LiveReservoirs {
+    mutex lock;
+    unordered_set<uint64_t> ids;
+};
+
+LiveReservoirs& liveReservoirs()
+{
+    static auto* live = new LiveReservoirs();
+    return *live;
+}
+
+bool greaterValue(const Exemplar& lhs, const Exemplar& rhs)
+{
+    return lhs.value > rhs.value;
+}
+
+}
+
+ExemplarReservoir::ExemplarReservoir(size_t capacity)
+    : mCapacity(max<size_t>(capacity, 1))
+    , mId(g_nextReservoirId.fetch_add(1, memory_order_relaxed))
+{
+    auto& live = liveReservoirs();
+    lock_guard<mutex> guard(live.lock);
+    live.ids.insert(mId);
+}
+
+ExemplarReservoir::~ExemplarReservoir()
+{
+    auto& live = liveReservoirs();
+    lock_guard<mutex> guard(live.lock);
+    live.ids.erase(mId);
+}
+
+ExemplarReservoir::Shard& ExemplarReservoir::localShard()
+{
+    // 大部分线程连续写入同一个metric，先检查上一次使用的分片
+    thread_local uint64_t lastId = 0;
+    thread_local Shard* lastShard = nullptr;
+    if (lastId == mId) {
+        return *lastShard;
+    }
+    thread_local unordered_map<uint64_t, Shard*> shards;
+    thread_local size_t purgeSize = kShardCachePurgeSize;
+    auto it = shards.find(mId);
+    if (it == shards.end()) {
+        // 已经销毁的reservoir的分片指针不会再被使用（id不会重复），只是占用内存，
+        // 缓存变大时一起清理，下一次清理的门槛是剩余个数的两倍
+        if (shards.size() >= purgeSize) {
+            auto& live = liveReservoirs();
+            lock_guard<mutex> guard(live.lock);
+            for (auto cached = shards.begin(); cached != shards.end();) {
+                cached = live.ids.count(cached->first) ? next(cached) : shards.erase(cached);
+            }
+            purgeSize = max(kShardCachePurgeSize, shards.size() * 2);
+        }
+        lock_guard<mutex> guard(mShardsLock);
+        mShards.push_back(make_unique<Shard>());
+        it = shards.emplace(mId, mShards.back().get()).first;
+    }
+    lastId = mId;
+    lastShard = it->second;
+    return *it->second;
+}
+
+void ExemplarReservoir::insert(Shard& shard, double value, string_view payload)
+{
+    Exemplar exemplar;
+    exemplar.value = value;
+    exemplar.timestamp = uint64_t(
+        chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count());
+    exemplar.payloadLength = uint32_t(min(payload.size(), Exemplar::kMaxPayload));
+    memcpy(exemplar.payload, payload.data(), exemplar.payloadLength);
+
+    lock_guard<mutex> guard(shard.lock);
+    auto& heap = shard.heap;
+    if (heap.size() == mCapacity) {
+        // collect()之后门槛被重置，这里需要再比较一次
+        if (value <= heap.front().value) {
+            return;
+        }
+        pop_heap(heap.begin(), heap.end(), greaterValue);
+        heap.back() = exemplar;
+    } else {
+        heap.push_back(exemplar);
+    }
+    push_heap(heap.begin(), heap.end(), greaterValue);
+    if (heap.size() == mCapacity) {
+        shard.threshold.store(heap.front().value, memory_order_relaxed);
+    }
+}
+
+size_t ExemplarReservoir::memoryUsage() const
+{
+    lock_guard<mutex> shardsGuard(mShardsLock);
+    size_t bytes = mShards.capacity() * sizeof(unique_ptr<Shard>) + mCollected.capacity() * sizeof(Exemplar);
+    for (auto& shard : mShards) {
+        lock_guard<mutex> guard(shard->lock);
+        bytes += sizeof(Shard) + shard->heap.capacity() * sizeof(Exemplar);
+    }
+    return bytes;
+}
+
+const vector<Exemplar>& ExemplarReservoir::collect(uint64_t minTimestamp)
+{
+    {
+        lock_guard<mutex> shardsGuard(mShardsLock);
+        for (auto& shard : mShards) {
+            lock_guard<mutex> guard(shard->lock);
+            mCollected.insert(mCollected.end(), shard->heap.begin(), shard->heap.end());
+            shard->heap.clear();
+            shard->threshold.store(-numeric_limits<double>::infinity(), memory_order_relaxed);
+        }
+    }
+    mCollected.erase(remove_if(mCollected.begin(), mCollected.end(),
+                         [minTimestamp](const Exemplar& e) { return e.timestamp < minTimestamp; }),
+        mCollected.end());
+    size_t keep = min(mCollected.size(), mCapacity);
+    partial_sort(mCollected.begin(), mCollected.begin() + ptrdiff_t(keep), mCollected.end(), greaterValue);
+    mCollected.resize(keep);
+    return mCollected;
+}
@@ -0,0 +1,55 @@
+//
+// Created by haosheng on 2021/10/11.
+//
+#include "MetricsSnapshot.h"
+
+#include <cstring>
+
+using namespace std;
+
+shared_ptr<const MetricsSnapshot> MetricsSnapshot::create(const char* data, size_t size)
+{
+    shared_ptr<MetricsSnapshot> snapshot(new MetricsSnapshot());
+    snapshot->mData.resize((size + 7) / 8);
+    if (size != 0) {
+        memcpy(snapshot->mData.data(), data, size);
+    }
+    if (!snapshot->mReader.open(reinterpret_cast<const char*>(snapshot->mData.data()), size)) {
+        return nullptr;
+    }
+    return snapshot;
+}
+
+const SnapshotRecord* MetricsSnapshot::find(string_view name, uint32_t windowSeconds) const
+{
+    // 找到第一条名称不小于name的记录
+    size_t low = 0;
+    size_t high = recordCount();
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (this->name(record(mid)) < name) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    for (size_t idx = low; idx < recordCount() && this->name(record(idx)) == name; ++idx) {
+        if (windowSeconds == 0 || record(idx).windowSeconds == windowSeconds) {
+            return &record(idx);
+        }
+    }
+    return nullptr;
+}
+
+bool MetricsSnapshot::percentile(const SnapshotRecord& record, double pct, double* value) const
+{
+    const auto& header = mReader.header();
+    for (size_t i = 0; i < header.percentileCount; ++i) {
+        if (header.percentiles[i] == pct) {
+            *value = record.percentiles[i];
+            return true;
+        }
+    }
+    return false;
+}
@@ -3,20 +3,123 @@
 //
 #include "PerformanceMarker.h"
 
+#include "SnapshotReader.h"
+
+#include <algorithm>
+#include <limits>
+#include <unordered_set>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
 using namespace std;
 
+namespace {
+
+// 最短的时间窗口使用的bucket个数，更长的窗口只接收滚入的数据，使用较少的bucket
+constexpr size_t kFineBuckets = 100;
+constexpr size_t kCoarseBuckets = 20;
+// 所有metric的直方图使用相同的bucket划分
+constexpr double kBucketSize = 1e3;
+constexpr double kMinValue = -1e5;
+constexpr double kMaxValue = 1e5;
+// 有界模式下SpaceSaving的计数器个数是跟踪个数的倍数，多出的计数器用于发现新的高频名称
+constexpr size_t kCandidateFactor = 4;
+// std::map的每个节点除了key和value，还有三个指针和颜色
+constexpr size_t kMapNodeOverhead = 4 * sizeof(void*);
+
+// 短字符串保存在对象内部，不占用堆内存
+size_t stringHeapBytes(const string& value)
+{
+    const char* data = value.data();
+    auto self = reinterpret_cast<const char*>(&value);
+    return data >= self && data < self + sizeof(string) ? 0 : value.capacity() + 1;
+}
+
+}
+
 PerformanceMarker* PerformanceMarker::mInstance = nullptr;
 chrono::seconds PerformanceMarker::mDuration {};
+vector<uint32_t> PerformanceMarker::mWindows {};
 string PerformanceMarker::mPrefix {};
+PerformanceMarker::ReportFormat PerformanceMarker::mFormat = PerformanceMarker::ReportFormat::Json;
+string PerformanceMarker::mJournalName {};
+uint32_t PerformanceMarker::mJournalRollSize = 64 * 1024 * 1024;
+uint32_t PerformanceMarker::mJournalRollInterval = 24 * 60 * 60;
+uint32_t PerformanceMarker::mJournalMaxFiles = 7;
+uint32_t PerformanceMarker::mKeyframeInterval = 0;
+uint32_t PerformanceMarker::mReportThreads = 0;
+size_t PerformanceMarker::mMaxMetrics = 0;
+chrono::seconds PerformanceMarker::mMetricTtl {};
 mutex PerformanceMarker::mLock {};
 
 void PerformanceMarker::initialize(const std::string& prefix, uint32_t intervalSeconds)
 {
     mPrefix = prefix;
     mDuration = std::chrono::seconds(intervalSeconds);
+    // 之前设置的窗口中比报告周期短的不能使用，见setReportWindows()
+    mWindows.erase(remove_if(mWindows.begin(), mWindows.end(), [intervalSeconds](uint32_t window) { return window < intervalSeconds; }),
+        mWindows.end());
+    if (mWindows.empty()) {
+        mWindows.push_back(intervalSeconds);
+    }
     PerformanceMarker::getInstance();
 }
 
+bool PerformanceMarker::setReportWindows(const std::vector<uint32_t>& windowSeconds)
+{
+    vector<uint32_t> windows;
+    for (uint32_t window : windowSeconds) {
+        if (window != 0) {
+            windows.push_back(window);
+        }
+    }
+    sort(windows.begin(), windows.end());
+    windows.erase(unique(windows.begin(), windows.end()), windows.end());
+    // 暂存的数据每个报告周期才写入直方图一次，更短的窗口会把整个周期的数据算在窗口内
+    if (!windows.empty() && chrono::seconds(windows[0]) < mDuration) {
+        return false;
+    }
+    // 在initialize()之前调用时mDuration为0，由initialize()使用报告周期并去掉更短的窗口
+    if (windows.empty() && mDuration.count() != 0) {
+        windows.push_back(uint32_t(mDuration.count()));
+    }
+    if (mInstance == nullptr) {
+        mWindows = windows;
+        return true;
+    }
+    // 生成报告时遍历mWindows，新metric在独占mMetricsLock时按mWindows创建直方图
+    lock_guard<mutex> reportGuard(mInstance->mReportLock);
+    unique_lock<shared_mutex> metricsGuard(mInstance->mMetricsLock);
+    if (!mInstance->mBuckets.empty() || !mInstance->mRetired.empty()) {
+        return false;
+    }
+    mWindows = windows;
+    return true;
+}
+
+TimeseriesHistogram<double> PerformanceMarker::makeHistogram()
+{
+    if (mWindows.size() <= 1) {
+        chrono::seconds window = mWindows.empty() ? mDuration : chrono::seconds(mWindows[0]);
+        return TimeseriesHistogram<double>(kBucketSize, kMinValue, kMaxValue, MultiLevelTimeSeries<double>(kFineBuckets, { window }));
+    }
+    vector<MultiLevelTimeSeries<double>::LevelConfig> levels;
+    for (uint32_t window : mWindows) {
+        levels.push_back({ levels.empty() ? kFineBuckets : kCoarseBuckets, chrono::seconds(window) });
+    }
+    return TimeseriesHistogram<double>(kBucketSize, kMinValue, kMaxValue, MultiLevelTimeSeries<double>(levels, true));
+}
+
+void PerformanceMarker::setJournal(const std::string& fileName, uint32_t rollSize, uint32_t rollInterval, uint32_t maxFiles)
+{
+    mJournalName = fileName;
+    mJournalRollSize = rollSize;
+    mJournalRollInterval = rollInterval;
+    mJournalMaxFiles = maxFiles;
+}
+
 PerformanceMarker& PerformanceMarker::getInstance()
 {
     if (mInstance == nullptr) {
@@ -25,58 +128,918 @@ PerformanceMarker& PerformanceMarker::getInstance()
             mInstance = new PerformanceMarker();
             mInstance->mTimer.add(
                 std::chrono::steady_clock::now() + mDuration,
-                [](CppTime::timer_id id) -> void {
-                    mInstance->mReport += "{\n";
-                    int idx = 0;
-                    for (auto& bucket : mInstance->mBuckets) {
-                        // 清除bucket中过时数据
-                        bucket.second.update(chrono::steady_clock::now());
-                        mInstance->mReport.append("\t\"" + mPrefix + "_" + bucket.first + "\": {\n" + bucket.second.getString(0) + "\n\t}");
-                        idx == mInstance->mBuckets.size() - 1 ? mInstance->mReport.append("\n") : mInstance->mReport.append(",\n");
-                        idx++;
-                    }
-                    mInstance->mReport += "}";
-
-                    // 打开对应日期时间的文件，并写入数据
-                    auto currentTime = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-                    std::stringstream ss;
-                    ss << std::put_time(std::localtime(&currentTime), "%Y.%m.%d-%H.%M.%S.json");
-                    ofstream outfile;
-                    outfile.open( ss.str());
-                    if (outfile) {
-                        outfile << mInstance->mReport;
-                        outfile.close();
-                    }
-                    mInstance->mReport = "";
-                },
+                [](CppTime::timer_id id) -> void { mInstance->report(); },
                 mDuration);
         }
     }
     return *mInstance;
 }
 
+#ifndef _WIN32
+bool PerformanceMarker::publishToSharedMemory(const std::string& name, size_t capacity)
+{
+    auto& instance = getInstance();
+    std::lock_guard<std::mutex> guard(instance.mPublisherLock);
+    return instance.mPublisher.open(name, capacity);
+}
+
+bool PerformanceMarker::serveMetrics(uint16_t port)
+{
+    return getInstance().mMetricsServer.listenTcp(port);
+}
+
+bool PerformanceMarker::serveMetrics(const std::string& unixSocketPath)
+{
+    return getInstance().mMetricsServer.listenUnix(unixSocketPath);
+}
+
+bool PerformanceMarker::forwardToAggregator(const std::string& unixSocketPath)
+{
+    auto& instance = getInstance();
+    std::lock_guard<std::mutex> guard(instance.mReportLock);
+    if (!instance.mAggregator.open(unixSocketPath)) {
+        return false;
+    }
+    instance.mForwarding.store(true, memory_order_relaxed);
+    return true;
+}
+
+bool PerformanceMarker::enableSharedMetrics(size_t capacity)
+{
+    auto& instance = getInstance();
+    std::lock_guard<std::mutex> guard(instance.mReportLock);
+    if (instance.mSharedTable) {
+        return true;
+    }
+    auto table = std::make_unique<SharedMetricTable>();
+    if (!table->create(capacity, makeHistogram().getNumBuckets())) {
+        return false;
+    }
+    instance.mSharedMetrics.assign(capacity, nullptr);
+    instance.mSharedTable = move(table);
+    instance.mSharedOwner = getpid();
+    return true;
+}
+
+bool PerformanceMarker::listenStatsd(uint16_t port)
+{
+    auto& instance = getInstance();
+    return instance.mStatsd.listenUdp(port,
+        [&instance](const StatsdSample* samples, size_t count) { instance.addStatsdBatch(samples, count); });
+}
+
+bool PerformanceMarker::listenStatsd(const std::string& unixSocketPath)
+{
+    auto& instance = getInstance();
+    return instance.mStatsd.listenUnix(unixSocketPath,
+        [&instance](const StatsdSample* samples, size_t count) { instance.addStatsdBatch(samples, count); });
+}
+
+void PerformanceMarker::addStatsdBatch(const StatsdSample* samples, size_t count)
+{
+    WriterReaderPhaser::WriterSection section(mPhaser);
+    // 移出的metric在这个WriterSection离开之前不会被释放，之后的批次按mRetireGeneration清空缓存
+    uint64_t generation = mRetireGeneration.load(memory_order_acquire);
+    if (generation != mStatsdGeneration) {
+        mStatsdMetrics.clear();
+        mStatsdGeneration = generation;
+    }
+    Metric* metric = nullptr;
+    for (size_t i = 0; i < count; ++i) {
+        const StatsdSample& sample = samples[i];
+        // 同一个客户端的数据报中经常连续出现同名的行
+        if (i == 0 || sample.name != samples[i - 1].name) {
+            mStatsdName.assign(sample.name.data(), sample.name.size());
+            auto it = mStatsdMetrics.find(mStatsdName);
+            if (it != mStatsdMetrics.end()) {
+                metric = it->second;
+            } else {
+                metric = &getMetric(mStatsdName);
+                // 未跟踪的名称不缓存，缓存的大小与跟踪的metric个数相同
+                if (metric != mOtherMetric.load(memory_order_relaxed)) {
+                    mStatsdMetrics.emplace(mStatsdName, metric);
+                }
+            }
+        }
+        metric->staging[section.phase()].addSample(metric->histogram.getBucketIdx(sample.value), sample.value, sample.count);
+    }
+}
+
+bool PerformanceMarker::ownsSharedTable() const
+{
+    return mSharedTable && getpid() == mSharedOwner;
+}
+
+void PerformanceMarker::syncSharedMetrics()
+{
+    if (!ownsSharedTable()) {
+        return;
+    }
+    for (size_t slot = 0; slot < mSharedMetrics.size(); ++slot) {
+        string_view name;
+        if (mSharedMetrics[slot] == nullptr && mSharedTable->getName(slot, &name)) {
+            mSharedMetrics[slot] = &getMetric(string(name));
+        }
+    }
+}
+#endif
+
+void PerformanceMarker::report()
+{
+#ifndef _WIN32
+    // 只遍历一次所有metric生成二进制报告，JSON报告由它转换而来
+    bool serving = mMetricsServer.isRunning();
+    const ReportBuffer& full = writeSnapshot(mSnapshot, serving ? &mExposition : nullptr);
+    if (serving) {
+        mMetricsServer.publish(mExposition.view(), PrometheusWriter::kContentType);
+    }
+    {
+        std::lock_guard<std::mutex> guard(mPublisherLock);
+        if (mPublisher.isOpen() && !mPublisher.publish(mSnapshot.data(), mSnapshot.size())) {
+            LOG_WARN << "snapshot of " << mSnapshot.size() << " bytes exceeds shared memory capacity "
+                     << mPublisher.capacity();
+        }
+    }
+#else
+    const ReportBuffer& full = writeSnapshot(mSnapshot);
+#endif
+    auto snapshot = Snapshot::create(full.data(), full.size());
+    {
+        // 旧的snapshot在锁外释放
+        std::lock_guard<std::mutex> guard(mSnapshotLock);
+        mLastSnapshot.swap(snapshot);
+    }
+
+#ifndef _WIN32
+    if (mAggregator.isOpen() && writeForward(mForward)) {
+        mAggregator.push(mForward.view());
+    }
+#endif
+
+    ReportFormat format = mFormat;
+    if (format == ReportFormat::None) {
+        return;
+    }
+    bool binary = format == ReportFormat::Binary;
+    if (!mJournal || mJournalFormat != format) {
+        // 格式改变时先关闭旧的日志文件
+        mJournal.reset();
+        string fileName = mJournalName.empty() ? mPrefix + "_report" : mJournalName;
+        mJournal = std::make_unique<AsyncLogging>(fileName, 3, mJournalRollSize, mJournalRollInterval,
+            mJournalMaxFiles, binary ? ".snap" : ".jsonl");
+        mJournalFormat = format;
+    }
+
+    if (binary) {
+        mJournal->append(mSnapshot.data(), int(mSnapshot.size()));
+    } else {
+        SnapshotReader reader;
+        reader.open(mSnapshot.data(), mSnapshot.size());
+        mReport.clear();
+        reader.toJsonLine(mReport);
+        mJournal->append(mReport.data(), int(mReport.size()));
+    }
+}
+
+PerformanceMarker::Staging::Staging(size_t numBuckets)
+    : counts(numBuckets)
+    , sums(numBuckets)
+    , active((numBuckets + 63) / 64)
+    , min(numeric_limits<double>::infinity())
+    , max(-numeric_limits<double>::infinity())
+{
+}
+
+void PerformanceMarker::Staging::addSample(size_t bucketIdx, double value, uint64_t count)
+{
+    addMoments(value, value, value * value * double(count));
+    add(bucketIdx, value * double(count), count);
+}
+
+void PerformanceMarker::Staging::addMoments(double minValue, double maxValue, double squares)
+{
+    // min和max大部分时候不变，只读一次
+    double current = min.load(memory_order_relaxed);
+    while (minValue < current && !min.compare_exchange_weak(current, minValue, memory_order_relaxed)) {
+    }
+    current = max.load(memory_order_relaxed);
+    while (maxValue > current && !max.compare_exchange_weak(current, maxValue, memory_order_relaxed)) {
+    }
+    current = sumSquares.load(memory_order_relaxed);
+    while (!sumSquares.compare_exchange_weak(current, current + squares, memory_order_relaxed)) {
+    }
+}
+
+void PerformanceMarker::Staging::add(size_t bucketIdx, double sum, uint64_t count)
+{
+    counts[bucketIdx].fetch_add(count, memory_order_relaxed);
+    double current = sums[bucketIdx].load(memory_order_relaxed);
+    while (!sums[bucketIdx].compare_exchange_weak(current, current + sum, memory_order_relaxed)) {
+    }
+    // 大部分时候位已经被设置，先读一次避免写共享的cache line
+    uint64_t bit = uint64_t(1) << (bucketIdx % 64);
+    auto& word = active[bucketIdx / 64];
+    if ((word.load(memory_order_relaxed) & bit) == 0) {
+        word.fetch_or(bit, memory_order_relaxed);
+    }
+    // 每一批只有第一个写入方读时钟，同时到达的几个写入方都写入时相差无几
+    if (!dirty.load(memory_order_relaxed)) {
+        firstWrite.store(chrono::steady_clock::now().time_since_epoch().count(), memory_order_relaxed);
+        dirty.store(true, memory_order_relaxed);
+    }
+}
+
+uint64_t PerformanceMarker::Staging::drain(TimeseriesHistogram<double>& histogram, chrono::steady_clock::time_point now,
+    HistogramSnapshot<double>* forward)
+{
+    // phase切换之后没有写入方，relaxed即可，可见性由WriterReaderPhaser保证
+    if (!dirty.exchange(false, memory_order_relaxed)) {
+        return 0;
+    }
+    // 汇总与bucket分开写入，min、max和平方和是这一批数据准确的值
+    TimeseriesHistogram<double>::MomentsBucket total;
+    for (size_t w = 0; w < active.size(); ++w) {
+        uint64_t bits = active[w].exchange(0, memory_order_relaxed);
+        while (bits != 0) {
+            size_t idx = w * 64 + CountScan::lowestBit(bits);
+            double sum = sums[idx].exchange(0, memory_order_relaxed);
+            uint64_t count = counts[idx].exchange(0, memory_order_relaxed);
+            histogram.addBucketAggregated(now, idx, sum, count, false);
+            total.addCountAndSum(sum, count);
+            if (forward) {
+                forward->addBucket(0, idx, sum, count);
+            }
+            bits &= bits - 1;
+        }
+    }
+    total.addMoments(min.exchange(numeric_limits<double>::infinity(), memory_order_relaxed),
+        max.exchange(-numeric_limits<double>::infinity(), memory_order_relaxed),
+        sumSquares.exchange(0, memory_order_relaxed));
+    if (total.mCount != 0) {
+        // 数据在now才写入直方图，但从第一个采样点开始累积，否则第一批的elapsed只有1秒，qps和rate偏高
+        chrono::steady_clock::time_point first { chrono::steady_clock::duration(firstWrite.load(memory_order_relaxed)) };
+        histogram.addTotalAggregated(now, total, std::min(first, now));
+    }
+    return total.mCount;
+}
+
+PerformanceMarker::Metric::Metric(const TimeseriesHistogram<double>& histogram)
+    : histogram(histogram)
+    , staging { Staging(histogram.getNumBuckets()), Staging(histogram.getNumBuckets()) }
+    , lastActive(chrono::steady_clock::now())
+{
+}
+
+size_t PerformanceMarker::Staging::memoryUsage() const
+{
+    return counts.capacity() * sizeof(counts[0]) + sums.capacity() * sizeof(sums[0])
+        + active.capacity() * sizeof(active[0]);
+}
+
+size_t PerformanceMarker::Metric::memoryUsage() const
+{
+    size_t bytes = sizeof(Metric) + histogram.memoryUsage() + staging[0].memoryUsage() + staging[1].memoryUsage()
+        + forward.memoryUsage();
+    ExemplarReservoir* reservoir = exemplars.load(memory_order_acquire);
+    if (reservoir) {
+        bytes += sizeof(ExemplarReservoir) + reservoir->memoryUsage();
+    }
+    return bytes;
+}
+
+PerformanceMarker::Metric& PerformanceMarker::getMetric(const std::string& name)
+{
+    {
+        shared_lock<shared_mutex> guard(mMetricsLock);
+        auto it = mBuckets.find(name);
+        if (it != mBuckets.end()) {
+            return it->second;
+        }
+    }
+    if (mMaxMetrics != 0) {
+        return admitMetric(name);
+    }
+    unique_lock<shared_mutex> guard(mMetricsLock);
+    // 其他线程可能已经插入了同名metric，此时返回已有的
+    return insertMetric(name);
+}
+
+PerformanceMarker::Metric& PerformanceMarker::admitMetric(const std::string& name)
+{
+    // 已满时不需要独占mMetricsLock，之后只有rebalanceMetrics()会提升名称
+    Metric* other = mOtherMetric.load(memory_order_acquire);
+    if (other == nullptr || mNumTracked.load(memory_order_relaxed) < mMaxMetrics) {
+        unique_lock<shared_mutex> guard(mMetricsLock);
+        auto it = mBuckets.find(name);
+        if (it != mBuckets.end()) {
+            return it->second;
+        }
+        other = &otherMetric();
+        if (name == kOtherMetric) {
+            return *other;
+        }
+        if (mNumTracked.load(memory_order_relaxed) < mMaxMetrics) {
+            mNumTracked.fetch_add(1, memory_order_relaxed);
+            return insertMetric(name);
+        }
+    }
+    lock_guard<mutex> guard(mHeavyLock);
+    if (!mHeavyHitters) {
+        mHeavyHitters = std::make_unique<SpaceSaving>(mMaxMetrics * kCandidateFactor);
+    }
+    mHeavyHitters->offer(name);
+    return *other;
+}
+
+PerformanceMarker::Metric& PerformanceMarker::insertMetric(const std::string& name)
+{
+    auto result = mBuckets.emplace(piecewise_construct, forward_as_tuple(name), forward_as_tuple(makeHistogram()));
+    Metric& metric = result.first->second;
+    auto exemplars = mExemplarCounts.find(name);
+    if (result.second && exemplars != mExemplarCounts.end()) {
+        metric.exemplarStorage = std::make_unique<ExemplarReservoir>(exemplars->second);
+        metric.exemplars.store(metric.exemplarStorage.get(), memory_order_release);
+    }
+    return metric;
+}
+
+PerformanceMarker::Metric& PerformanceMarker::otherMetric()
+{
+    Metric* other = mOtherMetric.load(memory_order_relaxed);
+    if (other == nullptr) {
+        other = &insertMetric(kOtherMetric);
+        mOtherMetric.store(other, memory_order_release);
+    }
+    return *other;
+}
+
+DecayingRate& PerformanceMarker::getDecayingRate(const std::string& name)
+{
+    {
+        shared_lock<shared_mutex> guard(mMetricsLock);
+        auto it = mDecayingRates.find(name);
+        if (it != mDecayingRates.end()) {
+            return it->second;
+        }
+    }
+    unique_lock<shared_mutex> guard(mMetricsLock);
+    return mDecayingRates.try_emplace(name).first->second;
+}
+
 void PerformanceMarker::addValue(const std::string& name, double value)
 {
-    if (mBuckets.count(name) == 0) {
-        TimeseriesHistogram<double> timeseriesHistogram(
-            1e3, -1e5, 1e5, MultiLevelTimeSeries<double>(100, { mDuration }));
-        mBuckets.insert(pair<string, TimeseriesHistogram<double>>(name, timeseriesHistogram));
+#ifndef _WIN32
+    if (mSharedTable) {
+        size_t slot = mSharedTable->findOrInsert(name);
+        if (slot == SharedMetricTable::kNotFound) {
+            mSharedTable->addDropped(1);
+            return;
+        }
+        // 与makeHistogram()相同的bucket划分，只用于计算下标
+        static const HistogramBuckets<double, Bucket<double>> layout(kBucketSize, kMinValue, kMaxValue, Bucket<double>());
+        mSharedTable->add(slot, layout.getBucketIdx(value), value, 1);
+        return;
+    }
+#endif
+    WriterReaderPhaser::WriterSection section(mPhaser);
+    Metric& metric = getMetric(name);
+    metric.staging[section.phase()].addSample(metric.histogram.getBucketIdx(value), value, 1);
+}
+
+void PerformanceMarker::enableExemplars(const std::string& name, size_t count)
+{
+    WriterReaderPhaser::WriterSection section(mPhaser);
+    getMetric(name);
+    unique_lock<shared_mutex> guard(mMetricsLock);
+    // 有界模式下name可能还没有被跟踪，提升为独立的metric时再开启
+    if (!mExemplarCounts.emplace(name, count).second) {
+        return;
+    }
+    auto it = mBuckets.find(name);
+    if (it != mBuckets.end() && !it->second.exemplarStorage) {
+        it->second.exemplarStorage = std::make_unique<ExemplarReservoir>(count);
+        it->second.exemplars.store(it->second.exemplarStorage.get(), memory_order_release);
+    }
+}
+
+void PerformanceMarker::addValue(const std::string& name, double value, std::string_view payload)
+{
+#ifndef _WIN32
+    // 共享表中没有样例，只记录采样点
+    if (mSharedTable) {
+        addValue(name, value);
+        return;
+    }
+#endif
+    WriterReaderPhaser::WriterSection section(mPhaser);
+    Metric& metric = getMetric(name);
+    ExemplarReservoir* exemplars = metric.exemplars.load(memory_order_acquire);
+    if (exemplars) {
+        exemplars->add(value, payload);
+    }
+    metric.staging[section.phase()].addSample(metric.histogram.getBucketIdx(value), value, 1);
+}
+
+bool PerformanceMarker::addAggregated(const std::string& name, const HistogramSnapshot<double>& delta)
+{
+    if (delta.numWindows() == 0) {
+        return true;
+    }
+    WriterReaderPhaser::WriterSection section(mPhaser);
+    Metric& metric = getMetric(name);
+    // bucket的划分只在构造时确定，读取不需要加锁
+    const auto& histogram = metric.histogram;
+    if (delta.getBucketSize() != histogram.getBucketSize() || delta.getMin() != histogram.getMin()
+        || delta.getMax() != histogram.getMax()) {
+        return false;
+    }
+
+    Staging& staging = metric.staging[section.phase()];
+    const auto& buckets = delta.getBuckets(0);
+    for (size_t b = 0; b < delta.getNumBuckets(); ++b) {
+        const auto& bucket = buckets.getByIndex(b);
+        if (bucket.mCount != 0) {
+            // 快照中只有每个bucket的count和sum，min、max和平方和按bucket的平均值近似
+            double avg = bucket.avg();
+            staging.addMoments(avg, avg, avg * bucket.mSum);
+            staging.add(b, bucket.mSum, bucket.mCount);
+        }
+    }
+    return true;
+}
+
+HistogramSnapshot<double>* PerformanceMarker::forwardOf(Metric& metric)
+{
+    if (!mForwarding.load(memory_order_relaxed)) {
+        return nullptr;
+    }
+    HistogramSnapshot<double>* forward = &metric.forward;
+    if (forward->numWindows() == 0) {
+        forward->reset(metric.histogram.getBucketSize(), metric.histogram.getMin(), metric.histogram.getMax());
+        forward->addWindow(mDuration, mDuration);
+    }
+    return forward;
+}
+
+void PerformanceMarker::retireMetric(std::map<std::string, Metric>::iterator it)
+{
+    Metric* metric = &it->second;
+#ifndef _WIN32
+    replace(mSharedMetrics.begin(), mSharedMetrics.end(), metric, static_cast<Metric*>(nullptr));
+#endif
+    if (mMaxMetrics != 0 && metric != mOtherMetric.load(memory_order_relaxed)) {
+        mNumTracked.fetch_sub(1, memory_order_relaxed);
+    }
+    mRetired.push_back(mBuckets.extract(it));
+}
+
+void PerformanceMarker::releaseRetired(size_t phase, chrono::steady_clock::time_point now)
+{
+    for (auto& node : mRetired) {
+        Staging& staging = node.mapped().staging[phase];
+        if (!staging.dirty.load(memory_order_relaxed)) {
+            continue;
+        }
+        Metric* target;
+        auto it = mBuckets.find(node.key());
+        if (it != mBuckets.end()) {
+            target = &it->second;
+        } else if (mMaxMetrics != 0) {
+            target = &otherMetric();
+        } else {
+            target = &insertMetric(node.key());
+        }
+        if (staging.drain(target->histogram, now, forwardOf(*target))) {
+            target->changed = true;
+            target->lastActive = now;
+        }
+    }
+    mRetired.clear();
+}
+
+void PerformanceMarker::evictIdleMetrics(size_t phase, chrono::steady_clock::time_point now)
+{
+    Metric* other = mOtherMetric.load(memory_order_relaxed);
+    for (auto it = mBuckets.begin(); it != mBuckets.end();) {
+        auto current = it++;
+        Metric& metric = current->second;
+        // 旧phase中有数据说明仍然活跃，由drainStaging()读取并更新lastActive
+        if (now - metric.lastActive < mMetricTtl || &metric == other || metric.staging[phase].dirty.load(memory_order_relaxed)) {
+            continue;
+        }
+#ifndef _WIN32
+        // 共享表中的slot不会被释放，移除之后syncSharedMetrics()会立即重新创建
+        if (find(mSharedMetrics.begin(), mSharedMetrics.end(), &metric) != mSharedMetrics.end()) {
+            continue;
+        }
+#endif
+        retireMetric(current);
+    }
+}
+
+void PerformanceMarker::rebalanceMetrics(size_t phase, chrono::steady_clock::time_point now)
+{
+    lock_guard<mutex> heavyGuard(mHeavyLock);
+    if (!mHeavyHitters) {
+        return;
+    }
+    Metric& other = otherMetric();
+    mHeavyHitters->top(mMaxMetrics, &mHeavyTop);
+    unordered_set<string_view> topNames;
+    for (const SpaceSaving::Counter& counter : mHeavyTop) {
+        topNames.insert(*counter.key);
+    }
+    // 可以被替换的metric，次数最少的在最后
+    vector<pair<uint64_t, map<string, Metric>::iterator>> victims;
+    for (auto it = mBuckets.begin(); it != mBuckets.end(); ++it) {
+        if (&it->second != &other && topNames.count(it->first) == 0) {
+            victims.emplace_back(mHeavyHitters->estimate(it->first), it);
+        }
+    }
+    sort(victims.begin(), victims.end(), [](const auto& lhs, const auto& rhs) { return lhs.first > rhs.first; });
+
+    for (const SpaceSaving::Counter& candidate : mHeavyTop) {
+        if (mBuckets.count(*candidate.key) != 0) {
+            continue;
+        }
+        if (mNumTracked.load(memory_order_relaxed) >= mMaxMetrics) {
+            // 只替换次数确定更少的metric，避免估计误差造成反复替换
+            if (victims.empty() || victims.back().first >= candidate.count - candidate.error) {
+                break;
+            }
+            auto victim = victims.back().second;
+            victims.pop_back();
+            Metric& metric = victim->second;
+            // 旧phase中的数据还没有写入直方图，同样并入other
+            if (metric.staging[phase].drain(other.histogram, now, forwardOf(other))) {
+                other.changed = true;
+            }
+            if (metric.forward.numWindows() != 0 && metric.forward.count(0) != 0) {
+                *forwardOf(other) += metric.forward;
+            }
+            retireMetric(victim);
+        }
+        insertMetric(*candidate.key);
+        mNumTracked.fetch_add(1, memory_order_relaxed);
+    }
+    mHeavyHitters->decay();
+}
+
+void PerformanceMarker::drainStaging(chrono::steady_clock::time_point now)
+{
+    size_t phase = mPhaser.flipPhase();
+    if (!mRetired.empty() || mMetricTtl.count() != 0 || mMaxMetrics != 0) {
+        unique_lock<shared_mutex> guard(mMetricsLock);
+        releaseRetired(phase, now);
+        if (mMetricTtl.count() != 0) {
+            evictIdleMetrics(phase, now);
+        }
+        if (mMaxMetrics != 0) {
+            rebalanceMetrics(phase, now);
+        }
+        if (!mRetired.empty()) {
+            mRetireGeneration.fetch_add(1, memory_order_release);
+        }
+    }
+    shared_lock<shared_mutex> metricsGuard(mMetricsLock);
+    bool forwarding = mForwarding.load(memory_order_relaxed);
+    // 有界模式下已跟踪的metric的次数在这里计入SpaceSaving，写入方不需要加锁
+    unique_lock<mutex> heavyGuard(mHeavyLock, defer_lock);
+    if (mMaxMetrics != 0) {
+        heavyGuard.lock();
+        if (!mHeavyHitters) {
+            mHeavyHitters = std::make_unique<SpaceSaving>(mMaxMetrics * kCandidateFactor);
+        }
+    }
+    Metric* other = mOtherMetric.load(memory_order_relaxed);
+    mMetricList.clear();
+    // 与mDecayingRates按名称归并，报告中的记录按名称排序
+    auto decaying = mDecayingRates.begin();
+    for (auto& bucket : mBuckets) {
+        for (; decaying != mDecayingRates.end() && decaying->first < bucket.first; ++decaying) {
+            mMetricList.push_back({ &decaying->first, nullptr, &decaying->second });
+        }
+        Metric& metric = bucket.second;
+        uint64_t drained = metric.staging[phase].drain(metric.histogram, now, forwardOf(metric));
+        if (drained != 0) {
+            metric.changed = true;
+            metric.lastActive = now;
+            if (heavyGuard.owns_lock() && &metric != other) {
+                mHeavyHitters->offer(bucket.first, drained);
+            }
+        }
+        mMetricList.push_back({ &bucket.first, &metric, nullptr });
+    }
+    for (; decaying != mDecayingRates.end(); ++decaying) {
+        mMetricList.push_back({ &decaying->first, nullptr, &decaying->second });
+    }
+#ifndef _WIN32
+    // 共享表只有一个读取方，子进程中生成报告时不切换它的phase，数据留给父进程
+    if (ownsSharedTable()) {
+        // 还没有同步到本进程的slot不读取，它的数据留在旧phase中，下一次切换回来时继续累加
+        size_t sharedPhase = mSharedTable->flipPhase();
+        for (size_t slot = 0; slot < mSharedMetrics.size(); ++slot) {
+            Metric* metric = mSharedMetrics[slot];
+            if (metric == nullptr) {
+                continue;
+            }
+            bool drained = mSharedTable->drain(slot, sharedPhase, [&](size_t idx, double sum, uint64_t count) {
+                metric->histogram.addBucketAggregated(now, idx, sum, count);
+                if (forwarding) {
+                    metric->forward.addBucket(0, idx, sum, count);
+                }
+            });
+            if (drained) {
+                metric->changed = true;
+                metric->lastActive = now;
+            }
+        }
+    }
+#endif
+}
+
+std::shared_ptr<const PerformanceMarker::Snapshot> PerformanceMarker::getSnapshot()
+{
+    std::lock_guard<std::mutex> guard(mSnapshotLock);
+    return mLastSnapshot;
+}
+
+size_t PerformanceMarker::memoryUsage(std::vector<std::pair<std::string, size_t>>* perMetric)
+{
+    // histogram只在持有mReportLock时访问
+    lock_guard<mutex> reportGuard(mReportLock);
+    shared_lock<shared_mutex> metricsGuard(mMetricsLock);
+    if (perMetric) {
+        perMetric->clear();
+    }
+    size_t total = 0;
+    auto addMetric = [&](const string& name, size_t bytes) {
+        bytes += kMapNodeOverhead + stringHeapBytes(name);
+        total += bytes;
+        if (perMetric) {
+            perMetric->emplace_back(name, bytes);
+        }
+    };
+    for (auto& bucket : mBuckets) {
+        addMetric(bucket.first, bucket.second.memoryUsage());
+    }
+    for (auto& decaying : mDecayingRates) {
+        addMetric(decaying.first, sizeof(DecayingRate));
+    }
+    if (perMetric) {
+        sort(perMetric->begin(), perMetric->end());
     }
-    (mBuckets.find(name)->second).addValue(chrono::steady_clock::now(), value);
+
+    // 不属于某一个metric的部分
+    for (auto& node : mRetired) {
+        total += kMapNodeOverhead + stringHeapBytes(node.key()) + node.mapped().memoryUsage();
+    }
+    total += mMetricList.capacity() * sizeof(MetricEntry);
+    lock_guard<mutex> heavyGuard(mHeavyLock);
+    if (mHeavyHitters) {
+        total += sizeof(SpaceSaving) + mHeavyHitters->memoryUsage() + mHeavyTop.capacity() * sizeof(SpaceSaving::Counter);
+    }
+    return total;
 }
 
 std::string PerformanceMarker::getLastReport()
 {
-    string lastReport;
-    int idx = 0;
-    lastReport += "{\n";
-    for (auto& bucket : mInstance->mBuckets) {
-        // 清除bucket中过时数据
-        bucket.second.update(chrono::steady_clock::now());
-        lastReport.append("\t\"" + mPrefix + "_" + bucket.first + "\": {\n" + bucket.second.getString(0) + "\n\t}");
-        idx == mInstance->mBuckets.size() - 1 ? mInstance->mReport.append("\n") : mInstance->mReport.append(",\n");
-        idx++;
-    }
-    lastReport += "}";
-    return lastReport;
+    ReportBuffer lastReport;
+    auto snapshot = getSnapshot();
+    if (snapshot) {
+        snapshot->toJson(lastReport);
+    } else {
+        writeReport(lastReport);
+    }
+    return lastReport.str();
+}
+
+bool PerformanceMarker::writeForward(ReportBuffer& out)
+{
+    lock_guard<mutex> reportGuard(mReportLock);
+    shared_lock<shared_mutex> metricsGuard(mMetricsLock);
+    out.clear();
+    mFrameWriter.begin(out);
+    for (auto& bucket : mBuckets) {
+        HistogramSnapshot<double>& forward = bucket.second.forward;
+        if (forward.numWindows() == 0 || forward.count(0) == 0) {
+            continue;
+        }
+        mFrameWriter.add(bucket.first, forward);
+        forward.clear();
+    }
+    bool empty = mFrameWriter.size() == 0;
+    mFrameWriter.finish();
+    return !empty;
+}
+
+void PerformanceMarker::writeReport(ReportBuffer& out)
+{
+    // 与定时报告相同，先生成snapshot再转换为JSON，但不影响增量报告的状态
+    lock_guard<mutex> reportGuard(mReportLock);
+#ifndef _WIN32
+    syncSharedMetrics();
+#endif
+    auto now = chrono::steady_clock::now();
+    drainStaging(now);
+    // 遍历mMetricList只需要mReportLock，见mMetricList的注释
+    ReportBuffer snapshot;
+    SnapshotWriter writer;
+    writer.begin(snapshot, TimeseriesHistogram<double>::kReportPercentiles,
+        TimeseriesHistogram<double>::kNumReportPercentiles, 0);
+    for (auto& entry : mMetricList) {
+        if (entry.decaying) {
+            writeDecaying(writer, *entry.decaying, *entry.name, now, nullptr);
+        } else {
+            writeWindows(&writer, nullptr, *entry.metric, *entry.name, now, nullptr);
+        }
+    }
+    writer.finish();
+
+    SnapshotReader reader;
+    reader.open(snapshot.data(), snapshot.size());
+    reader.toJson(out);
+}
+
+uint64_t PerformanceMarker::writeWindows(SnapshotWriter* writer, SnapshotWriter* full, Metric& metric,
+    const string& name, chrono::steady_clock::time_point now, PrometheusWriter* prometheus)
+{
+    // 清除bucket中过时数据
+    metric.histogram.update(now);
+    if (writer) {
+        writer->beginMetric(mPrefix, name);
+    }
+    if (full) {
+        full->beginMetric(mPrefix, name);
+    }
+    // getLastReport()可能在其他线程调用，每个线程复用自己的Summary
+    static thread_local TimeseriesHistogram<double>::Summary summary;
+    // 开启rollup时更长的窗口包含更短的窗口，最长窗口为空时所有窗口都为空
+    uint64_t count = 0;
+    for (size_t level = 0; level < mWindows.size(); ++level) {
+        metric.histogram.summarize(level, TimeseriesHistogram<double>::kReportPercentiles,
+            TimeseriesHistogram<double>::kNumReportPercentiles, &summary);
+        if (writer) {
+            writer->addWindow(mWindows[level], summary);
+        }
+        if (full) {
+            full->addWindow(mWindows[level], summary);
+        }
+        if (level == 0 && prometheus) {
+            prometheus->addHistogram(mPrefix, name, metric.histogram, summary);
+        }
+        count = summary.count;
+    }
+    // 不写入snapshot时样例留到下一次
+    ExemplarReservoir* exemplars = metric.exemplars.load(memory_order_acquire);
+    if (exemplars && (writer || full)) {
+        auto nowMs = uint64_t(
+            chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count());
+        uint64_t windowMs = uint64_t(mWindows[0]) * 1000;
+        for (const Exemplar& exemplar : exemplars->collect(nowMs > windowMs ? nowMs - windowMs : 0)) {
+            if (writer) {
+                writer->addExemplar(exemplar);
+            }
+            if (full) {
+                full->addExemplar(exemplar);
+            }
+        }
+    }
+    return count;
+}
+
+void PerformanceMarker::writeDecaying(SnapshotWriter& writer, DecayingRate& rate, const string& name,
+    chrono::steady_clock::time_point now, PrometheusWriter* prometheus)
+{
+    rate.update(now);
+    writer.beginMetric(mPrefix, name);
+    static thread_local TimeseriesHistogram<double>::Summary summary;
+    summary.percentiles.assign(TimeseriesHistogram<double>::kNumReportPercentiles, 0);
+    for (size_t i = 0; i < rate.numWindows(); ++i) {
+        auto seconds = chrono::duration_cast<chrono::seconds>(rate.getWindow(i)).count();
+        summary.qps = rate.qps(i);
+        summary.rate = rate.rate(i);
+        summary.avg = rate.avg(i);
+        summary.count = uint64_t(llround(summary.qps * double(seconds)));
+        summary.sum = summary.rate * double(seconds);
+        writer.addWindow(uint32_t(seconds), summary);
+    }
+    if (prometheus) {
+        prometheus->addDecayingRate(mPrefix, name, rate);
+    }
+}
+
+void PerformanceMarker::writePartition(ReportPartition& partition, chrono::steady_clock::time_point now,
+    uint64_t timestamp, bool keyframe, bool exposition)
+{
+    SnapshotWriter& writer = partition.writer;
+    PrometheusWriter* prometheus = exposition ? &partition.prometheus : nullptr;
+    writer.begin(partition.snapshot, TimeseriesHistogram<double>::kReportPercentiles,
+        TimeseriesHistogram<double>::kNumReportPercentiles, timestamp);
+    // 增量报告之外还要生成缓存的完整snapshot，完整报告本身就是
+    SnapshotWriter* full = keyframe ? nullptr : &partition.fullWriter;
+    if (full) {
+        full->begin(partition.full, TimeseriesHistogram<double>::kReportPercentiles,
+            TimeseriesHistogram<double>::kNumReportPercentiles, timestamp);
+    }
+    if (prometheus) {
+        prometheus->begin(partition.exposition);
+    }
+    for (size_t i = partition.begin; i < partition.end; ++i) {
+        const string& name = *mMetricList[i].name;
+        if (mMetricList[i].decaying) {
+            // 没有新数据时估计值也在衰减，总是写入
+            writeDecaying(writer, *mMetricList[i].decaying, name, now, prometheus);
+            if (full) {
+                writeDecaying(*full, *mMetricList[i].decaying, name, now, nullptr);
+            }
+            continue;
+        }
+        Metric& metric = *mMetricList[i].metric;
+        // 没有新采样点，并且上次报告时已经没有数据，这次的结果一定还是空的
+        bool changed = metric.changed;
+        metric.changed = false;
+        if (!changed && metric.empty) {
+            SnapshotWriter* target = keyframe ? &writer : full;
+            target->beginMetric(mPrefix, name);
+            for (uint32_t window : mWindows) {
+                target->addWindow(window, mEmptySummary);
+            }
+            if (prometheus) {
+                prometheus->addHistogram(mPrefix, name, metric.histogram, mEmptySummary);
+            }
+            continue;
+        }
+        // 增量报告只包含有新采样点的metric，缓存的snapshot和Prometheus每次都需要完整的统计
+        bool skipped = !changed && !keyframe;
+        metric.empty = writeWindows(skipped ? nullptr : &writer, full, metric, name, now, prometheus) == 0;
+    }
+    writer.finish();
+    if (full) {
+        full->finish();
+    }
+}
+
+const ReportBuffer& PerformanceMarker::writeSnapshot(ReportBuffer& out, ReportBuffer* exposition)
+{
+    lock_guard<mutex> reportGuard(mReportLock);
+#ifndef _WIN32
+    syncSharedMetrics();
+#endif
+    auto now = chrono::steady_clock::now();
+    auto timestamp = uint64_t(
+        chrono::duration_cast<chrono::seconds>(chrono::system_clock::now().time_since_epoch()).count());
+    bool keyframe = mKeyframeInterval == 0 || mReportCount % mKeyframeInterval == 0;
+    ++mReportCount;
+    drainStaging(now);
+    // 不持有mMetricsLock，生成报告期间新名称的addValue()不需要等待
+    mEmptySummary.percentiles.resize(TimeseriesHistogram<double>::kNumReportPercentiles);
+
+    // metric之间互不影响，按名称顺序分段并行生成，再按顺序拼接
+    if (mReportThreads > 0 && !mWorkers) {
+        mWorkers = std::make_unique<WorkerPool>(mReportThreads);
+    }
+    size_t numPartitions = mWorkers ? min(mWorkers->concurrency(), max<size_t>(mMetricList.size(), 1)) : 1;
+    while (mPartitions.size() < numPartitions) {
+        mPartitions.push_back(std::make_unique<ReportPartition>());
+    }
+    for (size_t p = 0; p < numPartitions; ++p) {
+        mPartitions[p]->begin = mMetricList.size() * p / numPartitions;
+        mPartitions[p]->end = mMetricList.size() * (p + 1) / numPartitions;
+    }
+    auto task = [&](size_t p) { writePartition(*mPartitions[p], now, timestamp, keyframe, exposition != nullptr); };
+    if (numPartitions == 1) {
+        task(0);
+    } else {
+        mWorkers->run(numPartitions, task);
+    }
+
+    mSnapshotWriter.begin(out, TimeseriesHistogram<double>::kReportPercentiles,
+        TimeseriesHistogram<double>::kNumReportPercentiles, timestamp, keyframe ? 0 : kSnapshotFlagDelta);
+    if (!keyframe) {
+        mFullWriter.begin(mFullSnapshot, TimeseriesHistogram<double>::kReportPercentiles,
+            TimeseriesHistogram<double>::kNumReportPercentiles, timestamp);
+    }
+    if (exposition) {
+        mExpositionWriter.begin(*exposition);
+    }
+    for (size_t p = 0; p < numPartitions; ++p) {
+        const ReportPartition& partition = *mPartitions[p];
+        SnapshotReader reader;
+        reader.open(partition.snapshot.data(), partition.snapshot.size());
+        mSnapshotWriter.append(reader);
+        if (!keyframe) {
+            reader.open(partition.full.data(), partition.full.size());
+            mFullWriter.append(reader);
+        }
+        if (exposition) {
+            mExpositionWriter.append(partition.prometheus);
+        }
+    }
+    mSnapshotWriter.finish();
+    if (keyframe) {
+        return out;
+    }
+    mFullWriter.finish();
+    return mFullSnapshot;
 }
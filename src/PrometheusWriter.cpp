@@ -0,0 +1,154 @@
+//
+// Created by haosheng on 2021/9/24.
+//
+#include "PrometheusWriter.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace {
+
+constexpr std::string_view kTypePrefix = "# TYPE ";
+
+bool isNameChar(char c, bool first)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == ':'
+        || (!first && c >= '0' && c <= '9');
+}
+
+}
+
+void PrometheusWriter::begin(ReportBuffer& out)
+{
+    mOut = &out;
+    mOut->clear();
+    mFamilies.clear();
+    mAppended.clear();
+}
+
+void PrometheusWriter::setName(string_view prefix, string_view name)
+{
+    mName.assign(prefix.data(), prefix.size());
+    mName.push_back('_');
+    mName.append(name.data(), name.size());
+    for (size_t i = 0; i < mName.size(); ++i) {
+        if (!isNameChar(mName[i], i == 0)) {
+            mName[i] = '_';
+        }
+    }
+}
+
+void PrometheusWriter::updateBounds(const TimeseriesHistogram<double>& histogram)
+{
+    size_t numBuckets = histogram.getNumBuckets();
+    if (mBounds.size() == numBuckets && mBucketSize == histogram.getBucketSize()
+        && mMin == histogram.getMin() && mMax == histogram.getMax()) {
+        return;
+    }
+    mBucketSize = histogram.getBucketSize();
+    mMin = histogram.getMin();
+    mMax = histogram.getMax();
+    mBounds.resize(numBuckets);
+
+    ReportBuffer bound(64);
+    for (size_t b = 0; b < numBuckets; ++b) {
+        bound.clear();
+        bound.append("_bucket{le=\"");
+        if (b == numBuckets - 1) {
+            bound.append("+Inf");
+        } else {
+            bound.appendDouble(min(histogram.getBucketMax(b), mMax), -1);
+        }
+        bound.append("\"} ");
+        mBounds[b] = bound.str();
+    }
+}
+
+void PrometheusWriter::addHistogram(string_view prefix, string_view name,
+    const TimeseriesHistogram<double>& histogram, size_t level)
+{
+    histogram.summarize(level, nullptr, 0, &mSummary);
+    addHistogram(prefix, name, histogram, mSummary);
+}
+
+void PrometheusWriter::addHistogram(string_view prefix, string_view name,
+    const TimeseriesHistogram<double>& histogram, const Summary& summary)
+{
+    setName(prefix, name);
+    updateBounds(histogram);
+
+    beginFamily(mName.size());
+    mOut->append(kTypePrefix);
+    mOut->append(mName);
+    mOut->append(" histogram\n");
+
+    // 最后一个bucket的上边界是+Inf，总是输出。没有bucketCounts时表示没有数据
+    uint64_t cumulative = 0;
+    size_t last = mBounds.size() - 1;
+    for (size_t b = 0; b < last && b < summary.numBuckets; ++b) {
+        if (summary.bucketCounts[b] == 0) {
+            continue;
+        }
+        cumulative += summary.bucketCounts[b];
+        mOut->append(mName);
+        mOut->append(mBounds[b]);
+        mOut->appendUInt(cumulative);
+        mOut->append('\n');
+    }
+
+    mOut->append(mName);
+    mOut->append(mBounds[last]);
+    mOut->appendUInt(summary.count);
+    mOut->append('\n');
+    mOut->append(mName);
+    mOut->append("_sum ");
+    mOut->appendDouble(summary.sum, -1);
+    mOut->append('\n');
+    mOut->append(mName);
+    mOut->append("_count ");
+    mOut->appendUInt(summary.count);
+    mOut->append('\n');
+}
+
+void PrometheusWriter::addDecayingRate(string_view prefix, string_view name, const DecayingRate& rate)
+{
+    setName(prefix, name);
+    const pair<const char*, double (DecayingRate::*)(size_t) const> families[] = {
+        { "_qps", &DecayingRate::qps },
+        { "_rate", &DecayingRate::rate },
+        { "_avg", &DecayingRate::avg },
+    };
+    for (const auto& family : families) {
+        beginFamily(mName.size() + strlen(family.first));
+        mOut->append(kTypePrefix);
+        mOut->append(mName);
+        mOut->append(family.first);
+        mOut->append(" gauge\n");
+        for (size_t i = 0; i < rate.numWindows(); ++i) {
+            mOut->append(mName);
+            mOut->append(family.first);
+            mOut->append("{window=\"");
+            mOut->appendInt(chrono::duration_cast<chrono::seconds>(rate.getWindow(i)).count());
+            mOut->append("\"} ");
+            mOut->appendDouble((rate.*family.second)(i), -1);
+            mOut->append('\n');
+        }
+    }
+}
+
+void PrometheusWriter::append(const PrometheusWriter& part)
+{
+    string_view text = part.mOut->view();
+    for (size_t i = 0; i < part.mFamilies.size(); ++i) {
+        const Family& family = part.mFamilies[i];
+        size_t end = i + 1 < part.mFamilies.size() ? part.mFamilies[i + 1].begin : text.size();
+        // 只保留第一次出现的family，重复的名称会让Prometheus拒绝整个响应
+        if (!mAppended.insert(text.substr(family.begin + kTypePrefix.size(), family.nameLength)).second) {
+            continue;
+        }
+        beginFamily(family.nameLength);
+        mOut->append(text.substr(family.begin, end - family.begin));
+    }
+}
@@ -0,0 +1,59 @@
+//
+// Created by haosheng on 2021/9/16.
+//
+#include "ReportBuffer.h"
+
+#include <charconv>
+
+using namespace std;
+
+ReportBuffer::ReportBuffer(size_t initialCapacity)
+    : mData(new char[initialCapacity > 0 ? initialCapacity : 1])
+    , mSize(0)
+    , mCapacity(initialCapacity > 0 ? initialCapacity : 1)
+{
+}
+
+void ReportBuffer::appendInt(int64_t value)
+{
+    // 20位数字加一个负号
+    ensure(21);
+    auto result = to_chars(mData.get() + mSize, mData.get() + mCapacity, value);
+    mSize = result.ptr - mData.get();
+}
+
+void ReportBuffer::appendUInt(uint64_t value)
+{
+    ensure(20);
+    auto result = to_chars(mData.get() + mSize, mData.get() + mCapacity, value);
+    mSize = result.ptr - mData.get();
+}
+
+void ReportBuffer::appendDouble(double value, int precision)
+{
+    // 绝大多数数值都能放进64字节，放不下时（例如1e300）按需扩容后重试
+    size_t reserve = 64;
+    while (true) {
+        ensure(reserve);
+        auto result = precision < 0
+            ? to_chars(mData.get() + mSize, mData.get() + mCapacity, value)
+            : to_chars(mData.get() + mSize, mData.get() + mCapacity, value, chars_format::fixed, precision);
+        if (result.ec == errc()) {
+            mSize = result.ptr - mData.get();
+            return;
+        }
+        reserve = mCapacity - mSize + 512;
+    }
+}
+
+void ReportBuffer::grow(size_t required)
+{
+    size_t capacity = mCapacity * 2;
+    while (capacity < required) {
+        capacity *= 2;
+    }
+    unique_ptr<char[]> data(new char[capacity]);
+    memcpy(data.get(), mData.get(), mSize);
+    mData = move(data);
+    mCapacity = capacity;
+}
@@ -0,0 +1,271 @@
+//
+// Created by haosheng on 2021/9/18.
+//
+#include "SnapshotReader.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace {
+
+/* 把s写成JSON字符串，转义引号、反斜杠和控制字符 */
+void appendJsonString(ReportBuffer& out, string_view s)
+{
+    static const char kHex[] = "0123456789abcdef";
+    out.append('"');
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out.append('\\');
+            out.append(c);
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out.append("\\u00");
+            out.append(kHex[(c >> 4) & 0xf]);
+            out.append(kHex[c & 0xf]);
+        } else {
+            out.append(c);
+        }
+    }
+    out.append('"');
+}
+
+}
+
+bool SnapshotReader::open(const char* data, size_t size)
+{
+    mData = nullptr;
+    mSize = 0;
+    mUpgraded.clear();
+    mHeader = SnapshotHeader {};
+    if (data == nullptr || size < kSnapshotMinHeaderSize || reinterpret_cast<uintptr_t>(data) % 8 != 0) {
+        return false;
+    }
+
+    const auto& raw = *reinterpret_cast<const SnapshotHeader*>(data);
+    if (memcmp(raw.magic, kSnapshotMagic, sizeof(kSnapshotMagic)) != 0 || raw.version != kSnapshotVersion) {
+        return false;
+    }
+    if (raw.headerSize < kSnapshotMinHeaderSize || raw.headerSize > size) {
+        return false;
+    }
+    memcpy(&mHeader, data, min<size_t>(raw.headerSize, sizeof(SnapshotHeader)));
+    const auto& h = mHeader;
+    if (h.recordSize < kSnapshotMinRecordSize || h.recordSize % 8 != 0
+        || h.percentileCount > kSnapshotMaxPercentiles || h.totalSize > size) {
+        return false;
+    }
+    // 先检查偏移量不超过totalSize，再与剩余的长度比较，偏移量和长度相加可能溢出
+    if (h.stringTableOffset > h.totalSize || h.stringTableSize > h.totalSize - h.stringTableOffset) {
+        return false;
+    }
+    if (h.recordOffset < h.headerSize || h.recordOffset % 8 != 0 || h.recordOffset > h.stringTableOffset
+        || h.recordCount > (h.stringTableOffset - h.recordOffset) / h.recordSize) {
+        return false;
+    }
+    uint64_t recordEnd = h.recordOffset + uint64_t(h.recordCount) * h.recordSize;
+
+    for (size_t i = 0; i < h.recordCount; ++i) {
+        const auto& r = *reinterpret_cast<const SnapshotRecord*>(data + h.recordOffset + i * h.recordSize);
+        if (uint64_t(r.nameOffset) + r.nameLength > h.stringTableSize) {
+            return false;
+        }
+    }
+    if (h.exemplarCount != 0) {
+        if (h.exemplarSize < sizeof(SnapshotExemplar) || h.exemplarSize % 8 != 0 || h.exemplarOffset % 8 != 0
+            || h.exemplarOffset < recordEnd || h.exemplarOffset > h.stringTableOffset
+            || h.exemplarCount > (h.stringTableOffset - h.exemplarOffset) / h.exemplarSize) {
+            return false;
+        }
+        for (size_t i = 0; i < h.exemplarCount; ++i) {
+            const auto& e = *reinterpret_cast<const SnapshotExemplar*>(data + h.exemplarOffset + i * h.exemplarSize);
+            if (e.payloadLength > kSnapshotMaxPayload) {
+                return false;
+            }
+        }
+    }
+
+    if (h.recordSize < sizeof(SnapshotRecord)) {
+        mUpgraded.assign(h.recordCount, SnapshotRecord {});
+        for (size_t i = 0; i < h.recordCount; ++i) {
+            memcpy(&mUpgraded[i], data + h.recordOffset + i * h.recordSize, h.recordSize);
+        }
+    }
+
+    mData = data;
+    mSize = size;
+    return true;
+}
+
+void SnapshotReader::toJson(ReportBuffer& out) const
+{
+    out.append("{\n");
+    size_t count = recordCount();
+    size_t idx = 0;
+    size_t exemplarIdx = 0;
+    while (idx < count) {
+        // 同一个metric的多个时间窗口是连续存放的
+        size_t end = idx + 1;
+        while (end < count && record(end).nameOffset == record(idx).nameOffset) {
+            ++end;
+        }
+
+        out.append("\t\"");
+        out.append(name(record(idx)));
+        out.append("\": {\n");
+        if (end - idx == 1) {
+            appendFields(out, record(idx), "\t\t");
+        } else {
+            for (size_t w = idx; w < end; ++w) {
+                out.append("\t\t\"");
+                out.appendUInt(record(w).windowSeconds);
+                out.append("s\": {\n");
+                appendFields(out, record(w), "\t\t\t");
+                out.append(w + 1 == end ? "\n\t\t}" : "\n\t\t},\n");
+            }
+        }
+        appendExemplars(out, record(idx).nameOffset, &exemplarIdx, "\t\t");
+        out.append(end == count ? "\n\t}\n" : "\n\t},\n");
+        idx = end;
+    }
+    out.append('}');
+}
+
+void SnapshotReader::toJsonLine(ReportBuffer& out) const
+{
+    out.append("{\"timestamp\":");
+    out.appendUInt(header().timestamp);
+    if (header().flags & kSnapshotFlagDelta) {
+        out.append(",\"delta\":true");
+    }
+    out.append(",\"metrics\":{");
+    size_t count = recordCount();
+    size_t idx = 0;
+    size_t exemplarIdx = 0;
+    while (idx < count) {
+        size_t end = idx + 1;
+        while (end < count && record(end).nameOffset == record(idx).nameOffset) {
+            ++end;
+        }
+
+        out.append('"');
+        out.append(name(record(idx)));
+        out.append("\":{");
+        if (end - idx == 1) {
+            appendFields(out, record(idx), nullptr);
+        } else {
+            for (size_t w = idx; w < end; ++w) {
+                out.append('"');
+                out.appendUInt(record(w).windowSeconds);
+                out.append("s\":{");
+                appendFields(out, record(w), nullptr);
+                out.append(w + 1 == end ? "}" : "},");
+            }
+        }
+        appendExemplars(out, record(idx).nameOffset, &exemplarIdx, nullptr);
+        out.append(end == count ? "}" : "},");
+        idx = end;
+    }
+    out.append("}}\n");
+}
+
+void SnapshotReader::appendFields(ReportBuffer& out, const SnapshotRecord& record, const char* indent) const
+{
+    // indent为空时输出紧凑格式
+    const char* separator = indent ? ",\n" : ",";
+    const char* colon = indent ? "\": " : "\":";
+    auto appendKey = [&](bool first) {
+        if (!first) {
+            out.append(separator);
+        }
+        if (indent) {
+            out.append(indent);
+        }
+        out.append('"');
+    };
+
+    appendKey(true);
+    out.append("count");
+    out.append(colon);
+    out.appendUInt(record.count);
+    const pair<const char*, double> fields[] = {
+        { "accu", record.sum },
+        { "avg", record.avg },
+        { "rate", record.rate },
+        { "qps", record.qps },
+    };
+    for (const auto& field : fields) {
+        appendKey(false);
+        out.append(field.first);
+        out.append(colon);
+        out.appendDouble(field.second);
+    }
+    const auto& h = header();
+    for (size_t i = 0; i < h.percentileCount; ++i) {
+        appendKey(false);
+        out.appendDouble(h.percentiles[i], -1);
+        out.append('%');
+        out.append(colon);
+        out.appendDouble(record.percentiles[i]);
+    }
+    const pair<const char*, double> moments[] = {
+        { "max", record.max },
+        { "stddev", record.stddev },
+    };
+    for (const auto& field : moments) {
+        appendKey(false);
+        out.append(field.first);
+        out.append(colon);
+        out.appendDouble(field.second);
+    }
+}
+
+void SnapshotReader::appendExemplars(ReportBuffer& out, uint32_t nameOffset, size_t* cursor, const char* indent) const
+{
+    // 样例与记录的metric顺序相同，跳过不属于任何输出记录的样例
+    size_t count = exemplarCount();
+    while (*cursor < count && exemplar(*cursor).nameOffset < nameOffset) {
+        ++*cursor;
+    }
+    if (*cursor == count || exemplar(*cursor).nameOffset != nameOffset) {
+        return;
+    }
+
+    const char* colon = indent ? "\": " : "\":";
+    const char* comma = indent ? ", \"" : ",\"";
+    if (indent) {
+        out.append(",\n");
+        out.append(indent);
+        out.append("\"exemplars\": [\n");
+    } else {
+        out.append(",\"exemplars\":[");
+    }
+    for (bool first = true; *cursor < count && exemplar(*cursor).nameOffset == nameOffset; ++*cursor) {
+        const SnapshotExemplar& e = exemplar(*cursor);
+        if (!first) {
+            out.append(indent ? ",\n" : ",");
+        }
+        first = false;
+        if (indent) {
+            out.append(indent);
+            out.append('\t');
+        }
+        out.append("{\"value");
+        out.append(colon);
+        out.appendDouble(e.value);
+        out.append(comma);
+        out.append("timestamp");
+        out.append(colon);
+        out.appendUInt(e.timestamp);
+        out.append(comma);
+        out.append("payload");
+        out.append(colon);
+        appendJsonString(out, payload(e));
+        out.append('}');
+    }
+    if (indent) {
+        out.append('\n');
+        out.append(indent);
+    }
+    out.append(']');
+}
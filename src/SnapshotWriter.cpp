@@ -0,0 +1,124 @@
+//
+// Created by haosheng on 2021/9/18.
+//
+#include "SnapshotWriter.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+SnapshotWriter::SnapshotWriter()
+    : mOut(nullptr)
+    , mStrings(4096)
+    , mExemplars(1024)
+    , mHeader()
+    , mNameOffset(0)
+    , mNameLength(0)
+{
+}
+
+void SnapshotWriter::begin(ReportBuffer& out, const double pcts[], size_t nPcts, uint64_t timestamp, uint32_t flags)
+{
+    mOut = &out;
+    mOut->clear();
+    mStrings.clear();
+    mExemplars.clear();
+
+    mHeader = SnapshotHeader();
+    memcpy(mHeader.magic, kSnapshotMagic, sizeof(kSnapshotMagic));
+    mHeader.version = kSnapshotVersion;
+    mHeader.headerSize = sizeof(SnapshotHeader);
+    mHeader.recordSize = sizeof(SnapshotRecord);
+    mHeader.percentileCount = uint32_t(min(nPcts, kSnapshotMaxPercentiles));
+    mHeader.flags = flags;
+    mHeader.timestamp = timestamp;
+    mHeader.recordOffset = sizeof(SnapshotHeader);
+    for (size_t i = 0; i < mHeader.percentileCount; ++i) {
+        mHeader.percentiles[i] = pcts[i];
+    }
+
+    // 先占位，finish()时回填
+    mOut->append(string_view(reinterpret_cast<const char*>(&mHeader), sizeof(mHeader)));
+}
+
+void SnapshotWriter::beginMetric(string_view prefix, string_view name)
+{
+    mNameOffset = uint32_t(mStrings.size());
+    mStrings.append(prefix);
+    mStrings.append('_');
+    mStrings.append(name);
+    mNameLength = uint32_t(mStrings.size() - mNameOffset);
+    mStrings.append('\0');
+}
+
+void SnapshotWriter::addWindow(uint32_t windowSeconds, const Summary& summary)
+{
+    SnapshotRecord record {};
+    record.nameOffset = mNameOffset;
+    record.nameLength = mNameLength;
+    record.windowSeconds = windowSeconds;
+    record.count = summary.count;
+    record.sum = summary.sum;
+    record.avg = summary.avg;
+    record.rate = summary.rate;
+    record.qps = summary.qps;
+    size_t nPcts = min<size_t>(mHeader.percentileCount, summary.percentiles.size());
+    for (size_t i = 0; i < nPcts; ++i) {
+        record.percentiles[i] = summary.percentiles[i];
+    }
+    record.max = summary.max;
+    record.stddev = summary.stddev;
+    mOut->append(string_view(reinterpret_cast<const char*>(&record), sizeof(record)));
+    mHeader.recordCount++;
+}
+
+void SnapshotWriter::addExemplar(const Exemplar& exemplar)
+{
+    static_assert(Exemplar::kMaxPayload == kSnapshotMaxPayload, "exemplar payload size mismatch");
+    SnapshotExemplar record {};
+    record.nameOffset = mNameOffset;
+    record.payloadLength = exemplar.payloadLength;
+    record.value = exemplar.value;
+    record.timestamp = exemplar.timestamp;
+    memcpy(record.payload, exemplar.payload, exemplar.payloadLength);
+    mExemplars.append(string_view(reinterpret_cast<const char*>(&record), sizeof(record)));
+    mHeader.exemplarCount++;
+}
+
+void SnapshotWriter::append(const SnapshotReader& part)
+{
+    auto base = uint32_t(mStrings.size());
+    mStrings.append(part.stringTable());
+    for (size_t i = 0; i < part.recordCount(); ++i) {
+        SnapshotRecord record {};
+        memcpy(&record, &part.record(i), sizeof(record));
+        record.nameOffset += base;
+        mOut->append(string_view(reinterpret_cast<const char*>(&record), sizeof(record)));
+        mHeader.recordCount++;
+    }
+    for (size_t i = 0; i < part.exemplarCount(); ++i) {
+        SnapshotExemplar exemplar {};
+        memcpy(&exemplar, &part.exemplar(i), sizeof(exemplar));
+        exemplar.nameOffset += base;
+        mExemplars.append(string_view(reinterpret_cast<const char*>(&exemplar), sizeof(exemplar)));
+        mHeader.exemplarCount++;
+    }
+}
+
+void SnapshotWriter::finish()
+{
+    mHeader.exemplarOffset = mOut->size();
+    mHeader.exemplarSize = sizeof(SnapshotExemplar);
+    mOut->append(mExemplars.view());
+    mHeader.stringTableOffset = mOut->size();
+    mHeader.stringTableSize = mStrings.size();
+    mOut->append(mStrings.view());
+    // 补齐到8字节，方便多个snapshot连续存放
+    while (mOut->size() % 8 != 0) {
+        mOut->append('\0');
+    }
+    mHeader.totalSize = mOut->size();
+    memcpy(mOut->data(), &mHeader, sizeof(mHeader));
+    mOut = nullptr;
+}
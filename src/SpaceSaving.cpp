@@ -0,0 +1,133 @@
+//
+// Created by haosheng on 2021/10/20.
+//
+#include "SpaceSaving.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+
+// 短字符串保存在对象内部，不占用堆内存
+size_t stringHeapBytes(const string& value)
+{
+    const char* data = value.data();
+    auto self = reinterpret_cast<const char*>(&value);
+    return data >= self && data < self + sizeof(string) ? 0 : value.capacity() + 1;
+}
+
+}
+
+SpaceSaving::SpaceSaving(size_t capacity)
+    : mCapacity(max<size_t>(capacity, 1))
+{
+    mCounters.reserve(mCapacity);
+    mIndex.reserve(mCapacity);
+}
+
+void SpaceSaving::offer(const std::string& key, uint64_t count)
+{
+    auto it = mIndex.find(key);
+    if (it != mIndex.end()) {
+        size_t pos = it->second;
+        mCounters[pos].count += count;
+        siftDown(pos);
+        return;
+    }
+    if (mCounters.size() < mCapacity) {
+        it = mIndex.emplace(key, mCounters.size()).first;
+        mCounters.push_back({ &it->first, count, 0 });
+        siftUp(mCounters.size() - 1);
+        return;
+    }
+    // 替换count最小的计数器，新key可能在之前被替换出去时出现过这么多次
+    Counter& victim = mCounters.front();
+    mIndex.erase(mIndex.find(*victim.key));
+    it = mIndex.emplace(key, 0).first;
+    victim.key = &it->first;
+    victim.error = victim.count;
+    victim.count += count;
+    siftDown(0);
+}
+
+uint64_t SpaceSaving::estimate(const std::string& key) const
+{
+    auto it = mIndex.find(key);
+    return it == mIndex.end() ? 0 : mCounters[it->second].count;
+}
+
+void SpaceSaving::top(size_t k, std::vector<Counter>* out) const
+{
+    out->assign(mCounters.begin(), mCounters.end());
+    size_t keep = min(k, out->size());
+    partial_sort(out->begin(), out->begin() + ptrdiff_t(keep), out->end(),
+        [](const Counter& lhs, const Counter& rhs) { return lhs.count > rhs.count; });
+    out->resize(keep);
+}
+
+void SpaceSaving::decay()
+{
+    // 减半是单调的，堆的顺序不变
+    for (Counter& counter : mCounters) {
+        counter.count /= 2;
+        counter.error /= 2;
+    }
+}
+
+void SpaceSaving::clear()
+{
+    mCounters.clear();
+    mIndex.clear();
+}
+
+size_t SpaceSaving::memoryUsage() const
+{
+    // unordered_map的每个节点除了key和value，还有next指针和缓存的hash
+    size_t bytes = mCounters.capacity() * sizeof(Counter) + mIndex.bucket_count() * sizeof(void*);
+    for (const auto& entry : mIndex) {
+        bytes += sizeof(entry) + sizeof(void*) + sizeof(size_t);
+        bytes += stringHeapBytes(entry.first);
+    }
+    return bytes;
+}
+
+void SpaceSaving::siftUp(size_t pos)
+{
+    while (pos > 0) {
+        size_t parent = (pos - 1) / 2;
+        if (mCounters[parent].count <= mCounters[pos].count) {
+            break;
+        }
+        swapCounters(parent, pos);
+        pos = parent;
+    }
+}
+
+void SpaceSaving::siftDown(size_t pos)
+{
+    size_t size = mCounters.size();
+    while (true) {
+        size_t smallest = pos;
+        size_t left = pos * 2 + 1;
+        size_t right = left + 1;
+        if (left < size && mCounters[left].count < mCounters[smallest].count) {
+            smallest = left;
+        }
+        if (right < size && mCounters[right].count < mCounters[smallest].count) {
+            smallest = right;
+        }
+        if (smallest == pos) {
+            break;
+        }
+        swapCounters(smallest, pos);
+        pos = smallest;
+    }
+}
+
+void SpaceSaving::swapCounters(size_t lhs, size_t rhs)
+{
+    swap(mCounters[lhs], mCounters[rhs]);
+    mIndex[*mCounters[lhs].key] = lhs;
+    mIndex[*mCounters[rhs].key] = rhs;
+}
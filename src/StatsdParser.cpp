@@ -0,0 +1,72 @@
+//
+// Created by haosheng on 2021/10/15.
+//
+#include "StatsdParser.h"
+
+#include <charconv>
+#include <cmath>
+
+using namespace std;
+
+namespace {
+
+// from_chars不接受'+'，StatsD客户端有时会带上
+bool parseDouble(string_view text, double* value)
+{
+    if (!text.empty() && text[0] == '+') {
+        text.remove_prefix(1);
+    }
+    if (text.empty()) {
+        return false;
+    }
+    auto result = from_chars(text.data(), text.data() + text.size(), *value);
+    return result.ec == errc() && result.ptr == text.data() + text.size() && isfinite(*value);
+}
+
+}
+
+bool StatsdParser::parseLine(string_view line, StatsdSample* sample)
+{
+    if (!line.empty() && line.back() == '\r') {
+        line.remove_suffix(1);
+    }
+    size_t colon = line.find(':');
+    if (colon == 0 || colon == string_view::npos) {
+        return false;
+    }
+    size_t pipe = line.find('|', colon + 1);
+    if (pipe == string_view::npos) {
+        return false;
+    }
+    string_view value = line.substr(colon + 1, pipe - colon - 1);
+    string_view sections = line.substr(pipe + 1);
+    size_t next = sections.find('|');
+    string_view type = sections.substr(0, next);
+
+    if (type == "g") {
+        if (!value.empty() && (value[0] == '+' || value[0] == '-')) {
+            return false;
+        }
+    } else if (type != "ms" && type != "h" && type != "d" && type != "c") {
+        return false;
+    }
+    if (!parseDouble(value, &sample->value)) {
+        return false;
+    }
+    sample->name = line.substr(0, colon);
+    sample->count = 1;
+
+    while (next != string_view::npos) {
+        sections.remove_prefix(next + 1);
+        next = sections.find('|');
+        string_view section = sections.substr(0, next);
+        if (!section.empty() && section[0] == '@') {
+            double rate = 0;
+            if (!parseDouble(section.substr(1), &rate) || rate <= 0 || rate > 1) {
+                return false;
+            }
+            sample->count = uint64_t(llround(1 / rate));
+        }
+    }
+    return true;
+}
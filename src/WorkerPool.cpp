@@ -0,0 +1,71 @@
+//
+// Created by haosheng on 2021/10/9.
+//
+#include "WorkerPool.h"
+
+using namespace std;
+
+WorkerPool::WorkerPool(size_t numThreads)
+{
+    mThreads.reserve(numThreads);
+    for (size_t i = 0; i < numThreads; ++i) {
+        mThreads.emplace_back(&WorkerPool::threadFunc, this);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        lock_guard<mutex> guard(mMutex);
+        mStop = true;
+    }
+    mWake.notify_all();
+    for (auto& thread : mThreads) {
+        thread.join();
+    }
+}
+
+void WorkerPool::run(size_t numTasks, const function<void(size_t)>& fn)
+{
+    unique_lock<mutex> lock(mMutex);
+    mTask = &fn;
+    mNumTasks = numTasks;
+    mNext = 0;
+    mRemaining = numTasks;
+    mWake.notify_all();
+
+    // 调用线程也参与计算
+    while (runNext(lock)) {
+    }
+    mDone.wait(lock, [this]() { return mRemaining == 0; });
+    mTask = nullptr;
+}
+
+bool WorkerPool::runNext(unique_lock<mutex>& lock)
+{
+    if (mTask == nullptr || mNext >= mNumTasks) {
+        return false;
+    }
+    const auto& task = *mTask;
+    size_t idx = mNext++;
+    lock.unlock();
+    task(idx);
+    lock.lock();
+    if (--mRemaining == 0) {
+        mDone.notify_all();
+    }
+    return true;
+}
+
+void WorkerPool::threadFunc()
+{
+    unique_lock<mutex> lock(mMutex);
+    while (true) {
+        mWake.wait(lock, [this]() { return mStop || (mTask != nullptr && mNext < mNumTasks); });
+        if (mStop) {
+            return;
+        }
+        while (runNext(lock)) {
+        }
+    }
+}
@@ -6,15 +6,20 @@
 
 using namespace std;
 
-AsyncLogging::AsyncLogging(string& fileName, int flushInterval)
+AsyncLogging::AsyncLogging(string& fileName, int flushInterval, uint32_t rollSize,
+    uint32_t rollInterval, uint32_t maxFiles, const string& suffix)
     : kFlushInterval(flushInterval)
     , mFileName(fileName)
+    , mRollSize(rollSize)
+    , mRollInterval(rollInterval)
+    , mMaxFiles(maxFiles)
+    , mSuffix(suffix)
     , mIsRunning(true)
-    , mThread([this]() { threadFunc(); })
     , mMutex()
     , mCondition()
     , mCurrentBuffer(new Buffer)
     , mBuffers()
+    , mThread([this]() { threadFunc(); })
 {
     mBuffers.reserve(16);
 }
@@ -22,12 +27,12 @@ AsyncLogging::AsyncLogging(string& fileName, int flushInterval)
 void AsyncLogging::append(const char* logLine, int len)
 {
     unique_lock<mutex> uniqueLock(mMutex);
-    if (mCurrentBuffer->str().size() + len < kFixedSize) {
-        (*mCurrentBuffer) << logLine;
+    if (mCurrentBuffer->size() + len < kFixedSize) {
+        mCurrentBuffer->append(logLine, len);
     } else {
         mBuffers.push_back(move(mCurrentBuffer));
         mCurrentBuffer.reset(new Buffer);
-        (*mCurrentBuffer) << logLine;
+        mCurrentBuffer->append(logLine, len);
         mCondition.notify_one();
     }
 }
@@ -37,14 +42,17 @@ void AsyncLogging::threadFunc()
     auto newBuffer = make_unique<Buffer>();
     BufferVector bufferVector;
     bufferVector.reserve(16);
-    LogFile logFile(mFileName, kFixedSize * 1000, kFlushInterval);
-    while (mIsRunning) {
+    LogFile logFile(mFileName, mRollSize, kFlushInterval, mRollInterval, mMaxFiles, mSuffix);
+    bool running = true;
+    while (running) {
         assert(bufferVector.empty());
         {
             unique_lock<mutex> uniqueLock(mMutex);
-            if (mBuffers.empty()) {
+            if (mBuffers.empty() && mIsRunning) {
                 mCondition.wait_for(uniqueLock, chrono::seconds(kFlushInterval));
             }
+            // stop()之前append的数据在这一轮中写完
+            running = mIsRunning;
             mBuffers.push_back(move(mCurrentBuffer));
             mCurrentBuffer = move(newBuffer);
             bufferVector.swap(mBuffers);
@@ -52,7 +60,9 @@ void AsyncLogging::threadFunc()
         assert(!bufferVector.empty());
 
         for (auto& buffer : bufferVector) {
-            logFile.append(buffer->str().c_str(), buffer->str().size());
+            if (!buffer->empty()) {
+                logFile.append(buffer->data(), int(buffer->size()));
+            }
         }
         logFile.flush();
 
@@ -64,4 +74,4 @@ void AsyncLogging::threadFunc()
         bufferVector.clear();
     }
     logFile.flush();
-}
\ No newline at end of file
+}
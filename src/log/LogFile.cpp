@@ -3,55 +3,115 @@
 //
 
 #include "log/LogFile.h"
+#include <algorithm>
 #include <chrono>
 #include <ctime>
-#include <thread>
+#include <filesystem>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
 
 using namespace std;
 
-LogFile::LogFile(std::string& fileName, uint32_t rollSize = 10*1000, uint32_t flushInterval = 10)
-    : mFileName(fileName)
+namespace {
+
+uint64_t nowSeconds()
+{
+    return chrono::duration_cast<chrono::seconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+}
+
+LogFile::LogFile(std::string& fileName, uint32_t rollSize, uint32_t flushInterval,
+    uint32_t rollInterval, uint32_t maxFiles, const std::string& suffix)
+    : mBaseName(fileName)
+    , mSuffix(suffix)
+    , mFileName(getLogFileName(fileName, suffix))
     , mFile()
     , mWrittenBytes(0)
     , mRollSize(rollSize)
     , mFlushInterval(flushInterval)
     , mLastFlush(0)
+    , mRollInterval(rollInterval)
+    , mMaxFiles(maxFiles)
+    , mStartOfPeriod(rollInterval == 0 ? 0 : nowSeconds() / rollInterval * rollInterval)
 {
-    mFile.open(getLogFileName(fileName), ofstream::app);
+    mFile.open(mFileName, ofstream::app | ofstream::binary);
+    removeOldFiles();
 }
 
 void LogFile::append(const char* logLine, int len)
 {
-    if (!(mFile << logLine)) {
+    if (!mFile.write(logLine, len)) {
         std::cerr << "AppendFile::append() failed\n";
         return;
     }
     mWrittenBytes += len;
-    if (mWrittenBytes > mRollSize) {
+    auto now = nowSeconds();
+    if (mWrittenBytes > mRollSize
+        || (mRollInterval != 0 && now / mRollInterval * mRollInterval != mStartOfPeriod)) {
         rollFile();
-    } else {
-        auto now = chrono::duration_cast<chrono::seconds>(
-            chrono::system_clock::now().time_since_epoch())
-                       .count();
-        if (now >= mLastFlush + mFlushInterval) {
-            mLastFlush = now;
-            mFile.flush();
-        }
+    } else if (now >= mLastFlush + mFlushInterval) {
+        mLastFlush = now;
+        mFile.flush();
     }
 }
 
 void LogFile::rollFile()
 {
-    string fileName = getLogFileName(mFileName);
+    // 文件名精确到秒，同一秒内不会重复换文件
+    string fileName = getLogFileName(mBaseName, mSuffix);
     if (fileName != mFileName) {
         mFile.close();
         mFileName = fileName;
-        mFile.open(fileName, ofstream::app);
+        mFile.open(fileName, ofstream::app | ofstream::binary);
         mWrittenBytes = 0;
+        if (mRollInterval != 0) {
+            mStartOfPeriod = nowSeconds() / mRollInterval * mRollInterval;
+        }
+        removeOldFiles();
+    }
+}
+
+void LogFile::removeOldFiles()
+{
+    if (mMaxFiles == 0) {
+        return;
+    }
+    namespace fs = std::filesystem;
+    fs::path base(mBaseName);
+    fs::path dir = base.has_parent_path() ? base.parent_path() : fs::path(".");
+    string prefix = base.filename().string() + ".";
+
+    // 文件名中的时间可以按字典序排序
+    vector<fs::path> files;
+    error_code ec;
+    for (const auto& entry : fs::directory_iterator(dir, ec)) {
+        string name = entry.path().filename().string();
+        if (name.size() > prefix.size() + mSuffix.size() && name.compare(0, prefix.size(), prefix) == 0
+            && name.compare(name.size() - mSuffix.size(), mSuffix.size(), mSuffix) == 0) {
+            files.push_back(entry.path());
+        }
+    }
+    if (files.size() <= mMaxFiles) {
+        return;
+    }
+    sort(files.begin(), files.end(), [](const fs::path& a, const fs::path& b) {
+        return a.filename().string() < b.filename().string();
+    });
+    for (size_t i = 0; i + mMaxFiles < files.size(); ++i) {
+        if (files[i].filename() != fs::path(mFileName).filename()) {
+            fs::remove(files[i], ec);
+        }
     }
 }
 
-string LogFile::getLogFileName(const string& fileName)
+string LogFile::getLogFileName(const string& fileName, const string& suffix)
 {
     string filename;
     filename.reserve(fileName.size() + 64);
@@ -59,16 +119,20 @@ string LogFile::getLogFileName(const string& fileName)
 
     char timebuf[32];
     struct tm tm;
-    time_t seconds = static_cast<time_t>(chrono::duration_cast<chrono::seconds>(chrono::system_clock::now().time_since_epoch()).count());
+    time_t seconds = static_cast<time_t>(nowSeconds());
+#ifdef _WIN32
     localtime_s(&tm, &seconds);
+#else
+    localtime_r(&seconds, &tm);
+#endif
     strftime(timebuf, sizeof timebuf, ".%Y%m%d-%H%M%S.", &tm);
     filename += timebuf;
 
     char pidbuf[32];
-    snprintf(pidbuf, sizeof pidbuf, "%d", this_thread::get_id());
+    snprintf(pidbuf, sizeof pidbuf, "%d", static_cast<int>(getpid()));
     filename += pidbuf;
 
-    filename += ".log";
+    filename += suffix;
 
     return filename;
 }
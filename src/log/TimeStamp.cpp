@@ -17,7 +17,11 @@ std::string Timestamp::toFixedSizeString(bool showMicroseconds) const
     char buf[64] = {0};
     time_t seconds = static_cast<time_t>(mMicroSecondsSinceEpoch / kMicroSecondsPerSecond);
     struct tm tm_time;
+#ifdef _WIN32
     localtime_s(&tm_time, &seconds);
+#else
+    localtime_r(&seconds, &tm_time);
+#endif
 
     if (showMicroseconds)
     {
@@ -0,0 +1,154 @@
+//
+// Created by haosheng on 2021/10/13.
+//
+#include "AggregatorClient.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "log/Logger.h"
+
+using namespace std;
+
+namespace {
+
+// 发送一次缓冲区的总超时时间，超时认为聚合进程已经不可用
+constexpr chrono::milliseconds kIoTimeout { 1000 };
+
+// POLLOUT只说明有一部分缓冲区空间，阻塞的send()仍然可能等到对方读取为止，所以总是不阻塞地发送
+#ifdef MSG_NOSIGNAL
+constexpr int kSendFlags = MSG_NOSIGNAL | MSG_DONTWAIT;
+#else
+constexpr int kSendFlags = MSG_DONTWAIT;
+#endif
+
+bool sendAll(int fd, const char* data, size_t size)
+{
+    auto deadline = chrono::steady_clock::now() + kIoTimeout;
+    while (size > 0) {
+        ssize_t n = send(fd, data, size, kSendFlags);
+        if (n >= 0) {
+            data += n;
+            size -= size_t(n);
+            continue;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            return false;
+        }
+        auto remaining = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now());
+        pollfd pfd { fd, POLLOUT, 0 };
+        int ready = remaining.count() > 0 ? poll(&pfd, 1, int(remaining.count())) : 0;
+        if (ready == 0) {
+            errno = ETIMEDOUT;
+            return false;
+        }
+        if (ready < 0 && errno != EINTR) {
+            return false;
+        }
+    }
+    return true;
+}
+}
+
+bool AggregatorClient::open(const string& path)
+{
+    close();
+    if (path.empty() || path.size() >= sizeof(sockaddr_un::sun_path)) {
+        return false;
+    }
+    mPath = path;
+    mStopping = false;
+    mThread = thread(&AggregatorClient::run, this);
+    return true;
+}
+
+void AggregatorClient::push(string_view frame)
+{
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+        if (mPending.size() + frame.size() > kMaxPending) {
+            LOG_WARN << "aggregator " << mPath << " is not keeping up, dropping " << mPending.size() << " bytes";
+            mPending.clear();
+        }
+        mPending.append(frame.data(), frame.size());
+    }
+    mCond.notify_one();
+}
+
+void AggregatorClient::close()
+{
+    if (mThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(mLock);
+            mStopping = true;
+        }
+        mCond.notify_one();
+        mThread.join();
+    }
+    disconnect();
+    mPending.clear();
+}
+
+bool AggregatorClient::connectSocket()
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+    sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, mPath.c_str(), mPath.size() + 1);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        ::close(fd);
+        return false;
+    }
+    mFd = fd;
+    return true;
+}
+
+void AggregatorClient::disconnect()
+{
+    if (mFd >= 0) {
+        ::close(mFd);
+        mFd = -1;
+    }
+}
+
+void AggregatorClient::run()
+{
+    // 在锁外发送，push()只和交换缓冲区竞争
+    string sending;
+    bool warned = false;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard(mLock);
+            mCond.wait(guard, [this]() { return mStopping || !mPending.empty(); });
+            if (mStopping) {
+                break;
+            }
+            sending.swap(mPending);
+        }
+        if (mFd < 0 && !connectSocket()) {
+            // 聚合进程没有运行时每个周期都会失败，只记录一次
+            if (!warned) {
+                LOG_WARN << "cannot connect to aggregator " << mPath << ": " << strerror(errno);
+                warned = true;
+            }
+        } else if (!sendAll(mFd, sending.data(), sending.size())) {
+            LOG_WARN << "sending to aggregator " << mPath << " failed: " << strerror(errno);
+            // 可能只发送了半帧，只能断开重连
+            disconnect();
+        } else {
+            warned = false;
+        }
+        sending.clear();
+    }
+}
@@ -0,0 +1,151 @@
+//
+// Created by haosheng on 2021/10/13.
+//
+#include "AggregatorServer.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "log/Logger.h"
+
+using namespace std;
+
+bool AggregatorServer::listen(const string& path, Callback fn)
+{
+    stop();
+    sockaddr_un addr {};
+    if (path.size() >= sizeof(addr.sun_path)) {
+        return false;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    unlink(path.c_str());
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(fd, 64) != 0
+        || pipe(mWakeFd) != 0) {
+        LOG_ERROR << "aggregator cannot listen on " << path << ": " << strerror(errno);
+        ::close(fd);
+        return false;
+    }
+    mPath = path;
+    mListenFd = fd;
+    mCallback = move(fn);
+    mRunning.store(true, memory_order_release);
+    mThread = thread(&AggregatorServer::run, this);
+    return true;
+}
+
+void AggregatorServer::stop()
+{
+    if (mThread.joinable()) {
+        mRunning.store(false, memory_order_release);
+        char c = 0;
+        (void)write(mWakeFd[1], &c, 1);
+        mThread.join();
+    }
+    for (auto& connection : mConnections) {
+        ::close(connection.fd);
+    }
+    mConnections.clear();
+    for (int* fd : { &mListenFd, &mWakeFd[0], &mWakeFd[1] }) {
+        if (*fd >= 0) {
+            ::close(*fd);
+            *fd = -1;
+        }
+    }
+    if (!mPath.empty()) {
+        unlink(mPath.c_str());
+        mPath.clear();
+    }
+}
+
+void AggregatorServer::run()
+{
+    vector<pollfd> fds;
+    while (mRunning.load(memory_order_acquire)) {
+        // 前两个是监听socket和唤醒pipe，之后与mConnections一一对应
+        fds.clear();
+        fds.push_back({ mListenFd, POLLIN, 0 });
+        fds.push_back({ mWakeFd[0], POLLIN, 0 });
+        for (auto& connection : mConnections) {
+            fds.push_back({ connection.fd, POLLIN, 0 });
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR << "aggregator poll failed: " << strerror(errno);
+            break;
+        }
+        if (fds[1].revents != 0) {
+            break;
+        }
+
+        // 从后往前处理，断开的连接可以直接删除
+        for (size_t i = mConnections.size(); i-- > 0;) {
+            if (fds[i + 2].revents == 0) {
+                continue;
+            }
+            if (!receive(mConnections[i])) {
+                ::close(mConnections[i].fd);
+                mConnections.erase(mConnections.begin() + ptrdiff_t(i));
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(mListenFd, nullptr, nullptr);
+            if (fd >= 0) {
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                mConnections.push_back({ fd, string() });
+            }
+        }
+    }
+    mRunning.store(false, memory_order_release);
+}
+
+bool AggregatorServer::receive(Connection& connection)
+{
+    char buf[64 * 1024];
+    // 对方关闭连接之前发送的数据仍然要处理
+    bool open = true;
+    while (true) {
+        ssize_t n = recv(connection.fd, buf, sizeof(buf), 0);
+        if (n == 0) {
+            open = false;
+            break;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            open = errno == EAGAIN || errno == EWOULDBLOCK;
+            break;
+        }
+        connection.buffer.append(buf, size_t(n));
+    }
+
+    // 处理所有完整的帧，剩下的部分留到下一次
+    size_t offset = 0;
+    while (offset < connection.buffer.size()) {
+        size_t frameSize = 0;
+        auto result = AggregatorFrame::parse(connection.buffer.data() + offset,
+            connection.buffer.size() - offset, &frameSize, mCallback);
+        if (result == AggregatorFrame::ParseResult::Incomplete) {
+            break;
+        }
+        if (result == AggregatorFrame::ParseResult::Invalid) {
+            LOG_WARN << "aggregator received an invalid frame, closing the connection";
+            return false;
+        }
+        offset += frameSize;
+    }
+    connection.buffer.erase(0, offset);
+    return open;
+}
@@ -0,0 +1,229 @@
+//
+// Created by haosheng on 2021/9/24.
+//
+#include "MetricsServer.h"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "log/Logger.h"
+
+using namespace std;
+
+namespace {
+
+// 请求头的最大长度，超过时直接关闭连接
+constexpr size_t kMaxRequestSize = 8192;
+// 客户端发送请求和接收响应的超时时间
+constexpr int kIoTimeoutMs = 1000;
+
+#ifdef MSG_NOSIGNAL
+constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+constexpr int kSendFlags = 0;
+#endif
+
+bool sendAll(int fd, const char* data, size_t size)
+{
+    while (size > 0) {
+        pollfd pfd { fd, POLLOUT, 0 };
+        if (poll(&pfd, 1, kIoTimeoutMs) <= 0) {
+            return false;
+        }
+        ssize_t n = send(fd, data, size, kSendFlags);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        size -= size_t(n);
+    }
+    return true;
+}
+
+void sendResponse(int fd, string_view status, string_view contentType, string_view body)
+{
+    string header;
+    header.reserve(128);
+    header.append("HTTP/1.1 ").append(status);
+    header.append("\r\nContent-Type: ").append(contentType);
+    header.append("\r\nContent-Length: ").append(to_string(body.size()));
+    header.append("\r\nConnection: close\r\n\r\n");
+    if (sendAll(fd, header.data(), header.size())) {
+        sendAll(fd, body.data(), body.size());
+    }
+}
+
+}
+
+bool MetricsServer::listenTcp(uint16_t port)
+{
+    stop();
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), len) != 0
+        || getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+        LOG_ERROR << "metrics server cannot bind port " << port << ": " << strerror(errno);
+        ::close(fd);
+        return false;
+    }
+    mPort = ntohs(addr.sin_port);
+    return start(fd);
+}
+
+bool MetricsServer::listenUnix(const string& path)
+{
+    stop();
+    sockaddr_un addr {};
+    if (path.size() >= sizeof(addr.sun_path)) {
+        return false;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    unlink(path.c_str());
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        LOG_ERROR << "metrics server cannot bind " << path << ": " << strerror(errno);
+        ::close(fd);
+        return false;
+    }
+    mUnixPath = path;
+    return start(fd);
+}
+
+bool MetricsServer::start(int fd)
+{
+    if (listen(fd, 16) != 0 || pipe(mWakeFd) != 0) {
+        ::close(fd);
+        return false;
+    }
+    mListenFd = fd;
+    mRunning.store(true, memory_order_release);
+    mThread = thread(&MetricsServer::run, this);
+    return true;
+}
+
+void MetricsServer::stop()
+{
+    if (mThread.joinable()) {
+        mRunning.store(false, memory_order_release);
+        char c = 0;
+        (void)write(mWakeFd[1], &c, 1);
+        mThread.join();
+    }
+    for (int* fd : { &mListenFd, &mWakeFd[0], &mWakeFd[1] }) {
+        if (*fd >= 0) {
+            ::close(*fd);
+            *fd = -1;
+        }
+    }
+    if (!mUnixPath.empty()) {
+        unlink(mUnixPath.c_str());
+        mUnixPath.clear();
+    }
+    mPort = 0;
+}
+
+void MetricsServer::publish(string_view body, string_view contentType)
+{
+    // 在锁外构造新内容，锁内只交换指针
+    auto content = make_shared<Content>();
+    content->body.assign(body.data(), body.size());
+    content->contentType.assign(contentType.data(), contentType.size());
+    std::lock_guard<std::mutex> guard(mContentLock);
+    mContent = move(content);
+}
+
+void MetricsServer::run()
+{
+    pollfd fds[2] = { { mListenFd, POLLIN, 0 }, { mWakeFd[0], POLLIN, 0 } };
+    while (mRunning.load(memory_order_acquire)) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR << "metrics server poll failed: " << strerror(errno);
+            break;
+        }
+        if (fds[1].revents != 0) {
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(mListenFd, nullptr, nullptr);
+            if (fd >= 0) {
+                handle(fd);
+                ::close(fd);
+            }
+        }
+    }
+    mRunning.store(false, memory_order_release);
+}
+
+void MetricsServer::handle(int fd)
+{
+    // 只需要请求行，读到请求头结束为止
+    char request[kMaxRequestSize];
+    size_t size = 0;
+    while (size < sizeof(request)) {
+        pollfd pfd { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, kIoTimeoutMs) <= 0) {
+            return;
+        }
+        ssize_t n = recv(fd, request + size, sizeof(request) - size, 0);
+        if (n <= 0) {
+            return;
+        }
+        size += size_t(n);
+        if (string_view(request, size).find("\r\n\r\n") != string_view::npos) {
+            break;
+        }
+    }
+
+    string_view line(request, size);
+    line = line.substr(0, line.find("\r\n"));
+    string_view method = line.substr(0, line.find(' '));
+    string_view target = line.substr(min(line.size(), method.size() + 1));
+    target = target.substr(0, target.find(' '));
+    target = target.substr(0, target.find('?'));
+
+    if (method != "GET") {
+        sendResponse(fd, "405 Method Not Allowed", "text/plain", "method not allowed\n");
+        return;
+    }
+    if (target != "/metrics") {
+        sendResponse(fd, "404 Not Found", "text/plain", "not found\n");
+        return;
+    }
+
+    shared_ptr<const Content> content;
+    {
+        std::lock_guard<std::mutex> guard(mContentLock);
+        content = mContent;
+    }
+    if (content) {
+        sendResponse(fd, "200 OK", content->contentType, content->body);
+    } else {
+        sendResponse(fd, "200 OK", "text/plain", "");
+    }
+}
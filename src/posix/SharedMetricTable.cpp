@@ -0,0 +1,150 @@
+//
+// Created by haosheng on 2021/10/14.
+//
+#include "SharedMetricTable.h"
+
+#include <cerrno>
+#include <cstring>
+#include <csignal>
+#include <new>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+
+#include "log/Logger.h"
+
+using namespace std;
+
+namespace {
+
+// 所有进程都使用同一个哈希函数，不依赖std::hash的实现
+uint64_t hashName(string_view name)
+{
+    uint64_t hash = 1469598103934665603ULL;
+    for (char c : name) {
+        hash ^= uint8_t(c);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// 低32位是kInserting，高32位是插入方的pid
+uint64_t insertingBy(pid_t pid)
+{
+    return uint64_t(uint32_t(pid)) << 32 | 1;
+}
+
+// kill(pid, 0)只检查进程是否存在，不发送信号
+bool processExists(uint64_t state)
+{
+    pid_t pid = pid_t(uint32_t(state >> 32));
+    return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+size_t alignUp(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+}
+
+bool SharedMetricTable::create(size_t capacity, size_t numBuckets)
+{
+    close();
+    if (capacity == 0 || numBuckets == 0) {
+        return false;
+    }
+    size_t activeWords = (numBuckets + 63) / 64;
+    size_t phaseWords = 1 + activeWords + 2 * numBuckets;
+    // 每个slot按cache line对齐，不同metric之间没有伪共享
+    size_t slotSize = alignUp(sizeof(SlotHeader) + 2 * phaseWords * sizeof(uint64_t), 64);
+    size_t headerSize = alignUp(sizeof(Header), 64);
+    size_t mappedSize = headerSize + capacity * slotSize;
+
+    // 匿名共享内存的内容为0，slot的状态都是kEmpty，所有计数都是0
+    void* addr = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+        LOG_ERROR << "cannot map " << mappedSize << " bytes of shared memory: " << strerror(errno);
+        return false;
+    }
+    mHeader = new (addr) Header();
+    mHeader->capacity = capacity;
+    mHeader->numBuckets = numBuckets;
+    mSlots = static_cast<char*>(addr) + headerSize;
+    mMappedSize = mappedSize;
+    mSlotSize = slotSize;
+    mActiveWords = activeWords;
+    mPhaseWords = phaseWords;
+    return true;
+}
+
+void SharedMetricTable::close()
+{
+    if (mHeader != nullptr) {
+        munmap(mHeader, mMappedSize);
+        mHeader = nullptr;
+        mSlots = nullptr;
+        mMappedSize = 0;
+    }
+}
+
+size_t SharedMetricTable::findOrInsert(string_view name)
+{
+    if (name.size() > kMaxNameLength) {
+        return kNotFound;
+    }
+    uint64_t hash = hashName(name);
+    size_t capacity = mHeader->capacity;
+    size_t idx = size_t(hash % capacity);
+    uint64_t inserting = insertingBy(getpid());
+    for (size_t probe = 0; probe < capacity; ++probe, idx = idx + 1 == capacity ? 0 : idx + 1) {
+        SlotHeader* slot = getSlot(idx);
+        uint64_t state = slot->state.load(memory_order_acquire);
+        if (state == kEmpty && slot->state.compare_exchange_strong(state, inserting, memory_order_acq_rel)) {
+            fillSlot(slot, name, hash);
+            return idx;
+        }
+        // 其他进程正在插入这个slot，名称很短，很快就会完成
+        auto deadline = chrono::steady_clock::now() + kInsertTimeout;
+        while ((state & 0xffffffff) == kInserting) {
+            if (chrono::steady_clock::now() >= deadline) {
+                if (processExists(state)) {
+                    return kNotFound;
+                }
+                // 插入方已经死掉，接管这个slot；其他进程同时接管时只有一个成功
+                if (slot->state.compare_exchange_strong(state, inserting, memory_order_acq_rel)) {
+                    fillSlot(slot, name, hash);
+                    return idx;
+                }
+                deadline = chrono::steady_clock::now() + kInsertTimeout;
+                continue;
+            }
+            this_thread::yield();
+            state = slot->state.load(memory_order_acquire);
+        }
+        if (slot->hash == hash && string_view(slot->name, slot->nameLength) == name) {
+            return idx;
+        }
+    }
+    return kNotFound;
+}
+
+size_t SharedMetricTable::flipPhase()
+{
+    bool timedOut = false;
+    size_t phase = mHeader->phaser.flipPhase(kFlipTimeout, &timedOut);
+    if (timedOut) {
+        LOG_WARN << "writers did not leave phase " << phase << " within " << kFlipTimeout.count()
+                 << " ms, a process may have been killed while adding samples";
+    }
+    return phase;
+}
+
+void SharedMetricTable::fillSlot(SlotHeader* slot, string_view name, uint64_t hash)
+{
+    slot->hash = hash;
+    slot->nameLength = uint32_t(name.size());
+    memcpy(slot->name, name.data(), name.size());
+    slot->name[name.size()] = '\0';
+    slot->state.store(kReady, memory_order_release);
+}
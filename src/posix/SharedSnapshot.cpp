@@ -0,0 +1,170 @@
+//
+// Created by haosheng on 2021/9/22.
+//
+#include "SharedSnapshot.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+string shmName(const string& name)
+{
+    return !name.empty() && name[0] == '/' ? name : "/" + name;
+}
+
+size_t headerSize()
+{
+    return (sizeof(SharedSnapshotRegion) + 63) / 64 * 64;
+}
+
+}
+
+bool SharedSnapshotPublisher::open(const string& name, size_t capacity)
+{
+    close();
+    capacity = (capacity + 7) / 8 * 8;
+    string path = shmName(name);
+    int fd = shm_open(path.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    size_t mappedSize = headerSize() + 2 * capacity;
+    if (ftruncate(fd, off_t(mappedSize)) != 0) {
+        ::close(fd);
+        shm_unlink(path.c_str());
+        return false;
+    }
+    void* addr = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        shm_unlink(path.c_str());
+        return false;
+    }
+
+    auto* region = new (addr) SharedSnapshotRegion;
+    region->version = SharedSnapshotRegion::kVersion;
+    region->headerSize = uint32_t(headerSize());
+    region->capacity = capacity;
+    region->generation.store(0, memory_order_relaxed);
+    for (size_t i = 0; i < 2; ++i) {
+        region->sequence[i].store(0, memory_order_relaxed);
+        region->size[i].store(0, memory_order_relaxed);
+    }
+    // magic最后写入，读取方看到magic时其他字段已经初始化
+    atomic_thread_fence(memory_order_release);
+    memcpy(region->magic, SharedSnapshotRegion::kMagic, sizeof(region->magic));
+
+    mName = path;
+    mRegion = region;
+    mMappedSize = mappedSize;
+    return true;
+}
+
+bool SharedSnapshotPublisher::publish(const char* data, size_t size)
+{
+    if (mRegion == nullptr || size > mRegion->capacity) {
+        return false;
+    }
+    uint64_t generation = mRegion->generation.load(memory_order_relaxed) + 1;
+    size_t idx = generation & 1;
+    uint64_t sequence = mRegion->sequence[idx].load(memory_order_relaxed);
+
+    mRegion->sequence[idx].store(sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(mRegion->slot(idx), data, size);
+    mRegion->size[idx].store(size, memory_order_relaxed);
+    mRegion->sequence[idx].store(sequence + 2, memory_order_release);
+    mRegion->generation.store(generation, memory_order_release);
+    return true;
+}
+
+void SharedSnapshotPublisher::close()
+{
+    if (mRegion) {
+        munmap(mRegion, mMappedSize);
+        shm_unlink(mName.c_str());
+        mRegion = nullptr;
+        mMappedSize = 0;
+    }
+}
+
+bool SharedSnapshotSubscriber::open(const string& name)
+{
+    close();
+    int fd = shm_open(shmName(name).c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st {};
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(SharedSnapshotRegion)) {
+        ::close(fd);
+        return false;
+    }
+    size_t mappedSize = size_t(st.st_size);
+    void* addr = mmap(nullptr, mappedSize, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+
+    const auto* region = static_cast<const SharedSnapshotRegion*>(addr);
+    if (memcmp(region->magic, SharedSnapshotRegion::kMagic, sizeof(region->magic)) != 0
+        || region->version != SharedSnapshotRegion::kVersion
+        || region->headerSize + 2 * region->capacity > mappedSize) {
+        munmap(addr, mappedSize);
+        return false;
+    }
+    atomic_thread_fence(memory_order_acquire);
+
+    mRegion = region;
+    mMappedSize = mappedSize;
+    return true;
+}
+
+bool SharedSnapshotSubscriber::read(ReportBuffer& out, uint64_t* generation) const
+{
+    if (mRegion == nullptr) {
+        return false;
+    }
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        uint64_t current = mRegion->generation.load(memory_order_acquire);
+        if (current == 0) {
+            return false;
+        }
+        size_t idx = current & 1;
+        uint64_t before = mRegion->sequence[idx].load(memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+        uint64_t size = mRegion->size[idx].load(memory_order_relaxed);
+        if (size > mRegion->capacity) {
+            continue;
+        }
+        out.clear();
+        out.append(string_view(mRegion->slot(idx), size));
+        atomic_thread_fence(memory_order_acquire);
+        if (mRegion->sequence[idx].load(memory_order_relaxed) == before) {
+            if (generation) {
+                *generation = current;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void SharedSnapshotSubscriber::close()
+{
+    if (mRegion) {
+        munmap(const_cast<SharedSnapshotRegion*>(mRegion), mMappedSize);
+        mRegion = nullptr;
+        mMappedSize = 0;
+    }
+}
@@ -0,0 +1,188 @@
+//
+// Created by haosheng on 2021/10/15.
+//
+#include "StatsdServer.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "log/Logger.h"
+
+using namespace std;
+
+namespace {
+
+// 突发流量时由内核缓冲，设置失败时使用系统默认值
+constexpr int kReceiveBufferSize = 8 * 1024 * 1024;
+
+}
+
+bool StatsdServer::listenUdp(uint16_t port, Callback fn)
+{
+    stop();
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), len) != 0
+        || getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+        LOG_ERROR << "statsd server cannot bind port " << port << ": " << strerror(errno);
+        ::close(fd);
+        return false;
+    }
+    mPort = ntohs(addr.sin_port);
+    return start(fd, move(fn));
+}
+
+bool StatsdServer::listenUnix(const string& path, Callback fn)
+{
+    stop();
+    sockaddr_un addr {};
+    if (path.size() >= sizeof(addr.sun_path)) {
+        return false;
+    }
+    int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    unlink(path.c_str());
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        LOG_ERROR << "statsd server cannot bind " << path << ": " << strerror(errno);
+        ::close(fd);
+        return false;
+    }
+    mUnixPath = path;
+    return start(fd, move(fn));
+}
+
+bool StatsdServer::start(int fd, Callback fn)
+{
+    if (pipe(mWakeFd) != 0) {
+        ::close(fd);
+        return false;
+    }
+    int size = kReceiveBufferSize;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    mFd = fd;
+    mCallback = move(fn);
+    mBuffer.resize(kBatchSize * kMaxDatagramSize);
+    mRunning.store(true, memory_order_release);
+    mThread = thread(&StatsdServer::run, this);
+    return true;
+}
+
+void StatsdServer::stop()
+{
+    if (mThread.joinable()) {
+        mRunning.store(false, memory_order_release);
+        char c = 0;
+        (void)write(mWakeFd[1], &c, 1);
+        mThread.join();
+    }
+    for (int* fd : { &mFd, &mWakeFd[0], &mWakeFd[1] }) {
+        if (*fd >= 0) {
+            ::close(*fd);
+            *fd = -1;
+        }
+    }
+    if (!mUnixPath.empty()) {
+        unlink(mUnixPath.c_str());
+        mUnixPath.clear();
+    }
+    mPort = 0;
+}
+
+void StatsdServer::run()
+{
+    pollfd fds[2] = { { mFd, POLLIN, 0 }, { mWakeFd[0], POLLIN, 0 } };
+    while (mRunning.load(memory_order_acquire)) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR << "statsd server poll failed: " << strerror(errno);
+            break;
+        }
+        if (fds[1].revents != 0) {
+            break;
+        }
+        // 持续接收直到socket中没有数据，高负载时几乎不调用poll()
+        while (mRunning.load(memory_order_relaxed) && receiveBatch()) {
+        }
+    }
+    mRunning.store(false, memory_order_release);
+}
+
+bool StatsdServer::receiveBatch()
+{
+    size_t sizes[kBatchSize];
+    bool truncated[kBatchSize];
+    size_t received = 0;
+#ifdef __linux__
+    mmsghdr messages[kBatchSize];
+    iovec iovs[kBatchSize];
+    for (size_t i = 0; i < kBatchSize; ++i) {
+        iovs[i] = { mBuffer.data() + i * kMaxDatagramSize, kMaxDatagramSize };
+        messages[i] = {};
+        messages[i].msg_hdr.msg_iov = &iovs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    int n = recvmmsg(mFd, messages, kBatchSize, MSG_DONTWAIT, nullptr);
+    if (n <= 0) {
+        return false;
+    }
+    received = size_t(n);
+    for (size_t i = 0; i < received; ++i) {
+        sizes[i] = messages[i].msg_len;
+        truncated[i] = (messages[i].msg_hdr.msg_flags & MSG_TRUNC) != 0;
+    }
+#else
+    // 没有recvmmsg()的系统逐个接收
+    for (; received < kBatchSize; ++received) {
+        ssize_t n = recv(mFd, mBuffer.data() + received * kMaxDatagramSize, kMaxDatagramSize,
+            MSG_DONTWAIT | MSG_TRUNC);
+        if (n < 0) {
+            break;
+        }
+        sizes[received] = min(size_t(n), kMaxDatagramSize);
+        truncated[received] = size_t(n) > kMaxDatagramSize;
+    }
+    if (received == 0) {
+        return false;
+    }
+#endif
+
+    mSamples.clear();
+    size_t invalid = 0;
+    for (size_t i = 0; i < received; ++i) {
+        const char* data = mBuffer.data() + i * kMaxDatagramSize;
+        size_t size = sizes[i];
+        if (truncated[i]) {
+            // 最后一行不完整
+            size_t end = string_view(data, size).rfind('\n');
+            size = end == string_view::npos ? 0 : end;
+            ++invalid;
+        }
+        invalid += StatsdParser::parse(data, size, [this](const StatsdSample& sample) { mSamples.push_back(sample); });
+    }
+    mReceived.fetch_add(mSamples.size(), memory_order_relaxed);
+    mInvalid.fetch_add(invalid, memory_order_relaxed);
+    if (!mSamples.empty()) {
+        mCallback(mSamples.data(), mSamples.size());
+    }
+    return true;
+}
@@ -0,0 +1,161 @@
+//
+// Created by haosheng on 2021/10/13.
+//
+#include "AggregatorFrame.h"
+#include "TimeseriesHistogram.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <map>
+#include <string>
+
+#ifndef _WIN32
+#include "AggregatorClient.h"
+#include "AggregatorServer.h"
+#include <mutex>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+class AggregatorTest : public ::testing::Test {
+protected:
+    using Snapshot = AggregatorFrame::Snapshot;
+
+    // 一个周期的新增数据，与PerformanceMarker发送的一样只有一个窗口
+    static Snapshot makeDelta(std::initializer_list<double> values)
+    {
+        TimeseriesHistogram<double> histogram { 1000, -1e5, 1e5,
+            MultiLevelTimeSeries<double>(10, { chrono::seconds(10) }) };
+        auto now = chrono::steady_clock::now();
+        for (double value : values) {
+            histogram.addValue(now, value);
+        }
+        histogram.update(now);
+        Snapshot snapshot;
+        histogram.snapshot(&snapshot);
+        return snapshot;
+    }
+
+    static void writeFrame(ReportBuffer& out, const map<string, Snapshot>& metrics)
+    {
+        AggregatorFrame frame;
+        frame.begin(out);
+        for (auto& metric : metrics) {
+            frame.add(metric.first, metric.second);
+        }
+        frame.finish();
+    }
+};
+
+TEST_F(AggregatorTest, frameRoundTrip)
+{
+    ReportBuffer out;
+    writeFrame(out, { { "latency", makeDelta({ 1, 2, 3000 }) }, { "size", makeDelta({ -5 }) } });
+    size_t firstSize = out.size();
+    writeFrame(out, {});
+
+    map<string, uint64_t> counts;
+    auto collect = [&](string_view name, const Snapshot& snapshot) { counts[string(name)] += snapshot.count(0); };
+    size_t frameSize = 0;
+    ASSERT_EQ(AggregatorFrame::parse(out.data(), out.size(), &frameSize, collect), AggregatorFrame::ParseResult::Ok);
+    EXPECT_EQ(frameSize, firstSize);
+    EXPECT_EQ(counts["latency"], 3);
+    EXPECT_EQ(counts["size"], 1);
+
+    ASSERT_EQ(AggregatorFrame::parse(out.data() + frameSize, out.size() - frameSize, &frameSize, collect),
+        AggregatorFrame::ParseResult::Ok);
+    EXPECT_EQ(frameSize, AggregatorFrame::kHeaderSize);
+
+    for (size_t size = 0; size < firstSize; ++size) {
+        ASSERT_EQ(AggregatorFrame::parse(out.data(), size, &frameSize, collect),
+            AggregatorFrame::ParseResult::Incomplete);
+    }
+    out.data()[0] = 'X';
+    EXPECT_EQ(AggregatorFrame::parse(out.data(), out.size(), &frameSize, collect),
+        AggregatorFrame::ParseResult::Invalid);
+}
+
+#ifndef _WIN32
+TEST_F(AggregatorTest, mergesFramesFromManyClients)
+{
+    string path = "/tmp/PerformanceMarkerTest.aggregator." + to_string(getpid());
+    mutex lock;
+    Snapshot merged;
+    size_t received = 0;
+    AggregatorServer server;
+    ASSERT_TRUE(server.listen(path, [&](string_view name, const Snapshot& delta) {
+        lock_guard<mutex> guard(lock);
+        EXPECT_EQ(name, "latency");
+        merged += delta;
+        ++received;
+    }));
+
+    const int kClients = 4;
+    const int kFrames = 5;
+    AggregatorClient clients[kClients];
+    for (auto& client : clients) {
+        ASSERT_TRUE(client.open(path));
+    }
+    ReportBuffer frame;
+    for (int i = 0; i < kFrames; ++i) {
+        for (int c = 0; c < kClients; ++c) {
+            frame.clear();
+            writeFrame(frame, { { "latency", makeDelta({ double(c * 1000), 50000 }) } });
+            clients[c].push(frame.view());
+        }
+    }
+
+    for (int wait = 0; wait < 500; ++wait) {
+        {
+            lock_guard<mutex> guard(lock);
+            if (received == kClients * kFrames) {
+                break;
+            }
+        }
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    for (auto& client : clients) {
+        client.close();
+    }
+    server.stop();
+
+    ASSERT_EQ(received, kClients * kFrames);
+    EXPECT_EQ(merged.count(0), 2 * kClients * kFrames);
+    EXPECT_DOUBLE_EQ(merged.sum(0), kFrames * (0 + 1000 + 2000 + 3000 + kClients * 50000.0));
+    // 一半的数据是50000
+    EXPECT_GE(merged.getPercentileEstimate(60, 0), 50000);
+    EXPECT_LT(merged.getPercentileEstimate(40, 0), 4000);
+    EXPECT_NE(access(path.c_str(), F_OK), 0);
+}
+
+TEST_F(AggregatorTest, closeDoesNotWaitForStalledAggregator)
+{
+    // 接受连接但从不读取的聚合进程
+    string path = "/tmp/PerformanceMarkerTest.stalled." + to_string(getpid());
+    unlink(path.c_str());
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    ASSERT_GE(listener, 0);
+    sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path.c_str());
+    ASSERT_EQ(bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0);
+    ASSERT_EQ(listen(listener, 1), 0);
+
+    AggregatorClient client;
+    ASSERT_TRUE(client.open(path));
+    // 远大于socket缓冲区，send()一定会在中途等待对方读取
+    client.push(string(AggregatorClient::kMaxPending / 2, 'x'));
+    this_thread::sleep_for(chrono::milliseconds(100));
+
+    auto start = chrono::steady_clock::now();
+    client.close();
+    EXPECT_LT(chrono::steady_clock::now() - start, chrono::seconds(3));
+    ::close(listener);
+    unlink(path.c_str());
+}
+#endif
@@ -2,6 +2,8 @@
 // Created by DELL on 2021/8/25.
 //
 #include <chrono>
+#include <filesystem>
+#include <fstream>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include <thread>
@@ -41,3 +43,29 @@ TEST(AsyncLoggingTest, bench)
 
     bench();
 }
+
+TEST(AsyncLoggingJournalTest, writesEverythingBeforeStop)
+{
+    auto dir = filesystem::temp_directory_path() / ("AsyncLoggingJournalTest." + to_string(getpid()));
+    filesystem::remove_all(dir);
+    filesystem::create_directories(dir);
+    string fileName = (dir / "journal").string();
+
+    string expected;
+    {
+        AsyncLogging log(fileName, 3, 64 * 1024 * 1024, 0, 0, ".jsonl");
+        for (int i = 0; i < 1000; ++i) {
+            // 包含'\0'的记录也要原样写入
+            string record = "{\"seq\":" + to_string(i) + "}" + string(i % 3, '\0') + "\n";
+            log.append(record.data(), int(record.size()));
+            expected += record;
+        }
+    }
+
+    vector<filesystem::path> files(filesystem::directory_iterator(dir), filesystem::directory_iterator {});
+    ASSERT_EQ(files.size(), 1);
+    EXPECT_EQ(files[0].extension(), ".jsonl");
+    ifstream file(files[0], ios::binary);
+    EXPECT_EQ(string(istreambuf_iterator<char>(file), istreambuf_iterator<char>()), expected);
+    filesystem::remove_all(dir);
+}
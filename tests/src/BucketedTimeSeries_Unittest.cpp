@@ -28,3 +28,118 @@ TEST_F(BucketedTimeSeriesTest, addValue)
     EXPECT_EQ(bucketedTimeSeries1.rate(), 0.6);
     EXPECT_EQ(bucketedTimeSeries1.countRate(), 0.3);
 }
+
+TEST_F(BucketedTimeSeriesTest, rangeIndexMatchesLinear)
+{
+    // 29s不能被60整除，bucket的宽度不一致
+    BucketedTimeSeries<double> linear { 60, std::chrono::seconds(29) };
+    BucketedTimeSeries<double> indexed { 60, std::chrono::seconds(29) };
+    indexed.enableRangeIndex();
+    ASSERT_TRUE(indexed.hasRangeIndex());
+
+    auto now = std::chrono::steady_clock::now();
+    auto begin = now;
+    uint32_t seed = 2021;
+    auto next = [&seed]() {
+        seed = seed * 1103515245 + 12345;
+        return seed >> 8;
+    };
+    for (int step = 0; step < 5000; ++step) {
+        now += std::chrono::milliseconds(next() % 400);
+        if (step % 1000 == 999) {
+            // 偶尔跳过整个duration，所有bucket都过时
+            now += std::chrono::seconds(40);
+        }
+        // 偶尔插入一个稍早的数据
+        auto when = next() % 5 == 0 ? now - std::chrono::seconds(next() % 10) : now;
+        double value = next() % 1000;
+        uint64_t times = 1 + next() % 3;
+        ASSERT_EQ(linear.addValue(when, value, times), indexed.addValue(when, value, times));
+        if (step == 2500) {
+            linear.clear();
+            indexed.clear();
+        }
+
+        for (int query = 0; query < 3; ++query) {
+            auto start = now - std::chrono::milliseconds(next() % 35000);
+            auto end = start + std::chrono::milliseconds(next() % 35000);
+            if (next() % 7 == 0) {
+                // 区间从头开始，可能晚于end，此时两者都是空区间
+                start = begin;
+            }
+            ASSERT_EQ(indexed.count(start, end), linear.count(start, end));
+            ASSERT_DOUBLE_EQ(indexed.sum(start, end), linear.sum(start, end));
+            ASSERT_DOUBLE_EQ(indexed.avg(start, end), linear.avg(start, end));
+        }
+    }
+
+    // 反向的区间在两种实现中都为空
+    auto reversed = now - std::chrono::seconds(5);
+    EXPECT_EQ(linear.count(now, reversed), 0);
+    EXPECT_DOUBLE_EQ(linear.sum(now, reversed), 0);
+    EXPECT_EQ(indexed.count(now, reversed), 0);
+
+    // 在已有数据上建立索引
+    linear.enableRangeIndex();
+    auto start = now - std::chrono::seconds(20);
+    BucketedTimeSeries<double> copy = indexed;
+    EXPECT_EQ(linear.count(start, now), indexed.count(start, now));
+    EXPECT_DOUBLE_EQ(linear.sum(start, now), copy.sum(start, now));
+}
+
+// 有无索引时区间查询的耗时，不检查结果，用--gtest_also_run_disabled_tests运行
+TEST_F(BucketedTimeSeriesTest, DISABLED_rangeIndexBench)
+{
+    BucketedTimeSeries<double> linear { 3600, std::chrono::hours(1) };
+    BucketedTimeSeries<double> indexed { 3600, std::chrono::hours(1) };
+    indexed.enableRangeIndex();
+    auto now = std::chrono::steady_clock::now();
+    for (int i = 0; i < 7200; ++i) {
+        now += std::chrono::milliseconds(500);
+        linear.addValue(now, i);
+        indexed.addValue(now, i);
+    }
+
+    const int kQueries = 20000;
+    for (auto* series : { &linear, &indexed }) {
+        uint64_t total = 0;
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < kQueries; ++i) {
+            total += series->count(now - std::chrono::seconds(3000 - i % 1000), now - std::chrono::seconds(i % 500));
+        }
+        auto cost = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - begin);
+        std::cout << (series->hasRangeIndex() ? "indexed" : "linear") << " range count: "
+                  << cost.count() / kQueries << " ns/op, total " << total << std::endl;
+    }
+}
+
+TEST(BucketedTimeSeriesMomentsTest, windowMinMaxAndStddev)
+{
+    BucketedTimeSeries<double, BucketMoments> series { 10, std::chrono::seconds(10) };
+    auto now = std::chrono::steady_clock::time_point(std::chrono::hours(1));
+    // 第一秒出现一个尖峰，之后每秒写入2和4
+    series.addValue(now, 1000);
+    for (int i = 1; i < 10; ++i) {
+        series.addValue(now + std::chrono::seconds(i), 2);
+        series.addValue(now + std::chrono::seconds(i), 4);
+    }
+    auto total = series.windowTotal();
+    EXPECT_EQ(total.mCount, series.count());
+    EXPECT_DOUBLE_EQ(total.mSum, series.sum());
+    EXPECT_DOUBLE_EQ(total.max(), 1000);
+    EXPECT_DOUBLE_EQ(total.min(), 2);
+
+    // 尖峰过期后max回落，标准差只来自窗口内的数据
+    series.update(now + std::chrono::seconds(10));
+    total = series.windowTotal();
+    EXPECT_EQ(total.mCount, 18);
+    EXPECT_DOUBLE_EQ(total.max(), 4);
+    EXPECT_NEAR(total.stddev(), 1, 1e-9);
+
+    // addValueAggregated()只知道总和，按平均值近似
+    Bucket<double, BucketMoments> aggregated;
+    aggregated.addValueAggregated(30, 3);
+    EXPECT_DOUBLE_EQ(aggregated.max(), 10);
+    EXPECT_DOUBLE_EQ(aggregated.stddev(), 0);
+}
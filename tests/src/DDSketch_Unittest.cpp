@@ -0,0 +1,144 @@
+//
+// Created by haosheng on 2021/10/16.
+//
+#include "DDSketch.h"
+#include "TimeseriesSketch.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+// 与DDSketch相同的rank定义：排序后第floor(pct / 100 * (n - 1))个值
+double exactPercentile(vector<double> values, double pct)
+{
+    sort(values.begin(), values.end());
+    return values[size_t(pct / 100 * double(values.size() - 1))];
+}
+
+}
+
+TEST(DDSketchTest, relativeAccuracyOnLongTail)
+{
+    const double kAccuracy = 0.01;
+    DDSketch<double> sketch(kAccuracy);
+    // 对数正态分布：大部分在几毫秒，尾部到几十秒
+    mt19937 rng(7);
+    lognormal_distribution<double> latency(1.5, 1.5);
+    vector<double> values;
+    for (int i = 0; i < 100000; ++i) {
+        values.push_back(latency(rng));
+        sketch.add(values.back());
+    }
+
+    EXPECT_EQ(sketch.count(), values.size());
+    EXPECT_DOUBLE_EQ(sketch.min(), *min_element(values.begin(), values.end()));
+    EXPECT_DOUBLE_EQ(sketch.max(), *max_element(values.begin(), values.end()));
+    for (double pct : { 1.0, 25.0, 50.0, 90.0, 99.0, 99.9, 99.99 }) {
+        double exact = exactPercentile(values, pct);
+        EXPECT_NEAR(sketch.getPercentileEstimate(pct), exact, exact * kAccuracy) << pct;
+    }
+    EXPECT_DOUBLE_EQ(sketch.getPercentileEstimate(100), sketch.max());
+}
+
+TEST(DDSketchTest, negativeZeroAndCollapse)
+{
+    DDSketch<double> sketch(0.02, 128);
+    for (int i = -100; i <= 100; ++i) {
+        sketch.add(i, 10);
+    }
+    EXPECT_EQ(sketch.count(), 2010);
+    EXPECT_DOUBLE_EQ(sketch.sum(), 0);
+    EXPECT_DOUBLE_EQ(sketch.getPercentileEstimate(50), 0);
+    EXPECT_NEAR(sketch.getPercentileEstimate(0), -100, 2);
+    EXPECT_NEAR(sketch.getPercentileEstimate(25), -50, 50 * 0.02 + 1e-9);
+
+    // 跨越很多数量级时bin个数不超过上限，合并的是最小的一端，高百分位数仍然准确
+    for (double value = 1e-6; value < 1e9; value *= 1.01) {
+        sketch.add(value);
+    }
+    EXPECT_LE(sketch.numBins(), 2 * sketch.maxBins());
+    EXPECT_NEAR(sketch.getPercentileEstimate(99.9), 1e9 * 0.999, 0.2 * 1e9);
+}
+
+TEST(DDSketchTest, mergeEqualsSingleSketch)
+{
+    DDSketch<double> first;
+    DDSketch<double> second;
+    DDSketch<double> whole;
+    mt19937 rng(11);
+    exponential_distribution<double> latency(0.01);
+    for (int i = 0; i < 20000; ++i) {
+        double value = latency(rng) - 20;
+        (i % 3 == 0 ? first : second).add(value);
+        whole.add(value);
+    }
+    first += second;
+    EXPECT_EQ(first.count(), whole.count());
+    EXPECT_NEAR(first.sum(), whole.sum(), 1e-6 * abs(whole.sum()));
+    for (double pct : { 0.0, 10.0, 50.0, 90.0, 99.0, 100.0 }) {
+        EXPECT_DOUBLE_EQ(first.getPercentileEstimate(pct), whole.getPercentileEstimate(pct)) << pct;
+    }
+
+    DDSketch<double> other(0.05);
+    other.add(1);
+    first += other;
+    EXPECT_EQ(first.count(), whole.count());
+}
+
+TEST(DDSketchTest, timeseriesWindows)
+{
+    using Sketch = TimeseriesSketch<double>;
+    Sketch sketch({ { 10, chrono::seconds(10) }, { 6, chrono::seconds(60) } });
+    auto start = chrono::steady_clock::time_point(chrono::hours(1));
+    // 第一个10秒写入1000，之后的50秒写入0..499
+    for (int i = 0; i < 100; ++i) {
+        sketch.addValue(start + chrono::milliseconds(i * 100), 1000);
+    }
+    for (int i = 0; i < 500; ++i) {
+        sketch.addValue(start + chrono::seconds(10) + chrono::milliseconds(i * 100), i);
+    }
+    // 包含now的时间片只有一部分在窗口内，与BucketedTimeSeries相同，所以查询在时间片的末尾
+    auto now = start + chrono::seconds(60) - chrono::milliseconds(1);
+    sketch.update(now);
+
+    EXPECT_EQ(sketch.count(1), 600);
+    EXPECT_DOUBLE_EQ(sketch.sum(1), 100 * 1000 + 499 * 500 / 2);
+    EXPECT_NEAR(sketch.getPercentileEstimate(99, 1), 1000, 10);
+    // 最短窗口中只有最近10秒的数据
+    EXPECT_EQ(sketch.count(0), 100);
+    EXPECT_NEAR(sketch.getPercentileEstimate(50, 0), 450, 5);
+    EXPECT_EQ(sketch.elapsed(0), chrono::seconds(10));
+
+    Sketch::Summary summary;
+    const double pcts[] = { 99, 50 };
+    sketch.summarize(0, pcts, 2, &summary);
+    EXPECT_EQ(summary.count, 100);
+    EXPECT_DOUBLE_EQ(summary.percentiles[1], sketch.getPercentileEstimate(50, 0));
+    EXPECT_DOUBLE_EQ(summary.qps, 10);
+
+    // 所有数据过时之后为空
+    sketch.update(now + chrono::minutes(2));
+    EXPECT_EQ(sketch.count(1), 0);
+    EXPECT_DOUBLE_EQ(sketch.getPercentileEstimate(99, 1), 0);
+
+    // 同一时间片的数据合并，过时的时间片不影响结果
+    Sketch first({ { 10, chrono::seconds(10) } });
+    Sketch second({ { 10, chrono::seconds(10) } });
+    auto base = start + chrono::hours(1);
+    for (int i = 0; i < 100; ++i) {
+        first.addValue(base + chrono::milliseconds(i * 100), i);
+        second.addValue(base + chrono::milliseconds(i * 100), i + 100);
+    }
+    second.addValue(base - chrono::seconds(30), 1e6);
+    first += second;
+    first.update(base + chrono::seconds(10) - chrono::milliseconds(1));
+    EXPECT_EQ(first.count(0), 200);
+    EXPECT_NEAR(first.getPercentileEstimate(50, 0), 100, 2);
+}
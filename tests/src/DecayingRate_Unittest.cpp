@@ -0,0 +1,88 @@
+//
+// Created by haosheng on 2021/10/18.
+//
+#include "DecayingRate.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+TEST(DecayingRateTest, convergesAndDecays)
+{
+    DecayingRate rate({ chrono::minutes(1), chrono::minutes(5) }, chrono::seconds(5));
+    ASSERT_EQ(rate.numWindows(), 2);
+    auto now = chrono::steady_clock::time_point(chrono::hours(1));
+    // 每秒100个采样点，值交替为10和30，持续10分钟
+    for (int i = 0; i < 600; ++i) {
+        rate.addValue(now, i % 2 == 0 ? 10 : 30, 100);
+        now += chrono::seconds(1);
+    }
+    rate.update(now);
+    // 输入恒定时第一次折算就等于瞬时值，之后保持不变
+    EXPECT_NEAR(rate.qps(0), 100, 1e-6);
+    EXPECT_NEAR(rate.qps(1), 100, 1e-6);
+    EXPECT_NEAR(rate.avg(0), 20, 1);
+    EXPECT_NEAR(rate.rate(0), rate.qps(0) * rate.avg(0), 1e-6);
+
+    // 停止写入一分钟，1分钟的窗口衰减为1/e，5分钟的窗口衰减为e^-0.2，平均值不变
+    double avg = rate.avg(0);
+    rate.update(now + chrono::minutes(1));
+    EXPECT_NEAR(rate.qps(0), 100 * exp(-1.0), 1e-6);
+    EXPECT_NEAR(rate.qps(1), 100 * exp(-0.2), 1e-6);
+    EXPECT_NEAR(rate.avg(0), avg, 1e-9);
+
+    // 没有新的tick时不变
+    rate.update(now + chrono::minutes(1) + chrono::seconds(1));
+    EXPECT_NEAR(rate.qps(0), 100 * exp(-1.0), 1e-6);
+}
+
+TEST(DecayingRateTest, partialFirstTick)
+{
+    DecayingRate rate({ chrono::minutes(1) }, chrono::seconds(5));
+    auto tickStart = chrono::steady_clock::time_point(chrono::hours(1));
+    // 第一个采样点在tick开始3秒之后，之后每秒100个
+    for (int i = 3; i < 10; ++i) {
+        rate.addValue(tickStart + chrono::seconds(i), 1, 100);
+        // 第一个tick只有2秒，与下一个tick合并折算
+        if (i == 5) {
+            EXPECT_EQ(rate.qps(0), 0);
+        }
+    }
+    rate.update(tickStart + chrono::seconds(10));
+    EXPECT_NEAR(rate.qps(0), 100, 1e-6);
+
+    // 下一个tick没有采样点时，第一个tick与这个空tick合并，之后的空tick只衰减
+    DecayingRate idle({ chrono::minutes(1) }, chrono::seconds(5));
+    idle.addValue(tickStart + chrono::seconds(3), 1, 200);
+    idle.update(tickStart + chrono::seconds(20));
+    EXPECT_NEAR(idle.qps(0), 200 / 7.0 * exp(-2 * 5 / 60.0), 1e-6);
+}
+
+TEST(DecayingRateTest, concurrentWriters)
+{
+    DecayingRate rate;
+    auto start = chrono::steady_clock::time_point(chrono::hours(2));
+    // 第一个采样点在tick的起点，第一个tick是完整的
+    rate.addValue(start, 2);
+    const int kThreads = 4;
+    const int kValues = 100000;
+    vector<thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&rate, start] {
+            for (int i = 0; i < kValues; ++i) {
+                rate.addValue(start + chrono::milliseconds(i % 1000), 2);
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    // 所有采样点都在同一个tick中，折算之后没有丢失
+    rate.update(start + chrono::seconds(5));
+    EXPECT_DOUBLE_EQ(rate.qps(0), (kThreads * kValues + 1) / 5.0);
+    EXPECT_DOUBLE_EQ(rate.avg(2), 2);
+}
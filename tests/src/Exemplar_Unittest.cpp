@@ -0,0 +1,124 @@
+//
+// Created by haosheng on 2021/10/19.
+//
+#include "ExemplarReservoir.h"
+#include "SnapshotReader.h"
+#include "SnapshotWriter.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+TEST(ExemplarTest, keepsLargestAcrossThreads)
+{
+    ExemplarReservoir reservoir(5);
+    const int kThreads = 4;
+    vector<thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&reservoir, t] {
+            for (int i = 0; i < 10000; ++i) {
+                int value = i * kThreads + t;
+                reservoir.add(value, "req-" + to_string(value));
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    const auto& top = reservoir.collect(0);
+    ASSERT_EQ(top.size(), 5);
+    for (size_t i = 0; i < top.size(); ++i) {
+        int expected = 40000 - 1 - int(i);
+        EXPECT_EQ(top[i].value, expected);
+        EXPECT_EQ(top[i].payloadView(), "req-" + to_string(expected));
+    }
+
+    // collect()之后门槛被重置，较小的值仍然可以进入；合并时只保留最大的5个
+    reservoir.add(1, string(100, 'x'));
+    EXPECT_EQ(reservoir.collect(0).size(), 5);
+    EXPECT_EQ(reservoir.collect(0).back().value, 39995);
+
+    // 窗口之外的样例被丢弃，截断的payload保留前kMaxPayload个字符
+    ExemplarReservoir small(2);
+    small.add(1, string(100, 'x'));
+    ASSERT_EQ(small.collect(0).size(), 1);
+    EXPECT_EQ(small.collect(0)[0].payloadView(), string(Exemplar::kMaxPayload, 'x'));
+    EXPECT_TRUE(small.collect(UINT64_MAX).empty());
+}
+
+TEST(ExemplarTest, recreatedReservoirsStartEmpty)
+{
+    // 新的reservoir可能分配在刚销毁的地址上，线程缓存不能把旧的分片交给它；
+    // 个数超过线程缓存的清理门槛，已销毁的项被清理
+    for (int i = 0; i < 1000; ++i) {
+        auto reservoir = make_unique<ExemplarReservoir>(2);
+        reservoir->add(i, to_string(i));
+        const auto& top = reservoir->collect(0);
+        ASSERT_EQ(top.size(), 1);
+        EXPECT_EQ(top[0].value, i);
+        EXPECT_EQ(top[0].payloadView(), to_string(i));
+    }
+}
+
+TEST(ExemplarTest, writtenToSnapshot)
+{
+    ReportBuffer part;
+    SnapshotWriter writer;
+    writer.begin(part, TimeseriesHistogram<double>::kReportPercentiles,
+        TimeseriesHistogram<double>::kNumReportPercentiles, 1631000000);
+    SnapshotWriter::Summary summary;
+    summary.count = 2;
+    summary.percentiles.resize(TimeseriesHistogram<double>::kNumReportPercentiles);
+    writer.beginMetric("test", "a");
+    writer.addWindow(10, summary);
+    writer.beginMetric("test", "latency");
+    writer.addWindow(10, summary);
+    writer.addWindow(60, summary);
+    ExemplarReservoir reservoir(2);
+    reservoir.add(250, "trace=\"ab\\c\"\n");
+    reservoir.add(900, "slow");
+    for (const Exemplar& exemplar : reservoir.collect(0)) {
+        writer.addExemplar(exemplar);
+    }
+    writer.finish();
+
+    // 与并行生成报告时一样，把part追加到另一个snapshot中，nameOffset被调整
+    ReportBuffer whole;
+    SnapshotReader partReader;
+    ASSERT_TRUE(partReader.open(part.data(), part.size()));
+    writer.begin(whole, TimeseriesHistogram<double>::kReportPercentiles,
+        TimeseriesHistogram<double>::kNumReportPercentiles, 1631000000);
+    writer.beginMetric("test", "0first");
+    writer.addWindow(10, summary);
+    writer.append(partReader);
+    writer.finish();
+
+    SnapshotReader reader;
+    ASSERT_TRUE(reader.open(whole.data(), whole.size()));
+    ASSERT_EQ(reader.exemplarCount(), 2);
+    EXPECT_EQ(reader.exemplar(0).value, 900);
+    EXPECT_EQ(reader.payload(reader.exemplar(1)), "trace=\"ab\\c\"\n");
+    EXPECT_EQ(reader.exemplar(0).nameOffset, reader.record(2).nameOffset);
+
+    ReportBuffer line;
+    reader.toJsonLine(line);
+    EXPECT_THAT(line.str(), ::testing::HasSubstr(
+        "\"60s\":{\"count\":2,"));
+    EXPECT_THAT(line.str(), ::testing::HasSubstr(
+        "\"stddev\":0.00},\"exemplars\":[{\"value\":900.00,\"timestamp\":" + to_string(reader.exemplar(0).timestamp)
+        + ",\"payload\":\"slow\"},{\"value\":250.00,"));
+    EXPECT_THAT(line.str(), ::testing::HasSubstr("\"payload\":\"trace=\\\"ab\\\\c\\\"\\u000a\"}]}}}"));
+    // 没有样例的metric不输出exemplars
+    EXPECT_THAT(line.str(), ::testing::HasSubstr("\"test_a\":{\"count\":2,"));
+    EXPECT_EQ(line.str().find("exemplars"), line.str().rfind("exemplars"));
+
+    ReportBuffer json;
+    reader.toJson(json);
+    EXPECT_THAT(json.str(), ::testing::HasSubstr("\n\t\t},\n\t\t\"exemplars\": [\n\t\t\t{\"value\": 900.00, "));
+}
@@ -0,0 +1,153 @@
+//
+// Created by haosheng on 2021/9/14.
+//
+#include "HistogramBuckets.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <random>
+
+using namespace std;
+
+namespace {
+
+// 改动前的实现：每次分配vector，逐个bucket累加百分比
+template <typename CountFn>
+size_t referencePercentileBucketIdx(
+    const HistogramBuckets<double>& buckets, double pct, CountFn countFromBucket, double* lowPct, double* highPct)
+{
+    vector<uint64_t> counts(buckets.getNumBuckets());
+    uint64_t totalCount = 0;
+    for (size_t n = 0; n < buckets.getNumBuckets(); ++n) {
+        counts[n] = countFromBucket(buckets.getByIndex(n));
+        totalCount += counts[n];
+    }
+    if (totalCount == 0) {
+        *lowPct = 0.0;
+        *highPct = 0.0;
+        return 1;
+    }
+    double prevPct = 0.0;
+    double curPct = 0.0;
+    uint64_t curCount = 0;
+    size_t idx;
+    for (idx = 0; idx < counts.size(); ++idx) {
+        if (counts[idx] == 0) {
+            continue;
+        }
+        prevPct = curPct;
+        curCount += counts[idx];
+        curPct = static_cast<double>(curCount) / totalCount;
+        if (pct <= curPct) {
+            break;
+        }
+    }
+    *lowPct = prevPct;
+    *highPct = curPct;
+    return idx;
+}
+
+uint64_t countFromLevel0(const MultiLevelTimeSeries<double>& bucket)
+{
+    return bucket.count(0);
+}
+
+}
+
+class HistogramBucketsTest : public ::testing::Test {
+protected:
+    void fill(size_t nValues, double sparsity)
+    {
+        mt19937 rng(42);
+        normal_distribution<double> value(0, 2e4);
+        uniform_real_distribution<double> skip(0, 1);
+        auto now = chrono::steady_clock::now();
+        for (size_t i = 0; i < nValues; ++i) {
+            double v = value(rng);
+            // 让部分bucket保持为空
+            if (skip(rng) < sparsity && buckets.getBucketIdx(v) % 3 == 0) {
+                continue;
+            }
+            buckets.getByValue(v).addValue(now, v);
+        }
+        for (auto& bucket : buckets) {
+            bucket.update(now);
+        }
+    }
+
+    HistogramBuckets<double> buckets { 1e3, -1e5, 1e5, MultiLevelTimeSeries<double>(10, { chrono::seconds(10) }) };
+};
+
+TEST(CountScanTest, lowerBoundMatchesScalar)
+{
+    mt19937 rng(7);
+    uniform_int_distribution<uint64_t> value(0, 50);
+    for (size_t n = 1; n < 40; ++n) {
+        uint64_t* counts = CountBuffer::local().reserve(n);
+        uint64_t total = 0;
+        for (size_t i = 0; i < n; ++i) {
+            counts[i] = i % 4 == 1 ? 0 : value(rng);
+            total += counts[i];
+        }
+        EXPECT_EQ(CountScan::sum(counts, n), total);
+        for (uint64_t threshold = 1; threshold <= total + 1; ++threshold) {
+            uint64_t cum = 0;
+            size_t expected = 0;
+            while (expected < n && cum + counts[expected] < threshold) {
+                cum += counts[expected++];
+            }
+            uint64_t countBefore = 0;
+            EXPECT_EQ(CountScan::lowerBound(counts, n, threshold, &countBefore), expected);
+            EXPECT_EQ(countBefore, cum);
+        }
+    }
+}
+
+TEST_F(HistogramBucketsTest, percentileBucketIdxMatchesReference)
+{
+    fill(5000, 0.7);
+    for (int i = 0; i <= 1000; ++i) {
+        double pct = i / 1000.0;
+        double lowPct, highPct, expectedLow, expectedHigh;
+        size_t idx = buckets.getPercentileBucketIdx(pct, countFromLevel0, &lowPct, &highPct);
+        size_t expected = referencePercentileBucketIdx(buckets, pct, countFromLevel0, &expectedLow, &expectedHigh);
+        EXPECT_EQ(idx, expected) << "pct: " << pct;
+        EXPECT_DOUBLE_EQ(lowPct, expectedLow);
+        EXPECT_DOUBLE_EQ(highPct, expectedHigh);
+    }
+}
+
+TEST_F(HistogramBucketsTest, percentileBucketIdxEmpty)
+{
+    double lowPct, highPct;
+    EXPECT_EQ(buckets.getPercentileBucketIdx(0.99, countFromLevel0, &lowPct, &highPct), 1);
+    EXPECT_EQ(lowPct, 0.0);
+    EXPECT_EQ(highPct, 0.0);
+}
+
+// 扫描与参考实现的耗时对比，只打印结果，用--gtest_also_run_disabled_tests运行
+TEST_F(HistogramBucketsTest, DISABLED_percentileBench)
+{
+    fill(100000, 0.0);
+    const int kIterations = 100000;
+    double lowPct, highPct;
+    size_t sink = 0;
+
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < kIterations; ++i) {
+        sink += referencePercentileBucketIdx(buckets, 0.99, countFromLevel0, &lowPct, &highPct);
+    }
+    auto reference = chrono::steady_clock::now() - start;
+
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < kIterations; ++i) {
+        sink += buckets.getPercentileBucketIdx(0.99, countFromLevel0, &lowPct, &highPct);
+    }
+    auto scan = chrono::steady_clock::now() - start;
+
+    printf("buckets: %zu, iterations: %d, reference: %.1f ns/op, scan: %.1f ns/op (%zu)\n",
+        buckets.getNumBuckets(), kIterations,
+        chrono::duration<double, nano>(reference).count() / kIterations,
+        chrono::duration<double, nano>(scan).count() / kIterations, sink);
+}
@@ -0,0 +1,129 @@
+//
+// Created by haosheng on 2021/10/12.
+//
+#include "HistogramSnapshot.h"
+#include "TimeseriesHistogram.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+using namespace std;
+
+class HistogramSnapshotTest : public ::testing::Test {
+protected:
+    using Histogram = TimeseriesHistogram<double>;
+    using Snapshot = HistogramSnapshot<double>;
+
+    static Histogram makeHistogram()
+    {
+        return Histogram { 10, 0, 1000,
+            MultiLevelTimeSeries<double>(10, { chrono::seconds(10), chrono::minutes(1) }) };
+    }
+
+    void SetUp() override
+    {
+        // 两个“进程”各自记录一部分数据，whole记录全部数据
+        auto now = chrono::steady_clock::now();
+        uint32_t seed = 42;
+        for (int i = 0; i < 3000; ++i) {
+            seed = seed * 1103515245 + 12345;
+            auto when = now + chrono::milliseconds(i * 10);
+            double value = double((seed >> 8) % (i % 2 == 0 ? 300 : 1200));
+            (i % 3 == 0 ? first : second).addValue(when, value);
+            whole.addValue(when, value);
+        }
+        auto end = now + chrono::seconds(30);
+        first.update(end);
+        second.update(end);
+        whole.update(end);
+    }
+
+    Histogram first = makeHistogram();
+    Histogram second = makeHistogram();
+    Histogram whole = makeHistogram();
+};
+
+TEST_F(HistogramSnapshotTest, mergeMatchesSingleHistogram)
+{
+    Snapshot merged;
+    Snapshot part;
+    first.snapshot(&part);
+    merged += part;
+    second.snapshot(&part);
+    ASSERT_TRUE(merged.isMergeable(part));
+    merged += part;
+
+    ASSERT_EQ(merged.numWindows(), whole.getNumLevels());
+    for (size_t level = 0; level < whole.getNumLevels(); ++level) {
+        EXPECT_EQ(merged.count(level), whole.count(level));
+        EXPECT_DOUBLE_EQ(merged.sum(level), whole.sum(level));
+        for (size_t b = 0; b < whole.getNumBuckets(); ++b) {
+            ASSERT_EQ(merged.getBuckets(level).getByIndex(b).mCount, whole.getBucket(b).count(level));
+        }
+        for (double pct : { 10.0, 50.0, 90.0, 99.0 }) {
+            EXPECT_DOUBLE_EQ(merged.getPercentileEstimate(pct, level), whole.getPercentileEstimate(pct, level));
+        }
+    }
+    EXPECT_EQ(merged.getWindow(1), chrono::minutes(1));
+    EXPECT_DOUBLE_EQ(merged.countRate(1), whole.countRate(1));
+}
+
+TEST_F(HistogramSnapshotTest, serializeRoundTrip)
+{
+    Snapshot snapshot;
+    whole.snapshot(&snapshot);
+    Snapshot empty;
+    ReportBuffer out;
+    snapshot.serialize(out);
+    size_t firstSize = out.size();
+    empty.serialize(out);
+
+    Snapshot parsed;
+    size_t consumed = 0;
+    ASSERT_TRUE(parsed.parse(out.data(), out.size(), &consumed));
+    EXPECT_EQ(consumed, firstSize);
+    ASSERT_EQ(parsed.numWindows(), snapshot.numWindows());
+    EXPECT_EQ(parsed.getNumBuckets(), snapshot.getNumBuckets());
+    for (size_t w = 0; w < parsed.numWindows(); ++w) {
+        EXPECT_EQ(parsed.getElapsed(w), snapshot.getElapsed(w));
+        EXPECT_EQ(parsed.count(w), snapshot.count(w));
+        EXPECT_DOUBLE_EQ(parsed.sum(w), snapshot.sum(w));
+        EXPECT_DOUBLE_EQ(parsed.getPercentileEstimate(99, w), snapshot.getPercentileEstimate(99, w));
+    }
+
+    // 连续存放的第二个快照
+    ASSERT_TRUE(parsed.parse(out.data() + consumed, out.size() - consumed));
+    EXPECT_EQ(parsed.numWindows(), 0);
+
+    for (size_t size = 0; size < firstSize; size += 7) {
+        EXPECT_FALSE(parsed.parse(out.data(), size));
+    }
+}
+
+TEST_F(HistogramSnapshotTest, serializesOnlyNonEmptyBuckets)
+{
+    Histogram sparse = makeHistogram();
+    auto now = chrono::steady_clock::now();
+    sparse.addValue(now, 5, 100);
+    sparse.addValue(now, 555, 3);
+    sparse.update(now);
+    Snapshot snapshot;
+    sparse.snapshot(&snapshot);
+    ReportBuffer out;
+    snapshot.serialize(out);
+    // 102个bucket、2个窗口，只有4个非空bucket
+    EXPECT_LT(out.size(), 100);
+}
+
+TEST_F(HistogramSnapshotTest, rejectsDifferentLayout)
+{
+    Snapshot snapshot;
+    whole.snapshot(&snapshot);
+    Histogram other { 20, 0, 1000, MultiLevelTimeSeries<double>(10, { chrono::seconds(10) }) };
+    Snapshot otherSnapshot;
+    other.snapshot(&otherSnapshot);
+
+    EXPECT_FALSE(snapshot.isMergeable(otherSnapshot));
+    uint64_t count = snapshot.count(0);
+    snapshot += otherSnapshot;
+    EXPECT_EQ(snapshot.count(0), count);
+}
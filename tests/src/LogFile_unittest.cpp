@@ -5,6 +5,10 @@
 #include <gmock/gmock.h>
 #include <thread>
 #include <chrono>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <unistd.h>
 
 #include "log/LogFile.h"
 #include "log/Logger.h"
@@ -33,3 +37,70 @@ TEST(LogFileTest, bench)
     }
 }
 
+
+class LogFileRollTest : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        dir = filesystem::temp_directory_path() / ("LogFileRollTest." + to_string(getpid()));
+        filesystem::remove_all(dir);
+        filesystem::create_directories(dir);
+        baseName = (dir / "journal").string();
+    }
+
+    void TearDown() override { filesystem::remove_all(dir); }
+
+    vector<string> files() const
+    {
+        vector<string> names;
+        for (const auto& entry : filesystem::directory_iterator(dir)) {
+            names.push_back(entry.path().filename().string());
+        }
+        sort(names.begin(), names.end());
+        return names;
+    }
+
+    filesystem::path dir;
+    string baseName;
+};
+
+TEST_F(LogFileRollTest, keepsNewestFiles)
+{
+    // 之前运行留下的文件
+    for (const char* name : { "journal.20200101-000000.1.log", "journal.20200102-000000.1.log",
+             "journal.20200103-000000.1.log", "other.20200101-000000.1.log" }) {
+        ofstream(dir / name) << "old";
+    }
+
+    LogFile logFile(baseName, 1000, 10, 0, 2);
+    logFile.append("new\n", 4);
+    logFile.flush();
+
+    auto names = files();
+    ASSERT_EQ(names.size(), 3);
+    EXPECT_EQ(names[0], "journal.20200103-000000.1.log");
+    EXPECT_THAT(names[1], ::testing::StartsWith("journal.20"));
+    EXPECT_NE(names[1], names[0]);
+    EXPECT_EQ(names[2], "other.20200101-000000.1.log");
+}
+
+TEST_F(LogFileRollTest, rollsByTime)
+{
+    LogFile logFile(baseName, 1000 * 1000, 10, 1, 0, ".jsonl");
+    logFile.append("first\n", 6);
+    this_thread::sleep_for(1100ms);
+    logFile.append("second\n", 7);
+    logFile.append("third\n", 6);
+    logFile.flush();
+
+    auto names = files();
+    ASSERT_EQ(names.size(), 2);
+    EXPECT_THAT(names[0], ::testing::EndsWith(".jsonl"));
+    string content;
+    for (const auto& name : names) {
+        ifstream file(dir / name, ios::binary);
+        content += string(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    }
+    // 超过周期之后的第一次写入仍在旧文件中，之后的写入在新文件中
+    EXPECT_EQ(content, "first\nsecond\nthird\n");
+}
@@ -37,3 +37,76 @@ TEST_F(MultiLevelTimeSeriesTest, addValueIn1Min)
     EXPECT_EQ(multiLevelTimeSeries1.sum(1), 1006);
     EXPECT_EQ(multiLevelTimeSeries1.avg(1), 251.5);
 }
+
+TEST_F(MultiLevelTimeSeriesTest, bucketsPerLevel)
+{
+    MultiLevelTimeSeries<double> series({ { 60, std::chrono::minutes(1) }, { 10, std::chrono::minutes(10) } });
+    ASSERT_EQ(series.numLevels(), 2);
+    EXPECT_EQ(series.getLevel(0).numBuckets(), 60);
+    EXPECT_EQ(series.getLevel(1).numBuckets(), 10);
+    EXPECT_FALSE(series.isRollup());
+}
+
+TEST_F(MultiLevelTimeSeriesTest, rollup)
+{
+    using namespace std::chrono;
+    std::vector<MultiLevelTimeSeries<double>::LevelConfig> levels {
+        { 10, seconds(10) }, { 6, minutes(1) }, { 5, minutes(5) }
+    };
+    MultiLevelTimeSeries<double> rollup(levels, true);
+    MultiLevelTimeSeries<double> full(levels);
+    ASSERT_TRUE(rollup.isRollup());
+
+    // 每100ms一个数据，持续3分钟
+    auto now = steady_clock::now();
+    for (int i = 0; i < 1800; ++i) {
+        now += milliseconds(100);
+        rollup.addValue(now, 2);
+        full.addValue(now, 2);
+    }
+    rollup.update(now);
+    full.update(now);
+
+    // level 0不受影响
+    EXPECT_EQ(rollup.count(0), full.count(0));
+    EXPECT_EQ(rollup.sum(0), full.sum(0));
+    EXPECT_DOUBLE_EQ(rollup.rate(0), full.rate(0));
+    // 滚入的数据按level 0的bucket起始时间落入level 1，误差不超过一个level 1的bucket
+    EXPECT_NEAR(double(rollup.count(1)), double(full.count(1)), 100);
+    EXPECT_NEAR(rollup.avg(1), 2, 1e-9);
+    // 还没有数据从最粗的level过期，所有数据都在
+    EXPECT_EQ(rollup.count(2), 1800);
+    EXPECT_EQ(rollup.sum(2), 3600);
+    EXPECT_EQ(rollup.count(2), full.count(2));
+    EXPECT_NEAR(rollup.countRate(2), full.countRate(2), 0.5);
+    // 每个level只保存自己那一部分
+    EXPECT_EQ(rollup.getLevel(0).count() + rollup.getLevel(1).count() + rollup.getLevel(2).count(), 1800);
+    EXPECT_EQ(rollup.count(now - minutes(5), now + seconds(1)), 1800);
+
+    // 超过最粗的level后数据全部过期
+    now += minutes(6);
+    rollup.update(now);
+    EXPECT_EQ(rollup.count(2), 0);
+}
+
+TEST_F(MultiLevelTimeSeriesTest, rollupKeepsMoments)
+{
+    using namespace std::chrono;
+    MultiLevelTimeSeries<double, BucketMoments> series({ { 10, seconds(10) }, { 6, minutes(1) } }, true);
+    auto now = steady_clock::time_point(hours(1));
+    series.addValue(now, 500);
+    for (int i = 1; i <= 300; ++i) {
+        series.addValue(now + milliseconds(i * 100), i % 2 == 0 ? 10 : 20);
+    }
+    series.update(now + seconds(30));
+
+    // 尖峰已经滚入level 1，不在level 0的窗口内
+    auto fine = series.windowTotal(0);
+    EXPECT_DOUBLE_EQ(fine.max(), 20);
+    EXPECT_DOUBLE_EQ(fine.min(), 10);
+    EXPECT_NEAR(fine.stddev(), 5, 1e-2);
+    auto coarse = series.windowTotal(1);
+    EXPECT_EQ(coarse.mCount, series.count(1));
+    EXPECT_DOUBLE_EQ(coarse.max(), 500);
+    EXPECT_DOUBLE_EQ(coarse.min(), 10);
+}
@@ -0,0 +1,219 @@
+//
+// Created by haosheng on 2021/10/22.
+//
+#include "PerformanceMarker.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using ::testing::HasSubstr;
+using ::testing::Not;
+
+namespace {
+
+/*
+ * PerformanceMarker是进程内的单例，配置只能在第一次使用之前设置，所以每个场景在death test
+ * fork出的子进程中运行，子进程中有断言失败时以1退出。
+ */
+void runScenario(void (*scenario)())
+{
+    scenario();
+    fflush(stdout);
+    std::_Exit(::testing::Test::HasFailure() ? 1 : 0);
+}
+
+#define EXPECT_SCENARIO(scenario) EXPECT_EXIT(runScenario(scenario), ::testing::ExitedWithCode(0), "")
+
+/* 报告周期足够长，定时器不会在场景中生成报告，getLastReport()每次用当前的数据生成 */
+PerformanceMarker& start()
+{
+    PerformanceMarker::setReportFormat(PerformanceMarker::ReportFormat::None);
+    PerformanceMarker::initialize("test", 3600);
+    return PerformanceMarker::getInstance();
+}
+
+void reportWindows()
+{
+    // 短于报告周期的窗口在initialize()时去掉
+    ASSERT_TRUE(PerformanceMarker::setReportWindows({ 60, 0, 10, 60, 5 }));
+    PerformanceMarker::setReportFormat(PerformanceMarker::ReportFormat::None);
+    PerformanceMarker::initialize("test", 10);
+    auto& marker = PerformanceMarker::getInstance();
+    EXPECT_FALSE(PerformanceMarker::setReportWindows({ 5, 60 }));
+    for (int i = 1; i <= 5; ++i) {
+        marker.addValue("latency", i * 1000);
+    }
+    marker.addValue("size", 1);
+
+    string report = marker.getLastReport();
+    EXPECT_THAT(report, HasSubstr("\t\"test_latency\": {\n\t\t\"10s\": {\n\t\t\t\"count\": 5,\n\t\t\t\"accu\": 15000.00,"));
+    EXPECT_THAT(report, HasSubstr("\t\t\"60s\": {\n\t\t\t\"count\": 5,\n\t\t\t\"accu\": 15000.00,"));
+    EXPECT_THAT(report, HasSubstr("\t\"test_size\": {\n\t\t\"10s\": {\n\t\t\t\"count\": 1,"));
+    EXPECT_THAT(report, Not(HasSubstr("\"0s\"")));
+    EXPECT_THAT(report, Not(HasSubstr("\"5s\"")));
+
+    // 已有直方图的level不能改变
+    EXPECT_FALSE(PerformanceMarker::setReportWindows({ 600 }));
+    EXPECT_THAT(marker.getLastReport(), HasSubstr("\"60s\": {"));
+}
+
+void rateStartsAtFirstSample()
+{
+    auto& marker = start();
+    for (int i = 0; i < 4; ++i) {
+        marker.addValue("latency", 10);
+    }
+    // 4个采样点经历了2秒多，elapsed按秒取整再加1秒
+    this_thread::sleep_for(chrono::milliseconds(2100));
+    EXPECT_THAT(marker.getLastReport(), HasSubstr("\t\t\"rate\": 13.33,\n\t\t\"qps\": 1.33,"));
+}
+
+void deltaReportsKeepFullSnapshot()
+{
+    // 只有第一个定时报告是完整报告
+    PerformanceMarker::setDeltaReports(1000);
+    ASSERT_TRUE(PerformanceMarker::setReportWindows({ 60 }));
+    PerformanceMarker::setReportFormat(PerformanceMarker::ReportFormat::None);
+    PerformanceMarker::initialize("test", 1);
+    auto& marker = PerformanceMarker::getInstance();
+    marker.addValue("idle", 1);
+    marker.addValue("busy", 1);
+    this_thread::sleep_for(chrono::milliseconds(1500));
+    marker.addValue("busy", 1);
+    // 第二个报告是增量报告，只包含busy
+    this_thread::sleep_for(chrono::milliseconds(1000));
+
+    auto snapshot = marker.getSnapshot();
+    ASSERT_TRUE(snapshot);
+    const SnapshotRecord* idle = snapshot->find("test_idle");
+    ASSERT_NE(idle, nullptr);
+    EXPECT_EQ(idle->count, 1u);
+    const SnapshotRecord* busy = snapshot->find("test_busy");
+    ASSERT_NE(busy, nullptr);
+    EXPECT_EQ(busy->count, 2u);
+    EXPECT_THAT(marker.getLastReport(), HasSubstr("\t\"test_idle\": {\n\t\t\"count\": 1,"));
+}
+
+void evictedMetricKeepsExemplars()
+{
+    PerformanceMarker::setMetricTtl(1);
+    auto& marker = start();
+    marker.enableExemplars("latency", 2);
+    marker.addValue("latency", 5, "req-a");
+    marker.addValue("size", 1);
+    EXPECT_THAT(marker.getLastReport(), HasSubstr("\"payload\": \"req-a\""));
+
+    // 超过ttl没有采样点，生成报告时被移除
+    this_thread::sleep_for(chrono::milliseconds(2100));
+    marker.addValue("size", 1);
+    string report = marker.getLastReport();
+    EXPECT_THAT(report, Not(HasSubstr("test_latency")));
+    EXPECT_THAT(report, HasSubstr("test_size"));
+
+    // 之后的采样点重新创建metric，仍然开启样例
+    marker.addValue("latency", 7, "req-b");
+    report = marker.getLastReport();
+    EXPECT_THAT(report, HasSubstr("\t\"test_latency\": {\n\t\t\"count\": 1,"));
+    EXPECT_THAT(report, HasSubstr("\"payload\": \"req-b\""));
+    EXPECT_THAT(report, Not(HasSubstr("req-a")));
+}
+
+void boundedMetricsPromoteHeavyHitters()
+{
+    PerformanceMarker::setMaxMetrics(2);
+    auto& marker = start();
+    marker.addValue("a", 1);
+    marker.addValue("b", 1);
+    // 已满，之后的名称写入kOtherMetric，提升为独立的metric时再开启样例
+    marker.enableExemplars("hot", 1);
+    for (int i = 0; i < 100; ++i) {
+        marker.addValue("hot", 10, "req-early");
+        marker.addValue("c", 1);
+    }
+    // 生成报告时把次数最多的hot和c提升为独立的metric，替换了a和b，
+    // a和b还没有写入直方图的采样点并入kOtherMetric
+    string report = marker.getLastReport();
+    EXPECT_THAT(report, HasSubstr("\t\"test___other__\": {\n\t\t\"count\": 202,"));
+    EXPECT_THAT(report, HasSubstr("\t\"test_hot\": {\n\t\t\"count\": 0,"));
+    EXPECT_THAT(report, Not(HasSubstr("\"test_a\"")));
+    EXPECT_THAT(report, Not(HasSubstr("req-early")));
+
+    for (int i = 0; i < 3; ++i) {
+        marker.addValue("hot", 20, "req-late");
+    }
+    marker.addValue("a", 1);
+    report = marker.getLastReport();
+    EXPECT_THAT(report, HasSubstr("\t\"test_hot\": {\n\t\t\"count\": 3,\n\t\t\"accu\": 60.00,"));
+    EXPECT_THAT(report, HasSubstr("\"payload\": \"req-late\""));
+    EXPECT_THAT(report, HasSubstr("\t\"test_c\": {\n\t\t\"count\": 0,"));
+    EXPECT_THAT(report, HasSubstr("\t\"test___other__\": {\n\t\t\"count\": 203,"));
+    EXPECT_THAT(report, Not(HasSubstr("\"test_a\"")));
+    EXPECT_THAT(report, Not(HasSubstr("\"test_b\"")));
+}
+
+#ifndef _WIN32
+void childReportLeavesSharedTable()
+{
+    auto& marker = start();
+    ASSERT_TRUE(PerformanceMarker::enableSharedMetrics(64));
+    pid_t child = fork();
+    ASSERT_GE(child, 0);
+    if (child == 0) {
+        for (int i = 0; i < 10; ++i) {
+            marker.addValue("x", 1);
+        }
+        // 子进程继承了单例，生成报告时不能取走共享表中的数据
+        marker.getLastReport();
+        _exit(0);
+    }
+    int status = 0;
+    ASSERT_EQ(waitpid(child, &status, 0), child);
+    ASSERT_TRUE(WIFEXITED(status));
+    EXPECT_THAT(marker.getLastReport(), HasSubstr("\t\"test_x\": {\n\t\t\"count\": 10,"));
+}
+#endif
+
+}
+
+#ifndef _WIN32
+TEST(PerformanceMarkerDeathTest, childReportLeavesSharedTable)
+{
+    EXPECT_SCENARIO(childReportLeavesSharedTable);
+}
+#endif
+
+TEST(PerformanceMarkerDeathTest, boundedMetricsPromoteHeavyHitters)
+{
+    EXPECT_SCENARIO(boundedMetricsPromoteHeavyHitters);
+}
+
+TEST(PerformanceMarkerDeathTest, deltaReportsKeepFullSnapshot)
+{
+    EXPECT_SCENARIO(deltaReportsKeepFullSnapshot);
+}
+
+TEST(PerformanceMarkerDeathTest, evictedMetricKeepsExemplars)
+{
+    EXPECT_SCENARIO(evictedMetricKeepsExemplars);
+}
+
+TEST(PerformanceMarkerDeathTest, rateStartsAtFirstSample)
+{
+    EXPECT_SCENARIO(rateStartsAtFirstSample);
+}
+
+TEST(PerformanceMarkerDeathTest, reportWindows)
+{
+    EXPECT_SCENARIO(reportWindows);
+}
@@ -0,0 +1,239 @@
+//
+// Created by haosheng on 2021/9/24.
+//
+#include "PrometheusWriter.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#ifndef _WIN32
+#include "MetricsServer.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+class PrometheusTest : public ::testing::Test {
+protected:
+    static TimeseriesHistogram<double> makeHistogram()
+    {
+        return TimeseriesHistogram<double>(1000, -1e5, 1e5,
+            MultiLevelTimeSeries<double>(10, { chrono::seconds(10) }));
+    }
+
+#ifndef _WIN32
+    // 发送一个HTTP请求并返回完整响应
+    static string request(int fd, const string& target)
+    {
+        string req = "GET " + target + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        send(fd, req.data(), req.size(), 0);
+        string response;
+        char buf[4096];
+        ssize_t n;
+        while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+            response.append(buf, size_t(n));
+        }
+        close(fd);
+        return response;
+    }
+
+    static string requestTcp(uint16_t port, const string& target)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            close(fd);
+            return "";
+        }
+        return request(fd, target);
+    }
+
+    static string requestUnix(const string& path, const string& target)
+    {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr {};
+        addr.sun_family = AF_UNIX;
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path.c_str());
+        if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            close(fd);
+            return "";
+        }
+        return request(fd, target);
+    }
+#endif
+};
+
+TEST_F(PrometheusTest, histogramExposition)
+{
+    auto now = chrono::steady_clock::now();
+    auto histogram = makeHistogram();
+    histogram.addValue(now, -2e5);
+    histogram.addValue(now, 10, 2);
+    histogram.addValue(now, 1500);
+    histogram.addValue(now, 3e5);
+    histogram.update(now);
+
+    ReportBuffer out;
+    PrometheusWriter writer;
+    writer.begin(out);
+    writer.addHistogram("test", "rpc.latency", histogram, 0);
+
+    EXPECT_EQ(out.str(),
+        "# TYPE test_rpc_latency histogram\n"
+        "test_rpc_latency_bucket{le=\"-1e+05\"} 1\n"
+        "test_rpc_latency_bucket{le=\"1000\"} 3\n"
+        "test_rpc_latency_bucket{le=\"2000\"} 4\n"
+        "test_rpc_latency_bucket{le=\"+Inf\"} 5\n"
+        "test_rpc_latency_sum 101520\n"
+        "test_rpc_latency_count 5\n");
+}
+
+TEST_F(PrometheusTest, appendSkipsCollidingFamilies)
+{
+    auto now = chrono::steady_clock::now();
+    auto histogram = makeHistogram();
+    histogram.addValue(now, 10);
+    histogram.update(now);
+    DecayingRate rate;
+
+    // a.b和a_b替换字符之后是同一个family，可能在同一段或者不同段中
+    ReportBuffer parts[2];
+    PrometheusWriter writers[2];
+    writers[0].begin(parts[0]);
+    writers[0].addHistogram("test", "a.b", histogram, 0);
+    writers[0].addHistogram("test", "a_b", histogram, 0);
+    writers[0].addDecayingRate("test", "c", rate);
+    writers[1].begin(parts[1]);
+    writers[1].addHistogram("test", "a-b", histogram, 0);
+    writers[1].addDecayingRate("test", "c.d", rate);
+    writers[1].addDecayingRate("test", "c_d", rate);
+    writers[1].addHistogram("test", "e", histogram, 0);
+
+    ReportBuffer out;
+    PrometheusWriter merged;
+    merged.begin(out);
+    for (const auto& writer : writers) {
+        merged.append(writer);
+    }
+    string text = out.str();
+    for (const char* family : { "test_a_b histogram", "test_c_qps gauge", "test_c_d_qps gauge", "test_c_d_avg gauge",
+             "test_e histogram" }) {
+        string type = string("# TYPE ") + family + "\n";
+        EXPECT_EQ(text.find(type), text.rfind(type)) << family;
+        EXPECT_NE(text.find(type), string::npos) << family;
+    }
+    EXPECT_EQ(count(text.begin(), text.end(), '#'), 8);
+
+    // 第一次出现的family保持原样
+    ReportBuffer single;
+    writers[0].begin(single);
+    writers[0].addHistogram("test", "a.b", histogram, 0);
+    EXPECT_EQ(text.substr(0, single.size()), single.str());
+}
+
+TEST_F(PrometheusTest, emptyHistogram)
+{
+    auto histogram = makeHistogram();
+    ReportBuffer out;
+    PrometheusWriter writer;
+    writer.begin(out);
+    writer.addHistogram("test", "0empty", histogram, 0);
+    string expected = "# TYPE test_0empty histogram\n"
+                      "test_0empty_bucket{le=\"+Inf\"} 0\n"
+                      "test_0empty_sum 0\n"
+                      "test_0empty_count 0\n";
+    EXPECT_EQ(out.str(), expected);
+
+    // 没有bucketCounts的summary与空直方图的输出相同
+    writer.begin(out);
+    writer.addHistogram("test", "0empty", histogram, PrometheusWriter::Summary());
+    EXPECT_EQ(out.str(), expected);
+}
+
+// 生成exposition的额外开销，只打印耗时，需要时用--gtest_also_run_disabled_tests运行
+TEST_F(PrometheusTest, DISABLED_renderBench)
+{
+    const size_t kMetrics = 10000;
+    auto now = chrono::steady_clock::now();
+    vector<TimeseriesHistogram<double>> histograms(kMetrics, makeHistogram());
+    vector<string> names;
+    for (size_t i = 0; i < kMetrics; ++i) {
+        names.push_back("metric_" + to_string(i));
+        for (int v = 0; v < 20; ++v) {
+            histograms[i].addValue(now, double((i * 7 + v * 997) % 20000));
+        }
+        histograms[i].update(now);
+    }
+
+    // 报告时已经对每个metric调用过summarize()，这里只统计在此基础上生成Prometheus格式的开销
+    ReportBuffer out;
+    PrometheusWriter writer;
+    PrometheusWriter::Summary summary;
+    double summarizeOnly = 1e9;
+    double withExposition = 1e9;
+    for (int round = 0; round < 5; ++round) {
+        auto begin = chrono::steady_clock::now();
+        for (size_t i = 0; i < kMetrics; ++i) {
+            histograms[i].summarize(0, nullptr, 0, &summary);
+        }
+        auto middle = chrono::steady_clock::now();
+        writer.begin(out);
+        for (size_t i = 0; i < kMetrics; ++i) {
+            histograms[i].summarize(0, nullptr, 0, &summary);
+            writer.addHistogram("bench", names[i], histograms[i], summary);
+        }
+        auto end = chrono::steady_clock::now();
+        summarizeOnly = min(summarizeOnly, chrono::duration<double, milli>(middle - begin).count());
+        withExposition = min(withExposition, chrono::duration<double, milli>(end - middle).count());
+    }
+    printf("metrics: %zu, exposition: %zu bytes, summarize: %.2f ms, render: %.2f ms\n", kMetrics, out.size(),
+        summarizeOnly, withExposition - summarizeOnly);
+}
+
+#ifndef _WIN32
+TEST_F(PrometheusTest, serveTcp)
+{
+    MetricsServer server;
+    ASSERT_TRUE(server.listenTcp(0));
+    ASSERT_NE(server.port(), 0);
+    EXPECT_TRUE(server.isRunning());
+
+    server.publish("a_count 1\n", PrometheusWriter::kContentType);
+    string response = requestTcp(server.port(), "/metrics");
+    EXPECT_THAT(response, ::testing::StartsWith("HTTP/1.1 200 OK\r\n"));
+    EXPECT_THAT(response, ::testing::HasSubstr("Content-Type: text/plain; version=0.0.4"));
+    EXPECT_THAT(response, ::testing::HasSubstr("Content-Length: 10\r\n"));
+    EXPECT_THAT(response, ::testing::EndsWith("\r\n\r\na_count 1\n"));
+
+    server.publish("a_count 2\n", PrometheusWriter::kContentType);
+    EXPECT_THAT(requestTcp(server.port(), "/metrics?x=1"), ::testing::EndsWith("a_count 2\n"));
+    EXPECT_THAT(requestTcp(server.port(), "/"), ::testing::StartsWith("HTTP/1.1 404"));
+
+    uint16_t port = server.port();
+    server.stop();
+    EXPECT_FALSE(server.isRunning());
+    EXPECT_EQ(requestTcp(port, "/metrics"), "");
+}
+
+TEST_F(PrometheusTest, serveUnixSocket)
+{
+    string path = "/tmp/PerformanceMarkerTest." + to_string(getpid()) + ".sock";
+    MetricsServer server;
+    ASSERT_TRUE(server.listenUnix(path));
+    server.publish("b_count 3\n", PrometheusWriter::kContentType);
+    EXPECT_THAT(requestUnix(path, "/metrics"), ::testing::EndsWith("\r\n\r\nb_count 3\n"));
+    server.stop();
+    EXPECT_NE(access(path.c_str(), F_OK), 0);
+}
+#endif
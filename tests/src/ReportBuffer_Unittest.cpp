@@ -0,0 +1,184 @@
+//
+// Created by haosheng on 2021/9/16.
+//
+#include "ReportBuffer.h"
+#include "TimeseriesHistogram.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <new>
+#include <random>
+#include <sstream>
+
+using namespace std;
+
+// 统计bench期间的内存分配次数
+static atomic<bool> g_countAllocations { false };
+static atomic<uint64_t> g_allocations { 0 };
+
+void* operator new(size_t size)
+{
+    if (g_countAllocations.load(memory_order_relaxed)) {
+        g_allocations.fetch_add(1, memory_order_relaxed);
+    }
+    void* ptr = malloc(size > 0 ? size : 1);
+    if (ptr == nullptr) {
+        throw bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+namespace {
+
+// 改动前getString(level)的实现
+string legacyString(const TimeseriesHistogram<double>& histogram, size_t level)
+{
+    std::stringstream result;
+    result.setf(std::ios::fixed);
+    result << std::setprecision(2);
+    result << "\t\t\"count\": " << histogram.count(level) << ",\n"
+           << "\t\t\"accu\": " << histogram.sum(level) << ",\n"
+           << "\t\t\"avg\": " << histogram.avg(level) << ",\n"
+           << "\t\t\"rate\": " << histogram.rate(level) << ",\n"
+           << "\t\t\"qps\": " << histogram.countRate(level) << ",\n"
+           << "\t\t\"99%\": " << histogram.getPercentileEstimate(99, level) << ",\n"
+           << "\t\t\"90%\": " << histogram.getPercentileEstimate(90, level) << ",\n"
+           << "\t\t\"80%\": " << histogram.getPercentileEstimate(80, level) << ",\n"
+           << "\t\t\"max\": " << histogram.max(level) << ",\n"
+           << "\t\t\"stddev\": " << histogram.stddev(level);
+    return result.str();
+}
+
+TimeseriesHistogram<double> makeHistogram()
+{
+    return TimeseriesHistogram<double>(1e3, -1e4, 1e4, MultiLevelTimeSeries<double>(10, { chrono::seconds(10) }));
+}
+
+}
+
+TEST(ReportBufferTest, formatsLikeStream)
+{
+    const double values[] = { 0, -0.0, 0.005, 0.015, 1.0 / 3, -2.5, 123456.789, 1e15, -1e-9 };
+    for (double value : values) {
+        std::stringstream expected;
+        expected.setf(std::ios::fixed);
+        expected << std::setprecision(2) << value;
+        ReportBuffer buffer(4);
+        buffer.appendDouble(value);
+        EXPECT_EQ(buffer.str(), expected.str());
+    }
+
+    ReportBuffer buffer(1);
+    buffer.appendInt(-42);
+    buffer.append(' ');
+    buffer.appendUInt(18446744073709551615ull);
+    buffer.append(" done");
+    EXPECT_EQ(buffer.str(), "-42 18446744073709551615 done");
+    buffer.clear();
+    EXPECT_TRUE(buffer.empty());
+    EXPECT_GE(buffer.capacity(), 29);
+}
+
+TEST(ReportBufferTest, histogramStringMatchesLegacy)
+{
+    auto histogram = makeHistogram();
+    mt19937 rng(3);
+    normal_distribution<double> value(100, 3000);
+    auto now = chrono::steady_clock::now();
+    for (int i = 0; i < 1000; ++i) {
+        histogram.addValue(now + chrono::milliseconds(i), value(rng));
+    }
+    histogram.update(now + chrono::seconds(1));
+    EXPECT_EQ(histogram.getString(0), legacyString(histogram, 0));
+}
+
+/* 用legacy方式和ReportBuffer分别生成numMetrics个metric的报告，检查结果相同、复用时没有内存分配 */
+void compareWithLegacy(size_t numMetrics, bool printTimes)
+{
+    vector<string> names;
+    vector<TimeseriesHistogram<double>> histograms;
+    names.reserve(numMetrics);
+    histograms.reserve(numMetrics);
+    mt19937 rng(5);
+    normal_distribution<double> value(100, 3000);
+    auto now = chrono::steady_clock::now();
+    for (size_t i = 0; i < numMetrics; ++i) {
+        names.push_back("metric_" + to_string(i));
+        histograms.push_back(makeHistogram());
+        for (int j = 0; j < 20; ++j) {
+            histograms.back().addValue(now, value(rng));
+        }
+        histograms.back().update(now + chrono::seconds(1));
+    }
+
+    // 改动前：字符串拼接 + stringstream
+    g_allocations = 0;
+    g_countAllocations = true;
+    auto start = chrono::steady_clock::now();
+    string legacy;
+    legacy += "{\n";
+    for (size_t i = 0; i < numMetrics; ++i) {
+        legacy.append("\t\"prefix_" + names[i] + "\": {\n" + legacyString(histograms[i], 0) + "\n\t}");
+        legacy.append(i == numMetrics - 1 ? "\n" : ",\n");
+    }
+    legacy += "}";
+    auto legacyTime = chrono::steady_clock::now() - start;
+    g_countAllocations = false;
+    uint64_t legacyAllocations = g_allocations;
+
+    // 改动后：复用ReportBuffer，第一次生成报告让容量稳定下来
+    ReportBuffer report;
+    for (int round = 0; round < 2; ++round) {
+        g_allocations = 0;
+        g_countAllocations = true;
+        start = chrono::steady_clock::now();
+        report.clear();
+        report.append("{\n");
+        for (size_t i = 0; i < numMetrics; ++i) {
+            report.append("\t\"prefix_");
+            report.append(names[i]);
+            report.append("\": {\n");
+            histograms[i].appendString(0, report);
+            report.append(i == numMetrics - 1 ? "\n\t}\n" : "\n\t},\n");
+        }
+        report.append('}');
+        g_countAllocations = false;
+    }
+    auto bufferTime = chrono::steady_clock::now() - start;
+    uint64_t bufferAllocations = g_allocations;
+
+    EXPECT_EQ(report.view(), legacy);
+    EXPECT_EQ(bufferAllocations, 0);
+    if (!printTimes) {
+        return;
+    }
+    printf("metrics: %zu, legacy: %.2f ms / %llu allocations, buffer: %.2f ms / %llu allocations\n",
+        numMetrics,
+        chrono::duration<double, milli>(legacyTime).count(), (unsigned long long)legacyAllocations,
+        chrono::duration<double, milli>(bufferTime).count(), (unsigned long long)bufferAllocations);
+}
+
+TEST(ReportBufferTest, reusedBufferMatchesLegacy)
+{
+    compareWithLegacy(200, false);
+}
+
+// 10000个metric的耗时和分配次数，用--gtest_also_run_disabled_tests运行
+TEST(ReportBufferTest, DISABLED_reportBench)
+{
+    compareWithLegacy(10000, true);
+}
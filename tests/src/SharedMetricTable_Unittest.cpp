@@ -0,0 +1,138 @@
+//
+// Created by haosheng on 2021/10/14.
+//
+#ifndef _WIN32
+
+#include "SharedMetricTable.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <csignal>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+TEST(SharedMetricTableTest, findOrInsert)
+{
+    SharedMetricTable table;
+    ASSERT_TRUE(table.create(4, 10));
+    size_t a = table.findOrInsert("a");
+    ASSERT_NE(a, SharedMetricTable::kNotFound);
+    EXPECT_EQ(table.findOrInsert("a"), a);
+
+    string_view name;
+    ASSERT_TRUE(table.getName(a, &name));
+    EXPECT_EQ(name, "a");
+
+    EXPECT_EQ(table.findOrInsert(string(SharedMetricTable::kMaxNameLength + 1, 'x')), SharedMetricTable::kNotFound);
+    EXPECT_NE(table.findOrInsert(string(SharedMetricTable::kMaxNameLength, 'x')), SharedMetricTable::kNotFound);
+    EXPECT_NE(table.findOrInsert("b"), SharedMetricTable::kNotFound);
+    EXPECT_NE(table.findOrInsert("c"), SharedMetricTable::kNotFound);
+    // 表已满
+    EXPECT_EQ(table.findOrInsert("d"), SharedMetricTable::kNotFound);
+    EXPECT_NE(table.findOrInsert("c"), SharedMetricTable::kNotFound);
+}
+
+TEST(SharedMetricTableTest, childProcessesShareCounts)
+{
+    const size_t kBuckets = 100;
+    SharedMetricTable table;
+    ASSERT_TRUE(table.create(64, kBuckets));
+
+    const int kChildren = 4;
+    const uint64_t kSamples = 20000;
+    pid_t children[kChildren];
+    for (int c = 0; c < kChildren; ++c) {
+        children[c] = fork();
+        ASSERT_GE(children[c], 0);
+        if (children[c] == 0) {
+            // 每个子进程都写入同一个metric和一个只有自己的metric，名称在子进程中才插入
+            size_t shared = table.findOrInsert("shared");
+            size_t own = table.findOrInsert("child" + to_string(c));
+            for (uint64_t n = 0; n < kSamples; ++n) {
+                table.add(shared, n % kBuckets, 1.0, 1);
+                table.add(own, size_t(c), 2.0, 2);
+            }
+            _exit(0);
+        }
+    }
+
+    // 子进程运行时父进程不断切换phase并读取，与定时器线程相同
+    uint64_t counts[64] = {};
+    double sums[64] = {};
+    auto drainAll = [&]() {
+        size_t phase = table.flipPhase();
+        for (size_t slot = 0; slot < table.capacity(); ++slot) {
+            table.drain(slot, phase, [&](size_t, double sum, uint64_t count) {
+                counts[slot] += count;
+                sums[slot] += sum;
+            });
+        }
+    };
+    for (int c = 0; c < kChildren; ++c) {
+        drainAll();
+        int status = 0;
+        waitpid(children[c], &status, 0);
+        ASSERT_TRUE(WIFEXITED(status));
+    }
+    drainAll();
+    drainAll();
+
+    size_t shared = table.findOrInsert("shared");
+    EXPECT_EQ(counts[shared], kChildren * kSamples);
+    EXPECT_DOUBLE_EQ(sums[shared], kChildren * kSamples * 1.0);
+    for (int c = 0; c < kChildren; ++c) {
+        size_t own = table.findOrInsert("child" + to_string(c));
+        EXPECT_EQ(counts[own], 2 * kSamples);
+        EXPECT_DOUBLE_EQ(sums[own], kSamples * 2.0);
+    }
+}
+
+TEST(SharedMetricTableTest, killedChildDoesNotBlockParent)
+{
+    SharedMetricTable table;
+    ASSERT_TRUE(table.create(4096, 10));
+
+    // 子进程不停地插入名称和写入，在任意位置被kill，可能停在插入中或者add()的临界区中
+    for (int round = 0; round < 5; ++round) {
+        pid_t child = fork();
+        ASSERT_GE(child, 0);
+        if (child == 0) {
+            size_t slot = table.findOrInsert("busy");
+            for (uint64_t n = 0;; ++n) {
+                table.add(slot, n % 10, 1.0, 1);
+                if (n % 1024 == 0) {
+                    table.findOrInsert("round" + to_string(round) + "_" + to_string(n / 1024 % 512));
+                }
+            }
+        }
+        usleep(20000);
+        kill(child, SIGKILL);
+        int status = 0;
+        waitpid(child, &status, 0);
+        ASSERT_TRUE(WIFSIGNALED(status));
+
+        // 父进程的等待都有上限
+        auto start = chrono::steady_clock::now();
+        for (int flip = 0; flip < 3; ++flip) {
+            size_t phase = table.flipPhase();
+            for (size_t slot = 0; slot < table.capacity(); ++slot) {
+                table.drain(slot, phase, [](size_t, double, uint64_t) {});
+            }
+        }
+        for (int n = 0; n < 512; ++n) {
+            string name = "round" + to_string(round) + "_" + to_string(n);
+            size_t slot = table.findOrInsert(name);
+            ASSERT_NE(slot, SharedMetricTable::kNotFound) << name;
+            string_view inserted;
+            ASSERT_TRUE(table.getName(slot, &inserted));
+            EXPECT_EQ(inserted, name);
+        }
+        EXPECT_LT(chrono::steady_clock::now() - start, chrono::seconds(2));
+    }
+}
+
+#endif
@@ -0,0 +1,86 @@
+//
+// Created by haosheng on 2021/9/22.
+//
+#ifndef _WIN32
+
+#include "SharedSnapshot.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+
+class SharedSnapshotTest : public ::testing::Test {
+protected:
+    string name = "PerformanceMarkerTest." + to_string(getpid());
+};
+
+TEST_F(SharedSnapshotTest, publishAndRead)
+{
+    SharedSnapshotPublisher publisher;
+    ASSERT_TRUE(publisher.open(name, 1024));
+
+    SharedSnapshotSubscriber subscriber;
+    ASSERT_TRUE(subscriber.open(name));
+    ReportBuffer out;
+    EXPECT_FALSE(subscriber.read(out));
+
+    string first = "first snapshot";
+    string second(1024, 'x');
+    uint64_t generation = 0;
+    ASSERT_TRUE(publisher.publish(first.data(), first.size()));
+    ASSERT_TRUE(subscriber.read(out, &generation));
+    EXPECT_EQ(out.view(), first);
+    EXPECT_EQ(generation, 1);
+
+    ASSERT_TRUE(publisher.publish(second.data(), second.size()));
+    ASSERT_TRUE(subscriber.read(out, &generation));
+    EXPECT_EQ(out.view(), second);
+    EXPECT_EQ(generation, 2);
+
+    // 超过容量的snapshot不会覆盖已发布的数据
+    string tooLarge(1025, 'y');
+    EXPECT_FALSE(publisher.publish(tooLarge.data(), tooLarge.size()));
+    ASSERT_TRUE(subscriber.read(out, &generation));
+    EXPECT_EQ(out.view(), second);
+
+    publisher.close();
+    SharedSnapshotSubscriber closed;
+    EXPECT_FALSE(closed.open(name));
+}
+
+TEST_F(SharedSnapshotTest, readsAreConsistent)
+{
+    SharedSnapshotPublisher publisher;
+    ASSERT_TRUE(publisher.open(name, 64 * 1024));
+    SharedSnapshotSubscriber subscriber;
+    ASSERT_TRUE(subscriber.open(name));
+
+    // 每个snapshot的所有字节相同，读到混合内容说明读到了写了一半的数据
+    atomic<bool> done { false };
+    thread writer([&]() {
+        string payload;
+        for (int i = 0; i < 20000; ++i) {
+            payload.assign(1000 + i % 50000, char('a' + i % 26));
+            publisher.publish(payload.data(), payload.size());
+        }
+        done = true;
+    });
+
+    ReportBuffer out;
+    size_t reads = 0;
+    while (!done) {
+        if (subscriber.read(out)) {
+            ++reads;
+            auto view = out.view();
+            ASSERT_EQ(view.find_first_not_of(view[0]), string_view::npos);
+        }
+    }
+    writer.join();
+    printf("consistent reads: %zu\n", reads);
+}
+
+#endif
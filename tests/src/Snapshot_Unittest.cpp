@@ -0,0 +1,281 @@
+//
+// Created by haosheng on 2021/9/18.
+//
+#include "MetricsSnapshot.h"
+#include "SnapshotReader.h"
+#include "SnapshotWriter.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+class SnapshotTest : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        auto beginTime = chrono::steady_clock::now();
+        auto nextTime = beginTime + chrono::seconds(10);
+        for (auto* histogram : { &latency, &size }) {
+            histogram->addValue(beginTime, 100);
+            histogram->addValue(nextTime, 1);
+            histogram->addValue(nextTime, 2);
+            histogram->addValue(nextTime, 3);
+            histogram->update(nextTime);
+        }
+        size.addValue(nextTime, 5000, 7);
+        size.update(nextTime);
+    }
+
+    void write(bool allLevels, uint32_t flags = 0)
+    {
+        writer.begin(snapshot, TimeseriesHistogram<double>::kReportPercentiles,
+            TimeseriesHistogram<double>::kNumReportPercentiles, 1631000000, flags);
+        const pair<const char*, TimeseriesHistogram<double>*> metrics[] = { { "latency", &latency }, { "size", &size } };
+        for (const auto& metric : metrics) {
+            writer.beginMetric("test", metric.first);
+            for (size_t level = 0; level < (allLevels ? 2 : 1); ++level) {
+                SnapshotWriter::Summary summary;
+                metric.second->summarize(level, TimeseriesHistogram<double>::kReportPercentiles,
+                    TimeseriesHistogram<double>::kNumReportPercentiles, &summary);
+                writer.addWindow(level == 0 ? 10 : 60, summary);
+            }
+        }
+        writer.finish();
+    }
+
+    TimeseriesHistogram<double> latency { 1000, -1e5, 1e5,
+        MultiLevelTimeSeries<double>(10, { chrono::seconds(10), chrono::minutes(1) }) };
+    TimeseriesHistogram<double> size { 1000, -1e5, 1e5,
+        MultiLevelTimeSeries<double>(10, { chrono::seconds(10), chrono::minutes(1) }) };
+    SnapshotWriter writer;
+    ReportBuffer snapshot;
+};
+
+TEST_F(SnapshotTest, readBack)
+{
+    write(true);
+    SnapshotReader reader;
+    ASSERT_TRUE(reader.open(snapshot.data(), snapshot.size()));
+    EXPECT_EQ(reader.header().timestamp, 1631000000);
+    EXPECT_EQ(reader.header().percentileCount, 3);
+    ASSERT_EQ(reader.recordCount(), 4);
+    EXPECT_EQ(reader.name(reader.record(0)), "test_latency");
+    EXPECT_EQ(reader.name(reader.record(1)), "test_latency");
+    EXPECT_EQ(reader.name(reader.record(3)), "test_size");
+    EXPECT_EQ(reader.record(1).windowSeconds, 60);
+    EXPECT_EQ(reader.record(0).count, 3);
+    EXPECT_EQ(reader.record(1).count, 4);
+    EXPECT_EQ(reader.record(2).count, 10);
+    EXPECT_DOUBLE_EQ(reader.record(2).sum, 35006);
+    EXPECT_EQ(reader.record(2).percentiles[0], size.getPercentileEstimate(99, 0));
+}
+
+TEST_F(SnapshotTest, toJsonMatchesReport)
+{
+    write(false);
+    SnapshotReader reader;
+    ASSERT_TRUE(reader.open(snapshot.data(), snapshot.size()));
+    ReportBuffer json;
+    reader.toJson(json);
+
+    string expected = "{\n\t\"test_latency\": {\n" + latency.getString(0) + "\n\t},\n"
+        + "\t\"test_size\": {\n" + size.getString(0) + "\n\t}\n}";
+    EXPECT_EQ(json.str(), expected);
+}
+
+TEST_F(SnapshotTest, toJsonLine)
+{
+    write(true);
+    SnapshotReader reader;
+    ASSERT_TRUE(reader.open(snapshot.data(), snapshot.size()));
+    ReportBuffer line;
+    reader.toJsonLine(line);
+
+    string text = line.str();
+    EXPECT_THAT(text, ::testing::StartsWith("{\"timestamp\":1631000000,\"metrics\":{\"test_latency\":{\"10s\":{\"count\":3,"));
+    EXPECT_THAT(text, ::testing::HasSubstr("},\"60s\":{\"count\":4,\"accu\":106.00,"));
+    EXPECT_THAT(text, ::testing::HasSubstr("\"test_size\":{\"10s\":{\"count\":10,\"accu\":35006.00,"));
+    EXPECT_THAT(text, ::testing::EndsWith("}}}}\n"));
+    EXPECT_EQ(count(text.begin(), text.end(), '\n'), 1);
+    EXPECT_EQ(text.find(' '), string::npos);
+
+    write(false, kSnapshotFlagDelta);
+    ASSERT_TRUE(reader.open(snapshot.data(), snapshot.size()));
+    EXPECT_EQ(reader.header().flags, kSnapshotFlagDelta);
+    line.clear();
+    reader.toJsonLine(line);
+    EXPECT_THAT(line.str(), ::testing::StartsWith("{\"timestamp\":1631000000,\"delta\":true,\"metrics\":{\"test_latency\":{\"count\":3,"));
+}
+
+TEST_F(SnapshotTest, appendParts)
+{
+    write(true);
+    ReportBuffer whole;
+    SnapshotReader reader;
+    ASSERT_TRUE(reader.open(snapshot.data(), snapshot.size()));
+    reader.toJson(whole);
+
+    // 每个metric单独写成一个snapshot，再按顺序合并
+    ReportBuffer parts[2];
+    const pair<const char*, TimeseriesHistogram<double>*> metrics[] = { { "latency", &latency }, { "size", &size } };
+    for (size_t i = 0; i < 2; ++i) {
+        SnapshotWriter partWriter;
+        partWriter.begin(parts[i], TimeseriesHistogram<double>::kReportPercentiles,
+            TimeseriesHistogram<double>::kNumReportPercentiles, 1631000000);
+        partWriter.beginMetric("test", metrics[i].first);
+        for (size_t level = 0; level < 2; ++level) {
+            SnapshotWriter::Summary summary;
+            metrics[i].second->summarize(level, TimeseriesHistogram<double>::kReportPercentiles,
+                TimeseriesHistogram<double>::kNumReportPercentiles, &summary);
+            partWriter.addWindow(level == 0 ? 10 : 60, summary);
+        }
+        partWriter.finish();
+    }
+
+    ReportBuffer merged;
+    writer.begin(merged, TimeseriesHistogram<double>::kReportPercentiles,
+        TimeseriesHistogram<double>::kNumReportPercentiles, 1631000000);
+    for (auto& part : parts) {
+        SnapshotReader partReader;
+        ASSERT_TRUE(partReader.open(part.data(), part.size()));
+        writer.append(partReader);
+    }
+    writer.finish();
+
+    ASSERT_TRUE(reader.open(merged.data(), merged.size()));
+    EXPECT_EQ(reader.recordCount(), 4);
+    EXPECT_EQ(reader.name(reader.record(3)), "test_size");
+    ReportBuffer json;
+    reader.toJson(json);
+    EXPECT_EQ(json.str(), whole.str());
+}
+
+TEST_F(SnapshotTest, metricsSnapshot)
+{
+    write(true);
+    auto cached = MetricsSnapshot::create(snapshot.data(), snapshot.size());
+    ASSERT_NE(cached, nullptr);
+    // 之后对snapshot的修改不影响已经拷贝的副本
+    snapshot.clear();
+
+    EXPECT_EQ(cached->timestamp(), 1631000000);
+    const SnapshotRecord* record = cached->find("test_size");
+    ASSERT_NE(record, nullptr);
+    EXPECT_EQ(record->windowSeconds, 10);
+    EXPECT_EQ(record->count, 10);
+    record = cached->find("test_size", 60);
+    ASSERT_NE(record, nullptr);
+    EXPECT_EQ(record->count, 11);
+    EXPECT_EQ(cached->find("test_latency", 60)->count, 4);
+    EXPECT_EQ(cached->find("test_size", 30), nullptr);
+    EXPECT_EQ(cached->find("test_missing"), nullptr);
+    EXPECT_EQ(cached->find("test"), nullptr);
+
+    double p99 = 0;
+    ASSERT_TRUE(cached->percentile(*cached->find("test_size"), 99, &p99));
+    EXPECT_EQ(p99, size.getPercentileEstimate(99, 0));
+    EXPECT_FALSE(cached->percentile(*record, 50, &p99));
+
+    EXPECT_EQ(MetricsSnapshot::create(snapshot.data(), snapshot.size()), nullptr);
+}
+
+TEST_F(SnapshotTest, readsShorterRecords)
+{
+    write(true);
+    SnapshotReader reader;
+    ASSERT_TRUE(reader.open(snapshot.data(), snapshot.size()));
+    ASSERT_EQ(reader.exemplarCount(), 0);
+
+    // 按第一版的记录长度重写：记录截断到percentiles为止，字符串表随之前移
+    SnapshotHeader header = reader.header();
+    header.recordSize = kSnapshotMinRecordSize;
+    header.stringTableOffset = header.recordOffset + header.recordCount * header.recordSize;
+    header.totalSize = header.stringTableOffset + header.stringTableSize;
+    vector<uint64_t> old((header.totalSize + 7) / 8);
+    auto* data = reinterpret_cast<char*>(old.data());
+    memcpy(data, &header, sizeof(header));
+    for (size_t i = 0; i < header.recordCount; ++i) {
+        memcpy(data + header.recordOffset + i * header.recordSize, &reader.record(i), header.recordSize);
+    }
+    memcpy(data + header.stringTableOffset, reader.stringTable().data(), header.stringTableSize);
+
+    SnapshotReader oldReader;
+    ASSERT_TRUE(oldReader.open(data, header.totalSize));
+    ASSERT_EQ(oldReader.recordCount(), 4);
+    EXPECT_EQ(oldReader.name(oldReader.record(3)), "test_size");
+    EXPECT_EQ(oldReader.record(2).count, 10);
+    EXPECT_DOUBLE_EQ(oldReader.record(2).sum, 35006);
+    EXPECT_EQ(oldReader.record(2).percentiles[0], reader.record(2).percentiles[0]);
+    EXPECT_NE(reader.record(2).max, 0);
+    EXPECT_EQ(oldReader.record(2).max, 0);
+    EXPECT_EQ(oldReader.record(2).stddev, 0);
+
+    // 比第一版更短的记录无法读取
+    reinterpret_cast<SnapshotHeader*>(data)->recordSize = kSnapshotMinRecordSize - 8;
+    EXPECT_FALSE(oldReader.open(data, header.totalSize));
+}
+
+TEST_F(SnapshotTest, readsShorterHeader)
+{
+    write(true);
+    SnapshotReader reader;
+    ASSERT_TRUE(reader.open(snapshot.data(), snapshot.size()));
+    ASSERT_EQ(reader.exemplarCount(), 0);
+
+    // 按第一版的header长度重写：没有样例的字段，记录和字符串表随之前移
+    SnapshotHeader header = reader.header();
+    size_t shift = sizeof(SnapshotHeader) - kSnapshotMinHeaderSize;
+    header.headerSize = kSnapshotMinHeaderSize;
+    header.recordOffset -= shift;
+    header.stringTableOffset -= shift;
+    header.totalSize -= shift;
+    vector<uint64_t> old((header.totalSize + 7) / 8);
+    auto* data = reinterpret_cast<char*>(old.data());
+    memcpy(data, &header, kSnapshotMinHeaderSize);
+    memcpy(data + header.recordOffset, snapshot.data() + sizeof(SnapshotHeader), header.totalSize - header.recordOffset);
+
+    SnapshotReader oldReader;
+    ASSERT_TRUE(oldReader.open(data, header.totalSize));
+    EXPECT_EQ(oldReader.header().headerSize, kSnapshotMinHeaderSize);
+    EXPECT_EQ(oldReader.header().percentileCount, 3);
+    EXPECT_EQ(oldReader.header().percentiles[0], reader.header().percentiles[0]);
+    EXPECT_EQ(oldReader.exemplarCount(), 0);
+    ReportBuffer json;
+    ReportBuffer oldJson;
+    reader.toJson(json);
+    oldReader.toJson(oldJson);
+    EXPECT_EQ(oldJson.str(), json.str());
+
+    reinterpret_cast<SnapshotHeader*>(data)->headerSize = kSnapshotMinHeaderSize - 8;
+    EXPECT_FALSE(oldReader.open(data, header.totalSize));
+}
+
+TEST_F(SnapshotTest, rejectsInvalidData)
+{
+    write(true);
+    SnapshotReader reader;
+    EXPECT_FALSE(reader.open(snapshot.data(), snapshot.size() - 8));
+    EXPECT_FALSE(reader.open(snapshot.data(), kSnapshotMinHeaderSize - 1));
+
+    // 偏移量加长度溢出之后不能通过检查
+    auto* header = reinterpret_cast<SnapshotHeader*>(snapshot.data());
+    SnapshotHeader original = *header;
+    header->stringTableSize = ~uint64_t(0) - header->stringTableOffset + 8;
+    EXPECT_FALSE(reader.open(snapshot.data(), snapshot.size()));
+    *header = original;
+    header->recordOffset = ~uint64_t(0) - 7;
+    EXPECT_FALSE(reader.open(snapshot.data(), snapshot.size()));
+    *header = original;
+    header->recordCount = ~uint32_t(0);
+    EXPECT_FALSE(reader.open(snapshot.data(), snapshot.size()));
+    *header = original;
+    ASSERT_TRUE(reader.open(snapshot.data(), snapshot.size()));
+
+    snapshot.data()[0] = 'X';
+    EXPECT_FALSE(reader.open(snapshot.data(), snapshot.size()));
+}
@@ -0,0 +1,91 @@
+//
+// Created by haosheng on 2021/10/20.
+//
+#include "SpaceSaving.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+TEST(SpaceSavingTest, heavyHittersOfZipfStream)
+{
+    const size_t kCapacity = 64;
+    SpaceSaving sketch(kCapacity);
+    // 名称个数远大于计数器个数，次数按1/rank分布
+    mt19937 rng(5);
+    vector<double> weights;
+    for (int rank = 1; rank <= 10000; ++rank) {
+        weights.push_back(1.0 / rank);
+    }
+    discrete_distribution<int> zipf(weights.begin(), weights.end());
+    map<string, uint64_t> exact;
+    const uint64_t kTotal = 200000;
+    for (uint64_t i = 0; i < kTotal; ++i) {
+        string key = "api_" + to_string(zipf(rng));
+        ++exact[key];
+        sketch.offer(key);
+    }
+    EXPECT_EQ(sketch.size(), kCapacity);
+    // 每个计数器的count是上界，count - error是下界
+    vector<SpaceSaving::Counter> top;
+    sketch.top(kCapacity, &top);
+    for (const auto& counter : top) {
+        EXPECT_GE(counter.count, exact[*counter.key]) << *counter.key;
+        EXPECT_LE(counter.count - counter.error, exact[*counter.key]) << *counter.key;
+    }
+    // 次数超过 总次数 / capacity 的名称一定在表中
+    for (const auto& entry : exact) {
+        if (entry.second > kTotal / kCapacity) {
+            EXPECT_GE(sketch.estimate(entry.first), entry.second) << entry.first;
+        }
+    }
+    sketch.top(5, &top);
+    ASSERT_EQ(top.size(), 5);
+    EXPECT_EQ(*top[0].key, "api_0");
+    EXPECT_EQ(*top[1].key, "api_1");
+    EXPECT_GE(top[0].count, top[1].count);
+
+    // 内存只与capacity有关，不随名称个数增长
+    size_t bytes = sketch.memoryUsage();
+    for (int i = 0; i < 10000; ++i) {
+        sketch.offer("tenant_" + to_string(i));
+    }
+    EXPECT_EQ(sketch.memoryUsage(), bytes);
+}
+
+TEST(SpaceSavingTest, decayLetsNewKeysReplaceOldOnes)
+{
+    SpaceSaving sketch(2);
+    sketch.offer("old", 1000);
+    sketch.offer("older", 800);
+    EXPECT_EQ(sketch.estimate("missing"), 0);
+
+    // 表满时新名称继承最小的count作为error
+    sketch.offer("new", 10);
+    EXPECT_EQ(sketch.estimate("older"), 0);
+    vector<SpaceSaving::Counter> top;
+    sketch.top(2, &top);
+    EXPECT_EQ(*top[0].key, "old");
+    EXPECT_EQ(*top[1].key, "new");
+    EXPECT_EQ(top[1].count, 810);
+    EXPECT_EQ(top[1].error, 800);
+
+    // 减半之后旧数据的影响逐渐消失
+    for (int i = 0; i < 10; ++i) {
+        sketch.decay();
+        sketch.offer("new", 100);
+    }
+    sketch.top(1, &top);
+    EXPECT_EQ(*top[0].key, "new");
+    EXPECT_EQ(sketch.estimate("old"), 0);
+
+    sketch.clear();
+    EXPECT_EQ(sketch.size(), 0);
+    sketch.top(2, &top);
+    EXPECT_TRUE(top.empty());
+}
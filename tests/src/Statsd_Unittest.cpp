@@ -0,0 +1,106 @@
+//
+// Created by haosheng on 2021/10/15.
+//
+#include "StatsdParser.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include "StatsdServer.h"
+#include <arpa/inet.h>
+#include <chrono>
+#include <mutex>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+TEST(StatsdTest, parseLines)
+{
+    string data = "latency:12.5|ms\n"
+                  "requests:3|c|@0.1\n"
+                  "size:-7|h|#host:a,zone:b\n"
+                  "queue:40|g\r\n"
+                  "\n"
+                  "dist:+2e3|d|@1|#tag";
+    vector<StatsdSample> samples;
+    size_t invalid = StatsdParser::parse(data.data(), data.size(), [&](const StatsdSample& sample) {
+        samples.push_back(sample);
+    });
+    EXPECT_EQ(invalid, 0);
+    ASSERT_EQ(samples.size(), 5);
+    EXPECT_EQ(samples[0].name, "latency");
+    EXPECT_DOUBLE_EQ(samples[0].value, 12.5);
+    EXPECT_EQ(samples[0].count, 1);
+    EXPECT_EQ(samples[1].name, "requests");
+    EXPECT_EQ(samples[1].count, 10);
+    EXPECT_DOUBLE_EQ(samples[2].value, -7);
+    EXPECT_EQ(samples[3].name, "queue");
+    EXPECT_DOUBLE_EQ(samples[3].value, 40);
+    EXPECT_DOUBLE_EQ(samples[4].value, 2000);
+    EXPECT_EQ(samples[4].count, 1);
+}
+
+TEST(StatsdTest, rejectInvalidLines)
+{
+    StatsdSample sample;
+    for (const char* line : { "latency", "latency:12", ":12|ms", "latency:|ms", "latency:abc|ms", "latency:1x|ms",
+             "users:42|s", "queue:+5|g", "latency:1|ms|@0", "latency:1|ms|@2", "latency:nan|ms" }) {
+        EXPECT_FALSE(StatsdParser::parseLine(line, &sample)) << line;
+    }
+    string data = "a:1|ms\nbad\nb:2|ms\n";
+    size_t valid = 0;
+    EXPECT_EQ(StatsdParser::parse(data.data(), data.size(), [&](const StatsdSample&) { ++valid; }), 1);
+    EXPECT_EQ(valid, 2);
+}
+
+#ifndef _WIN32
+TEST(StatsdTest, receiveDatagrams)
+{
+    mutex lock;
+    map<string, uint64_t> counts;
+    map<string, double> sums;
+    StatsdServer server;
+    ASSERT_TRUE(server.listenUdp(0, [&](const StatsdSample* samples, size_t count) {
+        lock_guard<mutex> guard(lock);
+        for (size_t i = 0; i < count; ++i) {
+            counts[string(samples[i].name)] += samples[i].count;
+            sums[string(samples[i].name)] += samples[i].value * samples[i].count;
+        }
+    }));
+    ASSERT_NE(server.port(), 0);
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_GE(fd, 0);
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(server.port());
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    const int kDatagrams = 200;
+    for (int i = 0; i < kDatagrams; ++i) {
+        string datagram = "latency:" + to_string(i) + "|ms\nrequests:1|c|@0.5\nbroken\n";
+        ASSERT_EQ(sendto(fd, datagram.data(), datagram.size(), 0, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)),
+            ssize_t(datagram.size()));
+    }
+    ::close(fd);
+
+    for (int wait = 0; wait < 500 && server.received() + server.invalid() < 3 * kDatagrams; ++wait) {
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    server.stop();
+
+    EXPECT_EQ(server.received(), 2 * kDatagrams);
+    EXPECT_EQ(server.invalid(), kDatagrams);
+    lock_guard<mutex> guard(lock);
+    EXPECT_EQ(counts["latency"], kDatagrams);
+    EXPECT_DOUBLE_EQ(sums["latency"], kDatagrams * (kDatagrams - 1) / 2.0);
+    EXPECT_EQ(counts["requests"], 2 * kDatagrams);
+}
+#endif
@@ -43,3 +43,80 @@ TEST_F(TimeseriesHistogramTest, addValueIn1Min)
     EXPECT_NEAR(timeseriesHistogram1.countRate(1), 0.4, 0.1);
 }
 
+
+TEST_F(TimeseriesHistogramTest, summarizeMatchesQueries)
+{
+    for (size_t level = 0; level < timeseriesHistogram1.getNumLevels(); ++level) {
+        auto summary = timeseriesHistogram1.summarize(level, { 99, 90, 50, 10 });
+        EXPECT_EQ(summary.count, timeseriesHistogram1.count(level));
+        EXPECT_EQ(summary.sum, timeseriesHistogram1.sum(level));
+        EXPECT_DOUBLE_EQ(summary.avg, timeseriesHistogram1.avg(level));
+        EXPECT_DOUBLE_EQ(summary.rate, timeseriesHistogram1.rate(level));
+        EXPECT_DOUBLE_EQ(summary.qps, timeseriesHistogram1.countRate(level));
+        ASSERT_EQ(summary.percentiles.size(), 4);
+        EXPECT_EQ(summary.percentiles[0], timeseriesHistogram1.getPercentileEstimate(99, level));
+        EXPECT_EQ(summary.percentiles[1], timeseriesHistogram1.getPercentileEstimate(90, level));
+        EXPECT_EQ(summary.percentiles[2], timeseriesHistogram1.getPercentileEstimate(50, level));
+        EXPECT_EQ(summary.percentiles[3], timeseriesHistogram1.getPercentileEstimate(10, level));
+    }
+}
+
+TEST_F(TimeseriesHistogramTest, totalsMatchBuckets)
+{
+    TimeseriesHistogram<double> histogram { 100, 0, 1000,
+        MultiLevelTimeSeries<double>(10, { std::chrono::seconds(10), std::chrono::minutes(1) }) };
+    auto now = std::chrono::steady_clock::now();
+    uint32_t seed = 12345;
+    for (int step = 0; step < 2000; ++step) {
+        seed = seed * 1103515245 + 12345;
+        // 时间不断前进，值集中在少数几个bucket中，中间有一段时间没有数据
+        now += std::chrono::milliseconds(seed % 700);
+        if (step < 800 || step > 1200) {
+            histogram.addValue(now, double((seed >> 8) % 400 + (step / 500) * 300), 1 + seed % 3);
+        }
+        if (step % 7 != 0) {
+            continue;
+        }
+        histogram.update(now);
+        for (size_t level = 0; level < histogram.getNumLevels(); ++level) {
+            uint64_t count = 0;
+            double sum = 0;
+            for (size_t b = 0; b < histogram.getNumBuckets(); ++b) {
+                count += histogram.getBucket(b).count(level);
+                sum += histogram.getBucket(b).sum(level);
+            }
+            ASSERT_EQ(histogram.count(level), count);
+            ASSERT_DOUBLE_EQ(histogram.sum(level), sum);
+
+            for (double pct : { 10.0, 50.0, 99.0 }) {
+                size_t expected = 0;
+                uint64_t cumulative = 0;
+                for (size_t b = 0; b < histogram.getNumBuckets(); ++b) {
+                    cumulative += histogram.getBucket(b).count(level);
+                    expected = b;
+                    if (count != 0 && cumulative * 100.0 >= pct * count) {
+                        break;
+                    }
+                }
+                if (count != 0) {
+                    ASSERT_EQ(histogram.getPercentileBucketIdx(pct, level), expected);
+                }
+            }
+        }
+    }
+}
+
+TEST_F(TimeseriesHistogramTest, memoryUsageIsFixedByLayout)
+{
+    // 每个bucket有2个level，每个level有10个时间片，所有内存在构造时分配
+    size_t slots = timeseriesHistogram1.getNumBuckets() * timeseriesHistogram1.getNumLevels() * 10;
+    size_t bytes = timeseriesHistogram1.memoryUsage();
+    EXPECT_GE(bytes, slots * sizeof(Bucket<double>));
+    EXPECT_LT(bytes, slots * sizeof(Bucket<double>) * 3);
+
+    auto now = std::chrono::steady_clock::now() + std::chrono::minutes(5);
+    for (int i = 0; i < 1000; ++i) {
+        timeseriesHistogram1.addValue(now + std::chrono::milliseconds(i * 100), i * 200 - 1e5);
+    }
+    EXPECT_EQ(timeseriesHistogram1.memoryUsage(), bytes);
+}
@@ -0,0 +1,53 @@
+//
+// Created by haosheng on 2021/10/9.
+//
+#include "WorkerPool.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <set>
+#include <vector>
+
+using namespace std;
+
+TEST(WorkerPoolTest, runsEveryTaskOnce)
+{
+    WorkerPool pool(3);
+    EXPECT_EQ(pool.concurrency(), 4);
+    for (size_t numTasks : { 0, 1, 4, 100 }) {
+        vector<atomic<int>> runs(numTasks);
+        pool.run(numTasks, [&](size_t idx) { runs[idx].fetch_add(1); });
+        for (size_t i = 0; i < numTasks; ++i) {
+            ASSERT_EQ(runs[i].load(), 1);
+        }
+    }
+}
+
+TEST(WorkerPoolTest, usesSeveralThreads)
+{
+    WorkerPool pool(3);
+    mutex lock;
+    set<thread::id> threads;
+    atomic<int> started { 0 };
+    // 每个任务等待其他任务开始，只有多个线程同时执行时才能全部完成
+    pool.run(4, [&](size_t) {
+        {
+            lock_guard<mutex> guard(lock);
+            threads.insert(this_thread::get_id());
+        }
+        started.fetch_add(1);
+        while (started.load() < 4) {
+            this_thread::yield();
+        }
+    });
+    EXPECT_EQ(threads.size(), 4);
+}
+
+TEST(WorkerPoolTest, noBackgroundThreads)
+{
+    WorkerPool pool(0);
+    int sum = 0;
+    pool.run(10, [&](size_t idx) { sum += int(idx); });
+    EXPECT_EQ(sum, 45);
+}
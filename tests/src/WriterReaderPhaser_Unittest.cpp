@@ -0,0 +1,94 @@
+//
+// Created by haosheng on 2021/10/8.
+//
+#include "WriterReaderPhaser.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+TEST(WriterReaderPhaserTest, flipWithoutWriters)
+{
+    WriterReaderPhaser phaser;
+    EXPECT_EQ(phaser.activePhase(), 0);
+    EXPECT_EQ(phaser.flipPhase(), 0);
+    EXPECT_EQ(phaser.activePhase(), 1);
+    EXPECT_EQ(phaser.flipPhase(), 1);
+    EXPECT_EQ(phaser.activePhase(), 0);
+}
+
+TEST(WriterReaderPhaserTest, noLostWrites)
+{
+    // 每个写入方在两个非原子的计数中增加相同的值，读取方切换之后读到的旧phase必须是一致的
+    struct Buffer {
+        atomic<uint64_t> a { 0 };
+        atomic<uint64_t> b { 0 };
+    };
+    WriterReaderPhaser phaser;
+    Buffer buffers[2];
+    const int kWriters = 4;
+    const uint64_t kWrites = 200000;
+
+    atomic<bool> consistent { true };
+    vector<thread> writers;
+    for (int i = 0; i < kWriters; ++i) {
+        writers.emplace_back([&]() {
+            for (uint64_t n = 0; n < kWrites; ++n) {
+                WriterReaderPhaser::WriterSection section(phaser);
+                auto& buffer = buffers[section.phase()];
+                buffer.a.fetch_add(1, memory_order_relaxed);
+                buffer.b.fetch_add(1, memory_order_relaxed);
+            }
+        });
+    }
+
+    uint64_t total = 0;
+    auto drain = [&]() {
+        size_t phase = phaser.flipPhase();
+        uint64_t a = buffers[phase].a.exchange(0, memory_order_relaxed);
+        uint64_t b = buffers[phase].b.exchange(0, memory_order_relaxed);
+        if (a != b) {
+            consistent = false;
+        }
+        total += a;
+    };
+    for (int i = 0; i < 1000; ++i) {
+        drain();
+    }
+    for (auto& writer : writers) {
+        writer.join();
+    }
+    // 两次切换之后两个phase都被读取过
+    drain();
+    drain();
+
+    EXPECT_TRUE(consistent);
+    EXPECT_EQ(total, kWriters * kWrites);
+}
+
+TEST(WriterReaderPhaserTest, flipTimesOutOnAbandonedWriter)
+{
+    WriterReaderPhaser phaser;
+    // 不析构的写入方，与在临界区中被kill的进程相同
+    alignas(WriterReaderPhaser::WriterSection) char storage[sizeof(WriterReaderPhaser::WriterSection)];
+    auto* abandoned = new (storage) WriterReaderPhaser::WriterSection(phaser);
+    EXPECT_EQ(abandoned->phase(), 0);
+
+    bool timedOut = false;
+    EXPECT_EQ(phaser.flipPhase(chrono::milliseconds(10), &timedOut), 0);
+    EXPECT_TRUE(timedOut);
+    // 切换回phase 0时结束计数被重置，之后不再等待它
+    EXPECT_EQ(phaser.flipPhase(chrono::milliseconds(10), &timedOut), 1);
+    EXPECT_FALSE(timedOut);
+    {
+        WriterReaderPhaser::WriterSection section(phaser);
+        EXPECT_EQ(section.phase(), 0);
+    }
+    EXPECT_EQ(phaser.flipPhase(chrono::milliseconds(10), &timedOut), 0);
+    EXPECT_FALSE(timedOut);
+}